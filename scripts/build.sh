@@ -27,6 +27,7 @@ if [ -z "$CROSS_PREFIX" ] && [ ! -f "/.dockerenv" ]; then
         -v "$REPO_ROOT:/build" \
         -u "$(id -u):$(id -g)" \
         -w /build \
+        -e PROFILE \
         "$IMAGE_NAME" \
         ./scripts/build.sh
 
@@ -49,26 +50,13 @@ mkdir -p dist/sf2
 
 # Compile FluidLite library
 echo "Compiling FluidLite..."
-FLUIDLITE_DIR="src/dsp/third_party/fluidlite"
-FLUIDLITE_SRCS="
-    $FLUIDLITE_DIR/src/fluid_chan.c
-    $FLUIDLITE_DIR/src/fluid_chorus.c
-    $FLUIDLITE_DIR/src/fluid_conv.c
-    $FLUIDLITE_DIR/src/fluid_defsfont.c
-    $FLUIDLITE_DIR/src/fluid_dsp_float.c
-    $FLUIDLITE_DIR/src/fluid_gen.c
-    $FLUIDLITE_DIR/src/fluid_hash.c
-    $FLUIDLITE_DIR/src/fluid_init.c
-    $FLUIDLITE_DIR/src/fluid_list.c
-    $FLUIDLITE_DIR/src/fluid_mod.c
-    $FLUIDLITE_DIR/src/fluid_ramsfont.c
-    $FLUIDLITE_DIR/src/fluid_rev.c
-    $FLUIDLITE_DIR/src/fluid_settings.c
-    $FLUIDLITE_DIR/src/fluid_synth.c
-    $FLUIDLITE_DIR/src/fluid_sys.c
-    $FLUIDLITE_DIR/src/fluid_tuning.c
-    $FLUIDLITE_DIR/src/fluid_voice.c
-"
+. "$SCRIPT_DIR/sources.sh"
+
+# PROFILE=1 times the stages of rendering (the "profile" parameter)
+FLUIDLITE_DEFS=""
+if [ -n "$PROFILE" ]; then
+    FLUIDLITE_DEFS="-DWITH_PROFILING"
+fi
 
 # Compile FluidLite objects
 mkdir -p build/fluidlite
@@ -76,7 +64,7 @@ for src in $FLUIDLITE_SRCS; do
     obj="build/fluidlite/$(basename $src .c).o"
     ${CROSS_PREFIX}gcc -O3 -fPIC \
         -march=armv8-a -mtune=cortex-a72 \
-        -DNDEBUG \
+        -DNDEBUG $FLUIDLITE_DEFS \
         -I$FLUIDLITE_DIR/include \
         -I$FLUIDLITE_DIR/src \
         -c "$src" -o "$obj"
@@ -92,7 +80,27 @@ ${CROSS_PREFIX}gcc -O3 -shared -fPIC \
     -o build/dsp.so \
     -Isrc/dsp \
     -I$FLUIDLITE_DIR/include \
-    -lm
+    -lm -lpthread
+
+# The vector kernels against the scalar loops; run build/kernel_test on
+# Move after changing them. The plugin has the double precision NEON
+# kernels, so compile the single precision ones as well.
+echo "Compiling kernel test..."
+${CROSS_PREFIX}gcc -O2 \
+    -march=armv8-a -mtune=cortex-a72 \
+    -DNDEBUG \
+    $FLUIDLITE_DIR/example/src/kernel_test.c \
+    build/fluidlite/*.o \
+    -o build/kernel_test \
+    -I$FLUIDLITE_DIR/include \
+    -I$FLUIDLITE_DIR/src \
+    -lm -lpthread
+${CROSS_PREFIX}gcc -fsyntax-only \
+    -march=armv8-a -mtune=cortex-a72 \
+    -DNDEBUG -DWITH_FLOAT \
+    -I$FLUIDLITE_DIR/include \
+    -I$FLUIDLITE_DIR/src \
+    $FLUIDLITE_DIR/src/fluid_dsp_float.c
 
 # Copy files to dist (use cat to avoid ExtFS deallocation issues with Docker)
 echo "Packaging..."
@@ -0,0 +1,77 @@
+#!/usr/bin/env bash
+# Build the SF2 plugin and the headless host benchmark (tests/host_bench.c)
+#
+# Builds for the machine it runs on by default, so the plugin can be
+# benchmarked off the device. Set CROSS_PREFIX (e.g. aarch64-linux-gnu-)
+# to build both for Move instead, with the flags of scripts/build.sh.
+# PROFILE=1 builds the plugin with the stage timers, as for build.sh.
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+REPO_ROOT="$(dirname "$SCRIPT_DIR")"
+
+cd "$REPO_ROOT"
+
+if [ -n "$CROSS_PREFIX" ]; then
+    ARCH_FLAGS="-march=armv8-a -mtune=cortex-a72"
+    OUT_DIR="build/host-arm64"
+else
+    ARCH_FLAGS=""
+    OUT_DIR="build/host"
+fi
+
+echo "=== Building SF2 host benchmark ==="
+echo "Compiler: ${CROSS_PREFIX}gcc"
+
+mkdir -p "$OUT_DIR/fluidlite"
+
+. "$SCRIPT_DIR/sources.sh"
+
+FLUIDLITE_DEFS=""
+if [ -n "$PROFILE" ]; then
+    FLUIDLITE_DEFS="-DWITH_PROFILING"
+fi
+
+echo "Compiling FluidLite..."
+for src in $FLUIDLITE_SRCS; do
+    obj="$OUT_DIR/fluidlite/$(basename $src .c).o"
+    ${CROSS_PREFIX}gcc -O3 -fPIC $ARCH_FLAGS \
+        -DNDEBUG $FLUIDLITE_DEFS \
+        -I$FLUIDLITE_DIR/include \
+        -I$FLUIDLITE_DIR/src \
+        -c "$src" -o "$obj"
+done
+
+echo "Compiling DSP plugin..."
+${CROSS_PREFIX}gcc -O3 -shared -fPIC $ARCH_FLAGS \
+    -DNDEBUG \
+    src/dsp/sf2_plugin.c \
+    "$OUT_DIR"/fluidlite/*.o \
+    -o "$OUT_DIR/dsp.so" \
+    -Isrc/dsp \
+    -I$FLUIDLITE_DIR/include \
+    -lm -lpthread
+
+echo "Compiling host benchmark..."
+${CROSS_PREFIX}gcc -O2 $ARCH_FLAGS \
+    tests/host_bench.c \
+    -o "$OUT_DIR/host_bench" \
+    -ldl
+
+echo "Compiling kernel test..."
+${CROSS_PREFIX}gcc -O2 $ARCH_FLAGS \
+    -DNDEBUG \
+    $FLUIDLITE_DIR/example/src/kernel_test.c \
+    "$OUT_DIR"/fluidlite/*.o \
+    -o "$OUT_DIR/kernel_test" \
+    -I$FLUIDLITE_DIR/include \
+    -I$FLUIDLITE_DIR/src \
+    -lm -lpthread
+
+echo ""
+echo "=== Build Complete ==="
+echo "Output: $OUT_DIR/host_bench, $OUT_DIR/dsp.so, $OUT_DIR/kernel_test"
+echo ""
+echo "Run:"
+echo "  $OUT_DIR/host_bench $OUT_DIR/dsp.so <module dir> --stress 30"
+echo "  $OUT_DIR/kernel_test"
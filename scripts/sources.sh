@@ -0,0 +1,31 @@
+# FluidLite sources the module is built from, shared by build.sh and
+# build_host.sh. Source it from the repo root:
+#
+#   . scripts/sources.sh
+#
+# Sets FLUIDLITE_DIR and FLUIDLITE_SRCS, the .c files as paths from
+# the repo root.
+
+FLUIDLITE_DIR="src/dsp/third_party/fluidlite"
+FLUIDLITE_SRCS="
+    $FLUIDLITE_DIR/src/fluid_chan.c
+    $FLUIDLITE_DIR/src/fluid_chorus.c
+    $FLUIDLITE_DIR/src/fluid_conv.c
+    $FLUIDLITE_DIR/src/fluid_defsfont.c
+    $FLUIDLITE_DIR/src/fluid_dsp_float.c
+    $FLUIDLITE_DIR/src/fluid_gen.c
+    $FLUIDLITE_DIR/src/fluid_hash.c
+    $FLUIDLITE_DIR/src/fluid_init.c
+    $FLUIDLITE_DIR/src/fluid_list.c
+    $FLUIDLITE_DIR/src/fluid_mod.c
+    $FLUIDLITE_DIR/src/fluid_ramsfont.c
+    $FLUIDLITE_DIR/src/fluid_rev.c
+    $FLUIDLITE_DIR/src/fluid_settings.c
+    $FLUIDLITE_DIR/src/fluid_sf2c.c
+    $FLUIDLITE_DIR/src/fluid_stream.c
+    $FLUIDLITE_DIR/src/fluid_synth.c
+    $FLUIDLITE_DIR/src/fluid_sys.c
+    $FLUIDLITE_DIR/src/fluid_tuning.c
+    $FLUIDLITE_DIR/src/fluid_voice.c
+    $FLUIDLITE_DIR/src/fluid_workers.c
+"
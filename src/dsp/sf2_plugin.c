@@ -13,6 +13,10 @@
 #include <strings.h>
 #include <math.h>
 #include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
 
 /* Include plugin API - inline definitions to avoid path issues */
 #include <stdint.h>
@@ -53,6 +57,17 @@ static const host_api_v1_t *g_host = NULL;
 /* Constants */
 #define MAX_SOUNDFONTS 2048
 #define MAX_PRESETS 1024
+/* Sample memory kept paged in beyond the selected presets (0 = whole font) */
+#define DEFAULT_SAMPLE_BUDGET_MB 64
+
+/* How a soundfont is loaded, from module.json defaults. FluidLite takes
+ * these as globals for the loads that follow, so each load sets them
+ * under g_parse_lock, and the shared cache keys fonts by them. */
+typedef struct {
+    unsigned int sample_budget;     /* bytes, 0 = whole font resident */
+    unsigned int stream_preload_ms; /* 0 = no streaming */
+    int sf2c_cache;
+} sf2_font_options_t;
 
 typedef struct {
     char path[512];
@@ -65,14 +80,119 @@ typedef struct {
     int program;
 } preset_entry_t;
 
-/* Per-Instance State */
+struct sf2_cache_entry;
+
+/*
+ * Result of a background soundfont load. Built entirely on the loader
+ * thread (fresh synth, soundfont) and handed to the audio thread through
+ * inst->load_ready with a single atomic exchange.
+ */
 typedef struct {
-    fluid_settings_t *settings;
     fluid_synth_t *synth;
     int sfont_id;
+    int generation;
+    struct sf2_cache_entry *entry;  /* held by the synth, NULL if the load failed */
+    char path[512];
+    char error[256];
+} sf2_load_result_t;
+
+/*
+ * What the control thread shows of a finished load: its preset list and
+ * error. Handed over under loader_lock, and taken once the audio thread
+ * has swapped the load in.
+ */
+typedef struct {
+    int generation;
+    struct sf2_cache_entry *entry;  /* a reference of its own, NULL if the load failed */
+    char error[256];
+} sf2_load_info_t;
+
+/* Old synths still finishing release tails, or waiting to be freed */
+#define MAX_RETIRED_SYNTHS 4
+/* Longest release tail rendered for a retiring synth, in seconds */
+#define RETIRE_MAX_SECONDS 2
+/* MIDI messages held for render_block; a power of two */
+#define MIDI_QUEUE_SIZE 256
+
+/* A MIDI message and the frame of the next rendered block it plays at */
+typedef struct {
+    uint8_t msg[3];
+    uint8_t len;
+    int frame;
+} midi_event_t;
+
+/* Changes from set_param held for render_block; a power of two */
+#define COMMAND_QUEUE_SIZE 64
+
+/* Gain and effect settings of a synth */
+typedef struct {
+    float gain;
+    int reverb_on;
+    int chorus_on;
+    float reverb_level;
+    float chorus_level;
+} sf2_mix_t;
+
+enum {
+    SF2_CMD_MIX,        /* new gain and effect settings */
+    SF2_CMD_NOTES_OFF,  /* all notes off */
+    SF2_CMD_PRESET      /* program a preset of the list */
+};
+
+/* A change to the synth, made on the audio thread for set_param */
+typedef struct {
+    int type;
+    int preset;         /* SF2_CMD_PRESET */
+    int generation;     /* SF2_CMD_PRESET: the load whose list it is from */
+    sf2_mix_t mix;      /* SF2_CMD_MIX */
+} sf2_command_t;
+
+/* Changes set_param made that are still to be queued for the audio thread */
+#define UNSENT_NOTES_OFF 1
+#define UNSENT_PRESET 2
+#define UNSENT_MIX 4
+
+/* Render times are counted in buckets of doubling width: bucket 0 holds
+ * blocks under 1 us, bucket i those of 2^(i-1) to 2^i us, and the last
+ * one everything from 16 ms up */
+#define PERF_HIST_BUCKETS 16
+
+/* Blocks between copies of the synth's profile for get_param; as many as
+ * the profile averages over */
+#define PROFILE_BLOCKS 64
+
+/* Render timing, kept by the audio thread. It is the only writer but for
+ * midi_dropped, which on_midi counts; readers load each field atomically
+ * and may see a block half counted. */
+typedef struct {
+    unsigned int blocks;
+    unsigned int hist[PERF_HIST_BUCKETS];
+    unsigned int over[3];           /* blocks above 50, 80 and 100% of budget */
+    uint64_t total_ns;
+    unsigned int max_ns;
+    int peak_voices;
+    unsigned int voices_stolen;
+    unsigned int midi_dropped;      /* messages that found the MIDI queue full */
+} sf2_perf_t;
+
+/* Per-Instance State
+ *
+ * What set_param and get_param see belongs to the control thread; the
+ * audio thread keeps its own copy of what it needs and only publishes
+ * through the fields marked atomic. */
+typedef struct {
+    fluid_settings_t *settings;
     int current_preset;
     int preset_count;
-    int octave_transpose;
+    const preset_entry_t *presets;  /* the cache entry's list */
+    struct sf2_cache_entry *entry;  /* the soundfont shown, NULL if none */
+    fluid_preset_t *held_preset;    /* keeps current_preset's samples paged in */
+    int shown_gen;                  /* last swapped in generation shown */
+    int list_gen;                   /* generation the preset list is from */
+    int pending_preset;             /* preset to select once the load lands */
+    unsigned int unsent;            /* UNSENT_* */
+    uint64_t program_seen;          /* last program_change taken */
+    int octave_transpose;           /* atomic: set_param -> MIDI */
     float gain;
     char soundfont_path[512];
     char soundfont_name[128];
@@ -80,17 +200,79 @@ typedef struct {
     int soundfont_index;
     int soundfont_count;
     soundfont_entry_t soundfonts[MAX_SOUNDFONTS];
-    preset_entry_t presets[MAX_PRESETS];
     int reverb_on;
     int chorus_on;
     float reverb_level;
     float chorus_level;
-    float left_buf[MOVE_FRAMES_PER_BLOCK];
-    float right_buf[MOVE_FRAMES_PER_BLOCK];
     char module_dir[512];
     char load_error[256];
+
+    /* Audio thread: the synth rendering and the load it came from. The
+     * synth holds the cache entry the programs are from. */
+    fluid_synth_t *synth;
+    int sfont_id;
+    int generation;
+    int program_count;
+    const preset_entry_t *programs;
+    int synth_preset;               /* preset programmed, -1 if none */
+    unsigned int program_changes;   /* program changes played so far */
+    uint64_t program_change;        /* atomic: render -> control, count << 32 |
+                                     * generation << 16 | preset */
+
+    /* Background loader. request_* and load_info are guarded by
+     * loader_lock; the audio thread never takes the lock. */
+    pthread_t loader_thread;
+    int loader_started;
+    pthread_mutex_t loader_lock;
+    pthread_cond_t loader_cond;
+    int loader_quit;
+    char request_path[512];
+    int request_gen;
+    int adopted_gen;                /* atomic: last generation swapped in */
+    int load_progress;              /* atomic: 0..100 for the running load */
+    sf2_load_result_t *load_ready;  /* atomic: loader -> audio thread */
+    sf2_load_info_t *load_info;     /* loader -> control thread */
+    sf2_load_result_t *spent;       /* atomic: audio -> loader, a load swapped in */
+    struct sf2_cache_entry *paging; /* loader: last load published, paged in when idle */
+
+    /* Synth replaced by the last swap, rendered until its voices die */
+    fluid_synth_t *retiring;
+    int retiring_frames;
+    fluid_synth_t *retired[MAX_RETIRED_SYNTHS];  /* atomic: audio -> loader */
+
+    /* MIDI from on_midi, played by render_block. One producer and one
+     * consumer: on_midi only moves midi_head, render only midi_tail. */
+    midi_event_t midi_queue[MIDI_QUEUE_SIZE];
+    unsigned int midi_head;         /* atomic: on_midi -> render */
+    unsigned int midi_tail;         /* atomic: render -> on_midi */
+    int midi_timestamps;            /* place messages by arrival time */
+    sf2_font_options_t font_options;
+    int64_t block_start_ns;         /* atomic: when the last render began */
+    int block_frames;               /* atomic: frames of the last render */
+
+    /* Synth changes from set_param, made by render_block, so that only
+     * the audio thread touches the synths. One producer and one
+     * consumer, like the MIDI queue. */
+    sf2_command_t commands[COMMAND_QUEUE_SIZE];
+    unsigned int command_head;      /* atomic: set_param -> render */
+    unsigned int command_tail;      /* atomic: render -> set_param */
+    sf2_mix_t mix;                  /* audio thread: what the synths were given */
+
+    /* For get_param("perf_stats") */
+    sf2_perf_t perf;                /* atomic: render -> get_param */
+    int perf_reset;                 /* atomic: set_param -> render */
+    unsigned int stolen_seen;       /* audio thread: the synth's count so far */
+
+    /* For get_param("profile"), with FluidLite built WITH_PROFILING: the
+     * audio thread fills the buffer not on show and then shows it */
+    fluid_synth_profile_t profile[2];
+    int profile_shown;              /* atomic: render -> get_param, -1 if none */
 } sf2_instance_t;
 
+/* The defsfont parser keeps file-scope state, so only one load may run
+ * at a time across all instances. */
+static pthread_mutex_t g_parse_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* Helper: log via host */
 static void plugin_log(const char *msg) {
     if (g_host && g_host->log) {
@@ -181,34 +363,74 @@ static void scan_soundfonts(sf2_instance_t *inst, const char *module_dir) {
     }
 }
 
-/* Build preset list from loaded soundfont */
-static void build_preset_list(sf2_instance_t *inst) {
-    char msg[256];
-    inst->preset_count = 0;
+/* Monotonic clock, in nanoseconds */
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    if (!inst->synth) {
-        plugin_log("build_preset_list: synth is NULL");
-        return;
-    }
-    if (inst->sfont_id < 0) {
-        plugin_log("build_preset_list: sfont_id < 0");
-        return;
+/* Sample rate the host renders at */
+static int host_sample_rate(void) {
+    return g_host ? g_host->sample_rate : MOVE_SAMPLE_RATE;
+}
+
+/* Create a synth configured the way every instance expects */
+static fluid_synth_t *create_synth(sf2_instance_t *inst) {
+    fluid_synth_t *synth = new_fluid_synth(inst->settings);
+    if (!synth) return NULL;
+
+    /* Explicitly set sample rate on synth (belt and suspenders) */
+    fluid_synth_set_sample_rate(synth, (float)host_sample_rate());
+
+    /* Set 4th order interpolation for better pitch accuracy (-1 = all channels) */
+    fluid_synth_set_interp_method(synth, -1, FLUID_INTERP_4THORDER);
+
+    /* Initialize mod wheel to 0 on all channels to prevent default vibrato */
+    for (int ch = 0; ch < 16; ch++) {
+        fluid_synth_cc(synth, ch, 1, 0);  /* CC 1 = mod wheel */
     }
 
-    snprintf(msg, sizeof(msg), "build_preset_list: sfont_id=%d", inst->sfont_id);
-    plugin_log(msg);
+    return synth;
+}
 
-    /* Try getting soundfont by ID first */
-    fluid_sfont_t *sfont = fluid_synth_get_sfont_by_id(inst->synth, inst->sfont_id);
-    if (!sfont) {
-        plugin_log("build_preset_list: get_sfont_by_id returned NULL, trying index 0");
-        /* Fallback: try getting by index */
-        sfont = fluid_synth_get_sfont(inst->synth, 0);
+/* Audio thread: move a synth's gain and effects from one setting to
+ * another, touching only what changed; every setting if 'from' is NULL */
+static void update_mix(fluid_synth_t *synth, const sf2_mix_t *from, const sf2_mix_t *to) {
+    if (!from || from->gain != to->gain) {
+        fluid_synth_set_gain(synth, to->gain);
+    }
+    if (!from || from->reverb_on != to->reverb_on) {
+        fluid_synth_set_reverb_on(synth, to->reverb_on);
     }
+    if (!from || from->chorus_on != to->chorus_on) {
+        fluid_synth_set_chorus_on(synth, to->chorus_on);
+    }
+    if (!from || from->reverb_level != to->reverb_level) {
+        fluid_synth_set_reverb(synth,
+            fluid_synth_get_reverb_roomsize(synth),
+            fluid_synth_get_reverb_damp(synth),
+            fluid_synth_get_reverb_width(synth),
+            to->reverb_level);
+    }
+    if (!from || from->chorus_level != to->chorus_level) {
+        fluid_synth_set_chorus(synth,
+            fluid_synth_get_chorus_nr(synth),
+            to->chorus_level,
+            fluid_synth_get_chorus_speed_Hz(synth),
+            fluid_synth_get_chorus_depth_ms(synth),
+            fluid_synth_get_chorus_type(synth));
+    }
+}
+
+/* Build preset list from a soundfont, returns the number of presets */
+static int build_preset_list(fluid_sfont_t *sfont, preset_entry_t *presets, int max_presets) {
+    char msg[256];
+    int count = 0;
 
     if (!sfont) {
         plugin_log("build_preset_list: sfont is NULL");
-        return;
+        return 0;
     }
 
     plugin_log("build_preset_list: got sfont, starting iteration");
@@ -219,9 +441,9 @@ static void build_preset_list(sf2_instance_t *inst) {
     memset(&preset, 0, sizeof(preset));
 
     int iterations = 0;
-    while (sfont->iteration_next(sfont, &preset) && inst->preset_count < MAX_PRESETS) {
+    while (sfont->iteration_next(sfont, &preset) && count < max_presets) {
         iterations++;
-        preset_entry_t *p = &inst->presets[inst->preset_count];
+        preset_entry_t *p = &presets[count];
 
         const char *name = NULL;
         if (preset.get_name) {
@@ -231,7 +453,7 @@ static void build_preset_list(sf2_instance_t *inst) {
             strncpy(p->name, name, sizeof(p->name) - 1);
             p->name[sizeof(p->name) - 1] = '\0';
         } else {
-            snprintf(p->name, sizeof(p->name), "Preset %d", inst->preset_count);
+            snprintf(p->name, sizeof(p->name), "Preset %d", count);
         }
 
         if (preset.get_banknum && preset.get_num) {
@@ -239,74 +461,579 @@ static void build_preset_list(sf2_instance_t *inst) {
             p->program = preset.get_num(&preset);
         } else {
             p->bank = 0;
-            p->program = inst->preset_count;
+            p->program = count;
         }
 
-        inst->preset_count++;
+        count++;
     }
 
-    snprintf(msg, sizeof(msg), "Found %d presets after %d iterations", inst->preset_count, iterations);
+    snprintf(msg, sizeof(msg), "Found %d presets after %d iterations", count, iterations);
     plugin_log(msg);
+    return count;
 }
 
-static int load_soundfont(sf2_instance_t *inst, const char *path) {
-    char msg[256];
+/* Soundfont File Access */
+
+/* fluid_fileapi_t status codes (FLUID_OK/FLUID_FAILED live in a private header) */
+#define FILEAPI_OK 0
+#define FILEAPI_FAILED -1
 
-    /* Unload previous soundfont */
-    if (inst->sfont_id >= 0 && inst->synth) {
-        fluid_synth_sfunload(inst->synth, inst->sfont_id, 1);
-        inst->sfont_id = -1;
+/* File handle that tracks how far the parser has read into the file */
+typedef struct {
+    FILE *fp;
+    long size;
+    long pos;
+    int *progress;
+} progress_file_t;
+
+static void progress_file_update(progress_file_t *pf) {
+    int percent = 0;
+    if (pf->size > 0) {
+        percent = (int)((double)pf->pos * 100.0 / (double)pf->size);
     }
+    /* 100 is reserved for "swapped in" */
+    if (percent > 99) percent = 99;
+    if (percent < 0) percent = 0;
+    __atomic_store_n(pf->progress, percent, __ATOMIC_RELAXED);
+}
 
-    inst->preset_count = 0;
-    inst->current_preset = 0;
+static void *progress_fopen(fluid_fileapi_t *fileapi, const char *filename) {
+    progress_file_t *pf = calloc(1, sizeof(progress_file_t));
+    if (!pf) return NULL;
 
-    snprintf(msg, sizeof(msg), "Loading SF2: %s", path);
-    plugin_log(msg);
+    pf->fp = fopen(filename, "rb");
+    if (!pf->fp) {
+        free(pf);
+        return NULL;
+    }
+    if (fseek(pf->fp, 0, SEEK_END) == 0) {
+        pf->size = ftell(pf->fp);
+    }
+    fseek(pf->fp, 0, SEEK_SET);
+    pf->progress = (int *)fileapi->data;
+    progress_file_update(pf);
+    return pf;
+}
+
+static int progress_fread(void *buf, int count, void *handle) {
+    progress_file_t *pf = (progress_file_t *)handle;
+    if (fread(buf, count, 1, pf->fp) != 1) return FILEAPI_FAILED;
+    pf->pos += count;
+    progress_file_update(pf);
+    return FILEAPI_OK;
+}
+
+static int progress_fseek(void *handle, long offset, int origin) {
+    progress_file_t *pf = (progress_file_t *)handle;
+    if (fseek(pf->fp, offset, origin) != 0) return FILEAPI_FAILED;
+    if (origin == SEEK_SET) pf->pos = offset;
+    else if (origin == SEEK_CUR) pf->pos += offset;
+    else pf->pos = pf->size + offset;
+    progress_file_update(pf);
+    return FILEAPI_OK;
+}
+
+static int progress_fclose(void *handle) {
+    progress_file_t *pf = (progress_file_t *)handle;
+    int ret = fclose(pf->fp) == 0 ? FILEAPI_OK : FILEAPI_FAILED;
+    free(pf);
+    return ret;
+}
+
+static long progress_ftell(void *handle) {
+    return ((progress_file_t *)handle)->pos;
+}
 
-    inst->sfont_id = fluid_synth_sfload(inst->synth, path, 1);
-    snprintf(msg, sizeof(msg), "fluid_synth_sfload returned: %d", inst->sfont_id);
+/* Shared SoundFont Cache
+ *
+ * Every instance owns its own synth, but the parsed soundfont (sample data,
+ * preset/zone tree, preset list) is shared process-wide. Entries are keyed
+ * by canonical path + mtime + size + load options and freed when the last
+ * synth using them is deleted. Each synth gets its own thin fluid_sfont_t wrapper because the
+ * synth assigns the sfont id and deletes the sfont it was given.
+ */
+
+typedef struct sf2_cache_entry {
+    struct sf2_cache_entry *next;
+    char path[PATH_MAX];
+    time_t mtime;
+    off_t size;
+    sf2_font_options_t options; /* loaded with these */
+    int stale;                  /* file changed on disk - never hand out again */
+    int refcount;
+    fluid_sfont_t *sfont;       /* the one parsed defsfont */
+    int preset_count;
+    preset_entry_t *presets;
+} sf2_cache_entry_t;
+
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static sf2_cache_entry_t *g_cache = NULL;
+
+/* Take another reference to an entry someone already holds */
+static sf2_cache_entry_t *cache_ref(sf2_cache_entry_t *entry) {
+    pthread_mutex_lock(&g_cache_lock);
+    entry->refcount++;
+    pthread_mutex_unlock(&g_cache_lock);
+    return entry;
+}
+
+static void cache_release(sf2_cache_entry_t *entry) {
+    char msg[PATH_MAX + 64];
+
+    pthread_mutex_lock(&g_cache_lock);
+    if (--entry->refcount > 0) {
+        pthread_mutex_unlock(&g_cache_lock);
+        return;
+    }
+    for (sf2_cache_entry_t **link = &g_cache; *link; link = &(*link)->next) {
+        if (*link == entry) {
+            *link = entry->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+
+    snprintf(msg, sizeof(msg), "Cache: freeing %s", entry->path);
     plugin_log(msg);
-    if (inst->sfont_id < 0) {
-        snprintf(msg, sizeof(msg), "Failed to load SF2: %s", path);
+
+    if (entry->sfont->free(entry->sfont) != 0) {
+        plugin_log("Cache: soundfont still had samples in use");
+    }
+    free(entry->presets);
+    free(entry);
+}
+
+static int cached_sfont_free(fluid_sfont_t *sfont) {
+    cache_release((sf2_cache_entry_t *)sfont->data);
+    free(sfont);
+    return 0;
+}
+
+static char *cached_sfont_get_name(fluid_sfont_t *sfont) {
+    fluid_sfont_t *shared = ((sf2_cache_entry_t *)sfont->data)->sfont;
+    return shared->get_name(shared);
+}
+
+static fluid_preset_t *cached_sfont_get_preset(fluid_sfont_t *sfont, unsigned int bank, unsigned int prenum) {
+    fluid_sfont_t *shared = ((sf2_cache_entry_t *)sfont->data)->sfont;
+    fluid_preset_t *preset = shared->get_preset(shared, bank, prenum);
+    if (preset) {
+        /* Presets must report the sfont (and id) of the synth they play on */
+        preset->sfont = sfont;
+    }
+    return preset;
+}
+
+/* Iteration shares the parsed font's cursor; only used while the entry is built */
+static void cached_sfont_iteration_start(fluid_sfont_t *sfont) {
+    fluid_sfont_t *shared = ((sf2_cache_entry_t *)sfont->data)->sfont;
+    shared->iteration_start(shared);
+}
+
+static int cached_sfont_iteration_next(fluid_sfont_t *sfont, fluid_preset_t *preset) {
+    fluid_sfont_t *shared = ((sf2_cache_entry_t *)sfont->data)->sfont;
+    int more = shared->iteration_next(shared, preset);
+    if (more) preset->sfont = sfont;
+    return more;
+}
+
+/* Wrap a referenced entry in a per-synth sfont; drops the ref on failure */
+static fluid_sfont_t *cache_wrap(sf2_cache_entry_t *entry) {
+    fluid_sfont_t *sfont = calloc(1, sizeof(fluid_sfont_t));
+    if (!sfont) {
+        cache_release(entry);
+        return NULL;
+    }
+    sfont->data = entry;
+    sfont->free = cached_sfont_free;
+    sfont->get_name = cached_sfont_get_name;
+    sfont->get_preset = cached_sfont_get_preset;
+    sfont->iteration_start = cached_sfont_iteration_start;
+    sfont->iteration_next = cached_sfont_iteration_next;
+    return sfont;
+}
+
+static int same_font_options(const sf2_font_options_t *a, const sf2_font_options_t *b) {
+    return a->sample_budget == b->sample_budget &&
+           a->stream_preload_ms == b->stream_preload_ms &&
+           a->sf2c_cache == b->sf2c_cache;
+}
+
+/* Find a live entry for this file and take a reference. Caller holds g_cache_lock. */
+static sf2_cache_entry_t *cache_lookup_locked(const char *path, const struct stat *st,
+                                              const sf2_font_options_t *options) {
+    for (sf2_cache_entry_t *entry = g_cache; entry; entry = entry->next) {
+        if (entry->stale || strcmp(entry->path, path) != 0) continue;
+        if (!same_font_options(&entry->options, options)) continue;
+        if (entry->mtime != st->st_mtime || entry->size != st->st_size) {
+            /* Rewritten on disk: existing users keep the old copy */
+            entry->stale = 1;
+            continue;
+        }
+        entry->refcount++;
+        return entry;
+    }
+    return NULL;
+}
+
+/* Parse a soundfont file, reporting read progress through *progress.
+ * Caller holds g_parse_lock. */
+static fluid_sfont_t *parse_soundfont(const char *path, const sf2_font_options_t *options,
+                                      int *progress) {
+    fluid_fileapi_t fileapi = {
+        progress, NULL,
+        progress_fopen, progress_fread, progress_fseek, progress_fclose, progress_ftell
+    };
+    fluid_sfont_t *sfont = NULL;
+
+    fluid_set_sample_budget(options->sample_budget);
+    fluid_set_sample_stream(options->stream_preload_ms);
+    fluid_set_sf2c_cache(options->sf2c_cache);
+
+    fluid_sfloader_t *loader = new_fluid_defsfloader();
+    if (loader) {
+        loader->fileapi = &fileapi;
+        sfont = loader->load(loader, path);
+        delete_fluid_defsfloader(loader);
+    }
+    return sfont;
+}
+
+/*
+ * Get a soundfont for one synth, parsing it only if no other instance has
+ * it loaded. Returns a wrapper sfont to hand to fluid_synth_add_sfont, or
+ * NULL on failure.
+ */
+static fluid_sfont_t *cache_acquire(const char *path, const sf2_font_options_t *options,
+                                    int *progress) {
+    char canonical[PATH_MAX];
+    char msg[PATH_MAX + 64];
+    struct stat st;
+
+    if (!realpath(path, canonical) || stat(canonical, &st) != 0) {
+        snprintf(msg, sizeof(msg), "Cache: cannot stat %s", path);
         plugin_log(msg);
-        strcpy(inst->soundfont_name, "Load failed");
-        snprintf(inst->load_error, sizeof(inst->load_error),
-                 "SF2: failed to load soundfont");
-        return -1;
+        return NULL;
     }
 
-    /* Clear any previous load error on success */
-    inst->load_error[0] = '\0';
+    pthread_mutex_lock(&g_cache_lock);
+    sf2_cache_entry_t *entry = cache_lookup_locked(canonical, &st, options);
+    pthread_mutex_unlock(&g_cache_lock);
+    if (entry) {
+        snprintf(msg, sizeof(msg), "Cache: sharing %s", canonical);
+        plugin_log(msg);
+        return cache_wrap(entry);
+    }
 
-    /* Build preset list */
-    build_preset_list(inst);
+    /* Only one parse at a time; whoever waited may now find it cached */
+    pthread_mutex_lock(&g_parse_lock);
+    pthread_mutex_lock(&g_cache_lock);
+    entry = cache_lookup_locked(canonical, &st, options);
+    pthread_mutex_unlock(&g_cache_lock);
+    if (entry) {
+        pthread_mutex_unlock(&g_parse_lock);
+        return cache_wrap(entry);
+    }
 
-    const char *fname = strrchr(path, '/');
-    if (fname) {
-        strncpy(inst->soundfont_name, fname + 1, sizeof(inst->soundfont_name) - 1);
-    } else {
-        strncpy(inst->soundfont_name, path, sizeof(inst->soundfont_name) - 1);
+    fluid_sfont_t *shared = parse_soundfont(canonical, options, progress);
+    if (!shared) {
+        pthread_mutex_unlock(&g_parse_lock);
+        return NULL;
     }
 
-    strncpy(inst->soundfont_path, path, sizeof(inst->soundfont_path) - 1);
-    inst->soundfont_path[sizeof(inst->soundfont_path) - 1] = '\0';
+    entry = calloc(1, sizeof(sf2_cache_entry_t));
+    preset_entry_t *presets = entry ? malloc(MAX_PRESETS * sizeof(preset_entry_t)) : NULL;
+    if (!entry || !presets) {
+        free(entry);
+        free(presets);
+        shared->free(shared);
+        pthread_mutex_unlock(&g_parse_lock);
+        return NULL;
+    }
+
+    strncpy(entry->path, canonical, sizeof(entry->path) - 1);
+    entry->mtime = st.st_mtime;
+    entry->size = st.st_size;
+    entry->options = *options;
+    entry->refcount = 1;
+    entry->sfont = shared;
+    entry->preset_count = build_preset_list(shared, presets, MAX_PRESETS);
+    entry->presets = presets;
+    if (entry->preset_count > 0) {
+        preset_entry_t *shrunk = realloc(presets, entry->preset_count * sizeof(preset_entry_t));
+        if (shrunk) entry->presets = shrunk;
+    }
+
+    pthread_mutex_lock(&g_cache_lock);
+    entry->next = g_cache;
+    g_cache = entry;
+    pthread_mutex_unlock(&g_cache_lock);
+    pthread_mutex_unlock(&g_parse_lock);
+
+    snprintf(msg, sizeof(msg), "Cache: parsed %s (%d presets)", canonical, entry->preset_count);
+    plugin_log(msg);
+
+    return cache_wrap(entry);
+}
+
+/* Background Loading */
+
+static void free_load_result(sf2_load_result_t *res) {
+    if (!res) return;
+    if (res->synth) delete_fluid_synth(res->synth);
+    free(res);
+}
+
+static void free_load_info(sf2_load_info_t *info) {
+    if (!info) return;
+    if (info->entry) cache_release(info->entry);
+    free(info);
+}
+
+/*
+ * Attach a soundfont to a brand new synth. Runs on the loader thread and
+ * never touches the synth the audio thread is rendering.
+ */
+static sf2_load_result_t *build_load_result(sf2_instance_t *inst, const char *path, int generation) {
+    char msg[256];
+
+    sf2_load_result_t *res = calloc(1, sizeof(sf2_load_result_t));
+    if (!res) return NULL;
 
-    snprintf(msg, sizeof(msg), "SF2 loaded: %d presets", inst->preset_count);
+    res->generation = generation;
+    res->sfont_id = -1;
+    strncpy(res->path, path, sizeof(res->path) - 1);
+
+    res->synth = create_synth(inst);
+    if (!res->synth) {
+        plugin_log("Failed to create FluidLite synth for load");
+        snprintf(res->error, sizeof(res->error), "SF2: out of memory");
+        return res;
+    }
+
+    snprintf(msg, sizeof(msg), "Loading SF2: %s", path);
+    plugin_log(msg);
+
+    fluid_sfont_t *sfont = cache_acquire(path, &inst->font_options, &inst->load_progress);
+    if (!sfont) {
+        snprintf(msg, sizeof(msg), "Failed to load SF2: %s", path);
+        plugin_log(msg);
+        snprintf(res->error, sizeof(res->error), "SF2: failed to load soundfont");
+        return res;
+    }
+
+    /* The synth owns the wrapper from here; deleting the synth drops the ref */
+    res->sfont_id = fluid_synth_add_sfont(res->synth, sfont);
+    snprintf(msg, sizeof(msg), "fluid_synth_add_sfont returned: %d", res->sfont_id);
+    plugin_log(msg);
+
+    sf2_cache_entry_t *entry = (sf2_cache_entry_t *)sfont->data;
+    res->entry = entry;
+
+    snprintf(msg, sizeof(msg), "SF2 loaded: %d presets", entry->preset_count);
     plugin_log(msg);
 
     /* Select first preset on all channels */
-    if (inst->preset_count > 0) {
-        strncpy(inst->preset_name, inst->presets[0].name, sizeof(inst->preset_name) - 1);
+    if (entry->preset_count > 0) {
         for (int ch = 0; ch < 16; ch++) {
-            fluid_synth_program_select(inst->synth, ch, inst->sfont_id,
-                                       inst->presets[0].bank, inst->presets[0].program);
+            fluid_synth_program_select(res->synth, ch, res->sfont_id,
+                                       entry->presets[0].bank, entry->presets[0].program);
         }
     }
+    /* ...and read its samples here rather than on first play */
+    fluid_defsfont_page_in(entry->sfont);
+
+    return res;
+}
+
+/* Hand a finished load to the audio thread, dropping any unclaimed one,
+ * and what it shows to the control thread. Caller holds loader_lock. */
+static void publish_load_result(sf2_instance_t *inst, sf2_load_result_t *res) {
+    sf2_load_info_t *info = calloc(1, sizeof(sf2_load_info_t));
+    if (info) {
+        info->generation = res->generation;
+        info->entry = res->entry ? cache_ref(res->entry) : NULL;
+        snprintf(info->error, sizeof(info->error), "%s", res->error);
+    }
+    free_load_info(inst->load_info);
+    inst->load_info = info;
+
+    if (inst->paging) cache_release(inst->paging);
+    inst->paging = res->entry ? cache_ref(res->entry) : NULL;
+
+    sf2_load_result_t *stale = __atomic_exchange_n(&inst->load_ready, res, __ATOMIC_ACQ_REL);
+    free_load_result(stale);
+}
+
+/* Free the synths and loads the audio thread has finished with */
+static void collect_retired(sf2_instance_t *inst) {
+    for (int i = 0; i < MAX_RETIRED_SYNTHS; i++) {
+        fluid_synth_t *old = __atomic_exchange_n(&inst->retired[i], NULL, __ATOMIC_ACQUIRE);
+        if (old) delete_fluid_synth(old);
+    }
+    free_load_result(__atomic_exchange_n(&inst->spent, NULL, __ATOMIC_ACQUIRE));
+}
 
+static void *loader_thread_main(void *arg) {
+    sf2_instance_t *inst = (sf2_instance_t *)arg;
+    char path[512];
+    int done_gen = 0;
+
+    pthread_mutex_lock(&inst->loader_lock);
+    while (!inst->loader_quit) {
+        if (inst->request_gen == done_gen) {
+            /* Idle: wake up periodically to free retired synths */
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 100 * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&inst->loader_cond, &inst->loader_lock, &ts);
+            pthread_mutex_unlock(&inst->loader_lock);
+            collect_retired(inst);
+            /* MIDI program changes only mark the samples they select on
+             * the audio thread; read them in here */
+            if (inst->paging) fluid_defsfont_page_in(inst->paging->sfont);
+            pthread_mutex_lock(&inst->loader_lock);
+            continue;
+        }
+
+        int gen = inst->request_gen;
+        memcpy(path, inst->request_path, sizeof(path));
+        pthread_mutex_unlock(&inst->loader_lock);
+
+        __atomic_store_n(&inst->load_progress, 0, __ATOMIC_RELAXED);
+        sf2_load_result_t *res = build_load_result(inst, path, gen);
+        done_gen = gen;
+
+        pthread_mutex_lock(&inst->loader_lock);
+        if (!res) {
+            plugin_log("Out of memory for soundfont load");
+            __atomic_store_n(&inst->adopted_gen, gen, __ATOMIC_RELEASE);
+        } else if (inst->request_gen != gen) {
+            /* Superseded while loading - go straight to the newer request */
+            pthread_mutex_unlock(&inst->loader_lock);
+            free_load_result(res);
+            pthread_mutex_lock(&inst->loader_lock);
+        } else {
+            publish_load_result(inst, res);
+        }
+    }
+    pthread_mutex_unlock(&inst->loader_lock);
+
+    return NULL;
+}
+
+/* Control thread: whether the soundfont asked for last is still to be shown */
+static int is_loading(sf2_instance_t *inst) {
+    return inst->shown_gen != inst->request_gen;
+}
+
+/*
+ * Queue a soundfont load. Returns immediately; the new font is swapped in
+ * by the audio thread once the loader thread has finished with it.
+ */
+static void load_soundfont(sf2_instance_t *inst, const char *path) {
+    /* Report the target right away so UI and state queries see it */
+    const char *fname = strrchr(path, '/');
+    strncpy(inst->soundfont_name, fname ? fname + 1 : path, sizeof(inst->soundfont_name) - 1);
+    inst->soundfont_name[sizeof(inst->soundfont_name) - 1] = '\0';
+    strncpy(inst->soundfont_path, path, sizeof(inst->soundfont_path) - 1);
+    inst->soundfont_path[sizeof(inst->soundfont_path) - 1] = '\0';
+    inst->pending_preset = -1;
+
+    pthread_mutex_lock(&inst->loader_lock);
+    strncpy(inst->request_path, path, sizeof(inst->request_path) - 1);
+    inst->request_path[sizeof(inst->request_path) - 1] = '\0';
+    int gen = ++inst->request_gen;
+    pthread_cond_signal(&inst->loader_cond);
+    pthread_mutex_unlock(&inst->loader_lock);
+
+    if (!inst->loader_started) {
+        /* No loader thread - load inline, swap on the next block, and free
+         * the synths earlier swaps left behind */
+        collect_retired(inst);
+        sf2_load_result_t *res = build_load_result(inst, path, gen);
+        if (res) {
+            pthread_mutex_lock(&inst->loader_lock);
+            publish_load_result(inst, res);
+            pthread_mutex_unlock(&inst->loader_lock);
+        } else {
+            __atomic_store_n(&inst->adopted_gen, gen, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/* Hand a synth to the loader thread for freeing. Returns 0 if every slot
+ * is taken; the caller keeps the synth and tries again next block, as
+ * freeing it here could take the cache lock and free a whole soundfont. */
+static int release_synth(sf2_instance_t *inst, fluid_synth_t *synth) {
+    for (int i = 0; i < MAX_RETIRED_SYNTHS; i++) {
+        fluid_synth_t *expected = NULL;
+        if (__atomic_compare_exchange_n(&inst->retired[i], &expected, synth, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
     return 0;
 }
 
+/* Start fading out a synth that has been replaced; the one fading before
+ * it must have been released already */
+static void retire_synth(sf2_instance_t *inst, fluid_synth_t *synth) {
+    if (!synth) return;
+
+    /* Lift the sustain pedals too, so held notes fade rather than being
+     * cut off after RETIRE_MAX_SECONDS */
+    for (int channel = 0; channel < 16; channel++) {
+        fluid_synth_cc(synth, channel, 64, 0);
+    }
+    fluid_synth_all_notes_off(synth, -1);
+    inst->retiring = synth;
+    inst->retiring_frames = 0;
+}
+
+/* Audio thread: swap in a finished load, if there is one. The control
+ * thread picks up its preset list once adopted_gen says it is in. */
+static void adopt_loaded_soundfont(sf2_instance_t *inst) {
+    if (!__atomic_load_n(&inst->load_ready, __ATOMIC_RELAXED)) return;
+
+    /* The load goes back to the loader thread to be freed; leave it for a
+     * later block while the one before is still waiting for that */
+    if (__atomic_load_n(&inst->spent, __ATOMIC_ACQUIRE)) return;
+
+    /* Only one synth fades at a time: cut an older one short, or leave the
+     * load for a later block if there is nowhere to put that one yet */
+    if (inst->retiring) {
+        if (!release_synth(inst, inst->retiring)) return;
+        inst->retiring = NULL;
+    }
+
+    sf2_load_result_t *res = __atomic_exchange_n(&inst->load_ready, NULL, __ATOMIC_ACQUIRE);
+    if (!res) return;
+
+    if (res->synth) {
+        /* Bring the new synth in line with the current settings */
+        update_mix(res->synth, NULL, &inst->mix);
+        retire_synth(inst, inst->synth);
+        inst->synth = res->synth;
+        inst->stolen_seen = fluid_synth_get_voices_stolen(inst->synth);
+        res->synth = NULL;
+    }
+
+    /* The synth holds the entry, so its list lives as long as we use it */
+    inst->sfont_id = res->sfont_id;
+    inst->generation = res->generation;
+    inst->program_count = res->entry ? res->entry->preset_count : 0;
+    inst->programs = res->entry ? res->entry->presets : NULL;
+    inst->synth_preset = inst->program_count > 0 ? 0 : -1;
+
+    __atomic_store_n(&inst->adopted_gen, res->generation, __ATOMIC_RELEASE);
+    __atomic_store_n(&inst->spent, res, __ATOMIC_RELEASE);
+}
+
 static void set_soundfont_index(sf2_instance_t *inst, int index) {
     if (inst->soundfont_count <= 0) return;
 
@@ -317,31 +1044,257 @@ static void set_soundfont_index(sf2_instance_t *inst, int index) {
     load_soundfont(inst, inst->soundfonts[inst->soundfont_index].path);
 }
 
-static void select_preset(sf2_instance_t *inst, int index) {
-    if (!inst->synth || inst->preset_count == 0) return;
+/* Control thread: make a preset of the list the current one. Returns its
+ * index, or -1 if the list is empty; 'changed' tells if another one was
+ * current. */
+static int pick_preset(sf2_instance_t *inst, int index, int *changed) {
+    if (inst->preset_count == 0) return -1;
 
     if (index < 0) index = inst->preset_count - 1;
     if (index >= inst->preset_count) index = 0;
 
-    /* Send all notes off before changing preset */
-    if (inst->current_preset != index) {
-        fluid_synth_all_notes_off(inst->synth, -1);
-    }
-
+    *changed = inst->current_preset != index;
     inst->current_preset = index;
 
-    preset_entry_t *p = &inst->presets[index];
+    const preset_entry_t *p = &inst->presets[index];
     strncpy(inst->preset_name, p->name, sizeof(inst->preset_name) - 1);
 
-    /* Set program on all 16 MIDI channels - notes may arrive on any channel */
-    for (int ch = 0; ch < 16; ch++) {
-        fluid_synth_program_select(inst->synth, ch, inst->sfont_id, p->bank, p->program);
-    }
-
     char msg[128];
     snprintf(msg, sizeof(msg), "Preset %d: %s (bank %d, prog %d)",
              index, inst->preset_name, p->bank, p->program);
     plugin_log(msg);
+    return index;
+}
+
+/* Control thread: select the current preset on the shared soundfont too,
+ * which keeps its samples in memory, and read them in before the synth
+ * is told to play it */
+static void hold_preset(sf2_instance_t *inst) {
+    if (inst->held_preset) {
+        inst->held_preset->free(inst->held_preset);
+        inst->held_preset = NULL;
+    }
+    if (!inst->entry || inst->current_preset >= inst->preset_count) return;
+
+    fluid_sfont_t *shared = inst->entry->sfont;
+    const preset_entry_t *p = &inst->presets[inst->current_preset];
+    inst->held_preset = shared->get_preset(shared, p->bank, p->program);
+    fluid_defsfont_page_in(shared);
+}
+
+/* Audio thread: set a preset of the list on all 16 MIDI channels - notes
+ * may arrive on any channel */
+static void program_preset(sf2_instance_t *inst, int index) {
+    if (!inst->synth || index < 0 || index >= inst->program_count) return;
+
+    const preset_entry_t *p = &inst->programs[index];
+    for (int ch = 0; ch < 16; ch++) {
+        fluid_synth_program_select(inst->synth, ch, inst->sfont_id, p->bank, p->program);
+    }
+    inst->synth_preset = index;
+}
+
+/* Audio thread: select a preset for a MIDI program change, and let the
+ * control thread know which one it is */
+static void program_change(sf2_instance_t *inst, int index) {
+    if (!inst->synth || index >= inst->program_count) return;
+
+    /* Send all notes off before changing preset */
+    if (index != inst->synth_preset) {
+        fluid_synth_all_notes_off(inst->synth, -1);
+    }
+    program_preset(inst, index);
+
+    inst->program_changes++;
+    __atomic_store_n(&inst->program_change,
+                     (uint64_t)inst->program_changes << 32 |
+                     (uint64_t)(inst->generation & 0xFFFF) << 16 | (uint64_t)index,
+                     __ATOMIC_RELEASE);
+}
+
+/* Audio thread: make a change set_param asked for. Without a synth the
+ * mix is kept for the one a load brings in; a preset from the list of
+ * another load than the synth's is dropped. */
+static void run_command(sf2_instance_t *inst, const sf2_command_t *cmd) {
+    switch (cmd->type) {
+        case SF2_CMD_MIX:
+            if (inst->synth) {
+                update_mix(inst->synth, &inst->mix, &cmd->mix);
+            }
+            inst->mix = cmd->mix;
+            break;
+        case SF2_CMD_NOTES_OFF:
+            if (inst->synth) {
+                fluid_synth_all_notes_off(inst->synth, -1);
+            }
+            break;
+        case SF2_CMD_PRESET:
+            if (cmd->generation == inst->generation) {
+                program_preset(inst, cmd->preset);
+            }
+            break;
+    }
+}
+
+/* Audio thread: make the changes queued before this block, in order */
+static void run_commands(sf2_instance_t *inst) {
+    unsigned int head = __atomic_load_n(&inst->command_head, __ATOMIC_ACQUIRE);
+    unsigned int tail = inst->command_tail;
+
+    for (; tail != head; tail++) {
+        run_command(inst, &inst->commands[tail & (COMMAND_QUEUE_SIZE - 1)]);
+    }
+    __atomic_store_n(&inst->command_tail, tail, __ATOMIC_RELEASE);
+}
+
+/* Control thread: queue a change for the audio thread; 0 if the queue is full */
+static int push_command(sf2_instance_t *inst, const sf2_command_t *cmd) {
+    unsigned int head = inst->command_head;
+
+    if (head - __atomic_load_n(&inst->command_tail, __ATOMIC_ACQUIRE) >= COMMAND_QUEUE_SIZE) {
+        return 0;
+    }
+    inst->commands[head & (COMMAND_QUEUE_SIZE - 1)] = *cmd;
+    __atomic_store_n(&inst->command_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Control thread: queue the changes still unsent. Only the last gain,
+ * effects and preset matter, so with the queue full they are held back
+ * and go out with a later set_param or get_param rather than waiting for
+ * the audio thread. */
+static void send_changes(sf2_instance_t *inst) {
+    if (inst->unsent & UNSENT_NOTES_OFF) {
+        if (!push_command(inst, &(sf2_command_t){ .type = SF2_CMD_NOTES_OFF })) return;
+        inst->unsent &= ~UNSENT_NOTES_OFF;
+    }
+    if (inst->unsent & UNSENT_PRESET) {
+        sf2_command_t cmd = { .type = SF2_CMD_PRESET };
+        cmd.preset = inst->current_preset;
+        cmd.generation = inst->list_gen;
+        if (!push_command(inst, &cmd)) return;
+        inst->unsent &= ~UNSENT_PRESET;
+    }
+    if (inst->unsent & UNSENT_MIX) {
+        sf2_command_t cmd = { .type = SF2_CMD_MIX };
+        cmd.mix.gain = inst->gain;
+        cmd.mix.reverb_on = inst->reverb_on;
+        cmd.mix.chorus_on = inst->chorus_on;
+        cmd.mix.reverb_level = inst->reverb_level;
+        cmd.mix.chorus_level = inst->chorus_level;
+        if (!push_command(inst, &cmd)) return;
+        inst->unsent &= ~UNSENT_MIX;
+    }
+}
+
+/* Control thread: select a preset; the synth takes it up at the next block */
+static void select_preset(sf2_instance_t *inst, int index) {
+    /* Preset lists are swapped in with the soundfont - apply it then */
+    if (is_loading(inst)) {
+        inst->pending_preset = index;
+        return;
+    }
+
+    int changed;
+    index = pick_preset(inst, index, &changed);
+    if (index < 0) return;
+    hold_preset(inst);
+
+    /* Send all notes off before changing preset */
+    if (changed) {
+        inst->unsent |= UNSENT_NOTES_OFF;
+    }
+    inst->unsent |= UNSENT_PRESET;
+    send_changes(inst);
+}
+
+/* Control thread: hand the current gain and effect settings to the synth */
+static void send_mix(sf2_instance_t *inst) {
+    inst->unsent |= UNSENT_MIX;
+    send_changes(inst);
+}
+
+/* Control thread: show the preset list of a load the audio thread swapped in */
+static void show_load(sf2_instance_t *inst, sf2_load_info_t *info) {
+    if (inst->held_preset) {
+        inst->held_preset->free(inst->held_preset);
+        inst->held_preset = NULL;
+    }
+    if (inst->entry) cache_release(inst->entry);
+    inst->entry = info->entry;
+    info->entry = NULL;
+    inst->list_gen = info->generation;
+    inst->preset_count = inst->entry ? inst->entry->preset_count : 0;
+    inst->presets = inst->entry ? inst->entry->presets : NULL;
+    inst->current_preset = 0;
+    inst->preset_name[0] = '\0';
+    if (inst->preset_count > 0) {
+        strncpy(inst->preset_name, inst->presets[0].name, sizeof(inst->preset_name) - 1);
+    }
+
+    if (info->error[0]) {
+        snprintf(inst->load_error, sizeof(inst->load_error), "%s", info->error);
+        if (info->generation == inst->request_gen) {
+            strcpy(inst->soundfont_name, "Load failed");
+            /* Allow the same path to be retried */
+            inst->soundfont_path[0] = '\0';
+        }
+    } else {
+        /* Clear any previous load error on success */
+        inst->load_error[0] = '\0';
+    }
+    free_load_info(info);
+
+    /* The preset asked for during the load */
+    int index = inst->pending_preset;
+    inst->pending_preset = -1;
+    if (index >= 0) {
+        select_preset(inst, index);
+    }
+}
+
+/*
+ * Control thread: catch up with the audio thread before set_param or
+ * get_param - show the preset a MIDI program change selected and a load
+ * it swapped in, and send the changes a full queue held back.
+ */
+static void sync_with_audio(sf2_instance_t *inst) {
+    uint64_t change = __atomic_load_n(&inst->program_change, __ATOMIC_ACQUIRE);
+    if (change != inst->program_seen) {
+        int index = (int)(change & 0xFFFF);
+        int16_t ahead = (int16_t)((change >> 16) - (uint64_t)inst->list_gen);
+        inst->program_seen = change;
+        if (ahead == 0 && !is_loading(inst)) {
+            int changed;
+            if (pick_preset(inst, index, &changed) >= 0 && changed) hold_preset(inst);
+        } else if (ahead >= 0) {
+            /* Played ahead of a load shown yet; the new list gets it */
+            inst->pending_preset = index;
+        }
+    }
+
+    int adopted = __atomic_load_n(&inst->adopted_gen, __ATOMIC_ACQUIRE);
+    if (adopted != inst->shown_gen) {
+        inst->shown_gen = adopted;
+        pthread_mutex_lock(&inst->loader_lock);
+        sf2_load_info_t *info = inst->load_info;
+        if (info && info->generation <= adopted) {
+            inst->load_info = NULL;
+        } else {
+            info = NULL;
+        }
+        pthread_mutex_unlock(&inst->loader_lock);
+        if (info) show_load(inst, info);
+    }
+
+    send_changes(inst);
+}
+
+/* Control thread: transpose the notes played from now on */
+static void set_octave_transpose(sf2_instance_t *inst, int octave) {
+    if (octave < -4) octave = -4;
+    if (octave > 4) octave = 4;
+    __atomic_store_n(&inst->octave_transpose, octave, __ATOMIC_RELAXED);
 }
 
 /* V2 API Implementation */
@@ -358,6 +1311,7 @@ static void* v2_create_instance(const char *module_dir, const char *json_default
     strcpy(inst->soundfont_name, "No SF2 loaded");
     inst->load_error[0] = '\0';
     inst->sfont_id = -1;
+    inst->synth_preset = -1;
 
     /* Create FluidLite settings and synth */
     inst->settings = new_fluid_settings();
@@ -368,7 +1322,7 @@ static void* v2_create_instance(const char *module_dir, const char *json_default
     }
 
     /* Use host's sample rate for proper tuning */
-    int sample_rate = g_host ? g_host->sample_rate : MOVE_SAMPLE_RATE;
+    int sample_rate = host_sample_rate();
 
     fluid_settings_setnum(inst->settings, "synth.sample-rate", (double)sample_rate);
     fluid_settings_setnum(inst->settings, "synth.gain", 1.0);
@@ -378,8 +1332,42 @@ static void* v2_create_instance(const char *module_dir, const char *json_default
     inst->chorus_on = 1;
     inst->reverb_level = FLUID_REVERB_DEFAULT_LEVEL;
     inst->chorus_level = FLUID_CHORUS_DEFAULT_LEVEL;
+    inst->mix.gain = inst->gain;
+    inst->mix.reverb_on = inst->reverb_on;
+    inst->mix.chorus_on = inst->chorus_on;
+    inst->mix.reverb_level = inst->reverb_level;
+    inst->mix.chorus_level = inst->chorus_level;
+    inst->profile_shown = -1;
+
+    /* Skip voice filters that are wide open without resonance and only
+     * apply their gain; read by every synth created from these settings */
+    float filter_bypass;
+    if (json_defaults && json_get_number(json_defaults, "filter_bypass", &filter_bypass) == 0) {
+        fluid_settings_setstr(inst->settings, "synth.filter-bypass", filter_bypass != 0.0f ? "yes" : "no");
+    }
 
-    inst->synth = new_fluid_synth(inst->settings);
+    /* Render voices on this many cores; busy blocks are split between the
+     * audio thread and pinned worker threads */
+    float cpu_cores;
+    if (json_defaults && json_get_number(json_defaults, "cpu_cores", &cpu_cores) == 0) {
+        fluid_settings_setint(inst->settings, "synth.cpu-cores", (int)cpu_cores);
+    }
+
+    /* Frames per internal block; MOVE_FRAMES_PER_BLOCK renders each host
+     * block in one go, at a coarser control rate */
+    float block_size;
+    if (json_defaults && json_get_number(json_defaults, "block_size", &block_size) == 0) {
+        fluid_settings_setint(inst->settings, "synth.block-size", (int)block_size);
+    }
+
+    /* Play MIDI at the frame it arrived at during the previous block
+     * instead of at the start of the next one */
+    float midi_timestamps;
+    if (json_defaults && json_get_number(json_defaults, "midi_timestamps", &midi_timestamps) == 0) {
+        inst->midi_timestamps = midi_timestamps != 0.0f;
+    }
+
+    inst->synth = create_synth(inst);
     if (!inst->synth) {
         plugin_log("Failed to create FluidLite synth");
         delete_fluid_settings(inst->settings);
@@ -387,9 +1375,6 @@ static void* v2_create_instance(const char *module_dir, const char *json_default
         return NULL;
     }
 
-    /* Explicitly set sample rate on synth (belt and suspenders) */
-    fluid_synth_set_sample_rate(inst->synth, (float)sample_rate);
-
     /* Verify and log sample rate */
     double actual_rate = 0;
     fluid_settings_getnum(inst->settings, "synth.sample-rate", &actual_rate);
@@ -401,13 +1386,37 @@ static void* v2_create_instance(const char *module_dir, const char *json_default
     fprintf(stderr, "[sf2] %s\n", rate_msg);
     fflush(stderr);
 
-    /* Set 4th order interpolation for better pitch accuracy (-1 = all channels) */
-    fluid_synth_set_interp_method(inst->synth, -1, FLUID_INTERP_4THORDER);
-    plugin_log("Set interpolation to FLUID_INTERP_4THORDER (4)");
+    /* Sample memory budget for the soundfonts this instance loads */
+    inst->font_options.sample_budget = DEFAULT_SAMPLE_BUDGET_MB * 1024 * 1024;
+    float budget_mb;
+    if (json_defaults && json_get_number(json_defaults, "sample_budget_mb", &budget_mb) == 0 &&
+        budget_mb >= 0.0f) {
+        inst->font_options.sample_budget = (unsigned int)(budget_mb * 1024.0f * 1024.0f);
+    }
 
-    /* Initialize mod wheel to 0 on all channels to prevent default vibrato */
-    for (int ch = 0; ch < 16; ch++) {
-        fluid_synth_cc(inst->synth, ch, 1, 0);  /* CC 1 = mod wheel */
+    /* Stream sample bodies from disk instead, keeping this much of each
+     * sample (plus its loop) in memory; 0 leaves streaming off */
+    float preload_ms;
+    if (json_defaults && json_get_number(json_defaults, "stream_preload_ms", &preload_ms) == 0 &&
+        preload_ms >= 0.0f) {
+        inst->font_options.stream_preload_ms = (unsigned int)preload_ms;
+    }
+
+    /* Keep a compiled .sf2c next to each soundfont and map that on later
+     * loads instead of parsing the .sf2 again */
+    float sf2c_cache;
+    if (json_defaults && json_get_number(json_defaults, "sf2c_cache", &sf2c_cache) == 0) {
+        inst->font_options.sf2c_cache = sf2c_cache != 0.0f;
+    }
+
+    /* Soundfonts are parsed on a loader thread and swapped in by render */
+    pthread_mutex_init(&inst->loader_lock, NULL);
+    pthread_cond_init(&inst->loader_cond, NULL);
+    inst->pending_preset = -1;
+    if (pthread_create(&inst->loader_thread, NULL, loader_thread_main, inst) == 0) {
+        inst->loader_started = 1;
+    } else {
+        plugin_log("Failed to start loader thread, loading inline");
     }
 
     /* Parse default soundfont path from JSON */
@@ -464,10 +1473,42 @@ static void v2_destroy_instance(void *instance) {
 
     plugin_log("Instance destroying");
 
+    if (inst->loader_started) {
+        pthread_mutex_lock(&inst->loader_lock);
+        inst->loader_quit = 1;
+        pthread_cond_signal(&inst->loader_cond);
+        pthread_mutex_unlock(&inst->loader_lock);
+        pthread_join(inst->loader_thread, NULL);
+    }
+    pthread_cond_destroy(&inst->loader_cond);
+    pthread_mutex_destroy(&inst->loader_lock);
+
+    free_load_result(inst->load_ready);
+    inst->load_ready = NULL;
+    free_load_info(inst->load_info);
+    inst->load_info = NULL;
+    if (inst->paging) {
+        cache_release(inst->paging);
+        inst->paging = NULL;
+    }
+    if (inst->retiring) {
+        delete_fluid_synth(inst->retiring);
+        inst->retiring = NULL;
+    }
+    collect_retired(inst);
+
     if (inst->synth) {
         delete_fluid_synth(inst->synth);
         inst->synth = NULL;
     }
+    if (inst->held_preset) {
+        inst->held_preset->free(inst->held_preset);
+        inst->held_preset = NULL;
+    }
+    if (inst->entry) {
+        cache_release(inst->entry);
+        inst->entry = NULL;
+    }
 
     if (inst->settings) {
         delete_fluid_settings(inst->settings);
@@ -477,11 +1518,143 @@ static void v2_destroy_instance(void *instance) {
     free(inst);
 }
 
-static void v2_on_midi(void *instance, const uint8_t *msg, int len, int source) {
-    sf2_instance_t *inst = (sf2_instance_t *)instance;
-    if (!inst || !inst->synth || len < 2) return;
-    (void)source;
+#define PERF_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
 
+/* Audio thread: the voices playing now, for the peak */
+static void perf_voices(sf2_instance_t *inst) {
+    int voices = fluid_synth_get_active_voice_count(inst->synth);
+    if (inst->retiring) {
+        voices += fluid_synth_get_active_voice_count(inst->retiring);
+    }
+    if (voices > inst->perf.peak_voices) {
+        __atomic_store_n(&inst->perf.peak_voices, voices, __ATOMIC_RELAXED);
+    }
+}
+
+/* Audio thread: count a render of 'frames' that took 'ns' */
+static void perf_block(sf2_instance_t *inst, int frames, int64_t ns) {
+    sf2_perf_t *perf = &inst->perf;
+    int64_t budget = (int64_t)frames * 1000000000 / host_sample_rate();
+    int bucket = 0;
+
+    for (int64_t us = ns / 1000; us > 0 && bucket < PERF_HIST_BUCKETS - 1; us >>= 1) {
+        bucket++;
+    }
+    PERF_ADD(perf->blocks, 1);
+    PERF_ADD(perf->hist[bucket], 1);
+    PERF_ADD(perf->total_ns, ns);
+    if (ns * 2 > budget) PERF_ADD(perf->over[0], 1);
+    if (ns * 5 > budget * 4) PERF_ADD(perf->over[1], 1);
+    if (ns > budget) PERF_ADD(perf->over[2], 1);
+    if (ns > perf->max_ns) {
+        __atomic_store_n(&perf->max_ns, ns > UINT32_MAX ? UINT32_MAX : (unsigned int)ns, __ATOMIC_RELAXED);
+    }
+
+    if (inst->synth) {
+        unsigned int stolen = fluid_synth_get_voices_stolen(inst->synth);
+        PERF_ADD(perf->voices_stolen, stolen - inst->stolen_seen);
+        inst->stolen_seen = stolen;
+
+        /* A reader would have to take a whole PROFILE_BLOCKS over one
+         * copy for the next but one to overwrite it */
+        if (perf->blocks % PROFILE_BLOCKS == 0) {
+            int next = __atomic_load_n(&inst->profile_shown, __ATOMIC_RELAXED) == 0 ? 1 : 0;
+            if (fluid_synth_get_profile(inst->synth, &inst->profile[next]) == 0) {
+                __atomic_store_n(&inst->profile_shown, next, __ATOMIC_RELEASE);
+            }
+        }
+    }
+}
+
+/* Audio thread: start counting afresh if set_param asked to */
+static void perf_take_reset(sf2_instance_t *inst) {
+    if (!__atomic_exchange_n(&inst->perf_reset, 0, __ATOMIC_ACQUIRE)) return;
+
+    sf2_perf_t *perf = &inst->perf;
+    __atomic_store_n(&perf->blocks, 0, __ATOMIC_RELAXED);
+    for (int i = 0; i < PERF_HIST_BUCKETS; i++) {
+        __atomic_store_n(&perf->hist[i], 0, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < 3; i++) {
+        __atomic_store_n(&perf->over[i], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&perf->total_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&perf->max_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&perf->peak_voices, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&perf->voices_stolen, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&perf->midi_dropped, 0, __ATOMIC_RELAXED);
+}
+
+/* Control thread: where the synth's time goes, as JSON */
+static int profile_json(sf2_instance_t *inst, char *buf, int buf_len) {
+    int shown = __atomic_load_n(&inst->profile_shown, __ATOMIC_ACQUIRE);
+    if (shown < 0) {
+        return snprintf(buf, buf_len, "{\"enabled\":0}");
+    }
+
+    const fluid_synth_profile_t *p = &inst->profile[shown];
+    int written = snprintf(buf, buf_len,
+        "{\"enabled\":1,\"blocks\":%d,\"total_us\":%.2f,\"clear_us\":%.2f,"
+        "\"prepare_us\":%.2f,\"voices_us\":%.2f,"
+        "\"interp_us\":{\"none\":%.2f,\"linear\":%.2f,\"4th\":%.2f,\"7th\":%.2f},"
+        "\"interp_voices\":{\"none\":%.1f,\"linear\":%.1f,\"4th\":%.1f,\"7th\":%.1f},"
+        "\"filter_update_us\":%.2f,\"filter_update_voices\":%.1f,"
+        "\"reverb_us\":%.2f,\"chorus_us\":%.2f}",
+        p->blocks, p->total, p->clear, p->prepare, p->voices,
+        p->interp[0], p->interp[1], p->interp[2], p->interp[3],
+        p->interp_voices[0], p->interp_voices[1], p->interp_voices[2], p->interp_voices[3],
+        p->filter_update, p->filter_update_voices, p->reverb, p->chorus);
+    return written < buf_len ? written : buf_len - 1;
+}
+
+/* Control thread: the render timing as JSON */
+static int perf_stats_json(sf2_instance_t *inst, char *buf, int buf_len) {
+    sf2_perf_t *perf = &inst->perf;
+    unsigned int blocks = __atomic_load_n(&perf->blocks, __ATOMIC_RELAXED);
+    uint64_t total_ns = __atomic_load_n(&perf->total_ns, __ATOMIC_RELAXED);
+    int frames = __atomic_load_n(&inst->block_frames, __ATOMIC_RELAXED);
+    int written;
+
+    written = snprintf(buf, buf_len,
+        "{\"blocks\":%u,\"budget_us\":%.1f,\"mean_us\":%.1f,\"max_us\":%.1f,"
+        "\"over_50\":%u,\"over_80\":%u,\"over_100\":%u,"
+        "\"peak_voices\":%d,\"voices_stolen\":%u,\"midi_dropped\":%u,\"hist_us_log2\":[",
+        blocks,
+        frames > 0 ? frames * 1e6 / host_sample_rate() : 0.0,
+        blocks ? total_ns / 1e3 / blocks : 0.0,
+        __atomic_load_n(&perf->max_ns, __ATOMIC_RELAXED) / 1e3,
+        __atomic_load_n(&perf->over[0], __ATOMIC_RELAXED),
+        __atomic_load_n(&perf->over[1], __ATOMIC_RELAXED),
+        __atomic_load_n(&perf->over[2], __ATOMIC_RELAXED),
+        __atomic_load_n(&perf->peak_voices, __ATOMIC_RELAXED),
+        __atomic_load_n(&perf->voices_stolen, __ATOMIC_RELAXED),
+        __atomic_load_n(&perf->midi_dropped, __ATOMIC_RELAXED));
+    for (int i = 0; i < PERF_HIST_BUCKETS && written < buf_len; i++) {
+        written += snprintf(buf + written, buf_len - written, "%s%u", i ? "," : "",
+                            __atomic_load_n(&perf->hist[i], __ATOMIC_RELAXED));
+    }
+    if (written < buf_len) {
+        written += snprintf(buf + written, buf_len - written, "]}");
+    }
+    return written < buf_len ? written : buf_len - 1;
+}
+
+/* Where a message arriving now plays in the next block: as far into it
+ * as the message came into the block being played, so that a message is
+ * late by one block rather than by however much of a block was left */
+static int midi_arrival_frame(sf2_instance_t *inst) {
+    int frames = __atomic_load_n(&inst->block_frames, __ATOMIC_RELAXED);
+    int64_t start = __atomic_load_n(&inst->block_start_ns, __ATOMIC_RELAXED);
+    if (frames <= 0) return 0;
+
+    int64_t frame = (now_ns() - start) * host_sample_rate() / 1000000000;
+    if (frame < 0) return 0;
+    return frame < frames ? (int)frame : frames - 1;
+}
+
+/* Audio thread: play a message; note-ons start 'delay' frames after the
+ * next frame rendered, if that falls in the next internal block */
+static void play_midi(sf2_instance_t *inst, const uint8_t *msg, int len, int delay) {
     uint8_t status = msg[0] & 0xF0;
     uint8_t channel = msg[0] & 0x0F;
     uint8_t data1 = msg[1];
@@ -490,7 +1663,7 @@ static void v2_on_midi(void *instance, const uint8_t *msg, int len, int source)
     int is_note = (status == 0x90 || status == 0x80);
     int note = data1;
     if (is_note) {
-        note += inst->octave_transpose * 12;
+        note += __atomic_load_n(&inst->octave_transpose, __ATOMIC_RELAXED) * 12;
         if (note < 0) note = 0;
         if (note > 127) note = 127;
     }
@@ -498,7 +1671,7 @@ static void v2_on_midi(void *instance, const uint8_t *msg, int len, int source)
     switch (status) {
         case 0x90:  /* Note on */
             if (data2 > 0) {
-                fluid_synth_noteon(inst->synth, channel, note, data2);
+                fluid_synth_noteon_delayed(inst->synth, channel, note, data2, delay);
             } else {
                 fluid_synth_noteoff(inst->synth, channel, note);
             }
@@ -520,9 +1693,7 @@ static void v2_on_midi(void *instance, const uint8_t *msg, int len, int source)
             }
             break;
         case 0xC0:  /* Program change - map to our preset list */
-            if (data1 < inst->preset_count) {
-                select_preset(inst, data1);
-            }
+            program_change(inst, data1);
             break;
         case 0xD0:  /* Channel pressure (aftertouch) */
             fluid_synth_channel_pressure(inst->synth, channel, data1);
@@ -530,9 +1701,29 @@ static void v2_on_midi(void *instance, const uint8_t *msg, int len, int source)
     }
 }
 
+static void v2_on_midi(void *instance, const uint8_t *msg, int len, int source) {
+    sf2_instance_t *inst = (sf2_instance_t *)instance;
+    if (!inst || len < 2) return;
+    (void)source;
+
+    unsigned int head = inst->midi_head;
+    if (head - __atomic_load_n(&inst->midi_tail, __ATOMIC_ACQUIRE) >= MIDI_QUEUE_SIZE) {
+        /* Full: drop it - only render_block may touch the synth */
+        __atomic_fetch_add(&inst->perf.midi_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    midi_event_t *event = &inst->midi_queue[head & (MIDI_QUEUE_SIZE - 1)];
+    event->len = len < 3 ? len : 3;
+    memcpy(event->msg, msg, event->len);
+    event->frame = inst->midi_timestamps ? midi_arrival_frame(inst) : 0;
+    __atomic_store_n(&inst->midi_head, head + 1, __ATOMIC_RELEASE);
+}
+
 static void v2_set_param(void *instance, const char *key, const char *val) {
     sf2_instance_t *inst = (sf2_instance_t *)instance;
     if (!inst) return;
+    sync_with_audio(inst);
 
     if (strcmp(key, "soundfont_path") == 0) {
         /* Skip if already loaded */
@@ -562,53 +1753,33 @@ static void v2_set_param(void *instance, const char *key, const char *val) {
         if (idx == inst->current_preset) return;
         select_preset(inst, idx);
     } else if (strcmp(key, "octave_transpose") == 0) {
-        inst->octave_transpose = atoi(val);
-        if (inst->octave_transpose < -4) inst->octave_transpose = -4;
-        if (inst->octave_transpose > 4) inst->octave_transpose = 4;
+        set_octave_transpose(inst, atoi(val));
     } else if (strcmp(key, "gain") == 0) {
         inst->gain = atof(val);
         if (inst->gain < 0.0f) inst->gain = 0.0f;
         if (inst->gain > 2.0f) inst->gain = 2.0f;
-        if (inst->synth) {
-            fluid_synth_set_gain(inst->synth, inst->gain);
-        }
+        send_mix(inst);
     } else if (strcmp(key, "reverb_on") == 0) {
         inst->reverb_on = atoi(val) ? 1 : 0;
-        if (inst->synth) {
-            fluid_synth_set_reverb_on(inst->synth, inst->reverb_on);
-        }
+        send_mix(inst);
     } else if (strcmp(key, "chorus_on") == 0) {
         inst->chorus_on = atoi(val) ? 1 : 0;
-        if (inst->synth) {
-            fluid_synth_set_chorus_on(inst->synth, inst->chorus_on);
-        }
+        send_mix(inst);
     } else if (strcmp(key, "reverb_level") == 0) {
         inst->reverb_level = atof(val);
         if (inst->reverb_level < 0.0f) inst->reverb_level = 0.0f;
         if (inst->reverb_level > 1.0f) inst->reverb_level = 1.0f;
-        if (inst->synth) {
-            fluid_synth_set_reverb(inst->synth,
-                fluid_synth_get_reverb_roomsize(inst->synth),
-                fluid_synth_get_reverb_damp(inst->synth),
-                fluid_synth_get_reverb_width(inst->synth),
-                inst->reverb_level);
-        }
+        send_mix(inst);
     } else if (strcmp(key, "chorus_level") == 0) {
         inst->chorus_level = atof(val);
         if (inst->chorus_level < 0.0f) inst->chorus_level = 0.0f;
         if (inst->chorus_level > 10.0f) inst->chorus_level = 10.0f;
-        if (inst->synth) {
-            fluid_synth_set_chorus(inst->synth,
-                fluid_synth_get_chorus_nr(inst->synth),
-                inst->chorus_level,
-                fluid_synth_get_chorus_speed_Hz(inst->synth),
-                fluid_synth_get_chorus_depth_ms(inst->synth),
-                fluid_synth_get_chorus_type(inst->synth));
-        }
+        send_mix(inst);
+    } else if (strcmp(key, "perf_stats_reset") == 0) {
+        __atomic_store_n(&inst->perf_reset, 1, __ATOMIC_RELEASE);
     } else if (strcmp(key, "all_notes_off") == 0 || strcmp(key, "panic") == 0) {
-        if (inst->synth) {
-            fluid_synth_all_notes_off(inst->synth, -1);
-        }
+        inst->unsent |= UNSENT_NOTES_OFF;
+        send_changes(inst);
     } else if (strcmp(key, "state") == 0) {
         /* Restore state from JSON */
         float f;
@@ -631,67 +1802,68 @@ static void v2_set_param(void *instance, const char *key, const char *val) {
             select_preset(inst, (int)f);
         }
         if (json_get_number(val, "octave_transpose", &f) == 0) {
-            inst->octave_transpose = (int)f;
-            if (inst->octave_transpose < -4) inst->octave_transpose = -4;
-            if (inst->octave_transpose > 4) inst->octave_transpose = 4;
+            set_octave_transpose(inst, (int)f);
         }
         if (json_get_number(val, "gain", &f) == 0) {
             inst->gain = f;
             if (inst->gain < 0.0f) inst->gain = 0.0f;
             if (inst->gain > 2.0f) inst->gain = 2.0f;
-            if (inst->synth) {
-                fluid_synth_set_gain(inst->synth, inst->gain);
-            }
         }
         if (json_get_number(val, "reverb_on", &f) == 0) {
             inst->reverb_on = (int)f ? 1 : 0;
-            if (inst->synth) {
-                fluid_synth_set_reverb_on(inst->synth, inst->reverb_on);
-            }
         }
         if (json_get_number(val, "chorus_on", &f) == 0) {
             inst->chorus_on = (int)f ? 1 : 0;
-            if (inst->synth) {
-                fluid_synth_set_chorus_on(inst->synth, inst->chorus_on);
-            }
         }
         if (json_get_number(val, "reverb_level", &f) == 0) {
             inst->reverb_level = f;
             if (inst->reverb_level < 0.0f) inst->reverb_level = 0.0f;
             if (inst->reverb_level > 1.0f) inst->reverb_level = 1.0f;
-            if (inst->synth) {
-                fluid_synth_set_reverb(inst->synth,
-                    fluid_synth_get_reverb_roomsize(inst->synth),
-                    fluid_synth_get_reverb_damp(inst->synth),
-                    fluid_synth_get_reverb_width(inst->synth),
-                    inst->reverb_level);
-            }
         }
         if (json_get_number(val, "chorus_level", &f) == 0) {
             inst->chorus_level = f;
             if (inst->chorus_level < 0.0f) inst->chorus_level = 0.0f;
             if (inst->chorus_level > 10.0f) inst->chorus_level = 10.0f;
-            if (inst->synth) {
-                fluid_synth_set_chorus(inst->synth,
-                    fluid_synth_get_chorus_nr(inst->synth),
-                    inst->chorus_level,
-                    fluid_synth_get_chorus_speed_Hz(inst->synth),
-                    fluid_synth_get_chorus_depth_ms(inst->synth),
-                    fluid_synth_get_chorus_type(inst->synth));
-            }
         }
+        send_mix(inst);
     }
 }
 
+/* The parsed soundfont shown, NULL if none */
+static fluid_sfont_t *current_shared_sfont(sf2_instance_t *inst) {
+    return inst->entry ? inst->entry->sfont : NULL;
+}
+
 static int v2_get_param(void *instance, const char *key, char *buf, int buf_len) {
     sf2_instance_t *inst = (sf2_instance_t *)instance;
     if (!inst) return -1;
+    sync_with_audio(inst);
 
     if (strcmp(key, "load_error") == 0) {
         if (inst->load_error[0]) {
             return snprintf(buf, buf_len, "%s", inst->load_error);
         }
         return 0;  /* No error */
+    } else if (strcmp(key, "loading") == 0) {
+        return snprintf(buf, buf_len, "%d", is_loading(inst));
+    } else if (strcmp(key, "load_progress") == 0) {
+        int progress = 100;
+        if (is_loading(inst)) {
+            progress = __atomic_load_n(&inst->load_progress, __ATOMIC_RELAXED);
+        }
+        return snprintf(buf, buf_len, "%d", progress);
+    } else if (strcmp(key, "sample_resident_bytes") == 0 || strcmp(key, "sample_total_bytes") == 0) {
+        unsigned int resident = 0, total = 0;
+        fluid_defsfont_get_sample_usage(current_shared_sfont(inst), &resident, &total);
+        return snprintf(buf, buf_len, "%u", key[7] == 'r' ? resident : total);
+    } else if (strcmp(key, "perf_stats") == 0) {
+        return perf_stats_json(inst, buf, buf_len);
+    } else if (strcmp(key, "profile") == 0) {
+        return profile_json(inst, buf, buf_len);
+    } else if (strcmp(key, "stream_underruns") == 0) {
+        unsigned int underruns = 0;
+        fluid_defsfont_get_stream_underruns(current_shared_sfont(inst), &underruns);
+        return snprintf(buf, buf_len, "%u", underruns);
     } else if (strcmp(key, "soundfont_name") == 0) {
         strncpy(buf, inst->soundfont_name, buf_len - 1);
         return strlen(buf);
@@ -805,7 +1977,9 @@ static int v2_get_param(void *instance, const char *key, char *buf, int buf_len)
 
 static int v2_get_error(void *instance, char *buf, int buf_len) {
     sf2_instance_t *inst = (sf2_instance_t *)instance;
-    if (!inst || !inst->load_error[0]) return 0;  /* No error */
+    if (!inst) return 0;
+    sync_with_audio(inst);
+    if (!inst->load_error[0]) return 0;  /* No error */
 
     int len = strlen(inst->load_error);
     if (len >= buf_len) len = buf_len - 1;
@@ -814,31 +1988,70 @@ static int v2_get_error(void *instance, char *buf, int buf_len) {
     return len;
 }
 
+/* Render frames of both the synth and a retiring one, if any */
+static void render_frames(sf2_instance_t *inst, int16_t *out_interleaved_lr, int frames) {
+    /* Alone, the synth converts and interleaves its own blocks in one pass */
+    if (!inst->retiring) {
+        fluid_synth_write_s16_interleaved(inst->synth, frames, out_interleaved_lr);
+        return;
+    }
+
+    /* Let the previous soundfont's release tails ring out, mixed in
+     * before the same conversion */
+    fluid_synth_write_s16_interleaved_mix(inst->synth, inst->retiring, frames, out_interleaved_lr);
+
+    inst->retiring_frames += frames;
+    if ((fluid_synth_get_active_voice_count(inst->retiring) == 0 ||
+         inst->retiring_frames >= RETIRE_MAX_SECONDS * host_sample_rate()) &&
+        release_synth(inst, inst->retiring)) {
+        inst->retiring = NULL;
+    }
+}
+
 static void v2_render_block(void *instance, int16_t *out_interleaved_lr, int frames) {
     sf2_instance_t *inst = (sf2_instance_t *)instance;
+    int64_t start = now_ns();
+    if (inst) {
+        perf_take_reset(inst);
+        /* Changes asked for before a new soundfont still go to the old synth */
+        run_commands(inst);
+        adopt_loaded_soundfont(inst);
+    }
     if (!inst || !inst->synth) {
         memset(out_interleaved_lr, 0, frames * 2 * sizeof(int16_t));
         return;
     }
 
-    /* Render to separate left/right float buffers */
-    fluid_synth_write_float(inst->synth, frames,
-                            inst->left_buf, 0, 1,
-                            inst->right_buf, 0, 1);
-
-    /* Interleave and convert to int16 */
-    for (int i = 0; i < frames; i++) {
-        float left = inst->left_buf[i];
-        float right = inst->right_buf[i];
-
-        if (left > 1.0f) left = 1.0f;
-        if (left < -1.0f) left = -1.0f;
-        if (right > 1.0f) right = 1.0f;
-        if (right < -1.0f) right = -1.0f;
-
-        out_interleaved_lr[i * 2] = (int16_t)(left * 32767.0f);
-        out_interleaved_lr[i * 2 + 1] = (int16_t)(right * 32767.0f);
+    if (inst->midi_timestamps) {
+        __atomic_store_n(&inst->block_start_ns, start, __ATOMIC_RELAXED);
     }
+    __atomic_store_n(&inst->block_frames, frames, __ATOMIC_RELAXED);
+
+    /* Play the messages that came before this block ahead of the internal
+     * block their frame falls in; the note-ons among them start on that
+     * frame. Frames after the last message are rendered in one go. */
+    unsigned int head = __atomic_load_n(&inst->midi_head, __ATOMIC_ACQUIRE);
+    unsigned int tail = inst->midi_tail;
+    int block = fluid_synth_get_internal_bufsize(inst->synth);
+    int n;
+
+    for (int pos = 0; pos < frames; pos += n) {
+        n = (frames - pos < block) ? frames - pos : block;
+        while (tail != head) {
+            midi_event_t *event = &inst->midi_queue[tail & (MIDI_QUEUE_SIZE - 1)];
+            if (event->frame >= pos + n) break;
+            play_midi(inst, event->msg, event->len, event->frame > pos ? event->frame - pos : 0);
+            tail++;
+        }
+        __atomic_store_n(&inst->midi_tail, tail, __ATOMIC_RELEASE);
+        if (tail == head) {
+            n = frames - pos;
+        }
+        perf_voices(inst);
+        render_frames(inst, out_interleaved_lr + 2 * pos, n);
+    }
+
+    perf_block(inst, frames, now_ns() - start);
 }
 
 /* V2 API struct */
@@ -856,6 +2069,11 @@ static plugin_api_v2_t g_plugin_api_v2 = {
 /* V2 Entry Point */
 plugin_api_v2_t* move_plugin_init_v2(const host_api_v1_t *host) {
     g_host = host;
+
+    /* Play samples straight from the page cache; shared between instances
+     * and prefaulted at load so rendering never waits on the disk. */
+    fluid_set_sample_mmap(FLUID_SAMPLE_MMAP_PREFAULT);
+
     plugin_log("V2 API initialized (FluidLite)");
     return &g_plugin_api_v2;
 }
@@ -19,10 +19,13 @@ LOCAL_SRC_FILES := \
 	src/fluid_ramsfont.c \
 	src/fluid_rev.c \
 	src/fluid_settings.c \
+	src/fluid_sf2c.c \
+	src/fluid_stream.c \
 	src/fluid_synth.c \
 	src/fluid_sys.c \
 	src/fluid_tuning.c \
-	src/fluid_voice.c
+	src/fluid_voice.c \
+	src/fluid_workers.c
 
 include $(BUILD_SHARED_LIBRARY)
 
@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "fluidlite.h"
+
+/*
+ * Renders the same few seconds of notes with each internal block size,
+ * the way a host with a fixed period calls the synth, and prints the
+ * time per period against the control rate: how long an envelope, LFO
+ * or note event waits for the next block, and how far the level of the
+ * output strays from that of the smallest block size.
+ */
+
+#define DEFAULT_RUNS 5
+#define SAMPLE_RATE 44100
+#define PERIOD 128
+#define SECONDS 8
+#define PERIODS (SECONDS * SAMPLE_RATE / PERIOD)
+#define WINDOW 256
+#define SILENCE 1e-8		/* -80 dB, per point */
+
+static const int block_sizes[] = { 32, 64, 128, 256 };
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+/* the notes of period p: a few chords, a held pad and fast repeats */
+static void play(fluid_synth_t* synth, int p) {
+  int chan, key;
+
+  if (p % 172 == 0) {
+    for (chan = 0; chan < 8; chan++) {
+      for (key = 0; key < 4; key++) {
+        fluid_synth_noteoff(synth, chan, 48 + ((p / 172 + chan) % 12) + 7 * key);
+        fluid_synth_noteon(synth, chan, 48 + ((p / 172 + chan + 1) % 12) + 7 * key, 90);
+      }
+    }
+  }
+  if (p % 23 == 0) {
+    fluid_synth_noteon(synth, 9, 36 + (p / 23) % 10, 110);
+    fluid_synth_noteon(synth, 10, 60 + (p / 23) % 24, 100);
+  }
+  if (p % 23 == 11) {
+    fluid_synth_noteoff(synth, 10, 60 + (p / 23) % 24);
+  }
+  if (p % 5 == 0) {
+    fluid_synth_pitch_bend(synth, 11, 8192 + (int) (4000.0 * sin(p / 40.0)));
+    fluid_synth_cc(synth, 12, 74, 64 + (int) (63.0 * sin(p / 60.0)));
+  }
+}
+
+/* renders the notes with one block size into 'out' if not NULL, and
+   returns the time of one period in microseconds */
+static double render(const char* font, int block_size, float* out) {
+  fluid_settings_t* settings;
+  fluid_synth_t* synth;
+  float left[PERIOD], right[PERIOD];
+  double start, t = 0.0;
+  int chan, p, i;
+
+  settings = new_fluid_settings();
+  fluid_settings_setnum(settings, "synth.sample-rate", SAMPLE_RATE);
+  fluid_settings_setint(settings, "synth.polyphony", 256);
+  fluid_settings_setint(settings, "synth.block-size", block_size);
+  synth = new_fluid_synth(settings);
+  if (fluid_synth_sfload(synth, font, 1) < 0) {
+    delete_fluid_synth(synth);
+    delete_fluid_settings(settings);
+    return -1.0;
+  }
+  for (chan = 0; chan < 16; chan++) {
+    fluid_synth_program_change(synth, chan, (chan * 11) % 128);
+  }
+  fluid_synth_noteon(synth, 11, 64, 80);
+  fluid_synth_noteon(synth, 12, 52, 80);
+
+  for (p = 0; p < PERIODS; p++) {
+    play(synth, p);
+    start = now_us();
+    fluid_synth_write_float(synth, PERIOD, left, 0, 1, right, 0, 1);
+    t += now_us() - start;
+    if (out != NULL) {
+      for (i = 0; i < PERIOD; i++) {
+        out[2 * (p * PERIOD + i)] = left[i];
+        out[2 * (p * PERIOD + i) + 1] = right[i];
+      }
+    }
+  }
+
+  delete_fluid_synth(synth);
+  delete_fluid_settings(settings);
+  return t / PERIODS;
+}
+
+/* How far the level of a render strays from the level of another, in
+ * dB on average over windows of WINDOW frames. Levels rather than
+ * samples: a vibrato a block late shifts the phase of everything after
+ * it without changing how it sounds. */
+static double drift(const float* ref, const float* out) {
+  double sum = 0.0, e_ref, e_out;
+  long i, k, windows = 0;
+
+  for (i = 0; i + 2 * WINDOW <= 2L * PERIODS * PERIOD; i += 2 * WINDOW) {
+    e_ref = e_out = 0.0;
+    for (k = i; k < i + 2 * WINDOW; k++) {
+      e_ref += (double) ref[k] * ref[k];
+      e_out += (double) out[k] * out[k];
+    }
+    /* silence says nothing about the envelopes */
+    if (e_ref < SILENCE * 2 * WINDOW) continue;
+    sum += fabs(10.0 * log10((e_out + 1e-30) / e_ref));
+    windows++;
+  }
+  return windows ? sum / windows : 0.0;
+}
+
+int main(int argc, char *argv[]) {
+  int count = (int) (sizeof(block_sizes) / sizeof(block_sizes[0]));
+  int runs = DEFAULT_RUNS;
+  double best[sizeof(block_sizes) / sizeof(block_sizes[0])];
+  float* out[sizeof(block_sizes) / sizeof(block_sizes[0])];
+  double base = 0.0;
+  int i, j;
+
+  if (argc < 2) {
+    printf("Usage: %s <soundfont> [-n <runs>]\n", argv[0]);
+    return 1;
+  }
+  if (argc > 3 && argv[2][0] == '-' && argv[2][1] == 'n') runs = atoi(argv[3]);
+  if (runs < 1) runs = 1;
+
+  for (i = 0; i < count; i++) {
+    out[i] = malloc(2L * PERIODS * PERIOD * sizeof(float));
+    if (out[i] == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+    best[i] = 0.0;
+  }
+
+  /* the sizes take turns so that all of them see the same cache state */
+  for (j = 0; j < runs; j++) {
+    for (i = 0; i < count; i++) {
+      double t = render(argv[1], block_sizes[i], (j == 0) ? out[i] : NULL);
+      if (t < 0.0) {
+        fprintf(stderr, "%s: failed to load\n", argv[1]);
+        return 1;
+      }
+      if (best[i] == 0.0 || t < best[i]) best[i] = t;
+    }
+  }
+  for (i = 0; i < count; i++) {
+    if (block_sizes[i] == 64) base = best[i];
+  }
+
+  printf("%d frames per period at %d Hz\n", PERIOD, SAMPLE_RATE);
+  printf("%8s %10s %12s %10s %14s\n", "block", "control", "per period", "vs 64", "level vs 32");
+  for (i = 0; i < count; i++) {
+    printf("%8d %8.2fms %10.2fus %9.2fx ", block_sizes[i],
+           1000.0 * block_sizes[i] / SAMPLE_RATE, best[i],
+           best[i] > 0.0 ? base / best[i] : 0.0);
+    if (i == 0) printf("%14s\n", "-");
+    else printf("%12.2fdB\n", drift(out[0], out[i]));
+  }
+
+  for (i = 0; i < count; i++) {
+    free(out[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "fluidlite.h"
+
+/*
+ * Times the rendering of 16, 64 and 128 voices with their filters run
+ * one voice at a time and 4 voices at a time. The notes are held on
+ * every channel and restarted before each run, so that each run
+ * renders the same voices from the same state.
+ */
+
+#define DEFAULT_RUNS 10
+#define BLOCKS 200
+#define BLOCK_SIZE 64
+
+static const int voice_counts[] = { 16, 64, 128 };
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+/* starts notes until 'voices' voices play, returns the number playing */
+static int start_voices(fluid_synth_t* synth, int voices) {
+  int chan, n;
+
+  for (chan = 0; chan < 16; chan++) {
+    fluid_synth_cc(synth, chan, 120, 0);
+    fluid_synth_cc(synth, chan, 64, 127);
+  }
+  for (n = 0; fluid_synth_get_active_voice_count(synth) < voices && n < 16 * 60; n++) {
+    fluid_synth_noteon(synth, n % 16, 36 + (n / 16) % 60, 100);
+  }
+  return fluid_synth_get_active_voice_count(synth);
+}
+
+/* the time of one block, in microseconds */
+static double run_once(fluid_synth_t* synth, int voices, int lanes) {
+  float left[BLOCK_SIZE], right[BLOCK_SIZE];
+  double start;
+  int i;
+
+  fluid_set_filter_lanes(lanes);
+  start_voices(synth, voices);
+  start = now_us();
+  for (i = 0; i < BLOCKS; i++) {
+    fluid_synth_write_float(synth, BLOCK_SIZE, left, 0, 1, right, 0, 1);
+  }
+  return (now_us() - start) / BLOCKS;
+}
+
+int main(int argc, char *argv[]) {
+  fluid_settings_t* settings;
+  fluid_synth_t* synth;
+  int runs = DEFAULT_RUNS;
+  int i, j, chan, playing;
+
+  if (argc < 2) {
+    printf("Usage: %s <soundfont> [-n <runs>]\n", argv[0]);
+    return 1;
+  }
+  if (argc > 3 && argv[2][0] == '-' && argv[2][1] == 'n') runs = atoi(argv[3]);
+  if (runs < 1) runs = 1;
+
+  settings = new_fluid_settings();
+  fluid_settings_setint(settings, "synth.polyphony", 256);
+  synth = new_fluid_synth(settings);
+  if (fluid_synth_sfload(synth, argv[1], 1) < 0) {
+    fprintf(stderr, "%s: failed to load\n", argv[1]);
+    delete_fluid_synth(synth);
+    delete_fluid_settings(settings);
+    return 1;
+  }
+  for (chan = 0; chan < 16; chan++) {
+    fluid_synth_program_change(synth, chan, (chan * 5) % 128);
+  }
+
+  printf("%8s %8s %12s %12s %10s\n", "voices", "playing", "1 at a time", "4 at a time", "speedup");
+  for (i = 0; i < (int) (sizeof(voice_counts) / sizeof(voice_counts[0])); i++) {
+    double best[2] = { 0.0, 0.0 };
+
+    playing = start_voices(synth, voice_counts[i]);
+    /* the two paths take turns so that both see the same cache state */
+    for (j = 0; j < 2 * runs; j++) {
+      int lanes = (j + j / 2) & 1;
+      double t = run_once(synth, voice_counts[i], lanes);
+      if (best[lanes] == 0.0 || t < best[lanes]) best[lanes] = t;
+    }
+    printf("%8d %8d %10.2fus %10.2fus %9.2fx\n", voice_counts[i], playing,
+           best[0], best[1], best[1] > 0.0 ? best[0] / best[1] : 0.0);
+  }
+
+  fluid_set_filter_lanes(1);
+  delete_fluid_synth(synth);
+  delete_fluid_settings(settings);
+  return 0;
+}
@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "fluidsynth_priv.h"
+#include "fluid_synth.h"
+#include "fluid_voice.h"
+#include "fluid_rev.h"
+#include "fluid_chorus.h"
+
+/*
+ * Times the DSP kernels of the synth one at a time, away from the rest
+ * of it: the four interpolations at several pitches, the filter and mix
+ * of a voice with its filter held and fading, the reverb, the chorus
+ * with several delay lines, and the conversion of a block to 16 bit.
+ * Each runs warm, block after block on the same state, and cold, after
+ * the caches were flushed by reading through a large buffer.
+ *
+ * Prints nanoseconds per point and millions of points per second; with
+ * -j one JSON object per kernel, for comparing runs across commits:
+ *
+ *   kernel_bench -j > before.json
+ */
+
+#define DEFAULT_RUNS 5
+#define SAMPLE_RATE 44100
+#define BLOCK FLUID_BUFSIZE
+#define HOST_BLOCK 128		/* frames the plugin converts per call */
+#define WARM_CALLS 4096		/* blocks per warm run */
+#define COLD_CALLS 64		/* blocks timed one at a time, each cold */
+#define DEFAULT_FLUSH_MB 32
+#define SAMPLE_POINTS 65536
+
+static const double phase_incrs[] = { 0.5, 1.0, 1.5, 2.9 };
+static const int chorus_nrs[] = { 1, 3, 8, 32 };
+
+typedef struct {
+  const char* kernel;
+  char variant[32];
+  int points;			/* points per call */
+  void (*run)(void* state);
+  void* state;
+} bench_t;
+
+typedef struct {
+  fluid_voice_t voice;
+  fluid_gen_t gen[GEN_LAST];
+  int (*interpolate)(fluid_voice_t* voice);
+  int ramp;			/* restart the filter fade at every block */
+} voice_state_t;
+
+static short int sample[SAMPLE_POINTS];
+static fluid_real_t dsp_buf[FLUID_MAX_BUFSIZE];
+static fluid_real_t left[HOST_BLOCK], right[HOST_BLOCK];
+static fluid_real_t reverb_send[BLOCK], chorus_send[BLOCK];
+static short int out_s16[2 * HOST_BLOCK];
+
+static unsigned char* flush_buf;
+static size_t flush_size;
+static volatile unsigned int flush_sink;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* reads a buffer larger than the caches, so that what the next kernel
+   touches comes from memory */
+static void flush_caches(void) {
+  unsigned int sum = 0;
+  size_t i;
+
+  for (i = 0; i < flush_size; i += 64) {
+    sum += flush_buf[i];
+  }
+  flush_sink += sum;
+}
+
+/* a voice looping through the whole sample at a fixed pitch, at
+   sustain level, with a low-pass filter held or fading */
+static void init_voice(voice_state_t* s, double phase_incr) {
+  fluid_voice_t* v = &s->voice;
+
+  memset(s, 0, sizeof(*s));
+  v->gen = s->gen;
+  s->gen[GEN_SAMPLEMODE].val = FLUID_LOOP_DURING_RELEASE;
+  v->volenv_section = FLUID_VOICE_ENVSUSTAIN;
+  v->block_size = BLOCK;
+  v->dsp_buf = dsp_buf;
+  v->dsp_data = sample;
+  v->start = 0;
+  v->end = SAMPLE_POINTS - 1;
+  v->loopstart = 16;
+  v->loopend = SAMPLE_POINTS - 16;
+  fluid_phase_set_int(v->phase, 16);
+  v->phase_incr = (fluid_real_t) phase_incr;
+  v->amp = 0.5f;
+
+  /* a pole pair at 0.9: a stable low-pass with unity gain at DC */
+  v->a1 = -1.8f;
+  v->a2 = 0.81f;
+  v->b02 = (1.0f + v->a1 + v->a2) / 4.0f;
+  v->b1 = 2.0f * v->b02;
+  v->pan = 200.0f;
+  v->amp_left = 0.3f;
+  v->amp_right = 0.6f;
+  v->amp_reverb = 0.2f;
+  v->amp_chorus = 0.1f;
+}
+
+static void run_interpolate(void* state) {
+  voice_state_t* s = state;
+  s->interpolate(&s->voice);
+}
+
+static void run_effects(void* state) {
+  voice_state_t* s = state;
+  fluid_voice_t* v = &s->voice;
+
+  if (s->ramp) {
+    /* the fade the synth sets up when the filter changes: the whole block */
+    v->a1 = -1.8f;
+    v->a2 = 0.81f;
+    v->a1_incr = 1e-4f;
+    v->a2_incr = -1e-4f;
+    v->b02_incr = 1e-6f;
+    v->b1_incr = 2e-6f;
+    v->filter_coeff_incr_count = BLOCK;
+  }
+  fluid_voice_finish(v, BLOCK, 0, left, right, reverb_send, chorus_send);
+}
+
+static void run_reverb(void* state) {
+  fluid_revmodel_processmix(state, reverb_send, left, right, BLOCK);
+}
+
+static void run_chorus(void* state) {
+  fluid_chorus_processmix(state, chorus_send, left, right, BLOCK);
+}
+
+static void run_s16(void* state) {
+  (void) state;
+  fluid_dsp_float_write_s16(left, right, out_s16, HOST_BLOCK);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return (x < y) ? -1 : (x > y);
+}
+
+/* the best of 'runs' warm runs, in ns per point */
+static double time_warm(bench_t* b, int runs) {
+  double best = 0.0, t;
+  int r, i;
+
+  for (i = 0; i < WARM_CALLS / 16; i++) b->run(b->state);
+  for (r = 0; r < runs; r++) {
+    t = now_ns();
+    for (i = 0; i < WARM_CALLS; i++) b->run(b->state);
+    t = (now_ns() - t) / ((double) WARM_CALLS * b->points);
+    if (r == 0 || t < best) best = t;
+  }
+  return best;
+}
+
+/* the median of blocks run one at a time after a flush, in ns per point;
+   the clock is read around each block, which adds its own few tens of
+   nanoseconds to it */
+static double time_cold(bench_t* b) {
+  double times[COLD_CALLS], t;
+  int i;
+
+  for (i = 0; i < COLD_CALLS; i++) {
+    flush_caches();
+    t = now_ns();
+    b->run(b->state);
+    times[i] = (now_ns() - t) / b->points;
+  }
+  qsort(times, COLD_CALLS, sizeof(double), compare_doubles);
+  return times[COLD_CALLS / 2];
+}
+
+int main(int argc, char *argv[]) {
+  static const char* interp_names[] = { "interp_none", "interp_linear", "interp_4th", "interp_7th" };
+  int (*interps[])(fluid_voice_t*) = {
+    fluid_dsp_float_interpolate_none, fluid_dsp_float_interpolate_linear,
+    fluid_dsp_float_interpolate_4th_order, fluid_dsp_float_interpolate_7th_order
+  };
+  int n_incrs = (int) (sizeof(phase_incrs) / sizeof(phase_incrs[0]));
+  int n_nrs = (int) (sizeof(chorus_nrs) / sizeof(chorus_nrs[0]));
+  int n_benches = 4 * n_incrs + 2 + 1 + n_nrs + 1;
+  voice_state_t* voices;
+  fluid_revmodel_t* reverb;
+  fluid_chorus_t* chorus[sizeof(chorus_nrs) / sizeof(chorus_nrs[0])];
+  bench_t* benches;
+  double warm, cold;
+  int runs = DEFAULT_RUNS, flush_mb = DEFAULT_FLUSH_MB, json = 0;
+  int i, j, n = 0;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) flush_mb = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-j") == 0) json = 1;
+    else {
+      printf("Usage: %s [-n <runs>] [-c <cache flush MB>] [-j]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (runs < 1) runs = 1;
+  if (flush_mb < 1) flush_mb = 1;
+
+  flush_size = (size_t) flush_mb << 20;
+  flush_buf = malloc(flush_size);
+  voices = calloc(4 * n_incrs + 2, sizeof(voice_state_t));
+  benches = calloc(n_benches, sizeof(bench_t));
+  if (flush_buf == NULL || voices == NULL || benches == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  memset(flush_buf, 1, flush_size);
+
+  /* a tone with some noise on it, so no two blocks are alike */
+  srand(1);
+  for (i = 0; i < SAMPLE_POINTS; i++) {
+    sample[i] = (short int) (12000.0 * sin(i * 0.031) + (rand() % 2001) - 1000);
+  }
+  for (i = 0; i < FLUID_MAX_BUFSIZE; i++) {
+    dsp_buf[i] = sample[i] / 32768.0f;
+  }
+  for (i = 0; i < BLOCK; i++) {
+    reverb_send[i] = chorus_send[i] = sample[7 * i] / 32768.0f;
+  }
+  for (i = 0; i < HOST_BLOCK; i++) {
+    left[i] = sample[3 * i] / 20000.0f;		/* some points out of range */
+    right[i] = sample[5 * i] / 20000.0f;
+  }
+
+  fluid_dsp_float_config();
+
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < n_incrs; j++) {
+      voice_state_t* s = &voices[n];
+      init_voice(s, phase_incrs[j]);
+      s->interpolate = interps[i];
+      benches[n].kernel = interp_names[i];
+      sprintf(benches[n].variant, "incr=%.2f", phase_incrs[j]);
+      benches[n].points = BLOCK;
+      benches[n].run = run_interpolate;
+      benches[n].state = s;
+      n++;
+    }
+  }
+
+  for (i = 0; i < 2; i++) {
+    voice_state_t* s = &voices[n];
+    init_voice(s, 1.0);
+    s->ramp = i;
+    benches[n].kernel = "voice_effects";
+    strcpy(benches[n].variant, i ? "ramp" : "steady");
+    benches[n].points = BLOCK;
+    benches[n].run = run_effects;
+    benches[n].state = s;
+    n++;
+  }
+
+  reverb = new_fluid_revmodel();
+  fluid_revmodel_setroomsize(reverb, FLUID_REVERB_DEFAULT_ROOMSIZE);
+  fluid_revmodel_setdamp(reverb, FLUID_REVERB_DEFAULT_DAMP);
+  fluid_revmodel_setwidth(reverb, FLUID_REVERB_DEFAULT_WIDTH);
+  fluid_revmodel_setlevel(reverb, FLUID_REVERB_DEFAULT_LEVEL);
+  benches[n].kernel = "reverb";
+  strcpy(benches[n].variant, "default");
+  benches[n].points = BLOCK;
+  benches[n].run = run_reverb;
+  benches[n].state = reverb;
+  n++;
+
+  for (i = 0; i < n_nrs; i++) {
+    chorus[i] = new_fluid_chorus(SAMPLE_RATE);
+    fluid_chorus_set(chorus[i], FLUID_CHORUS_SET_ALL, chorus_nrs[i], FLUID_CHORUS_DEFAULT_LEVEL,
+                     FLUID_CHORUS_DEFAULT_SPEED, FLUID_CHORUS_DEFAULT_DEPTH, FLUID_CHORUS_DEFAULT_TYPE);
+    benches[n].kernel = "chorus";
+    sprintf(benches[n].variant, "nr=%d", chorus_nrs[i]);
+    benches[n].points = BLOCK;
+    benches[n].run = run_chorus;
+    benches[n].state = chorus[i];
+    n++;
+  }
+
+  benches[n].kernel = "write_s16";
+  sprintf(benches[n].variant, "frames=%d", HOST_BLOCK);
+  benches[n].points = HOST_BLOCK;
+  benches[n].run = run_s16;
+  benches[n].state = NULL;
+  n++;
+
+  if (!json) {
+    printf("%d points per block, best of %d warm runs, cold after reading %d MB\n",
+           BLOCK, runs, flush_mb);
+    printf("%-14s %-11s %12s %10s %12s %10s\n", "kernel", "variant",
+           "warm ns/pt", "Mpt/s", "cold ns/pt", "Mpt/s");
+  }
+  for (i = 0; i < n; i++) {
+    warm = time_warm(&benches[i], runs);
+    cold = time_cold(&benches[i]);
+    if (json) {
+      printf("{\"kernel\":\"%s\",\"variant\":\"%s\",\"points\":%d,"
+             "\"warm_ns_per_point\":%.3f,\"warm_mpoints_per_s\":%.1f,"
+             "\"cold_ns_per_point\":%.3f,\"cold_mpoints_per_s\":%.1f}\n",
+             benches[i].kernel, benches[i].variant, benches[i].points,
+             warm, 1e3 / warm, cold, 1e3 / cold);
+    } else {
+      printf("%-14s %-11s %12.3f %10.1f %12.3f %10.1f\n", benches[i].kernel,
+             benches[i].variant, warm, 1e3 / warm, cold, 1e3 / cold);
+    }
+  }
+
+  delete_fluid_revmodel(reverb);
+  for (i = 0; i < n_nrs; i++) {
+    delete_fluid_chorus(chorus[i]);
+  }
+  free(benches);
+  free(voices);
+  free(flush_buf);
+  return 0;
+}
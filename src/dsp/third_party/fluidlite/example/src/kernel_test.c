@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "fluidsynth_priv.h"
+#include "fluid_synth.h"
+#include "fluid_voice.h"
+
+/*
+ * Checks that every interpolation kernel this build and CPU have plays
+ * the same points as the scalar loops: each interpolation order at
+ * several pitches, for a voice looping over a short loop and for one
+ * running off the end of its sample, with the amplitude ramping. The
+ * points written, the phase and whether the voice has looped must match
+ * exactly, the values within TOLERANCE of full scale. Exits with 1 on any
+ * mismatch. Kernels not available are listed as skipped.
+ */
+
+#define BLOCK FLUID_BUFSIZE
+#define BLOCKS 64
+#define SAMPLE_POINTS 1024
+#define LOOP_START 40
+#define LOOP_END 700
+#define TOLERANCE 1e-5		/* of 32768, the largest value a point can have */
+
+static const double phase_incrs[] = { 0.25, 0.5, 1.0, 1.37, 2.9, 7.3 };
+
+static short int sample[SAMPLE_POINTS];
+
+typedef struct {
+  fluid_voice_t voice;
+  fluid_gen_t gen[GEN_LAST];
+  fluid_real_t buf[FLUID_MAX_BUFSIZE];
+} voice_state_t;
+
+/* what a run of BLOCKS blocks played */
+typedef struct {
+  fluid_real_t points[BLOCKS][BLOCK];
+  int count[BLOCKS];
+  fluid_phase_t phase[BLOCKS];
+  int has_looped;
+} result_t;
+
+static void init_voice(voice_state_t* s, double phase_incr, int looping) {
+  fluid_voice_t* v = &s->voice;
+
+  memset(s, 0, sizeof(*s));
+  v->gen = s->gen;
+  s->gen[GEN_SAMPLEMODE].val = looping ? FLUID_LOOP_DURING_RELEASE : FLUID_UNLOOPED;
+  v->volenv_section = FLUID_VOICE_ENVSUSTAIN;
+  v->block_size = BLOCK;
+  v->dsp_buf = s->buf;
+  v->dsp_data = sample;
+  v->start = 0;
+  v->end = SAMPLE_POINTS - 1;
+  v->loopstart = LOOP_START;
+  v->loopend = LOOP_END;
+  /* off the grid, and unlooped voices close enough to the end to reach it */
+  fluid_phase_set_float(v->phase, looping ? 3.3 : SAMPLE_POINTS - 8 * BLOCK * phase_incr);
+  v->phase_incr = (fluid_real_t) phase_incr;
+  v->amp = 0.25f;
+  v->amp_incr = 1e-4f;
+}
+
+static void run(int (*interpolate)(fluid_voice_t*), double phase_incr, int looping,
+                result_t* r) {
+  voice_state_t s;
+  int b;
+
+  init_voice(&s, phase_incr, looping);
+  memset(r, 0, sizeof(*r));
+  for (b = 0; b < BLOCKS; b++) {
+    r->count[b] = interpolate(&s.voice);
+    memcpy(r->points[b], s.buf, r->count[b] * sizeof(fluid_real_t));
+    r->phase[b] = s.voice.phase;
+    if (r->count[b] < BLOCK) break;
+  }
+  r->has_looped = s.voice.has_looped;
+}
+
+/* the largest difference of the values, -1 if anything else differs */
+static double compare(const result_t* a, const result_t* b) {
+  double diff = 0.0, d;
+  int i, k;
+
+  if (a->has_looped != b->has_looped) return -1.0;
+  for (i = 0; i < BLOCKS; i++) {
+    if ((a->count[i] != b->count[i]) || (a->phase[i] != b->phase[i])) return -1.0;
+    for (k = 0; k < a->count[i]; k++) {
+      d = fabs((double) a->points[i][k] - (double) b->points[i][k]);
+      if (d > diff) diff = d;
+    }
+    if (a->count[i] < BLOCK) break;
+  }
+  return diff;
+}
+
+int main(int argc, char *argv[]) {
+  static const char* kernel_names[] = { "sse2", "avx2", "neon" };
+  static const int kernels[] = {
+    FLUID_INTERP_KERNEL_SSE2, FLUID_INTERP_KERNEL_AVX2, FLUID_INTERP_KERNEL_NEON
+  };
+  static const char* interp_names[] = { "none", "linear", "4th", "7th" };
+  int (*interps[])(fluid_voice_t*) = {
+    fluid_dsp_float_interpolate_none, fluid_dsp_float_interpolate_linear,
+    fluid_dsp_float_interpolate_4th_order, fluid_dsp_float_interpolate_7th_order
+  };
+  int n_incrs = (int) (sizeof(phase_incrs) / sizeof(phase_incrs[0]));
+  result_t *want, *got;
+  double diff, worst;
+  int k, i, j, looping, tested = 0, failed = 0;
+
+  (void) argv;
+  if (argc > 1) {
+    printf("Usage: %s\n", argv[0]);
+    return 1;
+  }
+
+  want = malloc(sizeof(result_t));
+  got = malloc(sizeof(result_t));
+  if (want == NULL || got == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  /* a tone with some noise on it, up to full scale */
+  srand(1);
+  for (i = 0; i < SAMPLE_POINTS; i++) {
+    sample[i] = (short int) (30000.0 * sin(i * 0.093) + (rand() % 2001) - 1000);
+  }
+
+  fluid_dsp_float_config();
+
+  printf("%8s %8s %8s %10s %12s\n", "kernel", "interp", "incr", "loop", "max diff");
+  for (k = 0; k < (int) (sizeof(kernels) / sizeof(kernels[0])); k++) {
+    if (fluid_set_interp_kernel(kernels[k]) != kernels[k]) {
+      printf("%8s %8s\n", kernel_names[k], "skipped");
+      continue;
+    }
+    tested++;
+    worst = 0.0;
+    for (i = 0; i < 4; i++) {
+      for (j = 0; j < n_incrs; j++) {
+        for (looping = 0; looping < 2; looping++) {
+          fluid_set_interp_kernel(FLUID_INTERP_KERNEL_SCALAR);
+          run(interps[i], phase_incrs[j], looping, want);
+          fluid_set_interp_kernel(kernels[k]);
+          run(interps[i], phase_incrs[j], looping, got);
+
+          diff = compare(want, got);
+          if (diff < 0.0) {
+            failed = 1;
+            printf("%8s %8s %8.2f %10s %12s\n", kernel_names[k], interp_names[i],
+                   phase_incrs[j], looping ? "yes" : "no", "FAILED");
+          } else if (diff > TOLERANCE * 32768.0) {
+            failed = 1;
+            printf("%8s %8s %8.2f %10s %12g\n", kernel_names[k], interp_names[i],
+                   phase_incrs[j], looping ? "yes" : "no", diff);
+          } else if (diff > worst) {
+            worst = diff;
+          }
+        }
+      }
+    }
+    printf("%8s %8s %8s %10s %12g\n", kernel_names[k], "all", "all", "both", worst);
+  }
+  fluid_set_interp_kernel(FLUID_INTERP_KERNEL_AUTO);
+
+  if (tested == 0) {
+    printf("no vector kernel in this build\n");
+  }
+  printf("%s\n", failed ? "FAILED" : "OK");
+
+  free(want);
+  free(got);
+  return failed;
+}
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "fluidlite.h"
+
+/*
+ * Times SoundFont loads with the preset, instrument and sample headers
+ * read field by field and read in one buffer. Sample data is mapped
+ * rather than copied so that the header parsing dominates.
+ */
+
+#define DEFAULT_RUNS 20
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int count_presets(fluid_synth_t* synth, int id) {
+  fluid_sfont_t* sfont = fluid_synth_get_sfont_by_id(synth, id);
+  fluid_preset_t preset;
+  int count = 0;
+
+  if (sfont == NULL) return -1;
+  sfont->iteration_start(sfont);
+  while (sfont->iteration_next(sfont, &preset)) count++;
+  return count;
+}
+
+typedef struct {
+  double best;
+  double total;
+  int presets;
+} result_t;
+
+static int load_once(fluid_synth_t* synth, const char* path, int buffered, result_t* result) {
+  double start, elapsed;
+  int id;
+
+  fluid_set_sfload_buffered(buffered);
+  start = now_ms();
+  id = fluid_synth_sfload(synth, path, 0);
+  elapsed = now_ms() - start;
+  if (id < 0) return -1;
+
+  result->presets = count_presets(synth, id);
+  fluid_synth_sfunload(synth, id, 0);
+  if (result->best == 0.0 || elapsed < result->best) result->best = elapsed;
+  result->total += elapsed;
+  return 0;
+}
+
+/* the two parsers take turns so that both see the same heap and cache state */
+static int bench(fluid_synth_t* synth, const char* path, int runs,
+                 result_t* field, result_t* buffered) {
+  result_t warmup = { 0.0, 0.0, 0 };
+  int i;
+
+  /* the first load warms the page cache and is not counted */
+  if (load_once(synth, path, 1, &warmup) != 0) return -1;
+  for (i = 0; i < runs; i++) {
+    if (load_once(synth, path, i & 1, (i & 1) ? buffered : field) != 0
+        || load_once(synth, path, !(i & 1), (i & 1) ? field : buffered) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  fluid_settings_t* settings;
+  fluid_synth_t* synth;
+  int runs = DEFAULT_RUNS;
+  int i, ret = 0;
+
+  if (argc < 2) {
+    printf("Usage: %s <soundfont>... [-n <runs>]\n", argv[0]);
+    return 1;
+  }
+  for (i = 1; i < argc - 1; i++) {
+    if (argv[i][0] == '-' && argv[i][1] == 'n') runs = atoi(argv[i + 1]);
+  }
+  if (runs < 1) runs = 1;
+
+  fluid_set_sample_mmap(FLUID_SAMPLE_MMAP_ON);
+  settings = new_fluid_settings();
+  synth = new_fluid_synth(settings);
+
+  printf("%-40s %8s %10s %10s %10s\n", "soundfont", "presets", "per-field", "buffered", "speedup");
+  for (i = 1; i < argc; i++) {
+    result_t field = { 0.0, 0.0, 0 };
+    result_t buffered = { 0.0, 0.0, 0 };
+
+    if (argv[i][0] == '-' && argv[i][1] == 'n') {
+      i++;
+      continue;
+    }
+    if (bench(synth, argv[i], runs, &field, &buffered) != 0) {
+      fprintf(stderr, "%s: failed to load\n", argv[i]);
+      ret = 1;
+      continue;
+    }
+    if (field.presets != buffered.presets) {
+      fprintf(stderr, "%s: %d presets per field, %d buffered\n", argv[i], field.presets, buffered.presets);
+      ret = 1;
+    }
+    printf("%-40s %8d %8.2fms %8.2fms %9.2fx\n", argv[i], buffered.presets,
+           field.best, buffered.best, buffered.best > 0.0 ? field.best / buffered.best : 0.0);
+    printf("%-40s %8s %8.2fms %8.2fms   (mean of %d)\n", "", "",
+           field.total / runs, buffered.total / runs, runs);
+  }
+
+  delete_fluid_synth(synth);
+  delete_fluid_settings(settings);
+  return ret;
+}
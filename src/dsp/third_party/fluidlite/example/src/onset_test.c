@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "fluidlite.h"
+
+/*
+ * Checks that notes started with fluid_synth_noteon_delayed() begin on
+ * the sample they were meant for, at several block sizes and at every
+ * kind of position in a block: its first sample, the middle, the last,
+ * and in later blocks of a period. A note begins after the delay of its
+ * volume envelope, which must come to the same number of samples at
+ * every block size. For comparison it also shows where a plain note-on
+ * sent ahead of the same block begins. Exits with 1 if any note begins
+ * elsewhere.
+ */
+
+#define SAMPLE_RATE 44100
+#define PERIOD 128
+#define CAPTURE (2 * PERIOD)	/* samples looked at for the onset */
+#define SETTLE 64		/* periods for a note to die out */
+
+static const int block_sizes[] = { 32, 64, 128 };
+static const int frames[] = { 0, 1, 5, 31, 32, 37, 63, 64, 65, 100, 127 };
+
+/* the first sample from the start of the period a note is played in that
+   isn't silent, -1 if there is none. The period is written a block at a
+   time, and the note sent ahead of the block it falls in, as a host
+   would pass on the events of a period. */
+static int onset(fluid_synth_t* synth, int frame, int delayed) {
+  float left[CAPTURE], right[CAPTURE];
+  int block = fluid_synth_get_internal_bufsize(synth);
+  int i, p;
+
+  /* silence, and whatever remains of the last note with it */
+  fluid_synth_cc(synth, 0, 120, 0);
+  for (p = 0; p < SETTLE; p++) {
+    fluid_synth_write_float(synth, PERIOD, left, 0, 1, right, 0, 1);
+  }
+
+  for (i = 0; i < CAPTURE; i += block) {
+    if (frame >= i && frame < i + block) {
+      if (delayed) {
+        fluid_synth_noteon_delayed(synth, 0, 60, 127, frame - i);
+      } else {
+        fluid_synth_noteon(synth, 0, 60, 127);
+      }
+    }
+    fluid_synth_write_float(synth, block, left + i, 0, 1, right + i, 0, 1);
+  }
+  fluid_synth_noteoff(synth, 0, 60);
+
+  for (i = 0; i < CAPTURE; i++) {
+    if (left[i] != 0.0f || right[i] != 0.0f) return i;
+  }
+  return -1;
+}
+
+int main(int argc, char *argv[]) {
+  fluid_settings_t* settings;
+  fluid_synth_t* synth;
+  int i, j, start, got, plain, failed = 0;
+  int lead = -1;
+
+  if (argc < 2) {
+    printf("Usage: %s <soundfont>\n", argv[0]);
+    return 1;
+  }
+
+  printf("%8s %8s %10s %10s %10s\n", "block", "frame", "expected", "delayed", "note-on");
+  for (i = 0; i < (int) (sizeof(block_sizes) / sizeof(block_sizes[0])); i++) {
+    settings = new_fluid_settings();
+    fluid_settings_setnum(settings, "synth.sample-rate", SAMPLE_RATE);
+    fluid_settings_setint(settings, "synth.block-size", block_sizes[i]);
+    fluid_settings_setstr(settings, "synth.reverb.active", "no");
+    fluid_settings_setstr(settings, "synth.chorus.active", "no");
+    synth = new_fluid_synth(settings);
+    if (fluid_synth_sfload(synth, argv[1], 1) < 0) {
+      fprintf(stderr, "%s: failed to load\n", argv[1]);
+      delete_fluid_synth(synth);
+      delete_fluid_settings(settings);
+      return 1;
+    }
+
+    /* the silent points at the start of the note itself, taken from the
+       first block size for all of them */
+    start = onset(synth, 0, 0);
+    if (start < 0) {
+      fprintf(stderr, "%s: preset 0 is silent\n", argv[1]);
+      return 1;
+    }
+    if (lead < 0) lead = start;
+    printf("%8d %8s %10d %10s %10d%s\n", block_sizes[i], "lead", lead, "", start,
+           (start == lead) ? "" : "  FAILED");
+    if (start != lead) failed = 1;
+
+    for (j = 0; j < (int) (sizeof(frames) / sizeof(frames[0])); j++) {
+      if (frames[j] + lead >= CAPTURE) continue;
+      got = onset(synth, frames[j], 1);
+      plain = onset(synth, frames[j], 0);
+      printf("%8d %8d %10d %10d %10d%s\n", block_sizes[i], frames[j], frames[j] + lead,
+             got, plain, (got == frames[j] + lead) ? "" : "  FAILED");
+      if (got != frames[j] + lead) failed = 1;
+    }
+
+    delete_fluid_synth(synth);
+    delete_fluid_settings(settings);
+  }
+
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed;
+}
@@ -138,6 +138,93 @@ FLUIDSYNTH_API void fluid_init_default_fileapi(fluid_fileapi_t* fileapi);
 
 FLUIDSYNTH_API void fluid_set_default_fileapi(fluid_fileapi_t* fileapi);
 
+/**
+ * How the default SoundFont loader stores 16 bit sample data.
+ */
+enum fluid_sample_mmap_mode {
+  FLUID_SAMPLE_MMAP_OFF,      /**< Read into a malloc'd buffer (default) */
+  FLUID_SAMPLE_MMAP_ON,       /**< Map the sample chunk read-only, pages fault in on first use */
+  FLUID_SAMPLE_MMAP_PREFAULT  /**< Map and touch every page at load time */
+};
+
+/**
+ * Select the sample storage used by subsequent loads. Mapping reads the
+ * file by name, so only enable it when the file API opens real files.
+ * Big endian hosts and SF3 files always use the malloc path.
+ */
+FLUIDSYNTH_API void fluid_set_sample_mmap(int mode);
+
+/**
+ * Read the preset, instrument and sample headers of subsequent loads
+ * with a single file API call and decode them from memory (the default),
+ * or with one call per field as the loader used to.
+ */
+FLUIDSYNTH_API void fluid_set_sfload_buffered(int enable);
+
+/**
+ * Page in mapped sample data per preset instead of all at once. Only the
+ * samples of presets that are currently selected on a channel are paged
+ * in; once more than budget_bytes are resident, the least recently used
+ * samples that no selected preset and no voice references are released
+ * again. 0 (the default) keeps the whole sample chunk resident, as does
+ * any budget the sample chunk fits in. Applies to subsequent loads that
+ * end up memory mapped.
+ *
+ * Selecting a preset only marks its samples; they are read from disk,
+ * and samples over the budget released, by fluid_defsfont_page_in().
+ * Until then they fault in as they are played.
+ */
+FLUIDSYNTH_API void fluid_set_sample_budget(unsigned int budget_bytes);
+
+/**
+ * Stream sample data from disk for subsequent loads. Of every sample only
+ * the first preload_ms, the loop and everything after it stay resident;
+ * the rest is read ahead of each playing voice by a background thread.
+ * Needs memory mapped sample data and takes precedence over the sample
+ * budget. 0 (the default) disables streaming.
+ */
+FLUIDSYNTH_API void fluid_set_sample_stream(unsigned int preload_ms);
+
+/**
+ * Load SoundFonts from a compiled .sf2c sidecar next to the file
+ * ("piano.sf2" -> "piano.sf2c") when one exists that was compiled from
+ * the file's current size and modification time, and write the sidecar
+ * after parsing otherwise. The sidecar holds the presets, zones and
+ * samples ready to be mapped, plus a copy of the sample data. Like
+ * fluid_set_sample_mmap(), only enable it when the file API opens real
+ * files. 0 (the default) disables the cache.
+ */
+FLUIDSYNTH_API void fluid_set_sf2c_cache(int enable);
+
+/**
+ * Report how many times voices of a streamed SoundFont played part of a
+ * block as silence because the disk had not caught up yet.
+ * @return FLUID_OK, or FLUID_FAILED if sfont is not a default SoundFont
+ */
+FLUIDSYNTH_API int fluid_defsfont_get_stream_underruns(fluid_sfont_t* sfont,
+                                                       unsigned int* underruns);
+
+/**
+ * Page in the samples of the presets selected since the last call, with
+ * a sample budget (see fluid_set_sample_budget()), after releasing the
+ * least recently used ones that no longer fit. Reads from disk, so call
+ * it from a thread other than the audio thread: after selecting a preset
+ * and before playing it, and now and then to catch the program changes
+ * of incoming MIDI. Returns at once if nothing was selected or another
+ * thread is paging the SoundFont; what was selected meanwhile is left
+ * for the next call.
+ * @return FLUID_OK, or FLUID_FAILED if sfont is not a default SoundFont
+ */
+FLUIDSYNTH_API int fluid_defsfont_page_in(fluid_sfont_t* sfont);
+
+/**
+ * Report the sample memory of a SoundFont loaded by the default loader.
+ * @return FLUID_OK, or FLUID_FAILED if sfont is not a default SoundFont
+ */
+FLUIDSYNTH_API int fluid_defsfont_get_sample_usage(fluid_sfont_t* sfont,
+                                                   unsigned int* resident_bytes,
+                                                   unsigned int* total_bytes);
+
 FLUIDSYNTH_API fluid_sfloader_t* new_fluid_defsfloader();
 
 FLUIDSYNTH_API int delete_fluid_defsfloader(fluid_sfloader_t* loader);
@@ -227,10 +314,14 @@ struct _fluid_sample_t
 
   /** Pointer to SoundFont specific data */
   void* userdata;
+
+  /** Streaming layout if only the head and loop of the sample are
+      resident, NULL if all of data[start..end] may be read */
+  fluid_sample_stream_t* stream;
 };
 
 
-#define fluid_sample_refcount(_sample) ((_sample)->refcount)
+#define fluid_sample_refcount(_sample) __atomic_load_n(&(_sample)->refcount, __ATOMIC_ACQUIRE)
 
 
 /** Sample types */
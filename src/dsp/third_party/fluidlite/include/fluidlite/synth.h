@@ -84,9 +84,24 @@ FLUIDSYNTH_API fluid_settings_t* fluid_synth_get_settings(fluid_synth_t* synth);
   /** Send a noteon message. Returns 0 if no error occurred, -1 otherwise. */
 FLUIDSYNTH_API int fluid_synth_noteon(fluid_synth_t* synth, int chan, int key, int vel);
 
+  /** Send a noteon message that takes effect 'delay' samples after the
+   *  next sample written out, rather than at the start of the next
+   *  block. The voices are started now and stay silent for the part of
+   *  their first block before that sample. The sample has to fall in
+   *  the next block the synth renders: when the current block still
+   *  holds unwritten samples, a delay shorter than those starts the
+   *  voices at the beginning of the next block, as does one past its
+   *  end. Returns 0 if no error occurred, -1 otherwise. */
+FLUIDSYNTH_API int fluid_synth_noteon_delayed(fluid_synth_t* synth, int chan, int key, int vel,
+					     int delay);
+
   /** Send a noteoff message. Returns 0 if no error occurred, -1 otherwise.  */
 FLUIDSYNTH_API int fluid_synth_noteoff(fluid_synth_t* synth, int chan, int key);
 
+  /** Release all notes of a channel, or of every channel if chan is -1, as
+      a note-off for each would. Returns 0. */
+FLUIDSYNTH_API int fluid_synth_all_notes_off(fluid_synth_t* synth, int chan);
+
   /** Send a control change message. Returns 0 if no error occurred, -1 otherwise.  */
 FLUIDSYNTH_API int fluid_synth_cc(fluid_synth_t* synth, int chan, int ctrl, int val);
 
@@ -393,11 +408,43 @@ FLUIDSYNTH_API int fluid_synth_get_polyphony(fluid_synth_t* synth);
 
 FLUIDSYNTH_API int fluid_synth_get_active_voice_count(fluid_synth_t* synth);
 
+  /** Get the number of voices stopped so far to make room for new ones,
+      when all of the polyphony was in use */
+FLUIDSYNTH_API unsigned int fluid_synth_get_voices_stolen(fluid_synth_t* synth);
+
+  /** Where the time of rendering goes: the stages of a block in
+      microseconds, and the voices behind some of them, per block on
+      average over the last 64 blocks. The voice times are each voice's
+      own interpolation, filter and mix; they overlap (a voice counts
+      under its interpolation and, if its filter changed, under
+      filter_update) and leave out filters run four voices at a time.
+      Voices rendered on worker threads count as well. */
+typedef struct _fluid_synth_profile_t {
+  int blocks;                   /**< blocks averaged over */
+  double total;                 /**< the whole block */
+  double clear;                 /**< clearing the mix buffers */
+  double prepare;               /**< envelopes, LFOs and filter settings of the voices */
+  double voices;                /**< rendering the voices, on all cores */
+  double interp[4];             /**< voices with no, linear, 4th and 7th order interpolation */
+  double interp_voices[4];      /**< how many of them */
+  double filter_update;         /**< voices whose filter coefficients were recalculated */
+  double filter_update_voices;  /**< how many of them */
+  double reverb;                /**< the reverb */
+  double chorus;                /**< the chorus */
+} fluid_synth_profile_t;
+
+  /** Get the profile of the last blocks rendered. Only measured if
+      FluidLite was built with WITH_PROFILING defined; otherwise the
+      profile is all zeros and FLUID_FAILED returned. Call it from the
+      thread that renders. */
+FLUIDSYNTH_API int fluid_synth_get_profile(fluid_synth_t* synth, fluid_synth_profile_t* profile);
+
   /** Get the internal buffer size. The internal buffer size if not the
       same thing as the buffer size specified in the
       settings. Internally, the synth *always* uses a specific buffer
       size independent of the buffer size used by the audio driver. The
-      internal buffer size is normally 64 samples. The reason why it
+      internal buffer size is 64 samples unless the setting
+      synth.block-size asks for another one. The reason why it
       uses an internal buffer size is to allow audio drivers to call the
       synthesizer with a variable buffer length. The internal buffer
       size is useful for client who want to optimize their buffer sizes.
@@ -422,6 +469,33 @@ enum fluid_interp {
   FLUID_INTERP_HIGHEST=7
 };
 
+/**
+ * The instruction set the linear, 4th and 7th order interpolation loops
+ * run on.
+ */
+enum fluid_interp_kernel {
+  FLUID_INTERP_KERNEL_AUTO = 0,   /**< The best one the CPU supports (default) */
+  FLUID_INTERP_KERNEL_SCALAR,     /**< Plain C, one point at a time */
+  FLUID_INTERP_KERNEL_SSE2,       /**< 4 points at a time, x86 */
+  FLUID_INTERP_KERNEL_AVX2,       /**< 4 points at a time, x86, double precision builds */
+  FLUID_INTERP_KERNEL_NEON        /**< 4 points at a time, AArch64 */
+};
+
+/**
+ * Select the interpolation kernel of all synths. Kernels this build or
+ * CPU does not have fall back to FLUID_INTERP_KERNEL_AUTO. Not to be
+ * called while a synth renders. Returns the kernel in use.
+ */
+FLUIDSYNTH_API int fluid_set_interp_kernel(int kernel);
+
+/**
+ * Enable or disable running the voice filters of all synths 4 voices at
+ * a time, on the interpolation kernel's vectors (enabled by default;
+ * FLUID_INTERP_KERNEL_SCALAR filters one voice at a time regardless).
+ * Not to be called while a synth renders.
+ */
+FLUIDSYNTH_API void fluid_set_filter_lanes(int enable);
+
 
 
 
@@ -641,6 +715,54 @@ FLUIDSYNTH_API int fluid_synth_nwrite_float(fluid_synth_t* synth, int len,
 					  float** left, float** right, 
 					  float** fx_left, float** fx_right);
 
+  /** Generate a number of samples into two floating point buffers
+   *  (left and right channel), each filled from the start. The
+   *  samples are taken a run at a time rather than one by one. When
+   *  len is a multiple of fluid_synth_get_internal_bufsize(), and no
+   *  call left a block half taken, whole blocks are rendered, and in a
+   *  32 bit float build mixed straight into the buffers.
+   *
+   *  \param synth The synthesizer
+   *  \param len The number of samples to generate
+   *  \param left The sample buffer for the left channel
+   *  \param right The sample buffer for the right channel
+   *  \returns 0 if no error occured, non-zero otherwise
+   */
+
+FLUIDSYNTH_API int fluid_synth_write_float_planar(fluid_synth_t* synth, int len,
+						float* left, float* right);
+
+  /** Generate a number of samples into one 16 bit buffer, left and
+   *  right interleaved. Each sample is clamped to [-1, 1] and scaled
+   *  by 32767, without dither, in a single pass over each run of the
+   *  internal buffers (vectorized where the build has SSE2 or NEON).
+   *
+   *  \param synth The synthesizer
+   *  \param len The number of samples (frames) to generate
+   *  \param out The buffer, of 2 * len samples
+   *  \returns 0 if no error occured, non-zero otherwise
+   */
+
+FLUIDSYNTH_API int fluid_synth_write_s16_interleaved(fluid_synth_t* synth, int len,
+						   short* out);
+
+  /** Like fluid_synth_write_s16_interleaved(), with the output of a
+   *  second synthesizer summed in before the samples are clamped and
+   *  converted: both are rendered and mixed at full precision, and the
+   *  sum is converted in the same pass. Without a second synthesizer,
+   *  or when it is not playing, this is fluid_synth_write_s16_interleaved().
+   *
+   *  \param synth The synthesizer
+   *  \param other The synthesizer to mix in, or NULL
+   *  \param len The number of samples (frames) to generate
+   *  \param out The buffer, of 2 * len samples
+   *  \returns 0 if no error occured, non-zero otherwise
+   */
+
+FLUIDSYNTH_API int fluid_synth_write_s16_interleaved_mix(fluid_synth_t* synth,
+						       fluid_synth_t* other,
+						       int len, short* out);
+
   /** Generate a number of samples. This function implements the
    *  default interface defined in fluidsynth/audio.h. This function
    *  ignores the input buffers and expects at least two output
@@ -28,6 +28,13 @@
 #cmakedefine01 HAVE_LIMITS_H
 #cmakedefine01 HAVE_FCNTL_H
 
+/* POSIX mmap/madvise for zero-copy sample data */
+#cmakedefine01 HAVE_SYS_MMAN_H
+#cmakedefine01 HAVE_UNISTD_H
+
+/* POSIX threads for sample streaming */
+#cmakedefine01 HAVE_PTHREAD_H
+
 //#pragma warning(disable : 4244)
 //#pragma warning(disable : 4101)
 //#pragma warning(disable : 4305)
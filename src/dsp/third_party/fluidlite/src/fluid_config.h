@@ -18,6 +18,10 @@
 /* Use double samples for pitch accuracy with non-standard sample rates */
 /* #define WITH_FLOAT 1 */
 
+/* Time the stages of rendering for fluid_synth_get_profile(); set by
+   PROFILE=1 ./scripts/build.sh */
+/* #define WITH_PROFILING 1 */
+
 /* Standard C99 headers detection */
 #define HAVE_STRING_H 1
 #define HAVE_STDLIB_H 1
@@ -26,3 +30,10 @@
 #define HAVE_MATH_H 1
 #define HAVE_LIMITS_H 1
 #define HAVE_FCNTL_H 1
+
+/* POSIX mmap/madvise for zero-copy sample data */
+#define HAVE_SYS_MMAN_H 1
+#define HAVE_UNISTD_H 1
+
+/* POSIX threads for sample streaming */
+#define HAVE_PTHREAD_H 1
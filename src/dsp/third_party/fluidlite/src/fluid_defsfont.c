@@ -23,10 +23,16 @@
 
 
 #include "fluid_defsfont.h"
+#include "fluid_sf2c.h"
 #include "fluid_sfont.h"
+#include "fluid_synth.h"
 /* Todo: Get rid of that 'include' */
 #include "fluid_sys.h"
 
+#if HAVE_SYS_MMAN_H
+#include <sys/stat.h>
+#endif
+
 #if SF3_SUPPORT == SF3_XIPH_VORBIS
 #define OV_EXCLUDE_STATIC_CALLBACKS
 #include "vorbis/vorbisfile.h"
@@ -183,6 +189,39 @@ void fluid_set_default_fileapi(fluid_fileapi_t* fileapi) {
   fluid_default_fileapi = fileapi == NULL ? (fluid_fileapi_t*)&default_fileapi : fileapi;
 }
 
+static int fluid_sample_mmap_mode = FLUID_SAMPLE_MMAP_OFF;
+static unsigned int fluid_sample_budget = 0;
+
+void fluid_set_sample_mmap(int mode) {
+  fluid_sample_mmap_mode = mode;
+}
+
+void fluid_set_sample_budget(unsigned int budget_bytes) {
+  fluid_sample_budget = budget_bytes;
+}
+
+/* a font whose sample data fits the budget stays resident as a whole */
+#define fluid_sample_budget_for(_samplesize) \
+  (((_samplesize) > fluid_sample_budget) ? fluid_sample_budget : 0)
+
+static unsigned int fluid_sample_stream_ms = 0;
+
+void fluid_set_sample_stream(unsigned int preload_ms) {
+  fluid_sample_stream_ms = preload_ms;
+}
+
+static int fluid_sfload_buffered = 1;
+
+void fluid_set_sfload_buffered(int enable) {
+  fluid_sfload_buffered = enable;
+}
+
+static int fluid_sf2c_cache = 0;
+
+void fluid_set_sf2c_cache(int enable) {
+  fluid_sf2c_cache = enable;
+}
+
 fluid_sfloader_t* new_fluid_defsfloader()
 {
   fluid_sfloader_t* loader;
@@ -289,6 +328,13 @@ fluid_defsfont_sfont_get_preset(fluid_sfont_t* sfont, unsigned int bank, unsigne
   preset->noteon = fluid_defpreset_preset_noteon;
   preset->notify = NULL;
 
+  /* a preset handed out is (about to be) selected on a channel: keep its
+     samples paged in until it is deleted again. This runs on the audio
+     thread for program changes, so it only counts and marks the samples;
+     paging in and out, and keeping to the budget, are done by
+     fluid_defsfont_page_in(). */
+  fluid_defpreset_pin_samples(defpreset, 1);
+
   return preset;
 }
 
@@ -311,6 +357,7 @@ int fluid_defsfont_sfont_iteration_next(fluid_sfont_t* sfont, fluid_preset_t* pr
 
 int fluid_defpreset_preset_delete(fluid_preset_t* preset)
 {
+  fluid_defpreset_pin_samples((fluid_defpreset_t*) preset->data, 0);
   FLUID_FREE(preset);
 
   /* TODO: free modulators */
@@ -365,6 +412,16 @@ fluid_defsfont_t* new_fluid_defsfont()
   sfont->samplesize = 0;
   sfont->sample = NULL;
   sfont->sampledata = NULL;
+  sfont->samplemap = NULL;
+  sfont->samplemap_size = 0;
+  sfont->sample_budget = 0;
+  sfont->resident_bytes = 0;
+  sfont->lru_clock = 0;
+  sfont->residency_lock = 0;
+  sfont->page_in_pending = 0;
+  sfont->paging = 0;
+  sfont->stream_file = NULL;
+  sfont->compiled = 0;
   sfont->preset = NULL;
 
   return sfont;
@@ -391,23 +448,50 @@ int delete_fluid_defsfont(fluid_defsfont_t* sfont)
     FLUID_FREE(sfont->filename);
   }
 
+  preset = sfont->preset;
+  while (preset != NULL) {
+    sfont->preset = preset->next;
+    /* compiled presets are part of the mapping, their tables are not */
+    if (!sfont->compiled) {
+      delete_fluid_defpreset(preset);
+    } else if (preset->lut != NULL) {
+      FLUID_FREE(preset->lut);
+    }
+    preset = sfont->preset;
+  }
+
   for (list = sfont->sample; list; list = fluid_list_next(list)) {
-    delete_fluid_sample((fluid_sample_t*) fluid_list_get(list));
+    sample = (fluid_sample_t*) fluid_list_get(list);
+    if (sample->userdata != NULL) {
+      FLUID_FREE(sample->userdata);
+    }
+    if (sample->stream != NULL) {
+      FLUID_FREE(sample->stream);
+    }
+    /* compiled samples are part of the mapping */
+    if (!sfont->compiled) {
+      delete_fluid_sample(sample);
+    }
   }
 
   if (sfont->sample) {
     delete_fluid_list(sfont->sample);
   }
 
-  if (sfont->sampledata != NULL) {
+  if (sfont->samplemap != NULL) {
+#if HAVE_SYS_MMAN_H
+    munmap(sfont->samplemap, sfont->samplemap_size);
+#endif
+  } else if (sfont->sampledata != NULL) {
     FLUID_FREE(sfont->sampledata);
   }
 
-  preset = sfont->preset;
-  while (preset != NULL) {
-    sfont->preset = preset->next;
-    delete_fluid_defpreset(preset);
-    preset = sfont->preset;
+  if (sfont->stream_file != NULL) {
+#if FLUID_STREAM_SUPPORT
+    close(sfont->stream_file->fd);
+#endif
+    FLUID_FREE(sfont->stream_file);
+    fluid_stream_engine_release();
   }
 
   FLUID_FREE(sfont);
@@ -428,6 +512,78 @@ void fluid_synth_set_preset_callback(void* callback)
     preset_callback=callback;
 }
 
+static void fluid_defsfont_touch(const short* first, const short* last);
+
+/* Streaming or the sample budget for sample data mapped from samplefile;
+   everything else is resident right away */
+static void fluid_defsfont_setup_residency(fluid_defsfont_t* sfont, const char* samplefile)
+{
+  /* only mapped sample data can be streamed, or paged in and out per
+     preset; streaming leaves the residency of each sample to the loader */
+  if (sfont->samplemap != NULL) {
+    if (fluid_sample_stream_ms > 0) {
+      fluid_defsfont_open_stream(sfont, samplefile);
+    }
+    if (sfont->stream_file == NULL) {
+      sfont->sample_budget = fluid_sample_budget_for(sfont->samplesize);
+    }
+  }
+  if ((sfont->sample_budget == 0) && (sfont->stream_file == NULL)) {
+    sfont->resident_bytes = sfont->samplesize;
+  }
+}
+
+static int fluid_defsfont_setup_sample(fluid_defsfont_t* sfont, fluid_sample_t* sample)
+{
+  if (sfont->stream_file != NULL) {
+    fluid_defsfont_stream_sample(sfont, sample);
+  } else if (sfont->sample_budget != 0) {
+    /* scanning the loop would page the sample in; done on first select */
+    sample->userdata = FLUID_NEW(fluid_sample_residency_t);
+    if (sample->userdata == NULL) {
+      FLUID_LOG(FLUID_ERR, "Out of memory");
+      return FLUID_FAILED;
+    }
+    FLUID_MEMSET(sample->userdata, 0, sizeof(fluid_sample_residency_t));
+  } else {
+    fluid_voice_optimize_sample(sample);
+  }
+  return FLUID_OK;
+}
+
+/*
+ * fluid_defsfont_load_compiled
+ *
+ * Loads the SoundFont from its .sf2c sidecar if that is current.
+ */
+static int fluid_defsfont_load_compiled(fluid_defsfont_t* sfont, const char* sidecar,
+					const fluid_sf2c_stamp_t* stamp)
+{
+  fluid_list_t *p;
+  fluid_defpreset_t* preset;
+
+  if (fluid_sf2c_load(sfont, sidecar, stamp) != FLUID_OK) {
+    return FLUID_FAILED;
+  }
+
+  if ((fluid_sample_mmap_mode == FLUID_SAMPLE_MMAP_PREFAULT)
+      && (fluid_sample_budget_for(sfont->samplesize) == 0) && (fluid_sample_stream_ms == 0)) {
+    fluid_defsfont_touch(sfont->sampledata, sfont->sampledata + sfont->samplesize / 2);
+  }
+  fluid_defsfont_setup_residency(sfont, sidecar);
+
+  for (p = sfont->sample; p != NULL; p = fluid_list_next(p)) {
+    if (fluid_defsfont_setup_sample(sfont, (fluid_sample_t*) fluid_list_get(p)) != FLUID_OK)
+      return FLUID_FAILED;
+  }
+  for (preset = sfont->preset; preset != NULL; preset = preset->next) {
+    if (fluid_defpreset_build_lut(preset) != FLUID_OK)
+      return FLUID_FAILED;
+    if(preset_callback) preset_callback(preset->bank,preset->num,preset->name);
+  }
+  return FLUID_OK;
+}
+
 /*
  * fluid_defsfont_load
  */
@@ -439,6 +595,8 @@ int fluid_defsfont_load(fluid_defsfont_t* sfont, const char* file, fluid_fileapi
   SFSample* sfsample;
   fluid_sample_t* sample;
   fluid_defpreset_t* preset;
+  fluid_sf2c_stamp_t stamp;
+  char* sidecar = NULL;
 
   sfont->filename = FLUID_MALLOC(1 + FLUID_STRLEN(file));
   if (sfont->filename == NULL) {
@@ -447,10 +605,27 @@ int fluid_defsfont_load(fluid_defsfont_t* sfont, const char* file, fluid_fileapi
   }
   FLUID_STRCPY(sfont->filename, file);
 
+  /* a current sidecar replaces parsing; otherwise it is (re)written from
+     what gets parsed, stamped with the revision seen before parsing */
+  if (fluid_sf2c_cache && (fluid_sf2c_stamp(file, &stamp) == FLUID_OK)) {
+    sidecar = fluid_sf2c_path(file);
+  }
+  if (sidecar != NULL) {
+    if (fluid_defsfont_load_compiled(sfont, sidecar, &stamp) == FLUID_OK) {
+      FLUID_FREE(sidecar);
+      return FLUID_OK;
+    }
+    if (sfont->compiled) {
+      FLUID_FREE(sidecar);
+      return FLUID_FAILED;
+    }
+  }
+
   /* The actual loading is done in the sfont and sffile files */
   sfdata = sfload_file(file, fapi);
   if (sfdata == NULL) {
     FLUID_LOG(FLUID_ERR, "Couldn't load soundfont file");
+    FLUID_FREE(sidecar);
     return FLUID_FAILED;
   }
 
@@ -459,9 +634,15 @@ int fluid_defsfont_load(fluid_defsfont_t* sfont, const char* file, fluid_fileapi
   sfont->samplepos = sfdata->samplepos;
   sfont->samplesize = sfdata->samplesize;
 
-  /* load sample data in one block */
-  if (fluid_defsfont_load_sampledata(sfont, fapi) != FLUID_OK)
-    goto err_exit;
+  /* map or load sample data in one block; SF3 samples are compressed
+     and get replaced after decoding, so they always take the copy */
+  if (sfdata->version.major >= 3
+      || fluid_defsfont_map_sampledata(sfont) != FLUID_OK) {
+    if (fluid_defsfont_load_sampledata(sfont, fapi) != FLUID_OK)
+      goto err_exit;
+  }
+
+  fluid_defsfont_setup_residency(sfont, sfont->filename);
 
   /* Create all the sample headers */
   p = sfdata->sample;
@@ -474,8 +655,10 @@ int fluid_defsfont_load(fluid_defsfont_t* sfont, const char* file, fluid_fileapi
     if (fluid_sample_import_sfont(sample, sfsample, sfont) != FLUID_OK)
       goto err_exit;
 
+    if (fluid_defsfont_setup_sample(sfont, sample) != FLUID_OK)
+      goto err_exit;
+
     fluid_defsfont_add_sample(sfont, sample);
-    fluid_voice_optimize_sample(sample);
     p = fluid_list_next(p);
   }
 
@@ -490,14 +673,23 @@ int fluid_defsfont_load(fluid_defsfont_t* sfont, const char* file, fluid_fileapi
       goto err_exit;
 
     fluid_defsfont_add_preset(sfont, preset);
+    if (fluid_defpreset_build_lut(preset) != FLUID_OK)
+      goto err_exit;
     if(preset_callback) preset_callback(preset->bank,preset->num,preset->name);
     p = fluid_list_next(p);
   }
+
+  if ((sidecar != NULL) && (sfdata->version.major < 3)
+      && (fluid_sf2c_compile(sfont, sidecar, &stamp) != FLUID_OK)) {
+    FLUID_LOG(FLUID_WARN, "Couldn't write compiled SoundFont %s", sidecar);
+  }
+  FLUID_FREE(sidecar);
   sfont_close (sfdata, fapi);
 
   return FLUID_OK;
 
 err_exit:
+  FLUID_FREE(sidecar);
   sfont_close (sfdata, fapi);
   return FLUID_FAILED;
 }
@@ -541,9 +733,498 @@ int fluid_defsfont_add_preset(fluid_defsfont_t* sfont, fluid_defpreset_t* preset
       prev = cur;
       cur = cur->next;
     }
-    preset->next = NULL;
-    prev->next = preset;
+    preset->next = NULL;
+    prev->next = preset;
+  }
+  return FLUID_OK;
+}
+
+/* fault the mapped points [first, last) in */
+static void fluid_defsfont_touch(const short* first, const short* last)
+{
+#if HAVE_SYS_MMAN_H && HAVE_UNISTD_H
+  long pagesize = sysconf(_SC_PAGESIZE);
+  uintptr begin = (uintptr) first;
+  uintptr end = (uintptr) last;
+  volatile const char* page;
+  char touched = 0;
+
+  if ((pagesize > 0) && (end > begin)) {
+    begin -= begin % pagesize;
+#ifdef MADV_WILLNEED
+    madvise((void*) begin, end - begin, MADV_WILLNEED);
+#endif
+    for (page = (volatile const char*) begin; (uintptr) page < end; page += pagesize) {
+      touched ^= *page;
+    }
+    (void) touched;
+  }
+#endif
+}
+
+/* release the pages that lie entirely within the mapped points [first, last) */
+static void fluid_defsfont_drop(const short* first, const short* last)
+{
+#if HAVE_SYS_MMAN_H && HAVE_UNISTD_H && defined(MADV_DONTNEED)
+  long pagesize = sysconf(_SC_PAGESIZE);
+  uintptr begin = (uintptr) first;
+  uintptr end = (uintptr) last;
+
+  if (pagesize > 0) {
+    begin += (pagesize - begin % pagesize) % pagesize;
+    end -= end % pagesize;
+    if (end > begin) {
+      madvise((void*) begin, end - begin, MADV_DONTNEED);
+    }
+  }
+#endif
+}
+
+/*
+ * fluid_defsfont_map_sampledata
+ *
+ * Maps the sample chunk read-only instead of copying it. The 16 bit PCM
+ * in the file is little endian, so it can only be used in place on a
+ * little endian host. Returns FLUID_FAILED, without logging, whenever the
+ * caller should fall back to fluid_defsfont_load_sampledata().
+ */
+int
+fluid_defsfont_map_sampledata(fluid_defsfont_t* sfont)
+{
+#if HAVE_SYS_MMAN_H && HAVE_UNISTD_H
+  unsigned short endian = 0x0100;
+  struct stat st;
+  long pagesize;
+  off_t offset;
+  size_t delta, len;
+  void* map;
+  int fd;
+
+  if (fluid_sample_mmap_mode == FLUID_SAMPLE_MMAP_OFF) {
+    return FLUID_FAILED;
+  }
+
+  /* big endian: the samples have to be byte swapped into a copy */
+  if (((char *) &endian)[0]) {
+    return FLUID_FAILED;
+  }
+
+  /* sampledata is a short*, so the chunk must be 2-byte aligned */
+  if ((sfont->samplesize == 0) || (sfont->samplepos & 1)) {
+    return FLUID_FAILED;
+  }
+
+  pagesize = sysconf(_SC_PAGESIZE);
+  if (pagesize <= 0) {
+    return FLUID_FAILED;
+  }
+
+  fd = open(sfont->filename, O_RDONLY);
+  if (fd < 0) {
+    return FLUID_FAILED;
+  }
+
+  /* a truncated file would SIGBUS on access instead of failing here */
+  if ((fstat(fd, &st) != 0)
+      || ((off_t) sfont->samplepos + (off_t) sfont->samplesize > st.st_size)) {
+    close(fd);
+    return FLUID_FAILED;
+  }
+
+  offset = (off_t) (sfont->samplepos - (sfont->samplepos % pagesize));
+  delta = sfont->samplepos - (size_t) offset;
+  len = delta + sfont->samplesize;
+
+  map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, offset);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return FLUID_FAILED;
+  }
+
+  sfont->samplemap = map;
+  sfont->samplemap_size = len;
+  sfont->sampledata = (short*) ((char*) map + delta);
+
+  /* with a sample budget the font does not fit, pages are touched per
+     preset instead, and streaming touches only what it keeps resident */
+  if ((fluid_sample_mmap_mode == FLUID_SAMPLE_MMAP_PREFAULT)
+      && (fluid_sample_budget_for(sfont->samplesize) == 0) && (fluid_sample_stream_ms == 0)) {
+    /* pull the whole chunk into the page cache and our page tables now,
+       so the audio thread never blocks on a major fault */
+    fluid_defsfont_touch(sfont->sampledata, sfont->sampledata + sfont->samplesize / 2);
+  }
+
+  FLUID_LOG(FLUID_DBG, "Mapped %u bytes of sample data", sfont->samplesize);
+  return FLUID_OK;
+#else
+  return FLUID_FAILED;
+#endif
+}
+
+/*
+ * Sample residency
+ *
+ * With a sample budget smaller than the sample data, the mapped sample
+ * chunk is not prefaulted at load.
+ * Every fluid_preset_t handed out by fluid_defsfont_sfont_get_preset() pins
+ * the samples of its zones until it is deleted, which is exactly as long as
+ * it stays selected on a channel. Pinned samples are paged in by the next
+ * fluid_defsfont_page_in(); unpinned ones that no voice plays are released
+ * by it, least recently used first, once resident_bytes exceeds the
+ * budget. Presets are selected from the audio thread as well as from
+ * loader threads, so the counters are guarded by a spinlock. Pinning only
+ * counts, under the lock, and makes no system calls: a program change on
+ * the audio thread walks the zones of one preset, and waits at most for
+ * one walk over the sample list by fluid_defsfont_page_in(), which drops
+ * and faults pages with the lock released.
+ */
+
+static void fluid_defsfont_lock(fluid_defsfont_t* sfont)
+{
+#if defined(__GNUC__)
+  while (__atomic_exchange_n(&sfont->residency_lock, 1, __ATOMIC_ACQUIRE)) {
+    /* held for one walk over the sample list at most */
+  }
+#endif
+}
+
+static void fluid_defsfont_unlock(fluid_defsfont_t* sfont)
+{
+#if defined(__GNUC__)
+  __atomic_store_n(&sfont->residency_lock, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+static unsigned int fluid_sample_bytes(fluid_sample_t* sample)
+{
+  return (sample->end + 1 - sample->start) * sizeof(short);
+}
+
+/* touch every page of a sample so playback does not fault */
+static void fluid_sample_page_in(fluid_sample_t* sample)
+{
+  fluid_defsfont_touch(sample->data + sample->start, sample->data + sample->end + 1);
+  fluid_voice_optimize_sample(sample);
+}
+
+/* drop the pages that belong to this sample alone */
+static void fluid_sample_page_out(fluid_sample_t* sample)
+{
+  fluid_defsfont_drop(sample->data + sample->start, sample->data + sample->end + 1);
+}
+
+/* flip PAGING_IN to RESIDENT; returns 1 for the one caller that did */
+static int fluid_sample_claim_page_in(fluid_defsfont_t* sfont, fluid_sample_residency_t* r)
+{
+  int claimed = 0;
+
+  fluid_defsfont_lock(sfont);
+  if (r->state == FLUID_SAMPLE_PAGING_IN) {
+    r->state = FLUID_SAMPLE_RESIDENT;
+    claimed = 1;
+  }
+  fluid_defsfont_unlock(sfont);
+  return claimed;
+}
+
+/* Release least recently used samples until the budget holds again. The
+   lock is held for one walk over the sample list per sample released and
+   never while the pages are dropped. */
+static void fluid_defsfont_enforce_budget(fluid_defsfont_t* sfont)
+{
+  fluid_list_t* list;
+  fluid_sample_t* sample;
+  fluid_sample_t* victim;
+  fluid_sample_residency_t* r;
+  fluid_sample_residency_t* victim_r;
+
+  for (;;) {
+    victim = NULL;
+    victim_r = NULL;
+    fluid_defsfont_lock(sfont);
+    if (sfont->resident_bytes > sfont->sample_budget) {
+      for (list = sfont->sample; list; list = fluid_list_next(list)) {
+        sample = (fluid_sample_t*) fluid_list_get(list);
+        r = (fluid_sample_residency_t*) sample->userdata;
+        if ((r == NULL) || (r->state != FLUID_SAMPLE_RESIDENT)
+            || (r->selected != 0) || (fluid_sample_refcount(sample) != 0)) {
+          continue;
+        }
+        if ((victim_r == NULL) || (r->last_used < victim_r->last_used)) {
+          victim = sample;
+          victim_r = r;
+        }
+      }
+      if (victim != NULL) {
+        victim_r->state = FLUID_SAMPLE_EVICTED;
+        sfont->resident_bytes -= fluid_sample_bytes(victim);
+      }
+    }
+    fluid_defsfont_unlock(sfont);
+
+    /* nothing over budget, or everything left is selected or playing */
+    if (victim == NULL) {
+      return;
+    }
+    /* a pin that lands meanwhile marks it for the page-in walk that follows */
+    fluid_sample_page_out(victim);
+  }
+}
+
+/*
+ * fluid_defpreset_pin_samples
+ *
+ * pin != 0: the preset got selected, count its samples as resident.
+ * pin == 0: the preset is gone from its channel, samples may be evicted.
+ */
+void fluid_defpreset_pin_samples(fluid_defpreset_t* preset, int pin)
+{
+  fluid_defsfont_t* sfont = preset->sfont;
+  fluid_preset_zone_t* preset_zone;
+  fluid_inst_zone_t* inst_zone;
+  fluid_sample_residency_t* r;
+  unsigned int clock;
+  int paging_in = 0;
+  int pending;
+
+  if ((sfont == NULL) || (sfont->sample_budget == 0)) {
+    return;
+  }
+
+  fluid_defsfont_lock(sfont);
+  clock = ++sfont->lru_clock;
+  for (preset_zone = preset->zone; preset_zone; preset_zone = preset_zone->next) {
+    if (preset_zone->inst == NULL) continue;
+    for (inst_zone = preset_zone->inst->zone; inst_zone; inst_zone = inst_zone->next) {
+      if ((inst_zone->sample == NULL) || (inst_zone->sample->userdata == NULL)) continue;
+      r = (fluid_sample_residency_t*) inst_zone->sample->userdata;
+      if (pin) {
+        r->selected++;
+        if (r->state == FLUID_SAMPLE_EVICTED) {
+          r->state = FLUID_SAMPLE_PAGING_IN;
+          sfont->resident_bytes += fluid_sample_bytes(inst_zone->sample);
+          paging_in = 1;
+        }
+      } else if (r->selected > 0) {
+        r->selected--;
+      }
+      r->last_used = clock;
+    }
+  }
+  /* paging in and releasing over budget are left to fluid_defsfont_page_in() */
+  pending = paging_in || (sfont->resident_bytes > sfont->sample_budget);
+  fluid_defsfont_unlock(sfont);
+
+  if (pending) {
+#if defined(__GNUC__)
+    __atomic_store_n(&sfont->page_in_pending, 1, __ATOMIC_RELEASE);
+#else
+    sfont->page_in_pending = 1;
+#endif
+  }
+}
+
+/*
+ * fluid_defsfont_page_in
+ */
+int fluid_defsfont_page_in(fluid_sfont_t* sfont)
+{
+  fluid_defsfont_t* defsfont;
+  fluid_list_t* list;
+  fluid_sample_t* sample;
+  fluid_sample_residency_t* r;
+  int pending;
+
+  if ((sfont == NULL) || (sfont->free != fluid_defsfont_sfont_delete)) {
+    return FLUID_FAILED;
+  }
+
+  defsfont = (fluid_defsfont_t*) sfont->data;
+#if defined(__GNUC__)
+  /* one thread pages at a time; a pin that comes while another does
+     stays pending for the next call */
+  if (__atomic_exchange_n(&defsfont->paging, 1, __ATOMIC_ACQUIRE)) {
+    return FLUID_OK;
+  }
+  pending = __atomic_exchange_n(&defsfont->page_in_pending, 0, __ATOMIC_ACQUIRE);
+#else
+  pending = defsfont->page_in_pending;
+  defsfont->page_in_pending = 0;
+#endif
+
+  if (pending) {
+    /* make room first, then fault the pinned samples in without holding
+       the lock; whoever flips a sample to resident does the work. A pin
+       that lands during the walk sets page_in_pending again. */
+    fluid_defsfont_enforce_budget(defsfont);
+    for (list = defsfont->sample; list; list = fluid_list_next(list)) {
+      sample = (fluid_sample_t*) fluid_list_get(list);
+      r = (fluid_sample_residency_t*) sample->userdata;
+      if ((r != NULL) && fluid_sample_claim_page_in(defsfont, r)) {
+        fluid_sample_page_in(sample);
+      }
+    }
+  }
+
+#if defined(__GNUC__)
+  __atomic_store_n(&defsfont->paging, 0, __ATOMIC_RELEASE);
+#endif
+  return FLUID_OK;
+}
+
+/*
+ * fluid_defsfont_get_sample_usage
+ */
+int fluid_defsfont_get_sample_usage(fluid_sfont_t* sfont,
+                                    unsigned int* resident_bytes,
+                                    unsigned int* total_bytes)
+{
+  fluid_defsfont_t* defsfont;
+
+  if ((sfont == NULL) || (sfont->free != fluid_defsfont_sfont_delete)) {
+    return FLUID_FAILED;
+  }
+
+  defsfont = (fluid_defsfont_t*) sfont->data;
+  fluid_defsfont_lock(defsfont);
+  *resident_bytes = defsfont->resident_bytes;
+  *total_bytes = defsfont->samplesize;
+  fluid_defsfont_unlock(defsfont);
+
+  return FLUID_OK;
+}
+
+/*
+ * Sample streaming
+ *
+ * A streamed SoundFont keeps of every sample the first preload_ms and the
+ * points from the loop start on resident in the mapping. The body in
+ * between is never touched through the mapping at play time; voices get
+ * it from rings that the stream engine fills from a file descriptor of
+ * its own (see fluid_stream.c and fluid_voice_stream_interpolate()).
+ */
+
+/*
+ * fluid_defsfont_open_stream
+ *
+ * Sets up streaming for a freshly mapped SoundFont, reading from
+ * samplefile, the SoundFont or its sidecar. On failure the sample data is
+ * left mapped and resident as without streaming.
+ */
+int fluid_defsfont_open_stream(fluid_defsfont_t* sfont, const char* samplefile)
+{
+#if FLUID_STREAM_SUPPORT
+  fluid_stream_file_t* file;
+
+  file = FLUID_NEW(fluid_stream_file_t);
+  if (file == NULL) {
+    FLUID_LOG(FLUID_ERR, "Out of memory");
+    goto error_recovery;
+  }
+  file->samplepos = sfont->samplepos;
+  file->underruns = 0;
+  file->fd = open(samplefile, O_RDONLY);
+  if (file->fd < 0) {
+    FLUID_FREE(file);
+    goto error_recovery;
+  }
+  if (fluid_stream_engine_acquire() != FLUID_OK) {
+    close(file->fd);
+    FLUID_FREE(file);
+    goto error_recovery;
+  }
+
+  sfont->stream_file = file;
+  return FLUID_OK;
+
+ error_recovery:
+#endif
+  FLUID_LOG(FLUID_WARN, "Can't stream sample data, keeping it resident");
+  if ((fluid_sample_mmap_mode == FLUID_SAMPLE_MMAP_PREFAULT)
+      && (fluid_sample_budget_for(sfont->samplesize) == 0)) {
+    fluid_defsfont_touch(sfont->sampledata, sfont->sampledata + sfont->samplesize / 2);
+  }
+  return FLUID_FAILED;
+}
+
+/*
+ * fluid_defsfont_stream_sample
+ *
+ * Splits a sample of a streamed SoundFont into resident head, streamed
+ * body and resident loop and tail, and faults the resident parts in. A
+ * loop that starts in the head keeps the head resident through its end.
+ * Samples with little to stream stay resident as a whole.
+ */
+void fluid_defsfont_stream_sample(fluid_defsfont_t* sfont, fluid_sample_t* sample)
+{
+  fluid_sample_stream_t* stream = NULL;
+  unsigned int rate = (sample->samplerate > 0) ? sample->samplerate : 44100;
+  unsigned int body_start, body_end;
+
+  body_start = sample->start
+    + (unsigned int) (((unsigned long long) fluid_sample_stream_ms * rate) / 1000);
+  body_end = sample->end + 1 - FLUID_STREAM_TAIL;
+  /* The voices read a loop in place, so it stays resident. Not the
+     placeholder fixup_sample() gives samples without a usable loop,
+     which spans the whole sample; voices that loop it anyway play
+     silence through the body. */
+  if ((sample->loopstart < sample->loopend) && (sample->loopend <= sample->end)
+      && (sample->loopstart < body_end) && (sample->loopend > body_start)
+      && !((sample->loopstart == sample->start + 1) && (sample->loopend == sample->end))) {
+    if (sample->loopstart >= body_start) {
+      body_end = sample->loopstart;
+    } else {
+      body_start = sample->loopend;
+    }
+  }
+
+  if (sample->valid && (body_end >= body_start + FLUID_STREAM_MIN_BODY)) {
+    stream = FLUID_NEW(fluid_sample_stream_t);
+  }
+  if (stream == NULL) {
+    fluid_defsfont_touch(sample->data + sample->start, sample->data + sample->end + 1);
+    fluid_voice_optimize_sample(sample);
+    sfont->resident_bytes += fluid_sample_bytes(sample);
+    return;
+  }
+
+  stream->file = sfont->stream_file;
+  stream->body_start = body_start;
+  stream->body_end = body_end;
+
+  fluid_defsfont_touch(sample->data + sample->start, sample->data + body_start);
+  fluid_defsfont_touch(sample->data + body_end, sample->data + sample->end + 1);
+
+  /* the loop scan may run through the body if the loop isn't used */
+  fluid_voice_optimize_sample(sample);
+  fluid_defsfont_drop(sample->data + body_start, sample->data + body_end);
+
+  sfont->resident_bytes += (body_start - sample->start) * sizeof(short)
+    + (sample->end + 1 - body_end) * sizeof(short);
+  sample->stream = stream;
+}
+
+/*
+ * fluid_defsfont_get_stream_underruns
+ */
+int fluid_defsfont_get_stream_underruns(fluid_sfont_t* sfont, unsigned int* underruns)
+{
+  fluid_defsfont_t* defsfont;
+
+  if ((sfont == NULL) || (sfont->free != fluid_defsfont_sfont_delete)) {
+    return FLUID_FAILED;
+  }
+
+  defsfont = (fluid_defsfont_t*) sfont->data;
+  *underruns = 0;
+  if (defsfont->stream_file != NULL) {
+#if defined(__GNUC__)
+    *underruns = __atomic_load_n(&defsfont->stream_file->underruns, __ATOMIC_RELAXED);
+#else
+    *underruns = defsfont->stream_file->underruns;
+#endif
   }
+
   return FLUID_OK;
 }
 
@@ -747,6 +1428,7 @@ new_fluid_defpreset(fluid_defsfont_t* sfont)
   preset->num = 0;
   preset->global_zone = NULL;
   preset->zone = NULL;
+  preset->lut = NULL;
   return preset;
 }
 
@@ -772,6 +1454,9 @@ delete_fluid_defpreset(fluid_defpreset_t* preset)
     }
     zone = preset->zone;
   }
+  if (preset->lut != NULL) {
+    FLUID_FREE(preset->lut);
+  }
   FLUID_FREE(preset);
   return err;
 }
@@ -805,231 +1490,500 @@ fluid_defpreset_next(fluid_defpreset_t* preset)
 
 
 /*
- * fluid_defpreset_noteon
+ * fluid_defpreset_merge_zone
+ *
+ * Merges the generators and modulators that a voice of an instrument
+ * zone, reached through one of the preset's zones, starts with into a
+ * template with room for GEN_LAST generators and FLUID_NUM_MOD
+ * modulators.
  */
-int
-fluid_defpreset_noteon(fluid_defpreset_t* preset, fluid_synth_t* synth, int chan, int key, int vel)
+static void
+fluid_defpreset_merge_zone(fluid_defpreset_t* preset, fluid_preset_zone_t* preset_zone,
+			   fluid_inst_zone_t* inst_zone, fluid_voice_template_t* templ)
 {
-  fluid_preset_zone_t *preset_zone, *global_preset_zone;
-  fluid_inst_t* inst;
-  fluid_inst_zone_t *inst_zone, *global_inst_zone;
-  fluid_sample_t* sample;
-  fluid_voice_t* voice;
+  fluid_preset_zone_t *global_preset_zone;
+  fluid_inst_zone_t *global_inst_zone;
   fluid_mod_t * mod;
   fluid_mod_t * mod_list[FLUID_NUM_MOD]; /* list for 'sorting' preset modulators */
   int mod_list_count;
+  double val[GEN_LAST];
+  char set[GEN_LAST];
   int i;
 
   global_preset_zone = fluid_defpreset_get_global_zone(preset);
+  global_inst_zone = fluid_inst_get_global_zone(fluid_preset_zone_get_inst(preset_zone));
 
-  /* run thru all the zones of this preset */
-  preset_zone = fluid_defpreset_get_zone(preset);
-  while (preset_zone != NULL) {
+  /* Instrument level, generators */
 
-    /* check if the note falls into the key and velocity range of this
-       preset */
-    if (fluid_preset_zone_inside_range(preset_zone, key, vel)) {
+  for (i = 0; i < GEN_LAST; i++) {
 
-      inst = fluid_preset_zone_get_inst(preset_zone);
-      global_inst_zone = fluid_inst_get_global_zone(inst);
+    /* SF 2.01 section 9.4 'bullet' 4:
+     *
+     * A generator in a local instrument zone supersedes a
+     * global instrument zone generator.  Both cases supersede
+     * the default generator -> voice_gen_set */
 
-      /* run thru all the zones of this instrument */
-      inst_zone = fluid_inst_get_zone(inst);
-	  while (inst_zone != NULL) {
+    set[i] = 1;
+    if (inst_zone->gen[i].flags){
+      val[i] = (float) inst_zone->gen[i].val;
 
-	/* make sure this instrument zone has a valid sample */
-	sample = fluid_inst_zone_get_sample(inst_zone);
-	if (fluid_sample_in_rom(sample) || (sample == NULL)) {
-	  inst_zone = fluid_inst_zone_next(inst_zone);
-	  continue;
-	}
+    } else if ((global_inst_zone != NULL) && (global_inst_zone->gen[i].flags)) {
+      val[i] = (float) global_inst_zone->gen[i].val;
 
-	/* check if the note falls into the key and velocity range of this
-	   instrument */
+    } else {
+      /* The generator has not been defined in this instrument.
+       * Leave it at the default.
+       */
+      set[i] = 0;
+      val[i] = fluid_gen_info[i].def;
+    }
 
-	if (fluid_inst_zone_inside_range(inst_zone, key, vel) && (sample != NULL)) {
+  } /* for all generators */
 
-	  /* this is a good zone. allocate a new synthesis process and
-             initialize it */
+  /* The default modulators come first, as they do for voices
+   * allocated without a template. */
 
-	  voice = fluid_synth_alloc_voice(synth, sample, chan, key, vel);
-	  if (voice == NULL) {
-	    return FLUID_FAILED;
-	  }
+  templ->mod_count = 0;
+  fluid_synth_template_default_mods(templ);
 
+  /* global instrument zone, modulators: Put them all into a
+   * list. */
 
-	  /* Instrument level, generators */
+  mod_list_count = 0;
 
-	  for (i = 0; i < GEN_LAST; i++) {
+  if (global_inst_zone){
+    mod = global_inst_zone->mod;
+    while (mod){
+      mod_list[mod_list_count++] = mod;
+      mod = mod->next;
+    }
+  }
 
-	    /* SF 2.01 section 9.4 'bullet' 4:
-	     *
-	     * A generator in a local instrument zone supersedes a
-	     * global instrument zone generator.  Both cases supersede
-	     * the default generator -> voice_gen_set */
+  /* local instrument zone, modulators.
+   * Replace modulators with the same definition in the list:
+   * SF 2.01 page 69, 'bullet' 8
+   */
+  mod = inst_zone->mod;
 
-	    if (inst_zone->gen[i].flags){
-	      fluid_voice_gen_set(voice, i, inst_zone->gen[i].val);
+  while (mod){
 
-	    } else if ((global_inst_zone != NULL) && (global_inst_zone->gen[i].flags)) {
-	      fluid_voice_gen_set(voice, i, global_inst_zone->gen[i].val);
+    /* 'Identical' modulators will be deleted by setting their
+     *  list entry to NULL.  The list length is known, NULL
+     *  entries will be ignored later.  SF2.01 section 9.5.1
+     *  page 69, 'bullet' 3 defines 'identical'.  */
 
-	    } else {
-	      /* The generator has not been defined in this instrument.
-	       * Do nothing, leave it at the default.
-	       */
-	    }
+    for (i = 0; i < mod_list_count; i++){
+      if (mod_list[i] && fluid_mod_test_identity(mod,mod_list[i])){
+	mod_list[i] = NULL;
+      }
+    }
 
-	  } /* for all generators */
+    /* Finally add the new modulator to to the list. */
+    mod_list[mod_list_count++] = mod;
+    mod = mod->next;
+  }
 
-	  /* global instrument zone, modulators: Put them all into a
-	   * list. */
+  /* Add instrument modulators (global / local) to the voice. */
+  for (i = 0; i < mod_list_count; i++){
 
-	  mod_list_count = 0;
+    mod = mod_list[i];
 
-	  if (global_inst_zone){
-	    mod = global_inst_zone->mod;
-	    while (mod){
-	      mod_list[mod_list_count++] = mod;
-	      mod = mod->next;
-	    }
-	  }
+    if (mod != NULL){ /* disabled modulators CANNOT be skipped. */
 
-	  /* local instrument zone, modulators.
-	   * Replace modulators with the same definition in the list:
-	   * SF 2.01 page 69, 'bullet' 8
-	   */
-	  mod = inst_zone->mod;
+      /* Instrument modulators -supersede- existing (default)
+       * modulators.  SF 2.01 page 69, 'bullet' 6 */
+      fluid_voice_template_add_mod(templ, mod, FLUID_VOICE_OVERWRITE);
+    }
+  }
 
-	  while (mod){
+  /* Preset level, generators */
+
+  for (i = 0; i < GEN_LAST; i++) {
+
+    /* SF 2.01 section 8.5 page 58: If some generators are
+     * encountered at preset level, they should be ignored */
+    if ((i != GEN_STARTADDROFS)
+	&& (i != GEN_ENDADDROFS)
+	&& (i != GEN_STARTLOOPADDROFS)
+	&& (i != GEN_ENDLOOPADDROFS)
+	&& (i != GEN_STARTADDRCOARSEOFS)
+	&& (i != GEN_ENDADDRCOARSEOFS)
+	&& (i != GEN_STARTLOOPADDRCOARSEOFS)
+	&& (i != GEN_KEYNUM)
+	&& (i != GEN_VELOCITY)
+	&& (i != GEN_ENDLOOPADDRCOARSEOFS)
+	&& (i != GEN_SAMPLEMODE)
+	&& (i != GEN_EXCLUSIVECLASS)
+	&& (i != GEN_OVERRIDEROOTKEY)) {
+
+      /* SF 2.01 section 9.4 'bullet' 9: A generator in a
+       * local preset zone supersedes a global preset zone
+       * generator.  The effect is -added- to the destination
+       * summing node -> voice_gen_incr */
+
+      if (preset_zone->gen[i].flags) {
+	val[i] += (float) preset_zone->gen[i].val;
+	set[i] = 1;
+      } else if ((global_preset_zone != NULL) && global_preset_zone->gen[i].flags) {
+	val[i] += (float) global_preset_zone->gen[i].val;
+	set[i] = 1;
+      } else {
+	/* The generator has not been defined in this preset
+	 * Do nothing, leave it unchanged.
+	 */
+      }
+    } /* if available at preset level */
+  } /* for all generators */
 
-	    /* 'Identical' modulators will be deleted by setting their
-	     *  list entry to NULL.  The list length is known, NULL
-	     *  entries will be ignored later.  SF2.01 section 9.5.1
-	     *  page 69, 'bullet' 3 defines 'identical'.  */
 
-	    for (i = 0; i < mod_list_count; i++){
-	      if (mod_list[i] && fluid_mod_test_identity(mod,mod_list[i])){
-		mod_list[i] = NULL;
-	      }
-	    }
+  /* Global preset zone, modulators: put them all into a
+   * list. */
+  mod_list_count = 0;
+  if (global_preset_zone){
+    mod = global_preset_zone->mod;
+    while (mod){
+      mod_list[mod_list_count++] = mod;
+      mod = mod->next;
+    }
+  }
 
-	    /* Finally add the new modulator to to the list. */
-	    mod_list[mod_list_count++] = mod;
-	    mod = mod->next;
-	  }
+  /* Process the modulators of the local preset zone.  Kick
+   * out all identical modulators from the global preset zone
+   * (SF 2.01 page 69, second-last bullet) */
 
-	  /* Add instrument modulators (global / local) to the voice. */
-	  for (i = 0; i < mod_list_count; i++){
+  mod = preset_zone->mod;
+  while (mod){
+    for (i = 0; i < mod_list_count; i++){
+      if (mod_list[i] && fluid_mod_test_identity(mod,mod_list[i])){
+	mod_list[i] = NULL;
+      }
+    }
 
-	    mod = mod_list[i];
+    /* Finally add the new modulator to the list. */
+    mod_list[mod_list_count++] = mod;
+    mod = mod->next;
+  }
 
-	    if (mod != NULL){ /* disabled modulators CANNOT be skipped. */
+  /* Add preset modulators (global / local) to the voice. */
+  for (i = 0; i < mod_list_count; i++){
+    mod = mod_list[i];
+    if ((mod != NULL) && (mod->amount != 0)) { /* disabled modulators can be skipped. */
 
-	      /* Instrument modulators -supersede- existing (default)
-	       * modulators.  SF 2.01 page 69, 'bullet' 6 */
-	      fluid_voice_add_mod(voice, mod, FLUID_VOICE_OVERWRITE);
-	    }
-	  }
+      /* Preset modulators -add- to existing instrument /
+       * default modulators.  SF2.01 page 70 first bullet on
+       * page */
+      fluid_voice_template_add_mod(templ, mod, FLUID_VOICE_ADD);
+    }
+  }
 
-	  /* Preset level, generators */
-
-	  for (i = 0; i < GEN_LAST; i++) {
-
-	    /* SF 2.01 section 8.5 page 58: If some generators are
-	     * encountered at preset level, they should be ignored */
-	    if ((i != GEN_STARTADDROFS)
-		&& (i != GEN_ENDADDROFS)
-		&& (i != GEN_STARTLOOPADDROFS)
-		&& (i != GEN_ENDLOOPADDROFS)
-		&& (i != GEN_STARTADDRCOARSEOFS)
-		&& (i != GEN_ENDADDRCOARSEOFS)
-		&& (i != GEN_STARTLOOPADDRCOARSEOFS)
-		&& (i != GEN_KEYNUM)
-		&& (i != GEN_VELOCITY)
-		&& (i != GEN_ENDLOOPADDRCOARSEOFS)
-		&& (i != GEN_SAMPLEMODE)
-		&& (i != GEN_EXCLUSIVECLASS)
-		&& (i != GEN_OVERRIDEROOTKEY)) {
-
-	      /* SF 2.01 section 9.4 'bullet' 9: A generator in a
-	       * local preset zone supersedes a global preset zone
-	       * generator.  The effect is -added- to the destination
-	       * summing node -> voice_gen_incr */
-
-	      if (preset_zone->gen[i].flags) {
-		fluid_voice_gen_incr(voice, i, preset_zone->gen[i].val);
-	      } else if ((global_preset_zone != NULL) && global_preset_zone->gen[i].flags) {
-		fluid_voice_gen_incr(voice, i, global_preset_zone->gen[i].val);
-	      } else {
-		/* The generator has not been defined in this preset
-		 * Do nothing, leave it unchanged.
-		 */
-	      }
-	    } /* if available at preset level */
-	  } /* for all generators */
-
-
-	  /* Global preset zone, modulators: put them all into a
-	   * list. */
-	  mod_list_count = 0;
-	  if (global_preset_zone){
-	    mod = global_preset_zone->mod;
-	    while (mod){
-	      mod_list[mod_list_count++] = mod;
-	      mod = mod->next;
-	    }
-	  }
+  /* only the generators the zones set replace the defaults */
+  templ->gen_count = 0;
+  for (i = 0; i < GEN_LAST; i++) {
+    if (set[i]) {
+      templ->gen[templ->gen_count] = (unsigned char) i;
+      templ->val[templ->gen_count++] = val[i];
+    }
+  }
+}
 
-	  /* Process the modulators of the local preset zone.  Kick
-	   * out all identical modulators from the global preset zone
-	   * (SF 2.01 page 69, second-last bullet) */
+/*
+ * fluid_defpreset_start_zone
+ *
+ * Starts a voice with a template.
+ */
+static int
+fluid_defpreset_start_zone(fluid_sample_t* sample, const fluid_voice_template_t* templ,
+			   fluid_synth_t* synth, int chan, int key, int vel)
+{
+  fluid_voice_t* voice;
 
-	  mod = preset_zone->mod;
-	  while (mod){
-	    for (i = 0; i < mod_list_count; i++){
-	      if (mod_list[i] && fluid_mod_test_identity(mod,mod_list[i])){
-		mod_list[i] = NULL;
-	      }
-	    }
+  voice = fluid_synth_alloc_voice_template(synth, sample, chan, key, vel, templ);
+  if (voice == NULL) {
+    return FLUID_FAILED;
+  }
 
-	    /* Finally add the new modulator to the list. */
-	    mod_list[mod_list_count++] = mod;
-	    mod = mod->next;
-	  }
+  /* add the synthesis process to the synthesis loop. */
+  fluid_synth_start_voice(synth, voice);
 
-	  /* Add preset modulators (global / local) to the voice. */
-	  for (i = 0; i < mod_list_count; i++){
-	    mod = mod_list[i];
-	    if ((mod != NULL) && (mod->amount != 0)) { /* disabled modulators can be skipped. */
+  /* Store the ID of the first voice that was created by this noteon event.
+   * Exclusive class may only terminate older voices.
+   * That avoids killing voices, which have just been created.
+   * (a noteon event can create several voice processes with the same exclusive
+   * class - for example when using stereo samples)
+   */
+  return FLUID_OK;
+}
 
-	      /* Preset modulators -add- to existing instrument /
-	       * default modulators.  SF2.01 page 70 first bullet on
-	       * page */
-	      fluid_voice_add_mod(voice, mod, FLUID_VOICE_ADD);
-	    }
-	  }
+/*
+ * fluid_defpreset_noteon
+ */
+int
+fluid_defpreset_noteon(fluid_defpreset_t* preset, fluid_synth_t* synth, int chan, int key, int vel)
+{
+  fluid_zone_lut_t* lut = preset->lut;
+  fluid_preset_zone_t *preset_zone;
+  fluid_inst_t* inst;
+  fluid_inst_zone_t *inst_zone;
+  fluid_sample_t* sample;
+  fluid_voice_template_t templ;
+  unsigned char gen[GEN_LAST];
+  double val[GEN_LAST];
+  fluid_mod_t mod[FLUID_NUM_MOD];
+  unsigned int i, b;
+
+  if ((lut != NULL) && (key >= 0) && (key < 128) && (vel >= 0) && (vel < 128)) {
+    /* the last band of every key ends at velocity 127 */
+    b = lut->key_band[key];
+    while (lut->band_velhi[b] < vel) {
+      b++;
+    }
+    for (i = lut->band_pair[b]; i < lut->band_pair[b + 1]; i++) {
+      if (fluid_defpreset_start_zone(lut->pair[i].inst_zone->sample, lut->pair[i].templ,
+				     synth, chan, key, vel) != FLUID_OK) {
+	return FLUID_FAILED;
+      }
+    }
+    return FLUID_OK;
+  }
+
+  templ.gen = gen;
+  templ.val = val;
+  templ.mod = mod;
+
+  /* run thru all the zones of this preset */
+  preset_zone = fluid_defpreset_get_zone(preset);
+  while (preset_zone != NULL) {
+
+    /* check if the note falls into the key and velocity range of this
+       preset */
+    if (fluid_preset_zone_inside_range(preset_zone, key, vel)) {
+
+      inst = fluid_preset_zone_get_inst(preset_zone);
+
+      /* run thru all the zones of this instrument */
+      inst_zone = fluid_inst_get_zone(inst);
+      while (inst_zone != NULL) {
 
-	  /* add the synthesis process to the synthesis loop. */
-	  fluid_synth_start_voice(synth, voice);
+	/* make sure this instrument zone has a valid sample */
+	sample = fluid_inst_zone_get_sample(inst_zone);
+	if (fluid_sample_in_rom(sample) || (sample == NULL)) {
+	  inst_zone = fluid_inst_zone_next(inst_zone);
+	  continue;
+	}
+
+	/* check if the note falls into the key and velocity range of this
+	   instrument */
+
+	if (fluid_inst_zone_inside_range(inst_zone, key, vel) && (sample != NULL)) {
 
-	  /* Store the ID of the first voice that was created by this noteon event.
-	   * Exclusive class may only terminate older voices.
-	   * That avoids killing voices, which have just been created.
-	   * (a noteon event can create several voice processes with the same exclusive
-	   * class - for example when using stereo samples)
-	   */
+	  /* this is a good zone. allocate a new synthesis process and
+             initialize it */
+	  fluid_defpreset_merge_zone(preset, preset_zone, inst_zone, &templ);
+	  if (fluid_defpreset_start_zone(sample, &templ, synth, chan, key, vel) != FLUID_OK) {
+	    return FLUID_FAILED;
+	  }
 	}
 
 	inst_zone = fluid_inst_zone_next(inst_zone);
       }
-	}
+    }
     preset_zone = fluid_preset_zone_next(preset_zone);
   }
 
   return FLUID_OK;
 }
 
+/*
+ * fluid_defpreset_build_lut
+ *
+ * Precomputes the zones each key and velocity starts, see
+ * fluid_zone_lut_t, so that note-ons do not walk every zone of the
+ * preset and of its instruments. Velocity bands are split wherever a
+ * zone's range starts or ends, so every zone listed for a band sounds
+ * for all of its velocities. Each zone gets the voice template it
+ * starts its voices with, so that note-ons do not merge generators and
+ * modulators either. Presets that would need too large a table keep
+ * walking their zones.
+ */
+int
+fluid_defpreset_build_lut(fluid_defpreset_t* preset)
+{
+  fluid_zone_pair_t* cand = NULL;
+  unsigned char (*range)[4] = NULL;	/* keylo, keyhi, vello, velhi */
+  fluid_zone_lut_t* lut;
+  fluid_preset_zone_t* preset_zone;
+  fluid_inst_zone_t* inst_zone;
+  fluid_sample_t* sample;
+  fluid_voice_template_t scratch, *templ;
+  unsigned char gen[GEN_LAST];
+  double val[GEN_LAST];
+  fluid_mod_t mod[FLUID_NUM_MOD];
+  unsigned char *gen_pool;
+  double *val_pool;
+  fluid_mod_t *mod_pool;
+  unsigned char split[129];
+  unsigned int count = 0, bands = 0, pairs = 0, gens = 0, mods = 0;
+  unsigned int b, i, n;
+  int pass, key, vel, lo, hi, vello, velhi;
+
+  if (preset->lut != NULL) {
+    FLUID_FREE(preset->lut);
+    preset->lut = NULL;
+  }
+
+  /* every instrument zone the zone walk could start, with the key and
+     velocity ranges that it sounds for */
+  for (pass = 0; pass < 2; pass++) {
+    n = 0;
+    for (preset_zone = preset->zone; preset_zone != NULL; preset_zone = preset_zone->next) {
+      if (preset_zone->inst == NULL) {
+	continue;
+      }
+      for (inst_zone = preset_zone->inst->zone; inst_zone != NULL; inst_zone = inst_zone->next) {
+	sample = fluid_inst_zone_get_sample(inst_zone);
+	if ((sample == NULL) || fluid_sample_in_rom(sample)) {
+	  continue;
+	}
+	lo = (preset_zone->keylo > inst_zone->keylo) ? preset_zone->keylo : inst_zone->keylo;
+	hi = (preset_zone->keyhi < inst_zone->keyhi) ? preset_zone->keyhi : inst_zone->keyhi;
+	if (lo < 0) lo = 0;
+	if (hi > 127) hi = 127;
+	vello = (preset_zone->vello > inst_zone->vello) ? preset_zone->vello : inst_zone->vello;
+	velhi = (preset_zone->velhi < inst_zone->velhi) ? preset_zone->velhi : inst_zone->velhi;
+	if (vello < 0) vello = 0;
+	if (velhi > 127) velhi = 127;
+	if ((lo > hi) || (vello > velhi)) {
+	  continue;
+	}
+	if (pass == 1) {
+	  cand[n].preset_zone = preset_zone;
+	  cand[n].inst_zone = inst_zone;
+	  range[n][0] = (unsigned char) lo;
+	  range[n][1] = (unsigned char) hi;
+	  range[n][2] = (unsigned char) vello;
+	  range[n][3] = (unsigned char) velhi;
+	}
+	n++;
+      }
+    }
+    if (pass == 0) {
+      if (n == 0) {
+	return FLUID_OK;
+      }
+      cand = FLUID_ARRAY(fluid_zone_pair_t, n);
+      range = FLUID_MALLOC(n * sizeof(*range));
+      if ((cand == NULL) || (range == NULL)) {
+	goto oom;
+      }
+    }
+  }
+  count = n;
+
+  /* size the table: the bands of each key and the pairs of each band */
+  for (key = 0; key < 128; key++) {
+    FLUID_MEMSET(split, 0, sizeof(split));
+    for (i = 0; i < count; i++) {
+      if ((range[i][0] <= key) && (key <= range[i][1])) {
+	split[range[i][2]] = 1;
+	split[range[i][3] + 1] = 1;
+      }
+    }
+    for (vel = 0; vel < 128; ) {
+      for (hi = vel; (hi < 127) && !split[hi + 1]; hi++);
+      for (i = 0; i < count; i++) {
+	if ((range[i][0] <= key) && (key <= range[i][1])
+	    && (range[i][2] <= vel) && (hi <= range[i][3])) {
+	  pairs++;
+	}
+      }
+      bands++;
+      vel = hi + 1;
+    }
+    if (pairs > FLUID_ZONE_LUT_MAX_PAIRS) {
+      FLUID_FREE(cand);
+      FLUID_FREE(range);
+      return FLUID_OK;
+    }
+  }
+
+  /* size the voice templates */
+  scratch.gen = gen;
+  scratch.val = val;
+  scratch.mod = mod;
+  for (i = 0; i < count; i++) {
+    fluid_defpreset_merge_zone(preset, cand[i].preset_zone, cand[i].inst_zone, &scratch);
+    gens += scratch.gen_count;
+    mods += scratch.mod_count;
+  }
+
+  /* the arrays in order of decreasing alignment */
+  lut = FLUID_MALLOC(sizeof(fluid_zone_lut_t) + pairs * sizeof(fluid_zone_pair_t)
+		     + count * sizeof(fluid_voice_template_t) + mods * sizeof(fluid_mod_t)
+		     + gens * sizeof(double) + (bands + 1) * sizeof(unsigned int)
+		     + gens + bands);
+  if (lut == NULL) {
+    goto oom;
+  }
+  lut->pair = (fluid_zone_pair_t*) (lut + 1);
+  templ = (fluid_voice_template_t*) (lut->pair + pairs);
+  mod_pool = (fluid_mod_t*) (templ + count);
+  val_pool = (double*) (mod_pool + mods);
+  lut->band_pair = (unsigned int*) (val_pool + gens);
+  gen_pool = (unsigned char*) (lut->band_pair + bands + 1);
+  lut->band_velhi = gen_pool + gens;
+
+  /* merging again yields the sizes above */
+  for (i = 0; i < count; i++) {
+    templ[i].gen = gen_pool;
+    templ[i].val = val_pool;
+    templ[i].mod = mod_pool;
+    fluid_defpreset_merge_zone(preset, cand[i].preset_zone, cand[i].inst_zone, &templ[i]);
+    gen_pool += templ[i].gen_count;
+    val_pool += templ[i].gen_count;
+    mod_pool += templ[i].mod_count;
+    cand[i].templ = &templ[i];
+  }
+
+  b = 0;
+  n = 0;
+  for (key = 0; key < 128; key++) {
+    lut->key_band[key] = (unsigned short) b;
+    FLUID_MEMSET(split, 0, sizeof(split));
+    for (i = 0; i < count; i++) {
+      if ((range[i][0] <= key) && (key <= range[i][1])) {
+	split[range[i][2]] = 1;
+	split[range[i][3] + 1] = 1;
+      }
+    }
+    for (vel = 0; vel < 128; ) {
+      for (hi = vel; (hi < 127) && !split[hi + 1]; hi++);
+      lut->band_pair[b] = n;
+      lut->band_velhi[b] = (unsigned char) hi;
+      for (i = 0; i < count; i++) {
+	if ((range[i][0] <= key) && (key <= range[i][1])
+	    && (range[i][2] <= vel) && (hi <= range[i][3])) {
+	  lut->pair[n++] = cand[i];
+	}
+      }
+      b++;
+      vel = hi + 1;
+    }
+  }
+  lut->key_band[128] = (unsigned short) b;
+  lut->band_pair[b] = n;
+
+  FLUID_FREE(cand);
+  FLUID_FREE(range);
+  preset->lut = lut;
+  return FLUID_OK;
+
+ oom:
+  FLUID_LOG(FLUID_ERR, "Out of memory");
+  if (cand != NULL) FLUID_FREE(cand);
+  if (range != NULL) FLUID_FREE(range);
+  return FLUID_FAILED;
+}
+
 /*
  * fluid_defpreset_set_global_zone
  */
@@ -1898,39 +2852,113 @@ fluid_sample_import_sfont(fluid_sample_t* sample, SFSample* sfsample, fluid_defs
    equivalent to the matching ID list in memory regardless of LE/BE machine
 */
 
+/*
+ * Buffered HYDRA parsing
+ *
+ * The pdta records are decoded field by field, 2 and 4 bytes at a time.
+ * The whole chunk can instead be read with a single call into an
+ * SFBuffer; the macros below then take each field straight from the
+ * buffer with little-endian loads, and fail past its end like EOF would.
+ * The buffer is passed as the file handle along with sfbuffer_fileapi,
+ * whose calls serve the rare seeks and tells.
+ */
+typedef struct _SFBuffer
+{
+  const unsigned char *data;
+  unsigned int size;
+  unsigned int pos;
+} SFBuffer;
+
+static const fluid_fileapi_t sfbuffer_fileapi;
+
+#define SFBUFFER(fd,fapi) \
+  (((const fluid_fileapi_t *) (fapi) == &sfbuffer_fileapi) ? (SFBuffer *) (fd) : NULL)
+
+/* the next 'count' bytes of the buffer, NULL at its end */
+static FLUID_INLINE const unsigned char *
+sfbuffer_take (SFBuffer * b, unsigned int count)
+{
+  const unsigned char *p = b->data + b->pos;
+
+  if (count > b->size - b->pos)
+    {
+      gerr (ErrEof, _("EOF while attemping to read %d bytes"), count);
+      return (NULL);
+    }
+  b->pos += count;
+  return (p);
+}
+
+#define SFBUF_W(p)	((unsigned short) ((p)[0] | ((p)[1] << 8)))
+#define SFBUF_D(p)	((unsigned int) (p)[0] | ((unsigned int) (p)[1] << 8) \
+			 | ((unsigned int) (p)[2] << 16) | ((unsigned int) (p)[3] << 24))
+
+/* take 'count' bytes from a buffer into _p, or fall through to the file API */
+#define SFBUF_TAKE(count,fd,fapi)					\
+    const unsigned char *_p = NULL;						\
+    SFBuffer *_b = SFBUFFER(fd,fapi);					\
+    if (_b != NULL && (_p = sfbuffer_take (_b, (count))) == NULL)	\
+	return(FAIL);
+
 #ifdef WORDS_BIGENDIAN
 #define READCHUNK(var,fd,fapi)	G_STMT_START {      \
+    SFBUF_TAKE (8, fd, fapi)				\
+    if (_b != NULL) {					\
+	FLUID_MEMCPY (&((SFChunk *)(var))->id, _p, 4);	\
+	((SFChunk *)(var))->size = SFBUF_D (_p + 4);	\
+    } else {						\
 	if (fapi->fread(var, 8, fd) == FLUID_FAILED)			\
 	return(FAIL);					\
 	((SFChunk *)(var))->size = GUINT32_FROM_BE(((SFChunk *)(var))->size);  \
+    }							\
 } G_STMT_END
 #else
 #define READCHUNK(var,fd,fapi)	G_STMT_START {      \
+    SFBUF_TAKE (8, fd, fapi)				\
+    if (_b != NULL) {					\
+	FLUID_MEMCPY (&((SFChunk *)(var))->id, _p, 4);	\
+	((SFChunk *)(var))->size = SFBUF_D (_p + 4);	\
+    } else {						\
     if (fapi->fread(var, 8, fd) == FLUID_FAILED)			\
 	return(FAIL);					\
     ((SFChunk *)(var))->size = GUINT32_FROM_LE(((SFChunk *)(var))->size);  \
+    }							\
 } G_STMT_END
 #endif
 #define READID(var,fd,fapi)		G_STMT_START {        \
-    if (fapi->fread(var, 4, fd) == FLUID_FAILED)			\
+    SFBUF_TAKE (4, fd, fapi)				\
+    if (_b != NULL)					\
+	FLUID_MEMCPY (var, _p, 4);			\
+    else if (fapi->fread(var, 4, fd) == FLUID_FAILED)			\
 	return(FAIL);					\
 } G_STMT_END
 #define READSTR(var,fd,fapi)		G_STMT_START {      \
-    if (fapi->fread(var, 20, fd) == FLUID_FAILED)			\
+    SFBUF_TAKE (20, fd, fapi)				\
+    if (_b != NULL)					\
+	FLUID_MEMCPY (var, _p, 20);			\
+    else if (fapi->fread(var, 20, fd) == FLUID_FAILED)			\
 	return(FAIL);					\
     (var)[20] = '\0';					\
 } G_STMT_END
 #ifdef WORDS_BIGENDIAN
 #define READD(var,fd,fapi)		G_STMT_START {        \
 	unsigned int _temp;					\
-	if (fapi->fread(&_temp, 4, fd) == FLUID_FAILED)			\
+	SFBUF_TAKE (4, fd, fapi)			\
+	if (_b != NULL)					\
+	_temp = SFBUF_D (_p);				\
+	else if (fapi->fread(&_temp, 4, fd) == FLUID_FAILED)			\
 	return(FAIL);					\
-	var = GINT32_FROM_BE(_temp);			\
+	else						\
+	_temp = GINT32_FROM_BE(_temp);			\
+	var = _temp;					\
 } G_STMT_END
 #else
 #define READD(var,fd,fapi)		G_STMT_START {        \
     unsigned int _temp;					\
-    if (fapi->fread(&_temp, 4, fd) == FLUID_FAILED)			\
+    SFBUF_TAKE (4, fd, fapi)				\
+    if (_b != NULL)					\
+	_temp = SFBUF_D (_p);				\
+    else if (fapi->fread(&_temp, 4, fd) == FLUID_FAILED)			\
 	return(FAIL);					\
     var = GINT32_FROM_LE(_temp);			\
 } G_STMT_END
@@ -1938,29 +2966,41 @@ fluid_sample_import_sfont(fluid_sample_t* sample, SFSample* sfsample, fluid_defs
 #ifdef WORDS_BIGENDIAN
 #define READW(var,fd,fapi)		G_STMT_START {        \
 	unsigned short _temp;					\
-	if (fapi->fread(&_temp, 2, fd) == FLUID_FAILED)			\
+	SFBUF_TAKE (2, fd, fapi)			\
+	if (_b != NULL)					\
+	_temp = SFBUF_W (_p);				\
+	else if (fapi->fread(&_temp, 2, fd) == FLUID_FAILED)			\
 	return(FAIL);					\
-var = GINT16_FROM_BE(_temp);			\
+	else						\
+	_temp = GINT16_FROM_BE(_temp);			\
+	var = _temp;					\
 } G_STMT_END
 #else
 #define READW(var,fd,fapi)		G_STMT_START {        \
     unsigned short _temp;					\
-    if (fapi->fread(&_temp, 2, fd) == FLUID_FAILED)			\
+    SFBUF_TAKE (2, fd, fapi)				\
+    if (_b != NULL)					\
+	_temp = SFBUF_W (_p);				\
+    else if (fapi->fread(&_temp, 2, fd) == FLUID_FAILED)			\
 	return(FAIL);					\
     var = GINT16_FROM_LE(_temp);			\
 } G_STMT_END
 #endif
 #define READB(var,fd,fapi)		G_STMT_START {        \
-    if (fapi->fread(&var, 1, fd) == FLUID_FAILED)			\
+    SFBUF_TAKE (1, fd, fapi)				\
+    if (_b != NULL)					\
+	var = _p[0];					\
+    else if (fapi->fread(&var, 1, fd) == FLUID_FAILED)			\
 	return(FAIL);					\
 } G_STMT_END
 #define FSKIP(size,fd,fapi)		G_STMT_START {		\
-    if (fapi->fseek(fd, size, SEEK_CUR) == FLUID_FAILED)		\
+    SFBUF_TAKE (size, fd, fapi)				\
+    if (_b == NULL && fapi->fseek(fd, size, SEEK_CUR) == FLUID_FAILED)		\
 	return(FAIL);					\
+    (void) _p;						\
 } G_STMT_END
 #define FSKIPW(fd,fapi)		G_STMT_START {      \
-    if (fapi->fseek(fd, 2, SEEK_CUR) == FLUID_FAILED)			\
-	return(FAIL);					\
+    FSKIP (2, fd, fapi);				\
 } G_STMT_END
 
 /* removes and advances a fluid_list_t pointer */
@@ -2293,7 +3333,7 @@ pdtahelper (unsigned int expid, unsigned int reclen, SFChunk * chunk,
 }
 
 static int
-process_pdta (int size, SFData * sf, void * fd, fluid_fileapi_t* fapi)
+process_pdta_records (int size, SFData * sf, void * fd, fluid_fileapi_t* fapi)
 {
   SFChunk chunk;
 
@@ -2345,6 +3385,94 @@ process_pdta (int size, SFData * sf, void * fd, fluid_fileapi_t* fapi)
   return (OK);
 }
 
+static int
+sfbuffer_fread (void *buf, int count, void *handle)
+{
+  SFBuffer *b = (SFBuffer *) handle;
+
+  if ((count < 0) || ((unsigned int) count > b->size - b->pos))
+    {
+      gerr (ErrEof, _("EOF while attemping to read %d bytes"), count);
+      return FLUID_FAILED;
+    }
+  FLUID_MEMCPY (buf, b->data + b->pos, count);
+  b->pos += count;
+  return FLUID_OK;
+}
+
+static int
+sfbuffer_fseek (void *handle, long ofs, int whence)
+{
+  SFBuffer *b = (SFBuffer *) handle;
+  long pos;
+
+  switch (whence)
+    {
+    case SEEK_SET: pos = ofs; break;
+    case SEEK_CUR: pos = (long) b->pos + ofs; break;
+    case SEEK_END: pos = (long) b->size + ofs; break;
+    default: pos = -1; break;
+    }
+  if ((pos < 0) || (pos > (long) b->size))
+    {
+      FLUID_LOG (FLUID_ERR, _("File seek failed with offset = %ld and whence = %d"), ofs, whence);
+      return FLUID_FAILED;
+    }
+  b->pos = (unsigned int) pos;
+  return FLUID_OK;
+}
+
+static long
+sfbuffer_ftell (void *handle)
+{
+  return (long) ((SFBuffer *) handle)->pos;
+}
+
+/* the file API of an SFBuffer, for what the macros above don't decode */
+static const fluid_fileapi_t sfbuffer_fileapi =
+{
+  NULL,
+  NULL,
+  NULL,
+  sfbuffer_fread,
+  sfbuffer_fseek,
+  NULL,
+  sfbuffer_ftell
+};
+
+static int
+process_pdta (int size, SFData * sf, void * fd, fluid_fileapi_t* fapi)
+{
+  SFBuffer buffer;
+  char *data;
+  int ret;
+
+  if (!fluid_sfload_buffered || (size <= 0))
+    return (process_pdta_records (size, sf, fd, fapi));
+
+  if (!(data = FLUID_MALLOC (size)))
+    {
+      FLUID_LOG(FLUID_ERR, "Out of memory");
+      return (FAIL);
+    }
+  if (fapi->fread (data, size, fd) == FLUID_FAILED)
+    {
+      FLUID_FREE (data);
+      return (FAIL);
+    }
+
+  /* Freed with the SFData rather than here: a hole this size in the
+     middle of the heap slows down the allocations of the import that
+     follows noticeably. */
+  sf->pdta = data;
+  buffer.data = (const unsigned char *) data;
+  buffer.size = size;
+  buffer.pos = 0;
+  ret = process_pdta_records (size, sf, &buffer, (fluid_fileapi_t *) &sfbuffer_fileapi);
+
+  return (ret);
+}
+
 /* preset header loader */
 static int
 load_phdr (int size, SFData * sf, void * fd, fluid_fileapi_t* fapi)
@@ -3344,6 +4472,9 @@ sfont_close (SFData * sf, fluid_fileapi_t* fapi)
   delete_fluid_list (sf->sample);
   sf->sample = NULL;
 
+  if (sf->pdta)
+    FLUID_FREE (sf->pdta);
+
   FLUID_FREE (sf);
 }
 
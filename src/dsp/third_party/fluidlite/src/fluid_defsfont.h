@@ -28,6 +28,7 @@
 #include "fluidlite.h"
 #include "fluidsynth_priv.h"
 #include "fluid_list.h"
+#include "fluid_stream.h"
 
 
 
@@ -148,6 +149,7 @@ typedef struct _SFData
   fluid_list_t *preset;		/* linked list of preset info */
   fluid_list_t *inst;			/* linked list of instrument info */
   fluid_list_t *sample;		/* linked list of sample info */
+  char *pdta;			/* the HYDRA chunk when read in one buffer */
 }
 SFData;
 
@@ -466,6 +468,25 @@ int fluid_defpreset_preset_get_num(fluid_preset_t* preset);
 int fluid_defpreset_preset_noteon(fluid_preset_t* preset, fluid_synth_t* synth, int chan, int key, int vel);
 
 
+/*
+ * fluid_sample_residency_t
+ *
+ * Per-sample bookkeeping of a lazily paged SoundFont, hung off
+ * fluid_sample_t::userdata.
+ */
+enum {
+  FLUID_SAMPLE_EVICTED,      /* pages released (or never touched) */
+  FLUID_SAMPLE_PAGING_IN,    /* counted as resident, pages not touched yet */
+  FLUID_SAMPLE_RESIDENT
+};
+
+typedef struct _fluid_sample_residency_t
+{
+  unsigned int selected;     /* selected presets referencing this sample */
+  unsigned int last_used;    /* lru_clock when last selected or unselected */
+  int state;
+} fluid_sample_residency_t;
+
 /*
  * fluid_defsfont_t
  */
@@ -474,7 +495,17 @@ struct _fluid_defsfont_t
   char* filename;           /* the filename of this soundfont */
   unsigned int samplepos;   /* the position in the file at which the sample data starts */
   unsigned int samplesize;  /* the size of the sample data */
-  short* sampledata;        /* the sample data, loaded in ram */
+  short* sampledata;        /* the sample data, loaded in ram or mapped from the file */
+  void* samplemap;          /* base of the file mapping, NULL if sampledata was malloc'd */
+  size_t samplemap_size;    /* length of the file mapping */
+  unsigned int sample_budget;   /* lazy residency byte budget, 0 if everything is resident */
+  unsigned int resident_bytes;  /* sample bytes paged in */
+  unsigned int lru_clock;       /* bumped on every preset select/unselect */
+  int residency_lock;           /* spinlock, presets are selected from several threads */
+  int page_in_pending;          /* samples were pinned that are still to be paged in */
+  int paging;                   /* a thread is in fluid_defsfont_page_in() */
+  fluid_stream_file_t* stream_file; /* set if sample bodies are streamed from disk */
+  int compiled;              /* presets, zones and samples live in a mapped .sf2c sidecar */
   fluid_list_t* sample;      /* the samples in this soundfont */
   fluid_defpreset_t* preset; /* the presets of this soundfont */
 
@@ -490,12 +521,44 @@ char* fluid_defsfont_get_name(fluid_defsfont_t* sfont);
 fluid_defpreset_t* fluid_defsfont_get_preset(fluid_defsfont_t* sfont, unsigned int bank, unsigned int prenum);
 void fluid_defsfont_iteration_start(fluid_defsfont_t* sfont);
 int fluid_defsfont_iteration_next(fluid_defsfont_t* sfont, fluid_preset_t* preset);
+int fluid_defsfont_map_sampledata(fluid_defsfont_t* sfont);
+int fluid_defsfont_open_stream(fluid_defsfont_t* sfont, const char* samplefile);
+void fluid_defsfont_stream_sample(fluid_defsfont_t* sfont, fluid_sample_t* sample);
+void fluid_defpreset_pin_samples(fluid_defpreset_t* preset, int pin);
 int fluid_defsfont_load_sampledata(fluid_defsfont_t* sfont, fluid_fileapi_t * fileapi);
 int fluid_defsfont_add_sample(fluid_defsfont_t* sfont, fluid_sample_t* sample);
 int fluid_defsfont_add_preset(fluid_defsfont_t* sfont, fluid_defpreset_t* preset);
 fluid_sample_t* fluid_defsfont_get_sample(fluid_defsfont_t* sfont, char *s);
 
 
+/*
+ * fluid_zone_lut_t
+ *
+ * The zones a note-on of a preset can start, precomputed per key and
+ * velocity band. The bands of key k are key_band[k] .. key_band[k+1]-1
+ * in ascending velocity, band b ending at velocity band_velhi[b], and
+ * the instrument zones of band b, in the order a zone walk would find
+ * them, are pair[band_pair[b]] .. pair[band_pair[b+1]-1]. Allocated in
+ * one block together with the voice templates of the pairs.
+ */
+typedef struct _fluid_zone_pair_t
+{
+  fluid_preset_zone_t* preset_zone;
+  fluid_inst_zone_t* inst_zone;
+  fluid_voice_template_t* templ;           /* what the voice starts with */
+} fluid_zone_pair_t;
+
+typedef struct _fluid_zone_lut_t
+{
+  unsigned short key_band[129];
+  fluid_zone_pair_t* pair;
+  unsigned int* band_pair;
+  unsigned char* band_velhi;
+} fluid_zone_lut_t;
+
+/* presets whose table would hold more pairs than this walk their zones */
+#define FLUID_ZONE_LUT_MAX_PAIRS 65536
+
 /*
  * fluid_preset_t
  */
@@ -508,6 +571,7 @@ struct _fluid_defpreset_t
   unsigned int num;                     /* the preset number */
   fluid_preset_zone_t* global_zone;        /* the global zone of the preset */
   fluid_preset_zone_t* zone;               /* the chained list of preset zones */
+  fluid_zone_lut_t* lut;                   /* note-on lookup, NULL to walk the zones */
 };
 
 fluid_defpreset_t* new_fluid_defpreset(fluid_defsfont_t* sfont);
@@ -522,6 +586,7 @@ int fluid_defpreset_get_banknum(fluid_defpreset_t* preset);
 int fluid_defpreset_get_num(fluid_defpreset_t* preset);
 char* fluid_defpreset_get_name(fluid_defpreset_t* preset);
 int fluid_defpreset_noteon(fluid_defpreset_t* preset, fluid_synth_t* synth, int chan, int key, int vel);
+int fluid_defpreset_build_lut(fluid_defpreset_t* preset);
 
 /*
  * fluid_preset_zone
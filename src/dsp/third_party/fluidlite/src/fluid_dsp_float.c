@@ -40,7 +40,7 @@
  *
  * A couple of variables are used internally, their results are discarded:
  * - dsp_i: Index through the output buffer
- * - dsp_buf: Output buffer of floating point values (FLUID_BUFSIZE in length)
+ * - dsp_buf: Output buffer of floating point values (block_size in length)
  */
 
 #include "fluidsynth_priv.h"
@@ -62,6 +62,606 @@ static fluid_real_t sinc_table7[FLUID_INTERP_MAX][7];
 
 #define SINC_INTERP_ORDER 7	/* 7th order constant */
 
+/* Vectorized runs of the linear, 4th and 7th order loops, see
+ * fluid_dsp_simd.h. A run interpolates as much of a block as it can,
+ * 4 points at a time, and returns the new dsp_i. */
+typedef unsigned int (*fluid_interp_run_t) (const short int *data, fluid_real_t *buf,
+					    unsigned int dsp_i, unsigned int size,
+					    fluid_phase_t *phase,
+					    fluid_phase_t incr, fluid_real_t *amp,
+					    fluid_real_t amp_incr, unsigned int end_index);
+
+/* the runs of the selected kernel, NULL for the scalar loops alone */
+static fluid_interp_run_t interp_run_linear = NULL;
+static fluid_interp_run_t interp_run_4th_order = NULL;
+static fluid_interp_run_t interp_run_7th_order = NULL;
+
+/* The filter state of 4 voices, a voice per lane, for fluid_filter_run */
+typedef struct {
+  fluid_real_t hist1[4], hist2[4];
+  fluid_real_t a1[4], a2[4], b02[4], b1[4];
+  fluid_real_t a1_incr[4], a2_incr[4], b02_incr[4], b1_incr[4];
+} fluid_filter_lanes_t;
+
+typedef void (*fluid_filter_run_t) (fluid_real_t **buf, int size,
+				    fluid_filter_lanes_t *f, int ramp);
+
+/* the filter run of the selected kernel, NULL for one voice at a time */
+static fluid_filter_run_t filter_run = NULL;
+
+static int interp_kernel_request = FLUID_INTERP_KERNEL_AUTO;
+static int filter_lanes_enabled = 1;
+
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define FLUID_DSP_SSE2 1
+#include <emmintrin.h>
+
+#if defined(WITH_FLOAT)
+
+#define fluid_v_t __m128
+#define fluid_v_load(_p) _mm_loadu_ps (_p)
+#define fluid_v_load_s16(_p) fluid_sse2_load_s16 (_p)
+#define fluid_v_set(_a, _b, _c, _d) _mm_setr_ps (_a, _b, _c, _d)
+#define fluid_v_mul(_a, _b) _mm_mul_ps (_a, _b)
+#define fluid_v_add(_a, _b) _mm_add_ps (_a, _b)
+#define fluid_v_sub(_a, _b) _mm_sub_ps (_a, _b)
+#define fluid_v_transpose(_r0, _r1, _r2, _r3) _MM_TRANSPOSE4_PS (_r0, _r1, _r2, _r3)
+#define fluid_v_store(_p, _v) _mm_storeu_ps (_p, _v)
+
+static inline __m128
+fluid_sse2_load_s16 (const short int *p)
+{
+  __m128i v = _mm_loadl_epi64 ((const __m128i *) p);
+  return _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16));
+}
+
+#else /* double */
+
+/* two halves of 2 doubles */
+typedef struct { __m128d lo, hi; } fluid_sse2_v_t;
+
+#define fluid_v_t fluid_sse2_v_t
+#define fluid_v_load(_p) fluid_sse2_load (_p)
+#define fluid_v_load_s16(_p) fluid_sse2_load_s16 (_p)
+#define fluid_v_set(_a, _b, _c, _d) fluid_sse2_set (_a, _b, _c, _d)
+#define fluid_v_mul(_a, _b) fluid_sse2_mul (_a, _b)
+#define fluid_v_add(_a, _b) fluid_sse2_add (_a, _b)
+#define fluid_v_sub(_a, _b) fluid_sse2_sub (_a, _b)
+#define fluid_v_transpose(_r0, _r1, _r2, _r3) fluid_sse2_transpose (&(_r0), &(_r1), &(_r2), &(_r3))
+#define fluid_v_store(_p, _v) fluid_sse2_store (_p, _v)
+
+static inline fluid_sse2_v_t
+fluid_sse2_load (const double *p)
+{
+  fluid_sse2_v_t r;
+  r.lo = _mm_loadu_pd (p);
+  r.hi = _mm_loadu_pd (p + 2);
+  return r;
+}
+
+static inline fluid_sse2_v_t
+fluid_sse2_load_s16 (const short int *p)
+{
+  __m128i v = _mm_loadl_epi64 ((const __m128i *) p);
+  fluid_sse2_v_t r;
+  v = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+  r.lo = _mm_cvtepi32_pd (v);
+  r.hi = _mm_cvtepi32_pd (_mm_shuffle_epi32 (v, _MM_SHUFFLE (3, 2, 3, 2)));
+  return r;
+}
+
+static inline fluid_sse2_v_t
+fluid_sse2_set (double a, double b, double c, double d)
+{
+  fluid_sse2_v_t r;
+  r.lo = _mm_setr_pd (a, b);
+  r.hi = _mm_setr_pd (c, d);
+  return r;
+}
+
+static inline fluid_sse2_v_t
+fluid_sse2_mul (fluid_sse2_v_t a, fluid_sse2_v_t b)
+{
+  a.lo = _mm_mul_pd (a.lo, b.lo);
+  a.hi = _mm_mul_pd (a.hi, b.hi);
+  return a;
+}
+
+static inline fluid_sse2_v_t
+fluid_sse2_add (fluid_sse2_v_t a, fluid_sse2_v_t b)
+{
+  a.lo = _mm_add_pd (a.lo, b.lo);
+  a.hi = _mm_add_pd (a.hi, b.hi);
+  return a;
+}
+
+static inline fluid_sse2_v_t
+fluid_sse2_sub (fluid_sse2_v_t a, fluid_sse2_v_t b)
+{
+  a.lo = _mm_sub_pd (a.lo, b.lo);
+  a.hi = _mm_sub_pd (a.hi, b.hi);
+  return a;
+}
+
+static inline void
+fluid_sse2_transpose (fluid_sse2_v_t *r0, fluid_sse2_v_t *r1,
+		      fluid_sse2_v_t *r2, fluid_sse2_v_t *r3)
+{
+  fluid_sse2_v_t t0 = *r0, t1 = *r1, t2 = *r2, t3 = *r3;
+  r0->lo = _mm_unpacklo_pd (t0.lo, t1.lo);
+  r0->hi = _mm_unpacklo_pd (t2.lo, t3.lo);
+  r1->lo = _mm_unpackhi_pd (t0.lo, t1.lo);
+  r1->hi = _mm_unpackhi_pd (t2.lo, t3.lo);
+  r2->lo = _mm_unpacklo_pd (t0.hi, t1.hi);
+  r2->hi = _mm_unpacklo_pd (t2.hi, t3.hi);
+  r3->lo = _mm_unpackhi_pd (t0.hi, t1.hi);
+  r3->hi = _mm_unpackhi_pd (t2.hi, t3.hi);
+}
+
+static inline void
+fluid_sse2_store (double *p, fluid_sse2_v_t v)
+{
+  _mm_storeu_pd (p, v.lo);
+  _mm_storeu_pd (p + 2, v.hi);
+}
+
+#endif /* WITH_FLOAT */
+
+#define FLUID_SIMD(_name) _name##_sse2
+#define FLUID_SIMD_FN static
+#include "fluid_dsp_simd.h"
+#undef FLUID_SIMD
+#undef FLUID_SIMD_FN
+#undef fluid_v_t
+#undef fluid_v_load
+#undef fluid_v_load_s16
+#undef fluid_v_set
+#undef fluid_v_mul
+#undef fluid_v_add
+#undef fluid_v_sub
+#undef fluid_v_transpose
+#undef fluid_v_store
+
+/* AVX2 doubles the width of the double precision vectors; single
+   precision groups of 4 already fill an SSE register */
+#if !defined(WITH_FLOAT) && (defined(__x86_64__) || defined(__i386__))
+#define FLUID_DSP_AVX2 1
+#include <immintrin.h>
+
+#define FLUID_AVX2_FN static inline __attribute__ ((target ("avx2")))
+
+#define fluid_v_t __m256d
+#define fluid_v_load(_p) _mm256_loadu_pd (_p)
+#define fluid_v_load_s16(_p) fluid_avx2_load_s16 (_p)
+#define fluid_v_set(_a, _b, _c, _d) _mm256_setr_pd (_a, _b, _c, _d)
+#define fluid_v_mul(_a, _b) _mm256_mul_pd (_a, _b)
+#define fluid_v_add(_a, _b) _mm256_add_pd (_a, _b)
+#define fluid_v_sub(_a, _b) _mm256_sub_pd (_a, _b)
+#define fluid_v_transpose(_r0, _r1, _r2, _r3) fluid_avx2_transpose (&(_r0), &(_r1), &(_r2), &(_r3))
+#define fluid_v_store(_p, _v) _mm256_storeu_pd (_p, _v)
+
+FLUID_AVX2_FN __m256d
+fluid_avx2_load_s16 (const short int *p)
+{
+  return _mm256_cvtepi32_pd (_mm_cvtepi16_epi32 (_mm_loadl_epi64 ((const __m128i *) p)));
+}
+
+FLUID_AVX2_FN void
+fluid_avx2_transpose (__m256d *r0, __m256d *r1, __m256d *r2, __m256d *r3)
+{
+  __m256d t0 = _mm256_unpacklo_pd (*r0, *r1);
+  __m256d t1 = _mm256_unpackhi_pd (*r0, *r1);
+  __m256d t2 = _mm256_unpacklo_pd (*r2, *r3);
+  __m256d t3 = _mm256_unpackhi_pd (*r2, *r3);
+  *r0 = _mm256_permute2f128_pd (t0, t2, 0x20);
+  *r1 = _mm256_permute2f128_pd (t1, t3, 0x20);
+  *r2 = _mm256_permute2f128_pd (t0, t2, 0x31);
+  *r3 = _mm256_permute2f128_pd (t1, t3, 0x31);
+}
+
+#define FLUID_SIMD(_name) _name##_avx2
+#define FLUID_SIMD_FN static __attribute__ ((target ("avx2")))
+#include "fluid_dsp_simd.h"
+#undef FLUID_SIMD
+#undef FLUID_SIMD_FN
+#undef fluid_v_t
+#undef fluid_v_load
+#undef fluid_v_load_s16
+#undef fluid_v_set
+#undef fluid_v_mul
+#undef fluid_v_add
+#undef fluid_v_sub
+#undef fluid_v_transpose
+#undef fluid_v_store
+
+#endif /* avx2 */
+#endif /* sse2 */
+
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define FLUID_DSP_NEON 1
+#include <arm_neon.h>
+
+#if defined(WITH_FLOAT)
+
+#define fluid_v_t float32x4_t
+#define fluid_v_load(_p) vld1q_f32 (_p)
+#define fluid_v_load_s16(_p) vcvtq_f32_s32 (vmovl_s16 (vld1_s16 (_p)))
+#define fluid_v_set(_a, _b, _c, _d) fluid_neon_set (_a, _b, _c, _d)
+#define fluid_v_mul(_a, _b) vmulq_f32 (_a, _b)
+#define fluid_v_add(_a, _b) vaddq_f32 (_a, _b)
+#define fluid_v_sub(_a, _b) vsubq_f32 (_a, _b)
+#define fluid_v_transpose(_r0, _r1, _r2, _r3) fluid_neon_transpose (&(_r0), &(_r1), &(_r2), &(_r3))
+#define fluid_v_store(_p, _v) vst1q_f32 (_p, _v)
+
+static inline float32x4_t
+fluid_neon_set (float a, float b, float c, float d)
+{
+  float v[4];
+  v[0] = a; v[1] = b; v[2] = c; v[3] = d;
+  return vld1q_f32 (v);
+}
+
+static inline void
+fluid_neon_transpose (float32x4_t *r0, float32x4_t *r1,
+		      float32x4_t *r2, float32x4_t *r3)
+{
+  float64x2_t t0 = vreinterpretq_f64_f32 (vtrn1q_f32 (*r0, *r1));
+  float64x2_t t1 = vreinterpretq_f64_f32 (vtrn2q_f32 (*r0, *r1));
+  float64x2_t t2 = vreinterpretq_f64_f32 (vtrn1q_f32 (*r2, *r3));
+  float64x2_t t3 = vreinterpretq_f64_f32 (vtrn2q_f32 (*r2, *r3));
+  *r0 = vreinterpretq_f32_f64 (vtrn1q_f64 (t0, t2));
+  *r1 = vreinterpretq_f32_f64 (vtrn1q_f64 (t1, t3));
+  *r2 = vreinterpretq_f32_f64 (vtrn2q_f64 (t0, t2));
+  *r3 = vreinterpretq_f32_f64 (vtrn2q_f64 (t1, t3));
+}
+
+#else /* double */
+
+/* two halves of 2 doubles */
+typedef struct { float64x2_t lo, hi; } fluid_neon_v_t;
+
+#define fluid_v_t fluid_neon_v_t
+#define fluid_v_load(_p) fluid_neon_load (_p)
+#define fluid_v_load_s16(_p) fluid_neon_load_s16 (_p)
+#define fluid_v_set(_a, _b, _c, _d) fluid_neon_set (_a, _b, _c, _d)
+#define fluid_v_mul(_a, _b) fluid_neon_mul (_a, _b)
+#define fluid_v_add(_a, _b) fluid_neon_add (_a, _b)
+#define fluid_v_sub(_a, _b) fluid_neon_sub (_a, _b)
+#define fluid_v_transpose(_r0, _r1, _r2, _r3) fluid_neon_transpose (&(_r0), &(_r1), &(_r2), &(_r3))
+#define fluid_v_store(_p, _v) fluid_neon_store (_p, _v)
+
+static inline fluid_neon_v_t
+fluid_neon_load (const double *p)
+{
+  fluid_neon_v_t r;
+  r.lo = vld1q_f64 (p);
+  r.hi = vld1q_f64 (p + 2);
+  return r;
+}
+
+static inline fluid_neon_v_t
+fluid_neon_load_s16 (const short int *p)
+{
+  int32x4_t v = vmovl_s16 (vld1_s16 (p));
+  fluid_neon_v_t r;
+  r.lo = vcvtq_f64_s64 (vmovl_s32 (vget_low_s32 (v)));
+  r.hi = vcvtq_f64_s64 (vmovl_high_s32 (v));
+  return r;
+}
+
+static inline fluid_neon_v_t
+fluid_neon_set (double a, double b, double c, double d)
+{
+  double v[4];
+  v[0] = a; v[1] = b; v[2] = c; v[3] = d;
+  return fluid_neon_load (v);
+}
+
+static inline fluid_neon_v_t
+fluid_neon_mul (fluid_neon_v_t a, fluid_neon_v_t b)
+{
+  a.lo = vmulq_f64 (a.lo, b.lo);
+  a.hi = vmulq_f64 (a.hi, b.hi);
+  return a;
+}
+
+static inline fluid_neon_v_t
+fluid_neon_add (fluid_neon_v_t a, fluid_neon_v_t b)
+{
+  a.lo = vaddq_f64 (a.lo, b.lo);
+  a.hi = vaddq_f64 (a.hi, b.hi);
+  return a;
+}
+
+static inline fluid_neon_v_t
+fluid_neon_sub (fluid_neon_v_t a, fluid_neon_v_t b)
+{
+  a.lo = vsubq_f64 (a.lo, b.lo);
+  a.hi = vsubq_f64 (a.hi, b.hi);
+  return a;
+}
+
+static inline void
+fluid_neon_transpose (fluid_neon_v_t *r0, fluid_neon_v_t *r1,
+		      fluid_neon_v_t *r2, fluid_neon_v_t *r3)
+{
+  fluid_neon_v_t t0 = *r0, t1 = *r1, t2 = *r2, t3 = *r3;
+  r0->lo = vzip1q_f64 (t0.lo, t1.lo);
+  r0->hi = vzip1q_f64 (t2.lo, t3.lo);
+  r1->lo = vzip2q_f64 (t0.lo, t1.lo);
+  r1->hi = vzip2q_f64 (t2.lo, t3.lo);
+  r2->lo = vzip1q_f64 (t0.hi, t1.hi);
+  r2->hi = vzip1q_f64 (t2.hi, t3.hi);
+  r3->lo = vzip2q_f64 (t0.hi, t1.hi);
+  r3->hi = vzip2q_f64 (t2.hi, t3.hi);
+}
+
+static inline void
+fluid_neon_store (double *p, fluid_neon_v_t v)
+{
+  vst1q_f64 (p, v.lo);
+  vst1q_f64 (p + 2, v.hi);
+}
+
+#endif /* WITH_FLOAT */
+
+#define FLUID_SIMD(_name) _name##_neon
+#define FLUID_SIMD_FN static
+#include "fluid_dsp_simd.h"
+#undef FLUID_SIMD
+#undef FLUID_SIMD_FN
+#undef fluid_v_t
+#undef fluid_v_load
+#undef fluid_v_load_s16
+#undef fluid_v_set
+#undef fluid_v_mul
+#undef fluid_v_add
+#undef fluid_v_sub
+#undef fluid_v_transpose
+#undef fluid_v_store
+
+#endif /* neon */
+
+
+/* Installs the runs of a kernel, or of the best one available if this
+ * build or CPU lacks it, and returns the kernel installed. */
+static int
+fluid_dsp_float_select_kernel (int kernel)
+{
+  int best = FLUID_INTERP_KERNEL_SCALAR;
+
+#if defined(FLUID_DSP_NEON)
+  best = FLUID_INTERP_KERNEL_NEON;
+#elif defined(FLUID_DSP_SSE2)
+  best = FLUID_INTERP_KERNEL_SSE2;
+#if defined(FLUID_DSP_AVX2)
+  if (__builtin_cpu_supports ("avx2")) best = FLUID_INTERP_KERNEL_AVX2;
+#endif
+#endif
+
+  /* only the best kernel and the ones it implies are available */
+  if (kernel != FLUID_INTERP_KERNEL_SCALAR && kernel != best
+      && !(kernel == FLUID_INTERP_KERNEL_SSE2 && best == FLUID_INTERP_KERNEL_AVX2))
+    kernel = best;
+
+  switch (kernel)
+  {
+#if defined(FLUID_DSP_NEON)
+  case FLUID_INTERP_KERNEL_NEON:
+    interp_run_linear = fluid_interp_run_linear_neon;
+    interp_run_4th_order = fluid_interp_run_4th_order_neon;
+    interp_run_7th_order = fluid_interp_run_7th_order_neon;
+    filter_run = fluid_filter_run_neon;
+    break;
+#endif
+#if defined(FLUID_DSP_SSE2)
+  case FLUID_INTERP_KERNEL_SSE2:
+    interp_run_linear = fluid_interp_run_linear_sse2;
+    interp_run_4th_order = fluid_interp_run_4th_order_sse2;
+    interp_run_7th_order = fluid_interp_run_7th_order_sse2;
+    filter_run = fluid_filter_run_sse2;
+    break;
+#endif
+#if defined(FLUID_DSP_AVX2)
+  case FLUID_INTERP_KERNEL_AVX2:
+    interp_run_linear = fluid_interp_run_linear_avx2;
+    interp_run_4th_order = fluid_interp_run_4th_order_avx2;
+    interp_run_7th_order = fluid_interp_run_7th_order_avx2;
+    filter_run = fluid_filter_run_avx2;
+    break;
+#endif
+  default:
+    kernel = FLUID_INTERP_KERNEL_SCALAR;
+    interp_run_linear = NULL;
+    interp_run_4th_order = NULL;
+    interp_run_7th_order = NULL;
+    filter_run = NULL;
+    break;
+  }
+
+  return kernel;
+}
+
+int
+fluid_set_interp_kernel (int kernel)
+{
+  interp_kernel_request = kernel;
+  return fluid_dsp_float_select_kernel (kernel);
+}
+
+void
+fluid_set_filter_lanes (int enable)
+{
+  filter_lanes_enabled = enable;
+}
+
+/* whether fluid_dsp_float_filter() runs */
+int
+fluid_dsp_float_filter_lanes (void)
+{
+  return filter_lanes_enabled && (filter_run != NULL);
+}
+
+/*
+ * fluid_dsp_float_filter
+ *
+ * Runs the filters of up to FLUID_FILTER_LANES voices side by side over
+ * their dsp_buf, one voice per lane of the selected kernel, in place of
+ * the filter fluid_voice_finish() would run. Each voice must pass
+ * fluid_voice_filter_lane() and have a whole block in dsp_buf, its
+ * 'count' points followed by zeros. Returns FLUID_FAILED, and filters
+ * nothing, if the kernel has no lanes.
+ */
+int
+fluid_dsp_float_filter (fluid_voice_t **voices, int *count, int n)
+{
+  fluid_filter_lanes_t f;
+  fluid_real_t pad[FLUID_MAX_BUFSIZE];
+  fluid_real_t *buf[4];
+  fluid_voice_t *voice;
+  int size, ramp = 0;
+  int k;
+
+  if (!fluid_dsp_float_filter_lanes () || n > FLUID_FILTER_LANES) return FLUID_FAILED;
+
+  size = voices[0]->block_size;
+
+  for (k = 0; k < n; k++)
+  {
+    voice = voices[k];
+    buf[k] = voice->dsp_buf;
+
+    /* Check for denormal number (too close to zero). */
+    f.hist1[k] = (fabs (voice->hist1) < 1e-20) ? 0.0f : voice->hist1;
+    f.hist2[k] = voice->hist2;
+    f.a1[k] = voice->a1;
+    f.a2[k] = voice->a2;
+    f.b02[k] = voice->b02;
+    f.b1[k] = voice->b1;
+
+    if (voice->filter_coeff_incr_count > 0)
+    {
+      f.a1_incr[k] = voice->a1_incr;
+      f.a2_incr[k] = voice->a2_incr;
+      f.b02_incr[k] = voice->b02_incr;
+      f.b1_incr[k] = voice->b1_incr;
+      ramp = 1;
+    }
+    else
+      f.a1_incr[k] = f.a2_incr[k] = f.b02_incr[k] = f.b1_incr[k] = 0.0f;
+  }
+
+  /* idle lanes filter silence */
+  if (n < 4) FLUID_MEMSET (pad, 0, size * sizeof (fluid_real_t));
+  for ( ; k < 4; k++)
+  {
+    buf[k] = pad;
+    f.hist1[k] = f.hist2[k] = 0.0f;
+    f.a1[k] = f.a2[k] = f.b02[k] = f.b1[k] = 0.0f;
+    f.a1_incr[k] = f.a2_incr[k] = f.b02_incr[k] = f.b1_incr[k] = 0.0f;
+  }
+
+  filter_run (buf, size, &f, ramp);
+
+  for (k = 0; k < n; k++)
+  {
+    voice = voices[k];
+    voice->hist1 = f.hist1[k];
+    voice->hist2 = f.hist2[k];
+    if (voice->filter_coeff_incr_count > 0)
+    {
+      voice->a1 = f.a1[k];
+      voice->a2 = f.a2[k];
+      voice->b02 = f.b02[k];
+      voice->b1 = f.b1[k];
+      voice->filter_coeff_incr_count -= count[k];
+    }
+  }
+
+  return FLUID_OK;
+}
+
+/*
+ * fluid_dsp_float_write_s16
+ *
+ * Writes n frames of left and right to out, interleaved, each point
+ * rounded to single precision, clamped to [-1, 1], scaled by 32767 and
+ * truncated: what (short) (x * 32767.0f) gives for a clamped float x.
+ * The vector loops take 8 frames at a time, the scalar loop the rest.
+ */
+void
+fluid_dsp_float_write_s16 (const fluid_real_t *left, const fluid_real_t *right,
+			   short int *out, int n)
+{
+  float l, r;
+  int i = 0;
+
+#if defined(FLUID_DSP_SSE2)
+  const __m128 one = _mm_set1_ps (1.0f);
+  const __m128 minus_one = _mm_set1_ps (-1.0f);
+  const __m128 scale = _mm_set1_ps (32767.0f);
+  __m128i l16, r16;
+
+  /* 4 points as single precision */
+#if defined(WITH_FLOAT)
+#define FLUID_S16_LOAD(_p) _mm_loadu_ps (_p)
+#else
+#define FLUID_S16_LOAD(_p) \
+  _mm_movelh_ps (_mm_cvtpd_ps (_mm_loadu_pd (_p)), _mm_cvtpd_ps (_mm_loadu_pd ((_p) + 2)))
+#endif
+  /* 4 points clamped, scaled and truncated */
+#define FLUID_S16_CONVERT(_p) \
+  _mm_cvttps_epi32 (_mm_mul_ps (_mm_min_ps (_mm_max_ps (FLUID_S16_LOAD (_p), minus_one), one), scale))
+
+  for ( ; i + 8 <= n; i += 8)
+  {
+    l16 = _mm_packs_epi32 (FLUID_S16_CONVERT (left + i), FLUID_S16_CONVERT (left + i + 4));
+    r16 = _mm_packs_epi32 (FLUID_S16_CONVERT (right + i), FLUID_S16_CONVERT (right + i + 4));
+    _mm_storeu_si128 ((__m128i *) (out + 2 * i), _mm_unpacklo_epi16 (l16, r16));
+    _mm_storeu_si128 ((__m128i *) (out + 2 * i + 8), _mm_unpackhi_epi16 (l16, r16));
+  }
+#undef FLUID_S16_CONVERT
+#undef FLUID_S16_LOAD
+
+#elif defined(FLUID_DSP_NEON)
+  int16x8x2_t lr;
+
+#if defined(WITH_FLOAT)
+#define FLUID_S16_LOAD(_p) vld1q_f32 (_p)
+#else
+#define FLUID_S16_LOAD(_p) \
+  vcvt_high_f32_f64 (vcvt_f32_f64 (vld1q_f64 (_p)), vld1q_f64 ((_p) + 2))
+#endif
+#define FLUID_S16_CONVERT(_p) \
+  vqmovn_s32 (vcvtq_s32_f32 (vmulq_n_f32 (vminq_f32 (vmaxq_f32 (FLUID_S16_LOAD (_p), \
+								  vdupq_n_f32 (-1.0f)), \
+							vdupq_n_f32 (1.0f)), 32767.0f)))
+
+  for ( ; i + 8 <= n; i += 8)
+  {
+    lr.val[0] = vcombine_s16 (FLUID_S16_CONVERT (left + i), FLUID_S16_CONVERT (left + i + 4));
+    lr.val[1] = vcombine_s16 (FLUID_S16_CONVERT (right + i), FLUID_S16_CONVERT (right + i + 4));
+    vst2q_s16 (out + 2 * i, lr);
+  }
+#undef FLUID_S16_CONVERT
+#undef FLUID_S16_LOAD
+#endif
+
+  for ( ; i < n; i++)
+  {
+    l = (float) left[i];
+    r = (float) right[i];
+    if (l > 1.0f) l = 1.0f;
+    if (l < -1.0f) l = -1.0f;
+    if (r > 1.0f) r = 1.0f;
+    if (r < -1.0f) r = -1.0f;
+    out[2 * i] = (short int) (l * 32767.0f);
+    out[2 * i + 1] = (short int) (r * 32767.0f);
+  }
+}
+
 
 /* Initializes interpolation tables */
 void fluid_dsp_float_config (void)
@@ -110,6 +710,8 @@ void fluid_dsp_float_config (void)
     }
   }
 
+  fluid_dsp_float_select_kernel (interp_kernel_request);
+
 #if 0
   for (i = 0; i < FLUID_INTERP_MAX; i++)
   {
@@ -129,11 +731,12 @@ fluid_dsp_float_interpolate_none (fluid_voice_t *voice)
 {
   fluid_phase_t dsp_phase = voice->phase;
   fluid_phase_t dsp_phase_incr;
-  short int *dsp_data = voice->sample->data;
+  short int *dsp_data = voice->dsp_data;
   fluid_real_t *dsp_buf = voice->dsp_buf;
   fluid_real_t dsp_amp = voice->amp;
   fluid_real_t dsp_amp_incr = voice->amp_incr;
   unsigned int dsp_i = 0;
+  unsigned int size = voice->block_size;
   unsigned int dsp_phase_index;
   unsigned int end_index;
   int looping;
@@ -153,7 +756,7 @@ fluid_dsp_float_interpolate_none (fluid_voice_t *voice)
     dsp_phase_index = fluid_phase_index_round (dsp_phase);	/* round to nearest point */
 
     /* interpolate sequence of sample points */
-    for ( ; dsp_i < FLUID_BUFSIZE && dsp_phase_index <= end_index; dsp_i++)
+    for ( ; dsp_i < size && dsp_phase_index <= end_index; dsp_i++)
     {
       dsp_buf[dsp_i] = dsp_amp * dsp_data[dsp_phase_index];
 
@@ -174,7 +777,7 @@ fluid_dsp_float_interpolate_none (fluid_voice_t *voice)
     }
 
     /* break out if filled buffer */
-    if (dsp_i >= FLUID_BUFSIZE) break;
+    if (dsp_i >= size) break;
   }
 
   voice->phase = dsp_phase;
@@ -183,503 +786,288 @@ fluid_dsp_float_interpolate_none (fluid_voice_t *voice)
   return (dsp_i);
 }
 
-/* Straight line interpolation.
- * Returns number of samples processed (usually FLUID_BUFSIZE but could be
- * smaller if end of sample occurs).
- */
-int
-fluid_dsp_float_interpolate_linear (fluid_voice_t *voice)
+/* The scalar loops. Each interpolates from 'data' until the block is
+ * full or the phase index passes end_index, with no special points: the
+ * interpolation below hands them segments in which every point read is
+ * in 'data'. */
+
+static unsigned int
+fluid_interp_run_linear (const short int *data, fluid_real_t *buf,
+			 unsigned int dsp_i, unsigned int size,
+			 fluid_phase_t *phase,
+			 fluid_phase_t incr, fluid_real_t *amp,
+			 fluid_real_t amp_incr, unsigned int end_index)
 {
-  fluid_phase_t dsp_phase = voice->phase;
-  fluid_phase_t dsp_phase_incr;
-  short int *dsp_data = voice->sample->data;
-  fluid_real_t *dsp_buf = voice->dsp_buf;
-  fluid_real_t dsp_amp = voice->amp;
-  fluid_real_t dsp_amp_incr = voice->amp_incr;
-  unsigned int dsp_i = 0;
-  unsigned int dsp_phase_index;
-  unsigned int end_index;
-  short int point;
+  fluid_phase_t dsp_phase = *phase;
+  fluid_real_t dsp_amp = *amp;
+  unsigned int dsp_phase_index = fluid_phase_index (dsp_phase);
   fluid_real_t *coeffs;
-  int looping;
 
-  /* Convert playback "speed" floating point value to phase index/fract */
-  fluid_phase_set_float (dsp_phase_incr, voice->phase_incr);
+  for ( ; dsp_i < size && dsp_phase_index <= end_index; dsp_i++)
+  {
+    coeffs = interp_coeff_linear[fluid_phase_fract_to_tablerow (dsp_phase)];
+    buf[dsp_i] = dsp_amp * (coeffs[0] * data[dsp_phase_index]
+			    + coeffs[1] * data[dsp_phase_index+1]);
 
-  /* voice is currently looping? */
-  looping = _SAMPLEMODE (voice) == FLUID_LOOP_DURING_RELEASE
-    || (_SAMPLEMODE (voice) == FLUID_LOOP_UNTIL_RELEASE
-	&& voice->volenv_section < FLUID_VOICE_ENVRELEASE);
+    /* increment phase and amplitude */
+    fluid_phase_incr (dsp_phase, incr);
+    dsp_phase_index = fluid_phase_index (dsp_phase);
+    dsp_amp += amp_incr;
+  }
 
-  /* last index before 2nd interpolation point must be specially handled */
-  end_index = (looping ? voice->loopend - 1 : voice->end) - 1;
+  *phase = dsp_phase;
+  *amp = dsp_amp;
+  return dsp_i;
+}
 
-  /* 2nd interpolation point to use at end of loop or sample */
-  if (looping) point = dsp_data[voice->loopstart];	/* loop start */
-  else point = dsp_data[voice->end];			/* duplicate end for samples no longer looping */
+static unsigned int
+fluid_interp_run_4th_order (const short int *data, fluid_real_t *buf,
+			    unsigned int dsp_i, unsigned int size,
+			    fluid_phase_t *phase,
+			    fluid_phase_t incr, fluid_real_t *amp,
+			    fluid_real_t amp_incr, unsigned int end_index)
+{
+  fluid_phase_t dsp_phase = *phase;
+  fluid_real_t dsp_amp = *amp;
+  unsigned int dsp_phase_index = fluid_phase_index (dsp_phase);
+  fluid_real_t *coeffs;
 
-  while (1)
+  for ( ; dsp_i < size && dsp_phase_index <= end_index; dsp_i++)
   {
+    coeffs = interp_coeff[fluid_phase_fract_to_tablerow (dsp_phase)];
+    buf[dsp_i] = dsp_amp * (coeffs[0] * data[dsp_phase_index-1]
+			    + coeffs[1] * data[dsp_phase_index]
+			    + coeffs[2] * data[dsp_phase_index+1]
+			    + coeffs[3] * data[dsp_phase_index+2]);
+
+    /* increment phase and amplitude */
+    fluid_phase_incr (dsp_phase, incr);
     dsp_phase_index = fluid_phase_index (dsp_phase);
+    dsp_amp += amp_incr;
+  }
 
-    /* interpolate the sequence of sample points */
-    for ( ; dsp_i < FLUID_BUFSIZE && dsp_phase_index <= end_index; dsp_i++)
-    {
-      coeffs = interp_coeff_linear[fluid_phase_fract_to_tablerow (dsp_phase)];
-      dsp_buf[dsp_i] = dsp_amp * (coeffs[0] * dsp_data[dsp_phase_index]
-				  + coeffs[1] * dsp_data[dsp_phase_index+1]);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
-    }
-
-    /* break out if buffer filled */
-    if (dsp_i >= FLUID_BUFSIZE) break;
-
-    end_index++;	/* we're now interpolating the last point */
-
-    /* interpolate within last point */
-    for (; dsp_phase_index <= end_index && dsp_i < FLUID_BUFSIZE; dsp_i++)
-    {
-      coeffs = interp_coeff_linear[fluid_phase_fract_to_tablerow (dsp_phase)];
-      dsp_buf[dsp_i] = dsp_amp * (coeffs[0] * dsp_data[dsp_phase_index]
-				  + coeffs[1] * point);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;	/* increment amplitude */
-    }
-
-    if (!looping) break;	/* break out if not looping (end of sample) */
-
-    /* go back to loop start (if past */
-    if (dsp_phase_index > end_index)
-    {
-      fluid_phase_sub_int (dsp_phase, voice->loopend - voice->loopstart);
-      voice->has_looped = 1;
-    }
+  *phase = dsp_phase;
+  *amp = dsp_amp;
+  return dsp_i;
+}
 
-    /* break out if filled buffer */
-    if (dsp_i >= FLUID_BUFSIZE) break;
+static unsigned int
+fluid_interp_run_7th_order (const short int *data, fluid_real_t *buf,
+			    unsigned int dsp_i, unsigned int size,
+			    fluid_phase_t *phase,
+			    fluid_phase_t incr, fluid_real_t *amp,
+			    fluid_real_t amp_incr, unsigned int end_index)
+{
+  fluid_phase_t dsp_phase = *phase;
+  fluid_real_t dsp_amp = *amp;
+  unsigned int dsp_phase_index = fluid_phase_index (dsp_phase);
+  fluid_real_t *coeffs;
 
-    end_index--;	/* set end back to second to last sample point */
+  for ( ; dsp_i < size && dsp_phase_index <= end_index; dsp_i++)
+  {
+    coeffs = sinc_table7[fluid_phase_fract_to_tablerow (dsp_phase)];
+
+    buf[dsp_i] = dsp_amp
+      * (coeffs[0] * (fluid_real_t)data[dsp_phase_index-3]
+	 + coeffs[1] * (fluid_real_t)data[dsp_phase_index-2]
+	 + coeffs[2] * (fluid_real_t)data[dsp_phase_index-1]
+	 + coeffs[3] * (fluid_real_t)data[dsp_phase_index]
+	 + coeffs[4] * (fluid_real_t)data[dsp_phase_index+1]
+	 + coeffs[5] * (fluid_real_t)data[dsp_phase_index+2]
+	 + coeffs[6] * (fluid_real_t)data[dsp_phase_index+3]);
+
+    /* increment phase and amplitude */
+    fluid_phase_incr (dsp_phase, incr);
+    dsp_phase_index = fluid_phase_index (dsp_phase);
+    dsp_amp += amp_incr;
   }
 
-  voice->phase = dsp_phase;
-  voice->amp = dsp_amp;
+  *phase = dsp_phase;
+  *amp = dsp_amp;
+  return dsp_i;
+}
 
-  return (dsp_i);
+/*
+ * fluid_interp_order_t
+ *
+ * The reach of an interpolation: the points read before and after the
+ * one the phase index is in.
+ */
+typedef struct {
+  unsigned int before;
+  unsigned int after;
+  fluid_phase_t offset;		/* added to the phase while interpolating */
+  fluid_interp_run_t run;	/* the scalar loop */
+} fluid_interp_order_t;
+
+static const fluid_interp_order_t interp_order_linear = {
+  0, 1, 0, fluid_interp_run_linear
+};
+static const fluid_interp_order_t interp_order_4th = {
+  1, 2, 0, fluid_interp_run_4th_order
+};
+/* 7th order interpolation is centered on the 4th sample point, so
+   it runs half a sample ahead */
+static const fluid_interp_order_t interp_order_7th = {
+  3, 3, 0x80000000, fluid_interp_run_7th_order
+};
+
+/* points in a segment gathered at the start or end, 2 * 3 + 3 at most */
+#define FLUID_INTERP_EDGE 16
+
+/* interpolates one segment: the vectorized run first, if any, and the
+   scalar loop for what it leaves */
+static FLUID_INLINE unsigned int
+fluid_interp_segment (const fluid_interp_order_t *order, fluid_interp_run_t simd,
+		      const short int *data, fluid_real_t *buf,
+		      unsigned int dsp_i, unsigned int size,
+		      fluid_phase_t *phase,
+		      fluid_phase_t incr, fluid_real_t *amp,
+		      fluid_real_t amp_incr, unsigned int end_index)
+{
+  if (simd != NULL)
+    dsp_i = simd (data, buf, dsp_i, size, phase, incr, amp, amp_incr, end_index);
+  return order->run (data, buf, dsp_i, size, phase, incr, amp, amp_incr, end_index);
 }
 
-/* 4th order (cubic) interpolation.
- * Returns number of samples processed (usually FLUID_BUFSIZE but could be
+/* Interpolation of a voice.
+ *
+ * The phase moves through the points 'first' to 'last': the sample, or
+ * the loop while looping. Interpolating the first and last few of them
+ * reads points beyond: the end of the loop once the voice has looped and
+ * copies of the start point before it has, the loop start while looping
+ * and copies of the end point after that. Those edges are interpolated
+ * from a small segment gathered with the points they read, and the rest
+ * straight from the sample data, so every segment runs the same loop.
+ *
+ * Returns number of samples processed (usually block_size but could be
  * smaller if end of sample occurs).
  */
-int
-fluid_dsp_float_interpolate_4th_order (fluid_voice_t *voice)
+static FLUID_INLINE int
+fluid_dsp_float_interpolate (fluid_voice_t *voice, const fluid_interp_order_t *order,
+			     fluid_interp_run_t simd)
 {
   fluid_phase_t dsp_phase = voice->phase;
   fluid_phase_t dsp_phase_incr;
-  short int *dsp_data = voice->sample->data;
+  short int *dsp_data = voice->dsp_data;
   fluid_real_t *dsp_buf = voice->dsp_buf;
   fluid_real_t dsp_amp = voice->amp;
   fluid_real_t dsp_amp_incr = voice->amp_incr;
   unsigned int dsp_i = 0;
+  unsigned int size = voice->block_size;
   unsigned int dsp_phase_index;
-  unsigned int start_index, end_index;
-  short int start_point, end_point1, end_point2;
-  fluid_real_t *coeffs;
+  unsigned int first, last, lo, n, k;
+  short int edge[FLUID_INTERP_EDGE];
   int looping;
 
   /* Convert playback "speed" floating point value to phase index/fract */
   fluid_phase_set_float (dsp_phase_incr, voice->phase_incr);
+  fluid_phase_incr (dsp_phase, order->offset);
 
   /* voice is currently looping? */
   looping = _SAMPLEMODE (voice) == FLUID_LOOP_DURING_RELEASE
     || (_SAMPLEMODE (voice) == FLUID_LOOP_UNTIL_RELEASE
 	&& voice->volenv_section < FLUID_VOICE_ENVRELEASE);
 
-  /* last index before 4th interpolation point must be specially handled */
-  end_index = (looping ? voice->loopend - 1 : voice->end) - 2;
-
-  if (voice->has_looped)	/* set start_index and start point if looped or not */
-  {
-    start_index = voice->loopstart;
-    start_point = dsp_data[voice->loopend - 1];	/* last point in loop (wrap around) */
-  }
-  else
-  {
-    start_index = voice->start;
-    start_point = dsp_data[voice->start];	/* just duplicate the point */
-  }
-
-  /* get points off the end (loop start if looping, duplicate point if end) */
-  if (looping)
-  {
-    end_point1 = dsp_data[voice->loopstart];
-    end_point2 = dsp_data[voice->loopstart + 1];
-  }
-  else
-  {
-    end_point1 = dsp_data[voice->end];
-    end_point2 = end_point1;
-  }
+  first = voice->has_looped ? voice->loopstart : voice->start;
+  last = looping ? voice->loopend - 1 : voice->end;
 
   while (1)
   {
     dsp_phase_index = fluid_phase_index (dsp_phase);
 
-    /* interpolate first sample point (start or loop start) if needed */
-    for ( ; dsp_phase_index == start_index && dsp_i < FLUID_BUFSIZE; dsp_i++)
+    /* the first points, from the points before them and the ones they
+       reach after */
+    if (dsp_phase_index >= first && dsp_phase_index - first < order->before)
     {
-      coeffs = interp_coeff[fluid_phase_fract_to_tablerow (dsp_phase)];
-      dsp_buf[dsp_i] = dsp_amp * (coeffs[0] * start_point
-				  + coeffs[1] * dsp_data[dsp_phase_index]
-				  + coeffs[2] * dsp_data[dsp_phase_index+1]
-				  + coeffs[3] * dsp_data[dsp_phase_index+2]);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
+      lo = first - order->before;
+      n = 2 * order->before + order->after;
+      for (k = 0; k < order->before; k++)
+	edge[k] = voice->has_looped ? dsp_data[voice->loopend - order->before + k]
+	  : dsp_data[voice->start];
+      FLUID_MEMCPY (edge + order->before, dsp_data + first,
+		    (n - order->before) * sizeof (short int));
+
+      fluid_phase_sub_int (dsp_phase, lo);
+      dsp_i = fluid_interp_segment (order, simd, edge, dsp_buf, dsp_i, size, &dsp_phase,
+				    dsp_phase_incr, &dsp_amp, dsp_amp_incr,
+				    first + order->before - 1 - lo);
+      fluid_phase_incr (dsp_phase, fluid_phase_from_index_fract (lo, 0));
     }
 
     /* interpolate the sequence of sample points */
-    for ( ; dsp_i < FLUID_BUFSIZE && dsp_phase_index <= end_index; dsp_i++)
-    {
-      coeffs = interp_coeff[fluid_phase_fract_to_tablerow (dsp_phase)];
-      dsp_buf[dsp_i] = dsp_amp * (coeffs[0] * dsp_data[dsp_phase_index-1]
-				  + coeffs[1] * dsp_data[dsp_phase_index]
-				  + coeffs[2] * dsp_data[dsp_phase_index+1]
-				  + coeffs[3] * dsp_data[dsp_phase_index+2]);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
-    }
+    dsp_i = fluid_interp_segment (order, simd, dsp_data, dsp_buf, dsp_i, size, &dsp_phase,
+				  dsp_phase_incr, &dsp_amp, dsp_amp_incr,
+				  last - order->after);
 
     /* break out if buffer filled */
-    if (dsp_i >= FLUID_BUFSIZE) break;
-
-    end_index++;	/* we're now interpolating the 2nd to last point */
+    if (dsp_i >= size) break;
 
-    /* interpolate within 2nd to last point */
-    for (; dsp_phase_index <= end_index && dsp_i < FLUID_BUFSIZE; dsp_i++)
-    {
-      coeffs = interp_coeff[fluid_phase_fract_to_tablerow (dsp_phase)];
-      dsp_buf[dsp_i] = dsp_amp * (coeffs[0] * dsp_data[dsp_phase_index-1]
-				  + coeffs[1] * dsp_data[dsp_phase_index]
-				  + coeffs[2] * dsp_data[dsp_phase_index+1]
-				  + coeffs[3] * end_point1);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
-    }
-
-    end_index++;	/* we're now interpolating the last point */
-
-    /* interpolate within the last point */
-    for (; dsp_phase_index <= end_index && dsp_i < FLUID_BUFSIZE; dsp_i++)
+    /* the last points, from the points they reach before and the ones
+       after them */
+    dsp_phase_index = fluid_phase_index (dsp_phase);
+    if (dsp_phase_index <= last)
     {
-      coeffs = interp_coeff[fluid_phase_fract_to_tablerow (dsp_phase)];
-      dsp_buf[dsp_i] = dsp_amp * (coeffs[0] * dsp_data[dsp_phase_index-1]
-				  + coeffs[1] * dsp_data[dsp_phase_index]
-				  + coeffs[2] * end_point1
-				  + coeffs[3] * end_point2);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
+      lo = dsp_phase_index - order->before;
+      n = last + 1 - lo;
+      FLUID_MEMCPY (edge, dsp_data + lo, n * sizeof (short int));
+      for (k = 0; k < order->after; k++)
+	edge[n + k] = looping ? dsp_data[voice->loopstart + k] : dsp_data[voice->end];
+
+      fluid_phase_sub_int (dsp_phase, lo);
+      dsp_i = fluid_interp_segment (order, simd, edge, dsp_buf, dsp_i, size, &dsp_phase,
+				    dsp_phase_incr, &dsp_amp, dsp_amp_incr, last - lo);
+      fluid_phase_incr (dsp_phase, fluid_phase_from_index_fract (lo, 0));
     }
 
     if (!looping) break;	/* break out if not looping (end of sample) */
 
     /* go back to loop start */
-    if (dsp_phase_index > end_index)
+    if (fluid_phase_index (dsp_phase) > last)
     {
       fluid_phase_sub_int (dsp_phase, voice->loopend - voice->loopstart);
-
-      if (!voice->has_looped)
-      {
-	voice->has_looped = 1;
-	start_index = voice->loopstart;
-	start_point = dsp_data[voice->loopend - 1];
-      }
+      voice->has_looped = 1;
+      first = voice->loopstart;
     }
 
     /* break out if filled buffer */
-    if (dsp_i >= FLUID_BUFSIZE) break;
-
-    end_index -= 2;	/* set end back to third to last sample point */
+    if (dsp_i >= size) break;
   }
 
+  fluid_phase_decr (dsp_phase, order->offset);
+
   voice->phase = dsp_phase;
   voice->amp = dsp_amp;
 
   return (dsp_i);
 }
 
-/* 7th order interpolation.
- * Returns number of samples processed (usually FLUID_BUFSIZE but could be
+/* Straight line interpolation.
+ * Returns number of samples processed (usually block_size but could be
  * smaller if end of sample occurs).
  */
 int
-fluid_dsp_float_interpolate_7th_order (fluid_voice_t *voice)
+fluid_dsp_float_interpolate_linear (fluid_voice_t *voice)
 {
-  fluid_phase_t dsp_phase = voice->phase;
-  fluid_phase_t dsp_phase_incr;
-  short int *dsp_data = voice->sample->data;
-  fluid_real_t *dsp_buf = voice->dsp_buf;
-  fluid_real_t dsp_amp = voice->amp;
-  fluid_real_t dsp_amp_incr = voice->amp_incr;
-  unsigned int dsp_i = 0;
-  unsigned int dsp_phase_index;
-  unsigned int start_index, end_index;
-  short int start_points[3];
-  short int end_points[3];
-  fluid_real_t *coeffs;
-  int looping;
-
-  /* Convert playback "speed" floating point value to phase index/fract */
-  fluid_phase_set_float (dsp_phase_incr, voice->phase_incr);
-
-  /* add 1/2 sample to dsp_phase since 7th order interpolation is centered on
-   * the 4th sample point */
-  fluid_phase_incr (dsp_phase, (fluid_phase_t)0x80000000);
-
-  /* voice is currently looping? */
-  looping = _SAMPLEMODE (voice) == FLUID_LOOP_DURING_RELEASE
-    || (_SAMPLEMODE (voice) == FLUID_LOOP_UNTIL_RELEASE
-	&& voice->volenv_section < FLUID_VOICE_ENVRELEASE);
-
-  /* last index before 7th interpolation point must be specially handled */
-  end_index = (looping ? voice->loopend - 1 : voice->end) - 3;
-
-  if (voice->has_looped)	/* set start_index and start point if looped or not */
-  {
-    start_index = voice->loopstart;
-    start_points[0] = dsp_data[voice->loopend - 1];
-    start_points[1] = dsp_data[voice->loopend - 2];
-    start_points[2] = dsp_data[voice->loopend - 3];
-  }
-  else
-  {
-    start_index = voice->start;
-    start_points[0] = dsp_data[voice->start];	/* just duplicate the start point */
-    start_points[1] = start_points[0];
-    start_points[2] = start_points[0];
-  }
-
-  /* get the 3 points off the end (loop start if looping, duplicate point if end) */
-  if (looping)
-  {
-    end_points[0] = dsp_data[voice->loopstart];
-    end_points[1] = dsp_data[voice->loopstart + 1];
-    end_points[2] = dsp_data[voice->loopstart + 2];
-  }
-  else
-  {
-    end_points[0] = dsp_data[voice->end];
-    end_points[1] = end_points[0];
-    end_points[2] = end_points[0];
-  }
-
-  while (1)
-  {
-    dsp_phase_index = fluid_phase_index (dsp_phase);
-
-    /* interpolate first sample point (start or loop start) if needed */
-    for ( ; dsp_phase_index == start_index && dsp_i < FLUID_BUFSIZE; dsp_i++)
-    {
-      coeffs = sinc_table7[fluid_phase_fract_to_tablerow (dsp_phase)];
-
-      dsp_buf[dsp_i] = dsp_amp
-	* (coeffs[0] * (fluid_real_t)start_points[2]
-	   + coeffs[1] * (fluid_real_t)start_points[1]
-	   + coeffs[2] * (fluid_real_t)start_points[0]
-	   + coeffs[3] * (fluid_real_t)dsp_data[dsp_phase_index]
-	   + coeffs[4] * (fluid_real_t)dsp_data[dsp_phase_index+1]
-	   + coeffs[5] * (fluid_real_t)dsp_data[dsp_phase_index+2]
-	   + coeffs[6] * (fluid_real_t)dsp_data[dsp_phase_index+3]);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
-    }
-
-    start_index++;
-
-    /* interpolate 2nd to first sample point (start or loop start) if needed */
-    for ( ; dsp_phase_index == start_index && dsp_i < FLUID_BUFSIZE; dsp_i++)
-    {
-      coeffs = sinc_table7[fluid_phase_fract_to_tablerow (dsp_phase)];
-
-      dsp_buf[dsp_i] = dsp_amp
-	* (coeffs[0] * (fluid_real_t)start_points[1]
-	   + coeffs[1] * (fluid_real_t)start_points[0]
-	   + coeffs[2] * (fluid_real_t)dsp_data[dsp_phase_index-1]
-	   + coeffs[3] * (fluid_real_t)dsp_data[dsp_phase_index]
-	   + coeffs[4] * (fluid_real_t)dsp_data[dsp_phase_index+1]
-	   + coeffs[5] * (fluid_real_t)dsp_data[dsp_phase_index+2]
-	   + coeffs[6] * (fluid_real_t)dsp_data[dsp_phase_index+3]);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
-    }
-
-    start_index++;
-
-    /* interpolate 3rd to first sample point (start or loop start) if needed */
-    for ( ; dsp_phase_index == start_index && dsp_i < FLUID_BUFSIZE; dsp_i++)
-    {
-      coeffs = sinc_table7[fluid_phase_fract_to_tablerow (dsp_phase)];
-
-      dsp_buf[dsp_i] = dsp_amp
-	* (coeffs[0] * (fluid_real_t)start_points[0]
-	   + coeffs[1] * (fluid_real_t)dsp_data[dsp_phase_index-2]
-	   + coeffs[2] * (fluid_real_t)dsp_data[dsp_phase_index-1]
-	   + coeffs[3] * (fluid_real_t)dsp_data[dsp_phase_index]
-	   + coeffs[4] * (fluid_real_t)dsp_data[dsp_phase_index+1]
-	   + coeffs[5] * (fluid_real_t)dsp_data[dsp_phase_index+2]
-	   + coeffs[6] * (fluid_real_t)dsp_data[dsp_phase_index+3]);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
-    }
-
-    start_index -= 2;	/* set back to original start index */
-
-
-    /* interpolate the sequence of sample points */
-    for ( ; dsp_i < FLUID_BUFSIZE && dsp_phase_index <= end_index; dsp_i++)
-    {
-      coeffs = sinc_table7[fluid_phase_fract_to_tablerow (dsp_phase)];
-
-      dsp_buf[dsp_i] = dsp_amp
-	* (coeffs[0] * (fluid_real_t)dsp_data[dsp_phase_index-3]
-	   + coeffs[1] * (fluid_real_t)dsp_data[dsp_phase_index-2]
-	   + coeffs[2] * (fluid_real_t)dsp_data[dsp_phase_index-1]
-	   + coeffs[3] * (fluid_real_t)dsp_data[dsp_phase_index]
-	   + coeffs[4] * (fluid_real_t)dsp_data[dsp_phase_index+1]
-	   + coeffs[5] * (fluid_real_t)dsp_data[dsp_phase_index+2]
-	   + coeffs[6] * (fluid_real_t)dsp_data[dsp_phase_index+3]);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
-    }
-
-    /* break out if buffer filled */
-    if (dsp_i >= FLUID_BUFSIZE) break;
-
-    end_index++;	/* we're now interpolating the 3rd to last point */
-
-    /* interpolate within 3rd to last point */
-    for (; dsp_phase_index <= end_index && dsp_i < FLUID_BUFSIZE; dsp_i++)
-    {
-      coeffs = sinc_table7[fluid_phase_fract_to_tablerow (dsp_phase)];
-
-      dsp_buf[dsp_i] = dsp_amp
-	* (coeffs[0] * (fluid_real_t)dsp_data[dsp_phase_index-3]
-	   + coeffs[1] * (fluid_real_t)dsp_data[dsp_phase_index-2]
-	   + coeffs[2] * (fluid_real_t)dsp_data[dsp_phase_index-1]
-	   + coeffs[3] * (fluid_real_t)dsp_data[dsp_phase_index]
-	   + coeffs[4] * (fluid_real_t)dsp_data[dsp_phase_index+1]
-	   + coeffs[5] * (fluid_real_t)dsp_data[dsp_phase_index+2]
-	   + coeffs[6] * (fluid_real_t)end_points[0]);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
-    }
-
-    end_index++;	/* we're now interpolating the 2nd to last point */
-
-    /* interpolate within 2nd to last point */
-    for (; dsp_phase_index <= end_index && dsp_i < FLUID_BUFSIZE; dsp_i++)
-    {
-      coeffs = sinc_table7[fluid_phase_fract_to_tablerow (dsp_phase)];
-
-      dsp_buf[dsp_i] = dsp_amp
-	* (coeffs[0] * (fluid_real_t)dsp_data[dsp_phase_index-3]
-	   + coeffs[1] * (fluid_real_t)dsp_data[dsp_phase_index-2]
-	   + coeffs[2] * (fluid_real_t)dsp_data[dsp_phase_index-1]
-	   + coeffs[3] * (fluid_real_t)dsp_data[dsp_phase_index]
-	   + coeffs[4] * (fluid_real_t)dsp_data[dsp_phase_index+1]
-	   + coeffs[5] * (fluid_real_t)end_points[0]
-	   + coeffs[6] * (fluid_real_t)end_points[1]);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
-    }
-
-    end_index++;	/* we're now interpolating the last point */
-
-    /* interpolate within last point */
-    for (; dsp_phase_index <= end_index && dsp_i < FLUID_BUFSIZE; dsp_i++)
-    {
-      coeffs = sinc_table7[fluid_phase_fract_to_tablerow (dsp_phase)];
-
-      dsp_buf[dsp_i] = dsp_amp
-	* (coeffs[0] * (fluid_real_t)dsp_data[dsp_phase_index-3]
-	   + coeffs[1] * (fluid_real_t)dsp_data[dsp_phase_index-2]
-	   + coeffs[2] * (fluid_real_t)dsp_data[dsp_phase_index-1]
-	   + coeffs[3] * (fluid_real_t)dsp_data[dsp_phase_index]
-	   + coeffs[4] * (fluid_real_t)end_points[0]
-	   + coeffs[5] * (fluid_real_t)end_points[1]
-	   + coeffs[6] * (fluid_real_t)end_points[2]);
-
-      /* increment phase and amplitude */
-      fluid_phase_incr (dsp_phase, dsp_phase_incr);
-      dsp_phase_index = fluid_phase_index (dsp_phase);
-      dsp_amp += dsp_amp_incr;
-    }
-
-    if (!looping) break;	/* break out if not looping (end of sample) */
-
-    /* go back to loop start */
-    if (dsp_phase_index > end_index)
-    {
-      fluid_phase_sub_int (dsp_phase, voice->loopend - voice->loopstart);
-
-      if (!voice->has_looped)
-      {
-	voice->has_looped = 1;
-	start_index = voice->loopstart;
-	start_points[0] = dsp_data[voice->loopend - 1];
-	start_points[1] = dsp_data[voice->loopend - 2];
-	start_points[2] = dsp_data[voice->loopend - 3];
-      }
-    }
-
-    /* break out if filled buffer */
-    if (dsp_i >= FLUID_BUFSIZE) break;
-
-    end_index -= 3;	/* set end back to 4th to last sample point */
-  }
-
-  /* sub 1/2 sample from dsp_phase since 7th order interpolation is centered on
-   * the 4th sample point (correct back to real value) */
-  fluid_phase_decr (dsp_phase, (fluid_phase_t)0x80000000);
+  return fluid_dsp_float_interpolate (voice, &interp_order_linear, interp_run_linear);
+}
 
-  voice->phase = dsp_phase;
-  voice->amp = dsp_amp;
+/* 4th order (cubic) interpolation.
+ * Returns number of samples processed (usually block_size but could be
+ * smaller if end of sample occurs).
+ */
+int
+fluid_dsp_float_interpolate_4th_order (fluid_voice_t *voice)
+{
+  return fluid_dsp_float_interpolate (voice, &interp_order_4th, interp_run_4th_order);
+}
 
-  return (dsp_i);
+/* 7th order interpolation.
+ * Returns number of samples processed (usually block_size but could be
+ * smaller if end of sample occurs).
+ */
+int
+fluid_dsp_float_interpolate_7th_order (fluid_voice_t *voice)
+{
+  return fluid_dsp_float_interpolate (voice, &interp_order_7th, interp_run_7th_order);
 }
@@ -0,0 +1,260 @@
+/* FluidSynth - A Software Synthesizer
+ *
+ * Copyright (C) 2003  Peter Hanappe and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307, USA
+ */
+
+/* Vectorized runs of the interpolation loops in fluid_dsp_float.c, and
+ * the filters of 4 voices side by side.
+ *
+ * Not a regular header: fluid_dsp_float.c includes it once per
+ * instruction set, after defining
+ *
+ * FLUID_SIMD(name)         the name of a kernel for that instruction set
+ * FLUID_SIMD_FN            the qualifiers of the kernels and helpers
+ * fluid_v_t                a vector of 4 fluid_real_t
+ * fluid_v_load(p)          4 fluid_real_t from p, unaligned
+ * fluid_v_load_s16(p)      4 sample points from p, converted
+ * fluid_v_set(a, b, c, d)
+ * fluid_v_mul(a, b)
+ * fluid_v_add(a, b)
+ * fluid_v_sub(a, b)
+ * fluid_v_transpose(r0, r1, r2, r3)   transposes 4 rows in place
+ * fluid_v_store(p, v)      to p, unaligned
+ *
+ * and fluid_filter_lanes_t.
+ *
+ * Each run interpolates 4 output points per iteration for as long as
+ * the whole group lies at or before end_index, and leaves the rest of
+ * the block to the scalar loop. The products and sums are formed in
+ * the order the scalar loops form them, and the amplitude is stepped
+ * once per point, so where the scalar code is not contracted into
+ * fused multiply-adds the results are identical.
+ */
+
+/* the phase and amplitude of the 4 points of a group */
+#define FLUID_SIMD_GROUP(_p, _a, _amp_incr, _amps) \
+  { \
+    _p[1] = _p[0] + incr; \
+    _p[2] = _p[1] + incr; \
+    _p[3] = _p[2] + incr; \
+    _amps[0] = _a; _a += _amp_incr; \
+    _amps[1] = _a; _a += _amp_incr; \
+    _amps[2] = _a; _a += _amp_incr; \
+    _amps[3] = _a; _a += _amp_incr; \
+  }
+
+FLUID_SIMD_FN unsigned int
+FLUID_SIMD(fluid_interp_run_linear) (const short int *data, fluid_real_t *buf,
+				     unsigned int dsp_i, unsigned int size,
+				     fluid_phase_t *phase,
+				     fluid_phase_t incr, fluid_real_t *amp,
+				     fluid_real_t amp_incr, unsigned int end_index)
+{
+  fluid_phase_t p[4];
+  fluid_real_t a = *amp;
+  fluid_real_t amps[4];
+  const fluid_real_t *c[4];
+  const short int *d[4];
+  fluid_v_t sum;
+  int k;
+
+  p[0] = *phase;
+  for ( ; dsp_i + 4 <= size; dsp_i += 4)
+  {
+    if (fluid_phase_index (p[0] + 3 * incr) > end_index) break;
+    FLUID_SIMD_GROUP (p, a, amp_incr, amps);
+
+    for (k = 0; k < 4; k++)
+    {
+      c[k] = interp_coeff_linear[fluid_phase_fract_to_tablerow (p[k])];
+      d[k] = data + fluid_phase_index (p[k]);
+    }
+
+    sum = fluid_v_add (fluid_v_mul (fluid_v_set (c[0][0], c[1][0], c[2][0], c[3][0]),
+				    fluid_v_set (d[0][0], d[1][0], d[2][0], d[3][0])),
+		       fluid_v_mul (fluid_v_set (c[0][1], c[1][1], c[2][1], c[3][1]),
+				    fluid_v_set (d[0][1], d[1][1], d[2][1], d[3][1])));
+    fluid_v_store (buf + dsp_i, fluid_v_mul (fluid_v_load (amps), sum));
+
+    p[0] = p[3] + incr;
+  }
+
+  *phase = p[0];
+  *amp = a;
+  return dsp_i;
+}
+
+FLUID_SIMD_FN unsigned int
+FLUID_SIMD(fluid_interp_run_4th_order) (const short int *data, fluid_real_t *buf,
+					unsigned int dsp_i, unsigned int size,
+					fluid_phase_t *phase,
+					fluid_phase_t incr, fluid_real_t *amp,
+					fluid_real_t amp_incr, unsigned int end_index)
+{
+  fluid_phase_t p[4];
+  fluid_real_t a = *amp;
+  fluid_real_t amps[4];
+  fluid_v_t r0, r1, r2, r3;
+
+  p[0] = *phase;
+  for ( ; dsp_i + 4 <= size; dsp_i += 4)
+  {
+    if (fluid_phase_index (p[0] + 3 * incr) > end_index) break;
+    FLUID_SIMD_GROUP (p, a, amp_incr, amps);
+
+    /* one row of 4 products per output point */
+#define FLUID_SIMD_ROW(_k) \
+    fluid_v_mul (fluid_v_load (interp_coeff[fluid_phase_fract_to_tablerow (p[_k])]), \
+		 fluid_v_load_s16 (data + fluid_phase_index (p[_k]) - 1))
+    r0 = FLUID_SIMD_ROW (0);
+    r1 = FLUID_SIMD_ROW (1);
+    r2 = FLUID_SIMD_ROW (2);
+    r3 = FLUID_SIMD_ROW (3);
+#undef FLUID_SIMD_ROW
+
+    fluid_v_transpose (r0, r1, r2, r3);
+    r0 = fluid_v_add (fluid_v_add (fluid_v_add (r0, r1), r2), r3);
+    fluid_v_store (buf + dsp_i, fluid_v_mul (fluid_v_load (amps), r0));
+
+    p[0] = p[3] + incr;
+  }
+
+  *phase = p[0];
+  *amp = a;
+  return dsp_i;
+}
+
+FLUID_SIMD_FN unsigned int
+FLUID_SIMD(fluid_interp_run_7th_order) (const short int *data, fluid_real_t *buf,
+					unsigned int dsp_i, unsigned int size,
+					fluid_phase_t *phase,
+					fluid_phase_t incr, fluid_real_t *amp,
+					fluid_real_t amp_incr, unsigned int end_index)
+{
+  fluid_phase_t p[4];
+  fluid_real_t a = *amp;
+  fluid_real_t amps[4];
+  const fluid_real_t *c[4];
+  const short int *d[4];
+  fluid_v_t r0, r1, r2, r3;
+  fluid_v_t s0, s1, s2, s3;
+  int k;
+
+  p[0] = *phase;
+  for ( ; dsp_i + 4 <= size; dsp_i += 4)
+  {
+    if (fluid_phase_index (p[0] + 3 * incr) > end_index) break;
+    FLUID_SIMD_GROUP (p, a, amp_incr, amps);
+
+    for (k = 0; k < 4; k++)
+    {
+      c[k] = sinc_table7[fluid_phase_fract_to_tablerow (p[k])];
+      d[k] = data + fluid_phase_index (p[k]);
+    }
+
+    /* the 7 taps as two overlapping rows of 4, points -3..0 and 0..3;
+       the product of point 0 in the second row is not used */
+    r0 = fluid_v_mul (fluid_v_load (c[0]), fluid_v_load_s16 (d[0] - 3));
+    r1 = fluid_v_mul (fluid_v_load (c[1]), fluid_v_load_s16 (d[1] - 3));
+    r2 = fluid_v_mul (fluid_v_load (c[2]), fluid_v_load_s16 (d[2] - 3));
+    r3 = fluid_v_mul (fluid_v_load (c[3]), fluid_v_load_s16 (d[3] - 3));
+    s0 = fluid_v_mul (fluid_v_load (c[0] + 3), fluid_v_load_s16 (d[0]));
+    s1 = fluid_v_mul (fluid_v_load (c[1] + 3), fluid_v_load_s16 (d[1]));
+    s2 = fluid_v_mul (fluid_v_load (c[2] + 3), fluid_v_load_s16 (d[2]));
+    s3 = fluid_v_mul (fluid_v_load (c[3] + 3), fluid_v_load_s16 (d[3]));
+
+    fluid_v_transpose (r0, r1, r2, r3);
+    fluid_v_transpose (s0, s1, s2, s3);
+    r0 = fluid_v_add (fluid_v_add (fluid_v_add (r0, r1), r2), r3);
+    r0 = fluid_v_add (fluid_v_add (fluid_v_add (r0, s1), s2), s3);
+    fluid_v_store (buf + dsp_i, fluid_v_mul (fluid_v_load (amps), r0));
+
+    p[0] = p[3] + incr;
+  }
+
+  *phase = p[0];
+  *amp = a;
+  return dsp_i;
+}
+
+#undef FLUID_SIMD_GROUP
+
+/* The biquads of 4 voices over a block of 'size' points, voice k in
+ * lane k: each point of buf[0..3] is filtered in place, the same way the
+ * scalar filter in fluid_voice.c filters it. With 'ramp' the
+ * coefficients move by their increments after every point. */
+FLUID_SIMD_FN void
+FLUID_SIMD(fluid_filter_run) (fluid_real_t **buf, int size, fluid_filter_lanes_t *f, int ramp)
+{
+  fluid_v_t hist1 = fluid_v_load (f->hist1);
+  fluid_v_t hist2 = fluid_v_load (f->hist2);
+  fluid_v_t a1 = fluid_v_load (f->a1);
+  fluid_v_t a2 = fluid_v_load (f->a2);
+  fluid_v_t b02 = fluid_v_load (f->b02);
+  fluid_v_t b1 = fluid_v_load (f->b1);
+  fluid_v_t a1_incr = fluid_v_load (f->a1_incr);
+  fluid_v_t a2_incr = fluid_v_load (f->a2_incr);
+  fluid_v_t b02_incr = fluid_v_load (f->b02_incr);
+  fluid_v_t b1_incr = fluid_v_load (f->b1_incr);
+  fluid_v_t x0, x1, x2, x3, centernode;
+  int i;
+
+#define FLUID_SIMD_BIQUAD(_x) \
+    centernode = fluid_v_sub (fluid_v_sub (_x, fluid_v_mul (a1, hist1)), \
+			      fluid_v_mul (a2, hist2)); \
+    _x = fluid_v_add (fluid_v_mul (b02, fluid_v_add (centernode, hist2)), \
+		      fluid_v_mul (b1, hist1)); \
+    hist2 = hist1; \
+    hist1 = centernode; \
+    if (ramp) \
+    { \
+      a1 = fluid_v_add (a1, a1_incr); \
+      a2 = fluid_v_add (a2, a2_incr); \
+      b02 = fluid_v_add (b02, b02_incr); \
+      b1 = fluid_v_add (b1, b1_incr); \
+    }
+
+  for (i = 0; i < size; i += 4)
+  {
+    /* 4 points of each voice, turned into a point of every voice per row */
+    x0 = fluid_v_load (buf[0] + i);
+    x1 = fluid_v_load (buf[1] + i);
+    x2 = fluid_v_load (buf[2] + i);
+    x3 = fluid_v_load (buf[3] + i);
+    fluid_v_transpose (x0, x1, x2, x3);
+
+    FLUID_SIMD_BIQUAD (x0);
+    FLUID_SIMD_BIQUAD (x1);
+    FLUID_SIMD_BIQUAD (x2);
+    FLUID_SIMD_BIQUAD (x3);
+
+    fluid_v_transpose (x0, x1, x2, x3);
+    fluid_v_store (buf[0] + i, x0);
+    fluid_v_store (buf[1] + i, x1);
+    fluid_v_store (buf[2] + i, x2);
+    fluid_v_store (buf[3] + i, x3);
+  }
+#undef FLUID_SIMD_BIQUAD
+
+  fluid_v_store (f->hist1, hist1);
+  fluid_v_store (f->hist2, hist2);
+  fluid_v_store (f->a1, a1);
+  fluid_v_store (f->a2, a2);
+  fluid_v_store (f->b02, b02);
+  fluid_v_store (f->b1, b1);
+}
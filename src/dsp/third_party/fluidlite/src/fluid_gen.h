@@ -33,6 +33,8 @@ typedef struct _fluid_gen_info_t {
 	float def;		/* The default value (cfr. fluid_gen_set_default_values()) */
 } fluid_gen_info_t;
 
+extern fluid_gen_info_t fluid_gen_info[];
+
 #define fluid_gen_set_mod(_gen, _val)  { (_gen)->mod = (double) (_val); }
 #define fluid_gen_set_nrpn(_gen, _val) { (_gen)->nrpn = (double) (_val); }
 
@@ -34,10 +34,10 @@ fluid_revmodel_t* new_fluid_revmodel(void);
 void delete_fluid_revmodel(fluid_revmodel_t* rev);
 
 void fluid_revmodel_processmix(fluid_revmodel_t* rev, fluid_real_t *in,
-			      fluid_real_t *left_out, fluid_real_t *right_out);
+			      fluid_real_t *left_out, fluid_real_t *right_out, int count);
 
 void fluid_revmodel_processreplace(fluid_revmodel_t* rev, fluid_real_t *in,
-				  fluid_real_t *left_out, fluid_real_t *right_out);
+				  fluid_real_t *left_out, fluid_real_t *right_out, int count);
 
 void fluid_revmodel_reset(fluid_revmodel_t* rev);
 
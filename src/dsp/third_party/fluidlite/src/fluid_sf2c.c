@@ -0,0 +1,877 @@
+/* FluidSynth - A Software Synthesizer
+ *
+ * Copyright (C) 2003  Peter Hanappe and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307, USA
+ */
+
+
+/*
+ * Compiled SoundFonts
+ *
+ * A .sf2c sidecar is a snapshot of what fluid_defsfont_load() builds from
+ * an SF2 file: the presets, preset zones, instruments, instrument zones,
+ * modulators and samples, each kind stored as an array of the very
+ * structures the synthesizer uses, followed by the sample data. Pointers
+ * between the structures are stored as file offsets (0 for NULL), so
+ * loading maps the file copy-on-write and adds the mapping's address to
+ * every pointer; nothing is parsed or allocated per zone.
+ *
+ * In the sample data every sample starts on a FLUID_SF2C_ALIGN byte
+ * boundary with at least FLUID_SF2C_GUARD zero points on either side,
+ * and the loop amplitude scan of fluid_voice_optimize_sample() is done
+ * at compile time.
+ *
+ * The structures are stored in the host's native layout and byte order.
+ * A sidecar is only used if it was written by the same build layout and
+ * the size and modification time of the SoundFont still match the ones
+ * it was compiled from; otherwise the SoundFont is parsed and the
+ * sidecar written again.
+ */
+
+#include "fluid_sf2c.h"
+
+#if FLUID_SF2C_SUPPORT
+
+#include <sys/stat.h>
+#include <strings.h>
+#include <errno.h>
+
+enum {
+  FLUID_SF2C_PRESETS,
+  FLUID_SF2C_PRESET_ZONES,
+  FLUID_SF2C_INSTS,
+  FLUID_SF2C_INST_ZONES,
+  FLUID_SF2C_MODS,
+  FLUID_SF2C_SAMPLES,
+  FLUID_SF2C_TABLES
+};
+
+static const size_t fluid_sf2c_record_size[FLUID_SF2C_TABLES] = {
+  sizeof(fluid_defpreset_t),
+  sizeof(fluid_preset_zone_t),
+  sizeof(fluid_inst_t),
+  sizeof(fluid_inst_zone_t),
+  sizeof(fluid_mod_t),
+  sizeof(fluid_sample_t)
+};
+
+typedef struct _fluid_sf2c_header_t {
+  char magic[4];                /* "SF2C" */
+  unsigned int version;         /* FLUID_SF2C_VERSION */
+  unsigned int layout;          /* fluid_sf2c_layout() of the writer */
+  unsigned int checksum;        /* of everything between header and sample data */
+  fluid_sf2c_stamp_t source;    /* the SoundFont revision compiled */
+  long long file_size;
+  unsigned int table_offset[FLUID_SF2C_TABLES];
+  unsigned int table_count[FLUID_SF2C_TABLES];
+  unsigned int strings_offset;  /* zone names, NUL terminated */
+  unsigned int strings_size;
+  unsigned int sampledata_offset;
+  unsigned int sampledata_size;
+} fluid_sf2c_header_t;
+
+#define fluid_sf2c_round(_n, _a)  ((((_n) + (_a) - 1) / (_a)) * (_a))
+
+static unsigned int fluid_sf2c_hash(unsigned int hash, const void* data, size_t len)
+{
+  const unsigned char* p = (const unsigned char*) data;
+  size_t i;
+
+  /* FNV-1a */
+  for (i = 0; i < len; i++) {
+    hash = (hash ^ p[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/* everything that must match for the stored structures to be usable */
+static unsigned int fluid_sf2c_layout(void)
+{
+  unsigned int values[] = {
+    0x01020304, sizeof(void*), sizeof(double), sizeof(long long), GEN_LAST,
+    sizeof(fluid_defpreset_t), sizeof(fluid_preset_zone_t), sizeof(fluid_inst_t),
+    sizeof(fluid_inst_zone_t), sizeof(fluid_mod_t), sizeof(fluid_sample_t),
+    sizeof(fluid_gen_t), sizeof(fluid_sf2c_header_t)
+  };
+
+  /* hashed as raw bytes, so the byte order goes in too */
+  return fluid_sf2c_hash(2166136261u, values, sizeof(values));
+}
+
+/*
+ * fluid_sf2c_path
+ */
+char* fluid_sf2c_path(const char* file)
+{
+  size_t len = FLUID_STRLEN(file);
+  char* path = FLUID_MALLOC(len + 6);
+
+  if (path == NULL) {
+    return NULL;
+  }
+  FLUID_STRCPY(path, file);
+  /* "piano.sf2" -> "piano.sf2c", anything else gets ".sf2c" appended */
+  if ((len >= 4) && (strcasecmp(file + len - 4, ".sf2") == 0)) {
+    FLUID_STRCPY(path + len, "c");
+  } else {
+    FLUID_STRCPY(path + len, ".sf2c");
+  }
+  return path;
+}
+
+/*
+ * fluid_sf2c_stamp
+ */
+int fluid_sf2c_stamp(const char* file, fluid_sf2c_stamp_t* stamp)
+{
+  struct stat st;
+
+  if (stat(file, &st) != 0) {
+    return FLUID_FAILED;
+  }
+  FLUID_MEMSET(stamp, 0, sizeof(fluid_sf2c_stamp_t));
+  stamp->size = (long long) st.st_size;
+  stamp->mtime = (long long) st.st_mtime;
+#if defined(__APPLE__)
+  stamp->mtime_nsec = (long long) st.st_mtimespec.tv_nsec;
+#else
+  stamp->mtime_nsec = (long long) st.st_mtim.tv_nsec;
+#endif
+  return FLUID_OK;
+}
+
+/***************************************************************
+ *
+ *                           LOADING
+ */
+
+/* Turn a stored offset into a pointer to a record of 'table'. With
+   'after' set, the record must come after the one at that offset, which
+   keeps corrupt lists from looping. */
+static int fluid_sf2c_fix(char* map, const fluid_sf2c_header_t* h,
+			  int table, void* field, uintptr after)
+{
+  void** ptr = (void**) field;
+  uintptr off = (uintptr) *ptr;
+  uintptr first = h->table_offset[table];
+  size_t size = fluid_sf2c_record_size[table];
+
+  if (off == 0) {
+    return FLUID_OK;
+  }
+  if ((off < first) || (off <= after) || ((off - first) % size != 0)
+      || ((off - first) / size >= h->table_count[table])) {
+    return FLUID_FAILED;
+  }
+  *ptr = map + off;
+  return FLUID_OK;
+}
+
+static int fluid_sf2c_fix_string(char* map, const fluid_sf2c_header_t* h, char** str)
+{
+  uintptr off = (uintptr) *str;
+
+  if (off == 0) {
+    return FLUID_OK;
+  }
+  if ((off < h->strings_offset) || (off >= (uintptr) h->strings_offset + h->strings_size)) {
+    return FLUID_FAILED;
+  }
+  *str = map + off;
+  return FLUID_OK;
+}
+
+#define fluid_sf2c_record(_map, _h, _table, _type, _i) \
+  ((_type*) ((_map) + (_h)->table_offset[_table] + (_i) * sizeof(_type)))
+
+#define fluid_sf2c_offset(_map, _rec)  ((uintptr) ((char*) (_rec) - (_map)))
+
+static int fluid_sf2c_check_header(const fluid_sf2c_header_t* h,
+				   const fluid_sf2c_stamp_t* stamp, long long file_size)
+{
+  long long end;
+  int i;
+
+  if ((FLUID_STRNCMP(h->magic, "SF2C", 4) != 0)
+      || (h->version != FLUID_SF2C_VERSION)
+      || (h->layout != fluid_sf2c_layout())
+      || (h->source.size != stamp->size)
+      || (h->source.mtime != stamp->mtime)
+      || (h->source.mtime_nsec != stamp->mtime_nsec)
+      || (h->file_size != file_size)) {
+    return FLUID_FAILED;
+  }
+
+  /* the tables, then the strings, then the sample data up to the end */
+  end = sizeof(fluid_sf2c_header_t);
+  for (i = 0; i < FLUID_SF2C_TABLES; i++) {
+    if ((long long) h->table_offset[i] < end) {
+      return FLUID_FAILED;
+    }
+    end = (long long) h->table_offset[i]
+      + (long long) h->table_count[i] * (long long) fluid_sf2c_record_size[i];
+  }
+  if (((long long) h->strings_offset < end) || (h->strings_size == 0)) {
+    return FLUID_FAILED;
+  }
+  end = (long long) h->strings_offset + h->strings_size;
+  if (((long long) h->sampledata_offset < end)
+      || (h->sampledata_offset % FLUID_SF2C_ALIGN != 0)
+      || ((long long) h->sampledata_offset + h->sampledata_size != file_size)) {
+    return FLUID_FAILED;
+  }
+  return FLUID_OK;
+}
+
+/* Point every stored offset into the mapping */
+static int fluid_sf2c_fixup(char* map, const fluid_sf2c_header_t* h, fluid_defsfont_t* sfont)
+{
+  fluid_defpreset_t* preset;
+  fluid_preset_zone_t* pzone;
+  fluid_inst_t* inst;
+  fluid_inst_zone_t* izone;
+  fluid_mod_t* mod;
+  fluid_sample_t* sample;
+  short* sampledata = (short*) (map + h->sampledata_offset);
+  unsigned int points = h->sampledata_size / sizeof(short);
+  unsigned int i;
+  int err = FLUID_OK;
+
+  if ((fluid_sf2c_hash(2166136261u, map + sizeof(fluid_sf2c_header_t),
+		       h->sampledata_offset - sizeof(fluid_sf2c_header_t)) != h->checksum)
+      || (map[h->strings_offset + h->strings_size - 1] != 0)) {
+    return FLUID_FAILED;
+  }
+
+  for (i = 0; i < h->table_count[FLUID_SF2C_PRESETS]; i++) {
+    preset = fluid_sf2c_record(map, h, FLUID_SF2C_PRESETS, fluid_defpreset_t, i);
+    preset->sfont = sfont;
+    preset->lut = NULL;
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_PRESETS, &preset->next,
+			  fluid_sf2c_offset(map, preset));
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_PRESET_ZONES, &preset->global_zone, 0);
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_PRESET_ZONES, &preset->zone, 0);
+  }
+  for (i = 0; i < h->table_count[FLUID_SF2C_PRESET_ZONES]; i++) {
+    pzone = fluid_sf2c_record(map, h, FLUID_SF2C_PRESET_ZONES, fluid_preset_zone_t, i);
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_PRESET_ZONES, &pzone->next,
+			  fluid_sf2c_offset(map, pzone));
+    err |= fluid_sf2c_fix_string(map, h, &pzone->name);
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_INSTS, &pzone->inst, 0);
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_MODS, &pzone->mod, 0);
+  }
+  for (i = 0; i < h->table_count[FLUID_SF2C_INSTS]; i++) {
+    inst = fluid_sf2c_record(map, h, FLUID_SF2C_INSTS, fluid_inst_t, i);
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_INST_ZONES, &inst->global_zone, 0);
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_INST_ZONES, &inst->zone, 0);
+  }
+  for (i = 0; i < h->table_count[FLUID_SF2C_INST_ZONES]; i++) {
+    izone = fluid_sf2c_record(map, h, FLUID_SF2C_INST_ZONES, fluid_inst_zone_t, i);
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_INST_ZONES, &izone->next,
+			  fluid_sf2c_offset(map, izone));
+    err |= fluid_sf2c_fix_string(map, h, &izone->name);
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_SAMPLES, &izone->sample, 0);
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_MODS, &izone->mod, 0);
+  }
+  for (i = 0; i < h->table_count[FLUID_SF2C_MODS]; i++) {
+    mod = fluid_sf2c_record(map, h, FLUID_SF2C_MODS, fluid_mod_t, i);
+    err |= fluid_sf2c_fix(map, h, FLUID_SF2C_MODS, &mod->next,
+			  fluid_sf2c_offset(map, mod));
+  }
+  for (i = 0; i < h->table_count[FLUID_SF2C_SAMPLES]; i++) {
+    sample = fluid_sf2c_record(map, h, FLUID_SF2C_SAMPLES, fluid_sample_t, i);
+    if ((sample->start > sample->end) || (sample->end >= points)) {
+      err = FLUID_FAILED;
+    }
+    sample->data = sampledata;
+    sample->refcount = 0;
+    sample->notify = NULL;
+    sample->userdata = NULL;
+    sample->stream = NULL;
+  }
+  return err;
+}
+
+/*
+ * fluid_sf2c_load
+ */
+int fluid_sf2c_load(fluid_defsfont_t* sfont, const char* path,
+		    const fluid_sf2c_stamp_t* stamp)
+{
+  fluid_sf2c_header_t h;
+  fluid_list_t* samples = NULL;
+  fluid_sample_t* sample;
+  struct stat st;
+  long pagesize;
+  char* map;
+  unsigned int i;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return FLUID_FAILED;
+  }
+  if ((fstat(fd, &st) != 0) || (st.st_size < (off_t) sizeof(h))
+      || (pread(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h))
+      || (fluid_sf2c_check_header(&h, stamp, (long long) st.st_size) != FLUID_OK)) {
+    close(fd);
+    return FLUID_FAILED;
+  }
+
+  /* private and writable for the pointer fixups; the sample data pages
+     are never written and stay shared with the page cache */
+  map = mmap(NULL, (size_t) h.file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return FLUID_FAILED;
+  }
+
+  if (fluid_sf2c_fixup(map, &h, sfont) != FLUID_OK) {
+    FLUID_LOG(FLUID_WARN, "Ignoring corrupt compiled SoundFont %s", path);
+    munmap(map, (size_t) h.file_size);
+    return FLUID_FAILED;
+  }
+
+  for (i = 0; i < h.table_count[FLUID_SF2C_SAMPLES]; i++) {
+    sample = fluid_sf2c_record(map, &h, FLUID_SF2C_SAMPLES, fluid_sample_t, i);
+    samples = fluid_list_append(samples, sample);
+  }
+
+  pagesize = sysconf(_SC_PAGESIZE);
+  if ((pagesize > 0) && (h.sampledata_offset % pagesize == 0)) {
+    mprotect(map + h.sampledata_offset, h.sampledata_size, PROT_READ);
+  }
+
+  sfont->samplemap = map;
+  sfont->samplemap_size = (size_t) h.file_size;
+  sfont->sampledata = (short*) (map + h.sampledata_offset);
+  sfont->samplepos = h.sampledata_offset;
+  sfont->samplesize = h.sampledata_size;
+  sfont->sample = samples;
+  sfont->preset = (h.table_count[FLUID_SF2C_PRESETS] > 0)
+    ? fluid_sf2c_record(map, &h, FLUID_SF2C_PRESETS, fluid_defpreset_t, 0) : NULL;
+  sfont->compiled = 1;
+
+  FLUID_LOG(FLUID_DBG, "Mapped compiled SoundFont %s", path);
+  return FLUID_OK;
+}
+
+/***************************************************************
+ *
+ *                           COMPILING
+ */
+
+typedef struct _fluid_sf2c_sample_ref_t {
+  fluid_sample_t* sample;
+  unsigned int index;
+} fluid_sf2c_sample_ref_t;
+
+typedef struct _fluid_sf2c_writer_t {
+  fluid_sf2c_header_t* h;
+  char* tables;                 /* everything before the sample data */
+  unsigned int next[FLUID_SF2C_TABLES];
+  unsigned int strings_used;
+  fluid_sf2c_sample_ref_t* refs;  /* the samples sorted by address */
+  unsigned int sample_count;
+} fluid_sf2c_writer_t;
+
+static int fluid_sf2c_ref_compare(const void* a, const void* b)
+{
+  uintptr pa = (uintptr) ((const fluid_sf2c_sample_ref_t*) a)->sample;
+  uintptr pb = (uintptr) ((const fluid_sf2c_sample_ref_t*) b)->sample;
+  return (pa < pb) ? -1 : (pa > pb);
+}
+
+/* claim the next record of a table; its offset goes to *off */
+static void* fluid_sf2c_put(fluid_sf2c_writer_t* w, int table, void* off)
+{
+  uintptr pos = w->h->table_offset[table]
+    + (uintptr) w->next[table]++ * fluid_sf2c_record_size[table];
+  *(void**) off = (void*) pos;
+  return w->tables + pos;
+}
+
+static char* fluid_sf2c_put_string(fluid_sf2c_writer_t* w, const char* s)
+{
+  uintptr pos;
+
+  if (s == NULL) {
+    return NULL;
+  }
+  pos = w->h->strings_offset + w->strings_used;
+  FLUID_STRCPY(w->tables + pos, s);
+  w->strings_used += FLUID_STRLEN(s) + 1;
+  return (char*) pos;
+}
+
+static fluid_mod_t* fluid_sf2c_put_mods(fluid_sf2c_writer_t* w, fluid_mod_t* mod)
+{
+  fluid_mod_t* first = NULL;
+  fluid_mod_t* prev = NULL;
+  fluid_mod_t* rec;
+  void* off;
+
+  for (; mod != NULL; mod = mod->next) {
+    rec = (fluid_mod_t*) fluid_sf2c_put(w, FLUID_SF2C_MODS, &off);
+    *rec = *mod;
+    rec->next = NULL;
+    if (prev != NULL) {
+      prev->next = (fluid_mod_t*) off;
+    } else {
+      first = (fluid_mod_t*) off;
+    }
+    prev = rec;
+  }
+  return first;
+}
+
+static fluid_sample_t* fluid_sf2c_sample_offset(fluid_sf2c_writer_t* w, fluid_sample_t* sample)
+{
+  fluid_sf2c_sample_ref_t key;
+  fluid_sf2c_sample_ref_t* ref;
+
+  if (sample == NULL) {
+    return NULL;
+  }
+  key.sample = sample;
+  ref = bsearch(&key, w->refs, w->sample_count, sizeof(key), fluid_sf2c_ref_compare);
+  if (ref == NULL) {
+    return NULL;
+  }
+  return (fluid_sample_t*) (uintptr) (w->h->table_offset[FLUID_SF2C_SAMPLES]
+				      + ref->index * sizeof(fluid_sample_t));
+}
+
+static fluid_inst_zone_t* fluid_sf2c_put_inst_zones(fluid_sf2c_writer_t* w,
+						    fluid_inst_zone_t* zone, int single)
+{
+  fluid_inst_zone_t* first = NULL;
+  fluid_inst_zone_t* prev = NULL;
+  fluid_inst_zone_t* rec;
+  void* off;
+
+  for (; zone != NULL; zone = single ? NULL : zone->next) {
+    rec = (fluid_inst_zone_t*) fluid_sf2c_put(w, FLUID_SF2C_INST_ZONES, &off);
+    *rec = *zone;
+    rec->next = NULL;
+    rec->name = fluid_sf2c_put_string(w, zone->name);
+    rec->sample = fluid_sf2c_sample_offset(w, zone->sample);
+    rec->mod = fluid_sf2c_put_mods(w, zone->mod);
+    if (prev != NULL) {
+      prev->next = (fluid_inst_zone_t*) off;
+    } else {
+      first = (fluid_inst_zone_t*) off;
+    }
+    prev = rec;
+  }
+  return first;
+}
+
+static fluid_inst_t* fluid_sf2c_put_inst(fluid_sf2c_writer_t* w, fluid_inst_t* inst)
+{
+  fluid_inst_t* rec;
+  void* off;
+
+  if (inst == NULL) {
+    return NULL;
+  }
+  rec = (fluid_inst_t*) fluid_sf2c_put(w, FLUID_SF2C_INSTS, &off);
+  *rec = *inst;
+  rec->global_zone = fluid_sf2c_put_inst_zones(w, inst->global_zone, 1);
+  rec->zone = fluid_sf2c_put_inst_zones(w, inst->zone, 0);
+  return (fluid_inst_t*) off;
+}
+
+static fluid_preset_zone_t* fluid_sf2c_put_preset_zones(fluid_sf2c_writer_t* w,
+							fluid_preset_zone_t* zone, int single)
+{
+  fluid_preset_zone_t* first = NULL;
+  fluid_preset_zone_t* prev = NULL;
+  fluid_preset_zone_t* rec;
+  void* off;
+
+  for (; zone != NULL; zone = single ? NULL : zone->next) {
+    rec = (fluid_preset_zone_t*) fluid_sf2c_put(w, FLUID_SF2C_PRESET_ZONES, &off);
+    *rec = *zone;
+    rec->next = NULL;
+    rec->name = fluid_sf2c_put_string(w, zone->name);
+    rec->inst = fluid_sf2c_put_inst(w, zone->inst);
+    rec->mod = fluid_sf2c_put_mods(w, zone->mod);
+    if (prev != NULL) {
+      prev->next = (fluid_preset_zone_t*) off;
+    } else {
+      first = (fluid_preset_zone_t*) off;
+    }
+    prev = rec;
+  }
+  return first;
+}
+
+static void fluid_sf2c_count_mods(fluid_sf2c_header_t* h, fluid_mod_t* mod)
+{
+  for (; mod != NULL; mod = mod->next) {
+    h->table_count[FLUID_SF2C_MODS]++;
+  }
+}
+
+static void fluid_sf2c_count_inst_zone(fluid_sf2c_header_t* h, fluid_inst_zone_t* zone)
+{
+  h->table_count[FLUID_SF2C_INST_ZONES]++;
+  h->strings_size += (zone->name != NULL) ? FLUID_STRLEN(zone->name) + 1 : 0;
+  fluid_sf2c_count_mods(h, zone->mod);
+}
+
+static void fluid_sf2c_count_preset_zone(fluid_sf2c_header_t* h, fluid_preset_zone_t* zone)
+{
+  fluid_inst_zone_t* izone;
+
+  h->table_count[FLUID_SF2C_PRESET_ZONES]++;
+  h->strings_size += (zone->name != NULL) ? FLUID_STRLEN(zone->name) + 1 : 0;
+  fluid_sf2c_count_mods(h, zone->mod);
+  if (zone->inst != NULL) {
+    h->table_count[FLUID_SF2C_INSTS]++;
+    if (zone->inst->global_zone != NULL) {
+      fluid_sf2c_count_inst_zone(h, zone->inst->global_zone);
+    }
+    for (izone = zone->inst->zone; izone != NULL; izone = izone->next) {
+      fluid_sf2c_count_inst_zone(h, izone);
+    }
+  }
+}
+
+static int fluid_sf2c_write(int fd, const void* buf, size_t len, off_t offset)
+{
+  const char* p = (const char*) buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = pwrite(fd, p, len, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return FLUID_FAILED;
+    }
+    p += n;
+    len -= (size_t) n;
+    offset += n;
+  }
+  return FLUID_OK;
+}
+
+static int fluid_sf2c_read(int fd, void* buf, size_t len, off_t offset)
+{
+  char* p = (char*) buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = pread(fd, p, len, offset);
+    if ((n < 0) && (errno == EINTR)) continue;
+    if (n <= 0) {
+      return FLUID_FAILED;
+    }
+    p += n;
+    len -= (size_t) n;
+    offset += n;
+  }
+  return FLUID_OK;
+}
+
+/* Copies the sample data into the sidecar after the tables, rebasing the
+   sample records. Mapped sample data is read from the file instead of
+   through the mapping, which would fault in pages that the sample budget
+   or streaming mean to keep out. */
+static int fluid_sf2c_put_samples(fluid_sf2c_writer_t* w, fluid_defsfont_t* sfont, int fd)
+{
+  fluid_list_t* list;
+  fluid_sample_t* sample;
+  fluid_sample_t* rec;
+  fluid_sample_t scan;
+  unsigned int align = FLUID_SF2C_ALIGN / sizeof(short);
+  unsigned int pos, len, index;
+  unsigned int sampledata_points = sfont->samplesize / sizeof(short);
+  unsigned long long end;
+  short* buf = NULL;
+  unsigned int buf_len = 0;
+  int src = -1;
+  int err = FLUID_OK;
+
+  if (sfont->samplemap != NULL) {
+    src = open(sfont->filename, O_RDONLY);
+    if (src < 0) {
+      return FLUID_FAILED;
+    }
+  }
+
+  pos = fluid_sf2c_round(FLUID_SF2C_GUARD, align);
+  for (list = sfont->sample, index = 0; list; list = fluid_list_next(list), index++) {
+    sample = (fluid_sample_t*) fluid_list_get(list);
+    rec = (fluid_sample_t*) (w->tables + w->h->table_offset[FLUID_SF2C_SAMPLES]
+			     + index * sizeof(fluid_sample_t));
+    *rec = *sample;
+    rec->data = NULL;
+    rec->refcount = 0;
+    rec->notify = NULL;
+    rec->userdata = NULL;
+    rec->stream = NULL;
+
+    len = 0;
+    if ((sample->data == sfont->sampledata) && (sample->start <= sample->end)
+	&& (sample->end < sampledata_points)) {
+      len = sample->end - sample->start + 1;
+    }
+
+    /* rebased points must stay addressable by an unsigned int */
+    end = (unsigned long long) pos + len + FLUID_SF2C_GUARD + align;
+    if (end > 0x7fffffffu / sizeof(short)) {
+      err = FLUID_FAILED;
+      break;
+    }
+
+    rec->start = pos;
+    rec->end = (len > 0) ? pos + len - 1 : pos;
+    rec->loopstart = sample->loopstart - sample->start + pos;
+    rec->loopend = sample->loopend - sample->start + pos;
+    if (len == 0) {
+      rec->valid = 0;
+      pos = fluid_sf2c_round(pos + FLUID_SF2C_GUARD, align);
+      continue;
+    }
+
+    if (len > buf_len) {
+      FLUID_FREE(buf);
+      buf = FLUID_ARRAY(short, len);
+      if (buf == NULL) {
+	buf_len = 0;
+	err = FLUID_FAILED;
+	break;
+      }
+      buf_len = len;
+    }
+    if (src >= 0) {
+      err = fluid_sf2c_read(src, buf, (size_t) len * sizeof(short),
+			    (off_t) sfont->samplepos + (off_t) sample->start * sizeof(short));
+    } else {
+      FLUID_MEMCPY(buf, sample->data + sample->start, (size_t) len * sizeof(short));
+    }
+    if (err == FLUID_OK) {
+      err = fluid_sf2c_write(fd, buf, (size_t) len * sizeof(short),
+			     (off_t) w->h->sampledata_offset + (off_t) pos * sizeof(short));
+    }
+    if (err != FLUID_OK) {
+      break;
+    }
+
+    /* scan the loop now, the loader then never has to */
+    if (!sample->amplitude_that_reaches_noise_floor_is_valid
+	&& (sample->loopstart >= sample->start) && (sample->loopstart <= sample->loopend)
+	&& (sample->loopend <= sample->end)) {
+      scan = *sample;
+      scan.data = buf;
+      scan.start = 0;
+      scan.end = len - 1;
+      scan.loopstart = sample->loopstart - sample->start;
+      scan.loopend = sample->loopend - sample->start;
+      fluid_voice_optimize_sample(&scan);
+      rec->amplitude_that_reaches_noise_floor_is_valid =
+	scan.amplitude_that_reaches_noise_floor_is_valid;
+      rec->amplitude_that_reaches_noise_floor = scan.amplitude_that_reaches_noise_floor;
+    }
+
+    pos = fluid_sf2c_round(pos + len + FLUID_SF2C_GUARD, align);
+  }
+
+  if (src >= 0) {
+    close(src);
+  }
+  FLUID_FREE(buf);
+
+  /* the gaps are left as holes, which read as zeros */
+  w->h->sampledata_size = pos * sizeof(short);
+  return err;
+}
+
+/*
+ * fluid_sf2c_compile
+ */
+int fluid_sf2c_compile(fluid_defsfont_t* sfont, const char* path,
+		       const fluid_sf2c_stamp_t* stamp)
+{
+  fluid_sf2c_writer_t w;
+  fluid_sf2c_header_t h;
+  fluid_defpreset_t* preset;
+  fluid_defpreset_t* rec;
+  fluid_defpreset_t* prev = NULL;
+  fluid_preset_zone_t* zone;
+  fluid_list_t* list;
+  unsigned long long pos;
+  long pagesize;
+  char* tmp = NULL;
+  void* off;
+  unsigned int i;
+  int fd = -1;
+  int err = FLUID_FAILED;
+
+  FLUID_MEMSET(&w, 0, sizeof(w));
+  FLUID_MEMSET(&h, 0, sizeof(h));
+  FLUID_MEMCPY(h.magic, "SF2C", 4);
+  h.version = FLUID_SF2C_VERSION;
+  h.layout = fluid_sf2c_layout();
+  h.source = *stamp;
+  w.h = &h;
+
+  /* size the tables */
+  for (preset = sfont->preset; preset != NULL; preset = preset->next) {
+    h.table_count[FLUID_SF2C_PRESETS]++;
+    if (preset->global_zone != NULL) {
+      fluid_sf2c_count_preset_zone(&h, preset->global_zone);
+    }
+    for (zone = preset->zone; zone != NULL; zone = zone->next) {
+      fluid_sf2c_count_preset_zone(&h, zone);
+    }
+  }
+  for (list = sfont->sample; list; list = fluid_list_next(list)) {
+    h.table_count[FLUID_SF2C_SAMPLES]++;
+  }
+  h.strings_size++;
+
+  pos = fluid_sf2c_round(sizeof(h), 16);
+  for (i = 0; i < FLUID_SF2C_TABLES; i++) {
+    h.table_offset[i] = (unsigned int) pos;
+    pos = fluid_sf2c_round(pos + (unsigned long long) h.table_count[i]
+			   * fluid_sf2c_record_size[i], 16);
+  }
+  h.strings_offset = (unsigned int) pos;
+  pos += h.strings_size;
+
+  /* the sample data starts on a page so it can be protected read-only */
+  pagesize = sysconf(_SC_PAGESIZE);
+  if (pagesize < FLUID_SF2C_ALIGN) {
+    pagesize = FLUID_SF2C_ALIGN;
+  }
+  pos = fluid_sf2c_round(pos, (unsigned long long) pagesize);
+  if (pos > 0x7fffffffu) {
+    return FLUID_FAILED;
+  }
+  h.sampledata_offset = (unsigned int) pos;
+
+  w.tables = FLUID_MALLOC(h.sampledata_offset);
+  w.refs = FLUID_ARRAY(fluid_sf2c_sample_ref_t, h.table_count[FLUID_SF2C_SAMPLES] + 1);
+  if ((w.tables == NULL) || (w.refs == NULL)) {
+    FLUID_LOG(FLUID_ERR, "Out of memory");
+    goto done;
+  }
+  FLUID_MEMSET(w.tables, 0, h.sampledata_offset);
+
+  for (list = sfont->sample, i = 0; list; list = fluid_list_next(list), i++) {
+    w.refs[i].sample = (fluid_sample_t*) fluid_list_get(list);
+    w.refs[i].index = i;
+  }
+  w.sample_count = h.table_count[FLUID_SF2C_SAMPLES];
+  qsort(w.refs, w.sample_count, sizeof(fluid_sf2c_sample_ref_t), fluid_sf2c_ref_compare);
+
+  /* the preset graph, in list order */
+  for (preset = sfont->preset; preset != NULL; preset = preset->next) {
+    rec = (fluid_defpreset_t*) fluid_sf2c_put(&w, FLUID_SF2C_PRESETS, &off);
+    *rec = *preset;
+    rec->next = NULL;
+    rec->sfont = NULL;
+    rec->lut = NULL;
+    rec->global_zone = fluid_sf2c_put_preset_zones(&w, preset->global_zone, 1);
+    rec->zone = fluid_sf2c_put_preset_zones(&w, preset->zone, 0);
+    if (prev != NULL) {
+      prev->next = (fluid_defpreset_t*) off;
+    }
+    prev = rec;
+  }
+
+  /* write next to the target and move it in place when complete, so
+     readers never see a partial sidecar */
+  tmp = FLUID_MALLOC(FLUID_STRLEN(path) + 8);
+  if (tmp == NULL) {
+    FLUID_LOG(FLUID_ERR, "Out of memory");
+    goto done;
+  }
+  FLUID_SPRINTF(tmp, "%s.XXXXXX", path);
+  fd = mkstemp(tmp);
+  if (fd < 0) {
+    FLUID_FREE(tmp);
+    tmp = NULL;
+    goto done;
+  }
+  fchmod(fd, 0644);
+
+  if (fluid_sf2c_put_samples(&w, sfont, fd) != FLUID_OK) {
+    goto done;
+  }
+  h.file_size = (long long) h.sampledata_offset + h.sampledata_size;
+  h.checksum = fluid_sf2c_hash(2166136261u, w.tables + sizeof(h),
+			       h.sampledata_offset - sizeof(h));
+  FLUID_MEMCPY(w.tables, &h, sizeof(h));
+  if ((fluid_sf2c_write(fd, w.tables, h.sampledata_offset, 0) != FLUID_OK)
+      || (ftruncate(fd, (off_t) h.file_size) != 0)) {
+    goto done;
+  }
+  if (close(fd) != 0) {
+    fd = -1;
+    goto done;
+  }
+  fd = -1;
+  if (rename(tmp, path) != 0) {
+    goto done;
+  }
+  FLUID_LOG(FLUID_DBG, "Wrote compiled SoundFont %s", path);
+  err = FLUID_OK;
+
+ done:
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (tmp != NULL) {
+    if (err != FLUID_OK) {
+      unlink(tmp);
+    }
+    FLUID_FREE(tmp);
+  }
+  FLUID_FREE(w.tables);
+  FLUID_FREE(w.refs);
+  return err;
+}
+
+#else
+
+char* fluid_sf2c_path(const char* file)
+{
+  return NULL;
+}
+
+int fluid_sf2c_stamp(const char* file, fluid_sf2c_stamp_t* stamp)
+{
+  return FLUID_FAILED;
+}
+
+int fluid_sf2c_load(fluid_defsfont_t* sfont, const char* path,
+		    const fluid_sf2c_stamp_t* stamp)
+{
+  return FLUID_FAILED;
+}
+
+int fluid_sf2c_compile(fluid_defsfont_t* sfont, const char* path,
+		       const fluid_sf2c_stamp_t* stamp)
+{
+  return FLUID_FAILED;
+}
+
+#endif /* FLUID_SF2C_SUPPORT */
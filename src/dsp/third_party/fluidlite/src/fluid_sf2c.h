@@ -0,0 +1,68 @@
+/* FluidSynth - A Software Synthesizer
+ *
+ * Copyright (C) 2003  Peter Hanappe and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307, USA
+ */
+
+
+#ifndef _FLUID_SF2C_H
+#define _FLUID_SF2C_H
+
+#include "fluid_defsfont.h"
+
+/* compiled SoundFonts are mapped and written through plain file
+   descriptors */
+#define FLUID_SF2C_SUPPORT (HAVE_SYS_MMAN_H && HAVE_UNISTD_H && HAVE_FCNTL_H)
+
+/* bump whenever the file layout or the meaning of a field changes */
+#define FLUID_SF2C_VERSION 1
+
+/* every sample starts on a boundary of this many bytes */
+#define FLUID_SF2C_ALIGN 64
+
+/* zero points at least before and after every sample */
+#define FLUID_SF2C_GUARD 8
+
+/*
+ * fluid_sf2c_stamp_t
+ *
+ * Identifies the revision of a source file a sidecar was compiled from.
+ */
+typedef struct _fluid_sf2c_stamp_t {
+  long long size;
+  long long mtime;
+  long long mtime_nsec;
+} fluid_sf2c_stamp_t;
+
+/* the sidecar path of a SoundFont, to be freed with FLUID_FREE() */
+char* fluid_sf2c_path(const char* file);
+
+int fluid_sf2c_stamp(const char* file, fluid_sf2c_stamp_t* stamp);
+
+/* Maps a sidecar compiled from the 'stamp' revision of its SoundFont into
+   sfont: presets, zones, instruments, modulators and samples live in the
+   mapping, sample data included. Returns FLUID_FAILED, without logging,
+   if the caller should parse the SoundFont instead. */
+int fluid_sf2c_load(fluid_defsfont_t* sfont, const char* path,
+		    const fluid_sf2c_stamp_t* stamp);
+
+/* Writes the sidecar for a SoundFont loaded by parsing it. 'stamp' is the
+   revision of the file taken before it was parsed. */
+int fluid_sf2c_compile(fluid_defsfont_t* sfont, const char* path,
+		       const fluid_sf2c_stamp_t* stamp);
+
+#endif /* _FLUID_SF2C_H */
@@ -65,11 +65,14 @@
   { if ((_preset) && (_preset)->notify) { (*(_preset)->notify)(_preset,_reason,_chan); }}
 
 
-#define fluid_sample_incr_ref(_sample) { (_sample)->refcount++; }
+/* The samples of a shared SoundFont are counted by the voices of every
+   synth using it, from several threads at once */
+#define fluid_sample_incr_ref(_sample) \
+  { __atomic_add_fetch(&(_sample)->refcount, 1, __ATOMIC_RELAXED); }
 
 #define fluid_sample_decr_ref(_sample) \
-  (_sample)->refcount--; \
-  if (((_sample)->refcount == 0) && ((_sample)->notify)) \
+  if ((__atomic_sub_fetch(&(_sample)->refcount, 1, __ATOMIC_ACQ_REL) == 0) \
+      && ((_sample)->notify)) \
     (*(_sample)->notify)(_sample, FLUID_SAMPLE_DONE);
 
 
@@ -0,0 +1,360 @@
+/* FluidSynth - A Software Synthesizer
+ *
+ * Copyright (C) 2003  Peter Hanappe and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307, USA
+ */
+
+
+/*
+ * Sample body streaming
+ *
+ * A fixed pool of ring buffers is shared by all voices of the process.
+ * A voice that starts a streamed sample claims a ring; the I/O thread
+ * keeps every claimed ring filled from the file ahead of the voice's
+ * read position, serving the ring with the least data buffered first.
+ *
+ * Each ring is single producer (the I/O thread) and single consumer (the
+ * voice). Positions are absolute sample point indices. 'fill' carries the
+ * first point not read yet together with a generation that changes on
+ * every open and close, so a read that was started for a previous owner
+ * of the ring is thrown away instead of committed.
+ */
+
+#include "fluid_stream.h"
+
+#if FLUID_STREAM_SUPPORT
+
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+
+#define FLUID_STREAM_SLOTS  128
+#define FLUID_STREAM_RING   16384	/* points per ring, a power of two */
+#define FLUID_STREAM_CHUNK  4096	/* points per read */
+
+struct _fluid_stream_slot_t {
+  int busy;                   /* claimed by a voice */
+  unsigned int gen;           /* owner generation, touched by the owner only */
+  unsigned long long fill;    /* gen << 32 | first point not read yet */
+  unsigned int read_pos;      /* first point the voice may still read */
+  int fd;                     /* the fields below are published by 'fill' */
+  unsigned int samplepos;
+  unsigned int body_end;
+  short* ring;
+};
+
+static pthread_mutex_t fluid_stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t fluid_stream_thread;
+static int fluid_stream_users = 0;
+static int fluid_stream_quit = 0;
+static fluid_stream_slot_t* fluid_stream_slots = NULL;
+static short* fluid_stream_rings = NULL;
+static unsigned int fluid_stream_hint = 0;
+
+#define fluid_stream_fill_value(_gen, _pos) \
+  (((unsigned long long)(_gen) << 32) | (unsigned long long)(_pos))
+
+/* read count points at 'pos' into buf; whatever can't be read is zeroed */
+static void fluid_stream_pread(int fd, unsigned int samplepos, short* buf,
+			       unsigned int pos, unsigned int count)
+{
+  char* dst = (char*) buf;
+  size_t left = (size_t) count * sizeof(short);
+  off_t offset = (off_t) samplepos + (off_t) pos * sizeof(short);
+  ssize_t n;
+
+  while (left > 0) {
+    n = pread(fd, dst, left, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      FLUID_MEMSET(dst, 0, left);
+      return;
+    }
+    dst += n;
+    offset += n;
+    left -= (size_t) n;
+  }
+}
+
+/* Fill one chunk of the ring whose 'fill' was sampled as 'fill' */
+static void fluid_stream_service(fluid_stream_slot_t* slot, unsigned long long fill)
+{
+  unsigned int gen = (unsigned int) (fill >> 32);
+  unsigned int pos = (unsigned int) fill;
+  unsigned int read_pos, body_end, samplepos, count, first;
+  int fd;
+
+  fd = __atomic_load_n(&slot->fd, __ATOMIC_RELAXED);
+  samplepos = __atomic_load_n(&slot->samplepos, __ATOMIC_RELAXED);
+  body_end = __atomic_load_n(&slot->body_end, __ATOMIC_RELAXED);
+  read_pos = __atomic_load_n(&slot->read_pos, __ATOMIC_ACQUIRE);
+
+  /* the fields above belong to the owner that published 'fill' only if
+     it is still in place after reading them */
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&slot->fill, __ATOMIC_RELAXED) != fill) {
+    return;
+  }
+
+  /* the voice started or got ahead of us: skip what it no longer needs */
+  if (read_pos > pos) {
+    pos = read_pos;
+  }
+  if (pos >= body_end) {
+    return;
+  }
+
+  count = FLUID_STREAM_RING - (pos - read_pos);
+  if (count > FLUID_STREAM_CHUNK) count = FLUID_STREAM_CHUNK;
+  if (count > body_end - pos) count = body_end - pos;
+
+  first = FLUID_STREAM_RING - (pos & (FLUID_STREAM_RING - 1));
+  if (first > count) first = count;
+
+  fluid_stream_pread(fd, samplepos, slot->ring + (pos & (FLUID_STREAM_RING - 1)), pos, first);
+  if (count > first) {
+    fluid_stream_pread(fd, samplepos, slot->ring, pos + first, count - first);
+  }
+
+  /* fails if the ring changed hands meanwhile; the data is just dropped */
+  __atomic_compare_exchange_n(&slot->fill, &fill, fluid_stream_fill_value(gen, pos + count),
+			      0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/* Pick the claimed ring with the least data ahead of its voice */
+static fluid_stream_slot_t* fluid_stream_most_urgent(unsigned long long* fill_out)
+{
+  fluid_stream_slot_t* best = NULL;
+  unsigned long long fill;
+  unsigned int best_lead = 0;
+  unsigned int pos, read_pos, body_end, lead;
+  int i;
+
+  for (i = 0; i < FLUID_STREAM_SLOTS; i++) {
+    fluid_stream_slot_t* slot = &fluid_stream_slots[i];
+
+    if (!__atomic_load_n(&slot->busy, __ATOMIC_ACQUIRE)) continue;
+
+    fill = __atomic_load_n(&slot->fill, __ATOMIC_ACQUIRE);
+    pos = (unsigned int) fill;
+    read_pos = __atomic_load_n(&slot->read_pos, __ATOMIC_RELAXED);
+    body_end = __atomic_load_n(&slot->body_end, __ATOMIC_RELAXED);
+    if (read_pos > pos) pos = read_pos;
+
+    if (pos >= body_end) continue;	/* read to the end of the body */
+
+    /* wait for a full chunk of room unless that's all that is left */
+    lead = pos - read_pos;
+    if ((FLUID_STREAM_RING - lead < FLUID_STREAM_CHUNK)
+	&& (FLUID_STREAM_RING - lead < body_end - pos)) {
+      continue;
+    }
+
+    if ((best == NULL) || (lead < best_lead)) {
+      best = slot;
+      best_lead = lead;
+      *fill_out = fill;
+    }
+  }
+  return best;
+}
+
+static void* fluid_stream_run(void* data)
+{
+  struct timespec idle = { 0, 1000000 };	/* 1 ms */
+  fluid_stream_slot_t* slot;
+  unsigned long long fill = 0;
+
+  while (!__atomic_load_n(&fluid_stream_quit, __ATOMIC_ACQUIRE)) {
+    slot = fluid_stream_most_urgent(&fill);
+    if (slot != NULL) {
+      fluid_stream_service(slot, fill);
+    } else {
+      nanosleep(&idle, NULL);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * fluid_stream_engine_acquire
+ *
+ * Called from loader threads for every SoundFont that gets streamed.
+ */
+int fluid_stream_engine_acquire(void)
+{
+  int i;
+
+  pthread_mutex_lock(&fluid_stream_lock);
+  if (fluid_stream_users == 0) {
+    fluid_stream_slots = FLUID_ARRAY(fluid_stream_slot_t, FLUID_STREAM_SLOTS);
+    fluid_stream_rings = FLUID_ARRAY(short, FLUID_STREAM_SLOTS * FLUID_STREAM_RING);
+    if ((fluid_stream_slots == NULL) || (fluid_stream_rings == NULL)) {
+      FLUID_LOG(FLUID_ERR, "Out of memory");
+      goto error_recovery;
+    }
+    FLUID_MEMSET(fluid_stream_slots, 0, FLUID_STREAM_SLOTS * sizeof(fluid_stream_slot_t));
+    for (i = 0; i < FLUID_STREAM_SLOTS; i++) {
+      fluid_stream_slots[i].fd = -1;
+      fluid_stream_slots[i].ring = fluid_stream_rings + i * FLUID_STREAM_RING;
+    }
+    fluid_stream_quit = 0;
+    if (pthread_create(&fluid_stream_thread, NULL, fluid_stream_run, NULL) != 0) {
+      FLUID_LOG(FLUID_ERR, "Failed to start the sample streaming thread");
+      goto error_recovery;
+    }
+  }
+  fluid_stream_users++;
+  pthread_mutex_unlock(&fluid_stream_lock);
+  return FLUID_OK;
+
+ error_recovery:
+  if (fluid_stream_slots != NULL) FLUID_FREE(fluid_stream_slots);
+  if (fluid_stream_rings != NULL) FLUID_FREE(fluid_stream_rings);
+  fluid_stream_slots = NULL;
+  fluid_stream_rings = NULL;
+  pthread_mutex_unlock(&fluid_stream_lock);
+  return FLUID_FAILED;
+}
+
+/*
+ * fluid_stream_engine_release
+ *
+ * Stops the I/O thread with the last streamed SoundFont. No voice may
+ * hold a ring by then, which deleting the SoundFont already guarantees.
+ */
+void fluid_stream_engine_release(void)
+{
+  pthread_mutex_lock(&fluid_stream_lock);
+  if ((fluid_stream_users > 0) && (--fluid_stream_users == 0)) {
+    __atomic_store_n(&fluid_stream_quit, 1, __ATOMIC_RELEASE);
+    pthread_join(fluid_stream_thread, NULL);
+    FLUID_FREE(fluid_stream_slots);
+    FLUID_FREE(fluid_stream_rings);
+    fluid_stream_slots = NULL;
+    fluid_stream_rings = NULL;
+  }
+  pthread_mutex_unlock(&fluid_stream_lock);
+}
+
+/*
+ * fluid_stream_open
+ */
+fluid_stream_slot_t* fluid_stream_open(fluid_sample_stream_t* stream)
+{
+  fluid_stream_slot_t* slot;
+  unsigned int hint;
+  int i, expected;
+
+  if (fluid_stream_slots == NULL) {
+    return NULL;
+  }
+
+  hint = __atomic_load_n(&fluid_stream_hint, __ATOMIC_RELAXED);
+  for (i = 0; i < FLUID_STREAM_SLOTS; i++) {
+    slot = &fluid_stream_slots[(hint + i) % FLUID_STREAM_SLOTS];
+    expected = 0;
+    if (__atomic_compare_exchange_n(&slot->busy, &expected, 1, 0,
+				    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      __atomic_store_n(&fluid_stream_hint, (hint + i + 1) % FLUID_STREAM_SLOTS, __ATOMIC_RELAXED);
+
+      /* the generation was bumped on close; order the new fields after it */
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      __atomic_store_n(&slot->fd, stream->file->fd, __ATOMIC_RELAXED);
+      __atomic_store_n(&slot->samplepos, stream->file->samplepos, __ATOMIC_RELAXED);
+      __atomic_store_n(&slot->body_end, stream->body_end, __ATOMIC_RELAXED);
+      __atomic_store_n(&slot->read_pos, stream->body_start, __ATOMIC_RELAXED);
+      slot->gen++;
+      __atomic_store_n(&slot->fill, fluid_stream_fill_value(slot->gen, stream->body_start),
+		       __ATOMIC_RELEASE);
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * fluid_stream_close
+ */
+void fluid_stream_close(fluid_stream_slot_t* slot)
+{
+  slot->gen++;
+  __atomic_store_n(&slot->fill, fluid_stream_fill_value(slot->gen, 0), __ATOMIC_RELEASE);
+  __atomic_store_n(&slot->busy, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * fluid_stream_read
+ *
+ * Copies the points [from, from + count) that have arrived so far into
+ * buf and returns how many that were, counting from 'from'. Also tells
+ * the I/O thread that nothing before 'from' is needed anymore, so 'from'
+ * must never decrease between calls.
+ */
+unsigned int fluid_stream_read(fluid_stream_slot_t* slot, short* buf,
+			       unsigned int from, unsigned int count)
+{
+  unsigned long long fill = __atomic_load_n(&slot->fill, __ATOMIC_ACQUIRE);
+  unsigned int pos = (unsigned int) fill;
+  unsigned int got = 0;
+  unsigned int first;
+
+  if (from < pos) {
+    got = pos - from;
+    if (got > count) got = count;
+
+    first = FLUID_STREAM_RING - (from & (FLUID_STREAM_RING - 1));
+    if (first > got) first = got;
+    FLUID_MEMCPY(buf, slot->ring + (from & (FLUID_STREAM_RING - 1)), first * sizeof(short));
+    if (got > first) {
+      FLUID_MEMCPY(buf + first, slot->ring, (got - first) * sizeof(short));
+    }
+  }
+
+  __atomic_store_n(&slot->read_pos, from, __ATOMIC_RELEASE);
+  return got;
+}
+
+#else /* !FLUID_STREAM_SUPPORT */
+
+int fluid_stream_engine_acquire(void)
+{
+  return FLUID_FAILED;
+}
+
+void fluid_stream_engine_release(void)
+{
+}
+
+fluid_stream_slot_t* fluid_stream_open(fluid_sample_stream_t* stream)
+{
+  return NULL;
+}
+
+void fluid_stream_close(fluid_stream_slot_t* slot)
+{
+}
+
+unsigned int fluid_stream_read(fluid_stream_slot_t* slot, short* buf,
+			       unsigned int from, unsigned int count)
+{
+  return 0;
+}
+
+#endif /* FLUID_STREAM_SUPPORT */
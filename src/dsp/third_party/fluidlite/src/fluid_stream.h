@@ -0,0 +1,85 @@
+/* FluidSynth - A Software Synthesizer
+ *
+ * Copyright (C) 2003  Peter Hanappe and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307, USA
+ */
+
+
+#ifndef _FLUID_STREAM_H
+#define _FLUID_STREAM_H
+
+#include "fluidsynth_priv.h"
+
+/* streaming keeps head and tail in the sample mapping and needs a
+   thread to read the rest */
+#define FLUID_STREAM_SUPPORT (HAVE_PTHREAD_H && HAVE_SYS_MMAN_H && HAVE_UNISTD_H)
+
+/* Most sample points a voice can gather for one block. Voices transposed
+   so far up that a block needs more play silence through the body. */
+#define FLUID_STREAM_WINDOW 4096
+
+/* zeroed points after the window, for the interpolation's end points */
+#define FLUID_STREAM_GUARD 4
+
+/* points at the end of every sample that stay resident; the interpolation
+   reads the end point of a sample on every block */
+#define FLUID_STREAM_TAIL 8
+
+/* samples with less than this many points to stream stay resident */
+#define FLUID_STREAM_MIN_BODY 8192
+
+typedef struct _fluid_stream_file_t fluid_stream_file_t;
+typedef struct _fluid_stream_slot_t fluid_stream_slot_t;
+
+/*
+ * fluid_stream_file_t
+ *
+ * The SoundFont file the bodies of streamed samples are read from.
+ */
+struct _fluid_stream_file_t {
+  int fd;
+  unsigned int samplepos;   /* file offset of sample point 0 */
+  unsigned int underruns;   /* blocks that played body points as silence */
+};
+
+/*
+ * fluid_sample_stream_t
+ *
+ * Streaming layout of one sample. The points before body_start (the
+ * head, and a loop that starts in it) and from body_end on (a loop that
+ * starts later and what follows it) are resident
+ * in the sample mapping; the body in between is never touched through
+ * the mapping during playback but read ahead of each voice into a ring.
+ */
+struct _fluid_sample_stream_t {
+  fluid_stream_file_t* file;
+  unsigned int body_start;
+  unsigned int body_end;
+};
+
+/* The I/O thread runs while at least one streamed SoundFont is loaded */
+int fluid_stream_engine_acquire(void);
+void fluid_stream_engine_release(void);
+
+/* Audio thread side, lock-free. fluid_stream_open() returns NULL when all
+   rings are taken; the voice then underruns through its body. */
+fluid_stream_slot_t* fluid_stream_open(fluid_sample_stream_t* stream);
+void fluid_stream_close(fluid_stream_slot_t* slot);
+unsigned int fluid_stream_read(fluid_stream_slot_t* slot, short* buf,
+			       unsigned int from, unsigned int count);
+
+#endif /* _FLUID_STREAM_H */
@@ -59,6 +59,15 @@ int fluid_synth_set_gen2(fluid_synth_t* synth, int chan,
 static int fluid_synth_initialized = 0;
 static void fluid_synth_init(void);
 static void init_dither(void);
+static int fluid_synth_init_voice_index(fluid_synth_t* synth);
+static void fluid_synth_reset_voice_index(fluid_synth_t* synth);
+static void fluid_synth_delete_voice_index(fluid_synth_t* synth);
+static void fluid_synth_link_voice(fluid_synth_t* synth, fluid_voice_t* voice);
+
+/* the voices of a channel on a key, or in an exclusive class, hash
+   into one of 128 lists and are told apart by comparing the key or
+   class */
+#define FLUID_SYNTH_VOICE_SLOT(_chan, _n)  ((_chan) * 128 + ((_n) & 0x7f))
 
 static int fluid_synth_sysex_midi_tuning (fluid_synth_t *synth, const char *data,
                                           int len, char *response,
@@ -109,10 +118,13 @@ void fluid_synth_settings(fluid_settings_t* settings)
   fluid_settings_register_str(settings, "synth.reverb.active", "yes", 0, NULL, NULL);
   fluid_settings_register_str(settings, "synth.chorus.active", "yes", 0, NULL, NULL);
   fluid_settings_register_str(settings, "synth.ladspa.active", "no", 0, NULL, NULL);
+  fluid_settings_register_str(settings, "synth.filter-bypass", "no", 0, NULL, NULL);
   fluid_settings_register_str(settings, "midi.portname", "", 0, NULL, NULL);
   fluid_settings_register_str(settings, "synth.drums-channel.active", "yes", 0, NULL, NULL);
 
   fluid_settings_register_int(settings, "synth.polyphony", 256, 16, 4096, 0, NULL, NULL);
+  fluid_settings_register_int(settings, "synth.cpu-cores", 1, 1, FLUID_WORKERS_MAX, 0, NULL, NULL);
+  fluid_settings_register_int(settings, "synth.block-size", FLUID_BUFSIZE, 16, FLUID_MAX_BUFSIZE, 0, NULL, NULL);
   fluid_settings_register_int(settings, "synth.midi-channels", 16, 16, 256, 0, NULL, NULL);
   fluid_settings_register_num(settings, "synth.gain", 0.2f, 0.0f, 10.0f, 0, NULL, NULL);
   fluid_settings_register_int(settings, "synth.audio-channels", 1, 1, 256, 0, NULL, NULL);
@@ -326,7 +338,7 @@ int fluid_synth_verify_settings(fluid_settings_t *settings)
 fluid_synth_t*
 new_fluid_synth(fluid_settings_t *settings)
 {
-  int i;
+  int i, cores = 1;
   fluid_synth_t* synth;
   fluid_sfloader_t* loader;
 
@@ -351,11 +363,13 @@ new_fluid_synth(fluid_settings_t *settings)
 
   synth->with_reverb = fluid_settings_str_equal(settings, "synth.reverb.active", "yes");
   synth->with_chorus = fluid_settings_str_equal(settings, "synth.chorus.active", "yes");
+  synth->filter_bypass = fluid_settings_str_equal(settings, "synth.filter-bypass", "yes");
   synth->verbose = fluid_settings_str_equal(settings, "synth.verbose", "yes");
   synth->dump = fluid_settings_str_equal(settings, "synth.dump", "yes");
 
   fluid_settings_getint(settings, "synth.polyphony", &synth->polyphony);
   fluid_settings_getnum(settings, "synth.sample-rate", &synth->sample_rate);
+  fluid_settings_getint(settings, "synth.block-size", &synth->block_size);
   fluid_settings_getint(settings, "synth.midi-channels", &synth->midi_channels);
   fluid_settings_getint(settings, "synth.audio-channels", &synth->audio_channels);
   fluid_settings_getint(settings, "synth.audio-groups", &synth->audio_groups);
@@ -404,6 +418,14 @@ new_fluid_synth(fluid_settings_t *settings)
     synth->audio_groups = 128;
   }
 
+  /* the dsp loops work on 4 points at a time */
+  if ((synth->block_size < 16) || (synth->block_size > FLUID_MAX_BUFSIZE)
+      || (synth->block_size % 4 != 0)) {
+    FLUID_LOG(FLUID_WARN, "Invalid block size (%d). "
+	     "Setting the block size to %d.", synth->block_size, FLUID_BUFSIZE);
+    synth->block_size = FLUID_BUFSIZE;
+  }
+
   if (synth->effects_channels != 2) {
     FLUID_LOG(FLUID_WARN, "Invalid number of effects channels (%d)."
 	     "Setting effects channels to 2.", synth->effects_channels);
@@ -459,11 +481,16 @@ new_fluid_synth(fluid_settings_t *settings)
   if (synth->voice == NULL) {
     goto error_recovery;
   }
+  FLUID_MEMSET(synth->voice, 0, sizeof(fluid_voice_t*) * synth->nvoice);
+  synth->voice_pool = new_fluid_voice_pool(synth->nvoice, synth->sample_rate, synth->block_size);
+  if (synth->voice_pool == NULL) {
+    goto error_recovery;
+  }
   for (i = 0; i < synth->nvoice; i++) {
-    synth->voice[i] = new_fluid_voice(synth->sample_rate);
-    if (synth->voice[i] == NULL) {
-      goto error_recovery;
-    }
+    synth->voice[i] = fluid_voice_pool_get(synth->voice_pool, i);
+  }
+  if (fluid_synth_init_voice_index(synth) != FLUID_OK) {
+    goto error_recovery;
   }
 
   /* Allocate the sample buffers */
@@ -487,8 +514,8 @@ new_fluid_synth(fluid_settings_t *settings)
 
   for (i = 0; i < synth->nbuf; i++) {
 
-    synth->left_buf[i] = FLUID_ARRAY(fluid_real_t, FLUID_BUFSIZE);
-    synth->right_buf[i] = FLUID_ARRAY(fluid_real_t, FLUID_BUFSIZE);
+    synth->left_buf[i] = FLUID_ARRAY(fluid_real_t, synth->block_size);
+    synth->right_buf[i] = FLUID_ARRAY(fluid_real_t, synth->block_size);
 
     if ((synth->left_buf[i] == NULL) || (synth->right_buf[i] == NULL)) {
       FLUID_LOG(FLUID_ERR, "Out of memory");
@@ -510,8 +537,8 @@ new_fluid_synth(fluid_settings_t *settings)
   FLUID_MEMSET(synth->fx_right_buf, 0, 2 * sizeof(fluid_real_t*));
 
   for (i = 0; i < synth->effects_channels; i++) {
-    synth->fx_left_buf[i] = FLUID_ARRAY(fluid_real_t, FLUID_BUFSIZE);
-    synth->fx_right_buf[i] = FLUID_ARRAY(fluid_real_t, FLUID_BUFSIZE);
+    synth->fx_left_buf[i] = FLUID_ARRAY(fluid_real_t, synth->block_size);
+    synth->fx_right_buf[i] = FLUID_ARRAY(fluid_real_t, synth->block_size);
 
     if ((synth->fx_left_buf[i] == NULL) || (synth->fx_right_buf[i] == NULL)) {
       FLUID_LOG(FLUID_ERR, "Out of memory");
@@ -519,8 +546,11 @@ new_fluid_synth(fluid_settings_t *settings)
     }
   }
 
+  /* the threads that render on the other cores */
+  fluid_settings_getint(settings, "synth.cpu-cores", &cores);
+  synth->workers = new_fluid_workers(synth, cores);
 
-  synth->cur = FLUID_BUFSIZE;
+  synth->cur = synth->block_size;
   synth->dither_index = 0;
 
   /* allocate the reverb module */
@@ -576,11 +606,8 @@ new_fluid_synth(fluid_settings_t *settings)
 void
 fluid_synth_set_sample_rate(fluid_synth_t* synth, float sample_rate)
 {
-    int i;
-    for (i = 0; i < synth->nvoice; i++) {
-      delete_fluid_voice(synth->voice[i]);
-      synth->voice[i] = new_fluid_voice(synth->sample_rate);
-    }
+    fluid_voice_pool_reset(synth->voice_pool, synth->sample_rate, synth->block_size);
+    fluid_synth_reset_voice_index(synth);
 
     delete_fluid_chorus(synth->chorus);
     synth->chorus = new_fluid_chorus(synth->sample_rate);
@@ -604,6 +631,9 @@ delete_fluid_synth(fluid_synth_t* synth)
 
   synth->state = FLUID_SYNTH_STOPPED;
 
+  delete_fluid_workers(synth->workers);
+  synth->workers = NULL;
+
   /* turn off all voices, needed to unload SoundFont data */
   if (synth->voice != NULL) {
     for (i = 0; i < synth->nvoice; i++) {
@@ -612,6 +642,15 @@ delete_fluid_synth(fluid_synth_t* synth)
     }
   }
 
+  /* also unset all presets for clean SoundFont unload; presets must not
+     outlive the SoundFont they came from */
+  if (synth->channel != NULL) {
+    for (i = 0; i < synth->midi_channels; i++) {
+      if (synth->channel[i] != NULL)
+	fluid_channel_set_preset(synth->channel[i], NULL);
+    }
+  }
+
   /* delete all the SoundFonts */
   for (list = synth->sfont; list; list = fluid_list_next(list)) {
     sfont = (fluid_sfont_t*) fluid_list_get(list);
@@ -649,13 +688,11 @@ delete_fluid_synth(fluid_synth_t* synth)
   }
 
   if (synth->voice != NULL) {
-    for (i = 0; i < synth->nvoice; i++) {
-      if (synth->voice[i] != NULL) {
-	delete_fluid_voice(synth->voice[i]);
-      }
-    }
     FLUID_FREE(synth->voice);
   }
+  delete_fluid_voice_pool(synth->voice_pool);
+
+  fluid_synth_delete_voice_index(synth);
 
   /* free all the sample buffers */
   if (synth->left_buf != NULL) {
@@ -783,21 +820,45 @@ fluid_synth_noteon(fluid_synth_t* synth, int chan, int key, int vel)
   return fluid_synth_start(synth, synth->noteid++, channel->preset, 0, chan, key, vel);
 }
 
+/*
+ * fluid_synth_noteon_delayed
+ */
+int
+fluid_synth_noteon_delayed(fluid_synth_t* synth, int chan, int key, int vel, int delay)
+{
+  int status;
+
+  /* the samples of the current block come first */
+  delay -= synth->block_size - synth->cur;
+  if ((delay > 0) && (delay < synth->block_size)) {
+    synth->start_offset = delay;
+  }
+
+  status = fluid_synth_noteon(synth, chan, key, vel);
+  synth->start_offset = 0;
+  return status;
+}
+
 /*
  * fluid_synth_noteoff
  */
 int
 fluid_synth_noteoff(fluid_synth_t* synth, int chan, int key)
 {
-  int i;
   fluid_voice_t* voice;
+  fluid_voice_t* next;
   int status = FLUID_FAILED;
 /*   fluid_mutex_lock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   fluid_mutex_unlock(synth->busy); */
 
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
-    if (_ON(voice) && (voice->chan == chan) && (voice->key == key)) {
+  if ((chan < 0) || (chan >= synth->midi_channels)) {
+    return FLUID_FAILED;
+  }
+  synth->steal_heap_valid = 0;
+
+  for (voice = synth->key_voices[FLUID_SYNTH_VOICE_SLOT(chan, key)]; voice != NULL; voice = next) {
+    next = voice->link[FLUID_VOICE_LIST_KEY].next;
+    if (_ON(voice) && (voice->key == key)) {
       if (synth->verbose) {
 	int used_voices = 0;
 	int k;
@@ -815,7 +876,7 @@ fluid_synth_noteoff(fluid_synth_t* synth, int chan, int key)
       fluid_voice_noteoff(voice);
       status = FLUID_OK;
     } /* if voice on */
-  } /* for all voices */
+  } /* for all voices on the key */
   return status;
 }
 
@@ -825,15 +886,19 @@ fluid_synth_noteoff(fluid_synth_t* synth, int chan, int key)
 int
 fluid_synth_damp_voices(fluid_synth_t* synth, int chan)
 {
-  int i;
   fluid_voice_t* voice;
+  fluid_voice_t* next;
 
 /*   fluid_mutex_lock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   fluid_mutex_unlock(synth->busy); */
 
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
-    if ((voice->chan == chan) && _SUSTAINED(voice)) {
+  if ((chan < 0) || (chan >= synth->midi_channels)) {
+    return FLUID_OK;
+  }
+  synth->steal_heap_valid = 0;
+  for (voice = synth->chan_voices[chan]; voice != NULL; voice = next) {
+    next = voice->link[FLUID_VOICE_LIST_CHAN].next;
+    if (_SUSTAINED(voice)) {
 /*        printf("turned off sustained note: chan=%d, key=%d, vel=%d\n", voice->chan, voice->key, voice->vel); */
       fluid_voice_noteoff(voice);
     }
@@ -1173,17 +1238,26 @@ fluid_synth_sysex_midi_tuning (fluid_synth_t *synth, const char *data, int len,
 /*
  * fluid_synth_all_notes_off
  *
- * put all notes on this channel into released state.
+ * put all notes on this channel into released state, or those of all
+ * channels if chan is -1.
  */
 int
 fluid_synth_all_notes_off(fluid_synth_t* synth, int chan)
 {
-  int i;
   fluid_voice_t* voice;
+  fluid_voice_t* next;
+  int first = chan, last = chan;
 
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
-    if (_PLAYING(voice) && (voice->chan == chan)) {
+  if (chan == -1) {
+    first = 0;
+    last = synth->midi_channels - 1;
+  } else if ((chan < 0) || (chan >= synth->midi_channels)) {
+    return FLUID_OK;
+  }
+  synth->steal_heap_valid = 0;
+  for (chan = first; chan <= last; chan++) {
+    for (voice = synth->chan_voices[chan]; voice != NULL; voice = next) {
+      next = voice->link[FLUID_VOICE_LIST_CHAN].next;
       fluid_voice_noteoff(voice);
     }
   }
@@ -1198,14 +1272,15 @@ fluid_synth_all_notes_off(fluid_synth_t* synth, int chan)
 int
 fluid_synth_all_sounds_off(fluid_synth_t* synth, int chan)
 {
-  int i;
   fluid_voice_t* voice;
+  fluid_voice_t* next;
 
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
-    if (_PLAYING(voice) && (voice->chan == chan)) {
-      fluid_voice_off(voice);
-    }
+  if ((chan < 0) || (chan >= synth->midi_channels)) {
+    return FLUID_OK;
+  }
+  for (voice = synth->chan_voices[chan]; voice != NULL; voice = next) {
+    next = voice->link[FLUID_VOICE_LIST_CHAN].next;
+    fluid_voice_off(voice);
   }
   return FLUID_OK;
 }
@@ -1220,13 +1295,9 @@ int
 fluid_synth_system_reset(fluid_synth_t* synth)
 {
   int i;
-  fluid_voice_t* voice;
 
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
-    if (_PLAYING(voice)) {
-      fluid_voice_off(voice);
-    }
+  while (synth->nactive > 0) {
+    fluid_voice_off(synth->active[synth->nactive - 1]);
   }
 
   for (i = 0; i < synth->midi_channels; i++) {
@@ -1248,17 +1319,16 @@ fluid_synth_system_reset(fluid_synth_t* synth)
 int
 fluid_synth_modulate_voices(fluid_synth_t* synth, int chan, int is_cc, int ctrl)
 {
-  int i;
   fluid_voice_t* voice;
 
 /*   fluid_mutex_lock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   fluid_mutex_unlock(synth->busy); */
 
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
-    if (voice->chan == chan) {
-      fluid_voice_modulate(voice, is_cc, ctrl);
-    }
+  if ((chan < 0) || (chan >= synth->midi_channels)) {
+    return FLUID_OK;
+  }
+  for (voice = synth->chan_voices[chan]; voice != NULL; voice = voice->link[FLUID_VOICE_LIST_CHAN].next) {
+    fluid_voice_modulate(voice, is_cc, ctrl);
   }
   return FLUID_OK;
 }
@@ -1273,17 +1343,16 @@ fluid_synth_modulate_voices(fluid_synth_t* synth, int chan, int is_cc, int ctrl)
 int
 fluid_synth_modulate_voices_all(fluid_synth_t* synth, int chan)
 {
-  int i;
   fluid_voice_t* voice;
 
 /*   fluid_mutex_lock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   fluid_mutex_unlock(synth->busy); */
 
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
-    if (voice->chan == chan) {
-      fluid_voice_modulate_all(voice);
-    }
+  if ((chan < 0) || (chan >= synth->midi_channels)) {
+    return FLUID_OK;
+  }
+  for (voice = synth->chan_voices[chan]; voice != NULL; voice = voice->link[FLUID_VOICE_LIST_CHAN].next) {
+    fluid_voice_modulate_all(voice);
   }
   return FLUID_OK;
 }
@@ -1348,12 +1417,11 @@ fluid_synth_key_pressure(fluid_synth_t* synth, int chan, int key, int val)
   // fluid_synth_update_key_pressure_LOCAL
   {
     fluid_voice_t* voice;
-    int i;
 
-    for (i = 0; i < synth->polyphony; i++) {
-      voice = synth->voice[i];
+    for (voice = synth->key_voices[FLUID_SYNTH_VOICE_SLOT(chan, key)]; voice != NULL;
+	 voice = voice->link[FLUID_VOICE_LIST_KEY].next) {
 
-      if (voice->chan == chan && voice->key == key) {
+      if (voice->key == key) {
         result = fluid_voice_modulate(voice, 0, FLUID_MOD_KEYPRESSURE);
         if (result != FLUID_OK)
           break;
@@ -1773,11 +1841,8 @@ void fluid_synth_set_gain(fluid_synth_t* synth, float gain)
   fluid_clip(gain, 0.0f, 10.0f);
   synth->gain = gain;
 
-  for (i = 0; i < synth->polyphony; i++) {
-    fluid_voice_t* voice = synth->voice[i];
-    if (_PLAYING(voice)) {
-      fluid_voice_set_gain(voice, gain);
-    }
+  for (i = 0; i < synth->nactive; i++) {
+    fluid_voice_set_gain(synth->active[i], gain);
   }
 }
 
@@ -1842,12 +1907,24 @@ fluid_synth_get_active_voice_count(fluid_synth_t* synth)
   return synth->active_voice_count;
 }
 
+/**
+ * Get the number of voices stopped so far to make room for new ones.
+ * @param synth FluidSynth instance
+ * @return Number of voices stolen since the synth was created; wraps
+ *   around like any unsigned counter.
+ */
+unsigned int
+fluid_synth_get_voices_stolen(fluid_synth_t* synth)
+{
+  return synth->voices_stolen;
+}
+
 /*
  * fluid_synth_get_internal_buffer_size
  */
 int fluid_synth_get_internal_bufsize(fluid_synth_t* synth)
 {
-  return FLUID_BUFSIZE;
+  return synth->block_size;
 }
 
 /*
@@ -2024,8 +2101,8 @@ fluid_synth_nwrite_float(fluid_synth_t* synth, int len,
   /* First, take what's still available in the buffer */
   count = 0;
   num = synth->cur;
-  if (synth->cur < FLUID_BUFSIZE) {
-    available = FLUID_BUFSIZE - synth->cur;
+  if (synth->cur < synth->block_size) {
+    available = synth->block_size - synth->cur;
 
     num = (available > len)? len : available;
     bytes = num * sizeof(float);
@@ -2042,7 +2119,7 @@ fluid_synth_nwrite_float(fluid_synth_t* synth, int len,
   while (count < len) {
     fluid_synth_one_block(synth, 1);
 
-    num = (FLUID_BUFSIZE > len - count)? len - count : FLUID_BUFSIZE;
+    num = (synth->block_size > len - count)? len - count : synth->block_size;
     bytes = num * sizeof(float);
 
     for (i = 0; i < synth->audio_channels; i++) {
@@ -2108,7 +2185,7 @@ fluid_synth_write_float(fluid_synth_t* synth, int len,
 
   for (i = 0, j = loff, k = roff; i < len; i++, l++, j += lincr, k += rincr) {
     /* fill up the buffers as needed */
-      if (l == FLUID_BUFSIZE) {
+      if (l == synth->block_size) {
 	fluid_synth_one_block(synth, 0);
 	l = 0;
       }
@@ -2124,6 +2201,143 @@ fluid_synth_write_float(fluid_synth_t* synth, int len,
   return 0;
 }
 
+/*
+ *  fluid_synth_write_float_planar
+ */
+int
+fluid_synth_write_float_planar(fluid_synth_t* synth, int len, float* left, float* right)
+{
+  fluid_real_t* left_in;
+  fluid_real_t* right_in;
+  int i, count, num;
+
+  /* make sure we're playing */
+  if (synth->state != FLUID_SYNTH_PLAYING) {
+    return 0;
+  }
+
+  for (count = 0; count < len; count += num) {
+    if (synth->cur == synth->block_size) {
+#if defined(WITH_FLOAT)
+      /* a whole block is mixed straight into the caller's buffers */
+      if (len - count >= synth->block_size) {
+	left_in = synth->left_buf[0];
+	right_in = synth->right_buf[0];
+	synth->left_buf[0] = left + count;
+	synth->right_buf[0] = right + count;
+	fluid_synth_one_block(synth, 0);
+	synth->left_buf[0] = left_in;
+	synth->right_buf[0] = right_in;
+	num = synth->block_size;
+	continue;
+      }
+#endif
+      fluid_synth_one_block(synth, 0);
+      synth->cur = 0;
+    }
+
+    num = synth->block_size - synth->cur;
+    if (num > len - count) {
+      num = len - count;
+    }
+    left_in = synth->left_buf[0] + synth->cur;
+    right_in = synth->right_buf[0] + synth->cur;
+    for (i = 0; i < num; i++) {
+      left[count + i] = (float) left_in[i];
+      right[count + i] = (float) right_in[i];
+    }
+    synth->cur += num;
+  }
+
+  return 0;
+}
+
+/*
+ *  fluid_synth_write_s16_interleaved
+ */
+int
+fluid_synth_write_s16_interleaved(fluid_synth_t* synth, int len, short* out)
+{
+  int count, num;
+
+  /* make sure we're playing */
+  if (synth->state != FLUID_SYNTH_PLAYING) {
+    return 0;
+  }
+
+  for (count = 0; count < len; count += num) {
+    if (synth->cur == synth->block_size) {
+      fluid_synth_one_block(synth, 0);
+      synth->cur = 0;
+    }
+
+    num = synth->block_size - synth->cur;
+    if (num > len - count) {
+      num = len - count;
+    }
+    fluid_dsp_float_write_s16(synth->left_buf[0] + synth->cur, synth->right_buf[0] + synth->cur,
+			      out + 2 * count, num);
+    synth->cur += num;
+  }
+
+  return 0;
+}
+
+/*
+ *  fluid_synth_write_s16_interleaved_mix
+ */
+int
+fluid_synth_write_s16_interleaved_mix(fluid_synth_t* synth, fluid_synth_t* other,
+				      int len, short* out)
+{
+  fluid_real_t* left_in;
+  fluid_real_t* right_in;
+  int i, count, num;
+
+  /* make sure we're playing */
+  if (synth->state != FLUID_SYNTH_PLAYING) {
+    return 0;
+  }
+  if (other == NULL || other->state != FLUID_SYNTH_PLAYING) {
+    return fluid_synth_write_s16_interleaved(synth, len, out);
+  }
+
+  for (count = 0; count < len; count += num) {
+    if (synth->cur == synth->block_size) {
+      fluid_synth_one_block(synth, 0);
+      synth->cur = 0;
+    }
+    if (other->cur == other->block_size) {
+      fluid_synth_one_block(other, 0);
+      other->cur = 0;
+    }
+
+    /* the run both synths have left of their blocks */
+    num = synth->block_size - synth->cur;
+    if (num > other->block_size - other->cur) {
+      num = other->block_size - other->cur;
+    }
+    if (num > len - count) {
+      num = len - count;
+    }
+
+    /* the run of the synth's block is taken by this call, so the
+       other synth is summed into it in place */
+    left_in = other->left_buf[0] + other->cur;
+    right_in = other->right_buf[0] + other->cur;
+    for (i = 0; i < num; i++) {
+      synth->left_buf[0][synth->cur + i] += left_in[i];
+      synth->right_buf[0][synth->cur + i] += right_in[i];
+    }
+    fluid_dsp_float_write_s16(synth->left_buf[0] + synth->cur, synth->right_buf[0] + synth->cur,
+			      out + 2 * count, num);
+    synth->cur += num;
+    other->cur += num;
+  }
+
+  return 0;
+}
+
 #define DITHER_SIZE 48000
 #define DITHER_CHANNELS 2
 
@@ -2183,7 +2397,7 @@ fluid_synth_write_s16(fluid_synth_t* synth, int len,
   for (i = 0, j = loff, k = roff; i < len; i++, cur++, j += lincr, k += rincr) {
 
     /* fill up the buffers as needed */
-    if (cur == FLUID_BUFSIZE) {
+    if (cur == synth->block_size) {
       fluid_synth_one_block(synth, 0);
       cur = 0;
     }
@@ -2253,23 +2467,208 @@ fluid_synth_dither_s16(int *dither_index, int len, float* lin, float* rin,
   *dither_index = di;	/* keep dither buffer continous */
 }
 
+/*
+ * fluid_synth_audio_group
+ *
+ * The output associated with a MIDI channel is wrapped around
+ * using the number of audio groups as modulo divider.  This is
+ * typically the number of output channels on the 'sound card',
+ * as long as the LADSPA Fx unit is not used. In case of LADSPA
+ * unit, think of it as subgroups on a mixer.
+ *
+ * For example: Assume that the number of groups is set to 2.
+ * Then MIDI channel 1, 3, 5, 7 etc. go to output 1, channels 2,
+ * 4, 6, 8 etc to output 2.  Or assume 3 groups: Then MIDI
+ * channels 1, 4, 7, 10 etc go to output 1; 2, 5, 8, 11 etc to
+ * output 2, 3, 6, 9, 12 etc to output 3.
+ */
+static int
+fluid_synth_audio_group(fluid_synth_t* synth, fluid_voice_t* voice)
+{
+  return fluid_channel_get_num(fluid_voice_get_channel(voice)) % synth->audio_groups;
+}
+
+/* Timing the stages of a block, if built with WITH_PROFILING: _ref
+   holds the start, and the time since is added to or set as a reading */
+#ifdef WITH_PROFILING
+#define fluid_synth_prof_ref(_ref)        ((_ref) = fluid_profile_ref())
+#define fluid_synth_prof_add(_val, _ref)  ((_val) += fluid_profile_ref() - (_ref))
+#define fluid_synth_prof_set(_val, _ref)  ((_val) = fluid_profile_ref() - (_ref))
+#else
+#define fluid_synth_prof_ref(_ref)
+#define fluid_synth_prof_add(_val, _ref)
+#define fluid_synth_prof_set(_val, _ref)
+#endif
+
+/*
+ * fluid_synth_write_voices
+ *
+ * Renders, filters and mixes n voices that fluid_voice_prepare() got
+ * ready, into the buffers of their audio groups in left_buf and
+ * right_buf and into the reverb and chorus sends, and leaves in count
+ * the number of points rendered for each. FLUID_FILTER_LANES voices are
+ * rendered before any of them is mixed, so that their filters can run
+ * side by side in fluid_dsp_float_filter(). They are still mixed one
+ * after the other, in the order given.
+ *
+ * Touches nothing but the voices and the buffers, so that shares of the
+ * voices can be rendered on several threads at once.
+ */
+void
+fluid_synth_write_voices(fluid_synth_t* synth, fluid_voice_t** voices, int* count, int n,
+			 fluid_real_t** left_buf, fluid_real_t** right_buf,
+			 fluid_real_t* reverb_buf, fluid_real_t* chorus_buf)
+{
+  fluid_real_t dsp_buf[FLUID_FILTER_LANES][FLUID_MAX_BUFSIZE];
+  fluid_voice_t* lane[FLUID_FILTER_LANES];
+  int lane_count[FLUID_FILTER_LANES];
+  int filtered[FLUID_FILTER_LANES];
+  int i, k, group, lanes, auchan;
+#ifdef WITH_PROFILING
+  unsigned int prof_ref;
+#endif
+
+  for (i = 0; i < n; i += group) {
+    group = (n - i < FLUID_FILTER_LANES) ? n - i : FLUID_FILTER_LANES;
+
+    for (k = 0; k < group; k++) {
+      fluid_synth_prof_ref(prof_ref);
+      count[i + k] = fluid_voice_render(voices[i + k], dsp_buf[k]);
+      fluid_synth_prof_set(voices[i + k]->prof_ns, prof_ref);
+    }
+
+    /* the filters that can share a run, each over a whole block */
+    for (k = 0, lanes = 0; k < group; k++) {
+      filtered[k] = (count[i + k] > 0) && fluid_voice_filter_lane(voices[i + k], count[i + k]);
+      if (filtered[k]) {
+	if (count[i + k] < synth->block_size) {
+	  FLUID_MEMSET(dsp_buf[k] + count[i + k], 0, (synth->block_size - count[i + k]) * sizeof(fluid_real_t));
+	}
+	lane[lanes] = voices[i + k];
+	lane_count[lanes++] = count[i + k];
+      }
+    }
+    if ((lanes < 2) || (fluid_dsp_float_filter(lane, lane_count, lanes) != FLUID_OK)) {
+      for (k = 0; k < group; k++) {
+	filtered[k] = 0;
+      }
+    }
+
+    for (k = 0; k < group; k++) {
+      fluid_synth_prof_ref(prof_ref);
+      auchan = fluid_synth_audio_group(synth, voices[i + k]);
+      fluid_voice_finish(voices[i + k], count[i + k], filtered[k],
+			 left_buf[auchan], right_buf[auchan], reverb_buf, chorus_buf);
+      fluid_synth_prof_add(voices[i + k]->prof_ns, prof_ref);
+    }
+  }
+}
+
+#ifdef WITH_PROFILING
+/* counts the time of the voices rendered in a block by interpolation,
+   and that of the voices whose filter changed */
+static void
+fluid_synth_prof_voices(fluid_synth_t* synth, int n, unsigned int* prof)
+{
+  fluid_voice_t* voice;
+  int i, k;
+
+  for (i = 0; i < n; i++) {
+    voice = synth->ready[i];
+    switch (voice->interp_method) {
+    case FLUID_INTERP_NONE: k = 0; break;
+    case FLUID_INTERP_LINEAR: k = 1; break;
+    case FLUID_INTERP_7THORDER: k = 3; break;
+    default: k = 2; break;
+    }
+    prof[FLUID_SYNTH_PROF_INTERP + k] += voice->prof_ns;
+    prof[FLUID_SYNTH_PROF_INTERP_VOICES + k]++;
+    if (voice->prof_filter_update) {
+      prof[FLUID_SYNTH_PROF_FILTER_UPDATE] += voice->prof_ns;
+      prof[FLUID_SYNTH_PROF_FILTER_UPDATE_VOICES]++;
+    }
+  }
+}
+
+/* adds the readings of a block to the window, in place of the oldest */
+static void
+fluid_synth_prof_commit(fluid_synth_t* synth, const unsigned int* prof)
+{
+  unsigned int* slot = synth->prof[synth->prof_next];
+  int k;
+
+  for (k = 0; k < FLUID_SYNTH_PROF_LAST; k++) {
+    if (synth->prof_blocks == FLUID_SYNTH_PROF_WINDOW) {
+      synth->prof_sum[k] -= slot[k];
+    }
+    slot[k] = prof[k];
+    synth->prof_sum[k] += prof[k];
+  }
+  synth->prof_next = (synth->prof_next + 1) % FLUID_SYNTH_PROF_WINDOW;
+  if (synth->prof_blocks < FLUID_SYNTH_PROF_WINDOW) {
+    synth->prof_blocks++;
+  }
+}
+#endif
+
+/**
+ * Get where the time of the last blocks rendered went.
+ * @param synth FluidSynth instance
+ * @param profile Filled in with the averages per block
+ * @return FLUID_OK, or FLUID_FAILED if FluidLite was built without
+ *   WITH_PROFILING
+ */
+int
+fluid_synth_get_profile(fluid_synth_t* synth, fluid_synth_profile_t* profile)
+{
+#ifdef WITH_PROFILING
+  double us = (synth->prof_blocks > 0) ? 1.0 / (1000.0 * synth->prof_blocks) : 0.0;
+  double per_block = (synth->prof_blocks > 0) ? 1.0 / synth->prof_blocks : 0.0;
+  int k;
+
+  profile->blocks = synth->prof_blocks;
+  profile->total = synth->prof_sum[FLUID_SYNTH_PROF_TOTAL] * us;
+  profile->clear = synth->prof_sum[FLUID_SYNTH_PROF_CLEAR] * us;
+  profile->prepare = synth->prof_sum[FLUID_SYNTH_PROF_PREPARE] * us;
+  profile->voices = synth->prof_sum[FLUID_SYNTH_PROF_VOICES] * us;
+  for (k = 0; k < 4; k++) {
+    profile->interp[k] = synth->prof_sum[FLUID_SYNTH_PROF_INTERP + k] * us;
+    profile->interp_voices[k] = synth->prof_sum[FLUID_SYNTH_PROF_INTERP_VOICES + k] * per_block;
+  }
+  profile->filter_update = synth->prof_sum[FLUID_SYNTH_PROF_FILTER_UPDATE] * us;
+  profile->filter_update_voices = synth->prof_sum[FLUID_SYNTH_PROF_FILTER_UPDATE_VOICES] * per_block;
+  profile->reverb = synth->prof_sum[FLUID_SYNTH_PROF_REVERB] * us;
+  profile->chorus = synth->prof_sum[FLUID_SYNTH_PROF_CHORUS] * us;
+  return FLUID_OK;
+#else
+  FLUID_MEMSET(profile, 0, sizeof(fluid_synth_profile_t));
+  return FLUID_FAILED;
+#endif
+}
+
 /*
  *  fluid_synth_one_block
  */
 int
 fluid_synth_one_block(fluid_synth_t* synth, int do_not_mix_fx_to_out)
 {
-  int i, auchan;
+  int i, n;
   fluid_voice_t* voice;
-  fluid_real_t* left_buf;
-  fluid_real_t* right_buf;
   fluid_real_t* reverb_buf;
   fluid_real_t* chorus_buf;
-  int byte_size = FLUID_BUFSIZE * sizeof(fluid_real_t);
+  int byte_size = synth->block_size * sizeof(fluid_real_t);
+#ifdef WITH_PROFILING
+  unsigned int prof[FLUID_SYNTH_PROF_LAST];
+  unsigned int block_ref, prof_ref;
+
+  FLUID_MEMSET(prof, 0, sizeof(prof));
+  block_ref = fluid_profile_ref();
+#endif
 
 /*   fluid_mutex_lock(synth->busy); /\* Here comes the audio thread. Lock the synth. *\/ */
 
   /* clean the audio buffers */
+  fluid_synth_prof_ref(prof_ref);
   for (i = 0; i < synth->nbuf; i++) {
     FLUID_MEMSET(synth->left_buf[i], 0, byte_size);
     FLUID_MEMSET(synth->right_buf[i], 0, byte_size);
@@ -2279,6 +2678,7 @@ fluid_synth_one_block(fluid_synth_t* synth, int do_not_mix_fx_to_out)
     FLUID_MEMSET(synth->fx_left_buf[i], 0, byte_size);
     FLUID_MEMSET(synth->fx_right_buf[i], 0, byte_size);
   }
+  fluid_synth_prof_add(prof[FLUID_SYNTH_PROF_CLEAR], prof_ref);
 
   /* Set up the reverb / chorus buffers only, when the effect is
    * enabled on synth level.  Nonexisting buffers are detected in the
@@ -2287,31 +2687,39 @@ fluid_synth_one_block(fluid_synth_t* synth, int do_not_mix_fx_to_out)
   reverb_buf = synth->with_reverb ? synth->fx_left_buf[0] : NULL;
   chorus_buf = synth->with_chorus ? synth->fx_left_buf[1] : NULL;
 
-  /* call all playing synthesis processes */
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
+  /* get all playing voices ready for the block. A voice that finishes is
+   * dropped from the list and the next one takes its place. */
+  fluid_synth_prof_ref(prof_ref);
+  for (i = 0, n = 0; i < synth->nactive; ) {
+    voice = synth->active[i];
+    if (fluid_voice_prepare(voice)) {
+      synth->ready[n++] = voice;
+    }
+    if ((i < synth->nactive) && (synth->active[i] == voice)) {
+      i++;
+    }
+  }
+  fluid_synth_prof_add(prof[FLUID_SYNTH_PROF_PREPARE], prof_ref);
 
-    if (_PLAYING(voice)) {
-      /* The output associated with a MIDI channel is wrapped around
-       * using the number of audio groups as modulo divider.  This is
-       * typically the number of output channels on the 'sound card',
-       * as long as the LADSPA Fx unit is not used. In case of LADSPA
-       * unit, think of it as subgroups on a mixer.
-       *
-       * For example: Assume that the number of groups is set to 2.
-       * Then MIDI channel 1, 3, 5, 7 etc. go to output 1, channels 2,
-       * 4, 6, 8 etc to output 2.  Or assume 3 groups: Then MIDI
-       * channels 1, 4, 7, 10 etc go to output 1; 2, 5, 8, 11 etc to
-       * output 2, 3, 6, 9, 12 etc to output 3.
-       */
-      auchan = fluid_channel_get_num(fluid_voice_get_channel(voice));
-      auchan %= synth->audio_groups;
-      left_buf = synth->left_buf[auchan];
-      right_buf = synth->right_buf[auchan];
-
-      fluid_voice_write(voice, left_buf, right_buf, reverb_buf, chorus_buf);
+  /* render them, on several cores if there are enough of them */
+  fluid_synth_prof_ref(prof_ref);
+  if ((synth->workers == NULL) || !fluid_workers_write(synth->workers, n, reverb_buf, chorus_buf)) {
+    fluid_synth_write_voices(synth, synth->ready, synth->ready_count, n,
+			     synth->left_buf, synth->right_buf, reverb_buf, chorus_buf);
+  }
+  fluid_synth_prof_add(prof[FLUID_SYNTH_PROF_VOICES], prof_ref);
+#ifdef WITH_PROFILING
+  fluid_synth_prof_voices(synth, n, prof);
+#endif
+
+  /* turn off voices with a short count (sample ended and not looping) */
+  for (i = 0; i < n; i++) {
+    if (synth->ready_count[i] < synth->block_size) {
+      fluid_voice_off(synth->ready[i]);
     }
   }
+  /* the envelopes moved on */
+  synth->steal_heap_valid = 0;
 
   /* if multi channel output, don't mix the output of the chorus and
      reverb in the final output. The effects outputs are send
@@ -2321,28 +2729,36 @@ fluid_synth_one_block(fluid_synth_t* synth, int do_not_mix_fx_to_out)
 
     /* send to reverb */
     if (reverb_buf) {
+      fluid_synth_prof_ref(prof_ref);
       fluid_revmodel_processreplace(synth->reverb, reverb_buf,
-				   synth->fx_left_buf[0], synth->fx_right_buf[0]);
+				   synth->fx_left_buf[0], synth->fx_right_buf[0], synth->block_size);
+      fluid_synth_prof_add(prof[FLUID_SYNTH_PROF_REVERB], prof_ref);
     }
 
     /* send to chorus */
     if (chorus_buf) {
+      fluid_synth_prof_ref(prof_ref);
       fluid_chorus_processreplace(synth->chorus, chorus_buf,
-				 synth->fx_left_buf[1], synth->fx_right_buf[1]);
+				 synth->fx_left_buf[1], synth->fx_right_buf[1], synth->block_size);
+      fluid_synth_prof_add(prof[FLUID_SYNTH_PROF_CHORUS], prof_ref);
     }
 
   } else {
 
     /* send to reverb */
     if (reverb_buf) {
+      fluid_synth_prof_ref(prof_ref);
       fluid_revmodel_processmix(synth->reverb, reverb_buf,
-			       synth->left_buf[0], synth->right_buf[0]);
+			       synth->left_buf[0], synth->right_buf[0], synth->block_size);
+      fluid_synth_prof_add(prof[FLUID_SYNTH_PROF_REVERB], prof_ref);
     }
 
     /* send to chorus */
     if (chorus_buf) {
+      fluid_synth_prof_ref(prof_ref);
       fluid_chorus_processmix(synth->chorus, chorus_buf,
-			     synth->left_buf[0], synth->right_buf[0]);
+			     synth->left_buf[0], synth->right_buf[0], synth->block_size);
+      fluid_synth_prof_add(prof[FLUID_SYNTH_PROF_CHORUS], prof_ref);
     }
   }
 
@@ -2353,7 +2769,7 @@ fluid_synth_one_block(fluid_synth_t* synth, int do_not_mix_fx_to_out)
   fluid_check_fpe("LADSPA");
 #endif
 
-  synth->ticks += FLUID_BUFSIZE;
+  synth->ticks += synth->block_size;
 
   /* Testcase, that provokes a denormal floating point error */
 #if 0
@@ -2362,98 +2778,409 @@ fluid_synth_one_block(fluid_synth_t* synth, int do_not_mix_fx_to_out)
 
 /*   fluid_mutex_unlock(synth->busy); /\* Allow other threads to touch the synth *\/ */
 
+#ifdef WITH_PROFILING
+  prof[FLUID_SYNTH_PROF_TOTAL] = fluid_profile_ref() - block_ref;
+  fluid_synth_prof_commit(synth, prof);
+#endif
+
   return 0;
 }
 
 
-/*
- * fluid_synth_free_voice_by_kill
+/***************************************************************
  *
- * selects a voice for killing. the selection algorithm is a refinement
- * of the algorithm previously in fluid_synth_alloc_voice.
+ *                         VOICE INDEX
+ *
+ * Playing voices are linked into a list per channel, per channel
+ * and key and per channel and exclusive class, so that note-offs and
+ * channel messages visit only the voices they concern. A bitmap marks
+ * the voices that are free and a heap orders the playing ones by how
+ * little they would be missed, for voice stealing. The playing voices
+ * are also kept densely in voice table order, which is the order they
+ * are mixed in, so that rendering does not visit idle voices.
  */
-fluid_voice_t*
-fluid_synth_free_voice_by_kill(fluid_synth_t* synth)
+
+#define FLUID_SYNTH_FREE_BITS  (8 * (int) sizeof(unsigned int))
+
+#if defined(__GNUC__)
+#define fluid_synth_ctz(_x)  __builtin_ctz(_x)
+#else
+static int fluid_synth_ctz(unsigned int x)
+{
+  int n = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+}
+#endif
+
+static int
+fluid_synth_init_voice_index(fluid_synth_t* synth)
+{
+  int nslots = synth->midi_channels * 128;
+
+  synth->voice_free = FLUID_ARRAY(unsigned int, (synth->nvoice + FLUID_SYNTH_FREE_BITS - 1) / FLUID_SYNTH_FREE_BITS);
+  synth->chan_voices = FLUID_ARRAY(fluid_voice_t*, synth->midi_channels);
+  synth->key_voices = FLUID_ARRAY(fluid_voice_t*, nslots);
+  synth->excl_voices = FLUID_ARRAY(fluid_voice_t*, nslots);
+  synth->steal_heap = FLUID_ARRAY(fluid_voice_t*, synth->nvoice);
+  synth->active = FLUID_ARRAY(fluid_voice_t*, synth->nvoice);
+  synth->ready = FLUID_ARRAY(fluid_voice_t*, synth->nvoice);
+  synth->ready_count = FLUID_ARRAY(int, synth->nvoice);
+  if ((synth->voice_free == NULL) || (synth->active == NULL) || (synth->chan_voices == NULL) || (synth->key_voices == NULL)
+      || (synth->excl_voices == NULL) || (synth->steal_heap == NULL) || (synth->ready == NULL) || (synth->ready_count == NULL)) {
+    FLUID_LOG(FLUID_ERR, "Out of memory");
+    return FLUID_FAILED;
+  }
+  fluid_synth_reset_voice_index(synth);
+  return FLUID_OK;
+}
+
+/* forgets all playing voices; only for when none are */
+static void
+fluid_synth_reset_voice_index(fluid_synth_t* synth)
 {
   int i;
-  fluid_real_t best_prio = 999999.;
-  fluid_real_t this_voice_prio;
-  fluid_voice_t* voice;
-  int best_voice_index=-1;
 
-/*   fluid_mutex_lock(synth->busy); /\* Don't interfere with the audio thread *\/ */
-/*   fluid_mutex_unlock(synth->busy); */
+  FLUID_MEMSET(synth->voice_free, 0, sizeof(unsigned int) * ((synth->nvoice + FLUID_SYNTH_FREE_BITS - 1) / FLUID_SYNTH_FREE_BITS));
+  FLUID_MEMSET(synth->chan_voices, 0, sizeof(fluid_voice_t*) * synth->midi_channels);
+  FLUID_MEMSET(synth->key_voices, 0, sizeof(fluid_voice_t*) * synth->midi_channels * 128);
+  FLUID_MEMSET(synth->excl_voices, 0, sizeof(fluid_voice_t*) * synth->midi_channels * 128);
+  for (i = 0; i < synth->nvoice; i++) {
+    synth->voice_free[i / FLUID_SYNTH_FREE_BITS] |= 1u << (i % FLUID_SYNTH_FREE_BITS);
+    synth->voice[i]->index = i;
+    synth->voice[i]->heap_index = -1;
+  }
+  synth->nactive = 0;
+  synth->steal_heap_count = 0;
+  synth->steal_heap_valid = 0;
+}
 
-  for (i = 0; i < synth->polyphony; i++) {
+static void
+fluid_synth_delete_voice_index(fluid_synth_t* synth)
+{
+  if (synth->voice_free != NULL) FLUID_FREE(synth->voice_free);
+  if (synth->chan_voices != NULL) FLUID_FREE(synth->chan_voices);
+  if (synth->key_voices != NULL) FLUID_FREE(synth->key_voices);
+  if (synth->excl_voices != NULL) FLUID_FREE(synth->excl_voices);
+  if (synth->steal_heap != NULL) FLUID_FREE(synth->steal_heap);
+  if (synth->active != NULL) FLUID_FREE(synth->active);
+  if (synth->ready != NULL) FLUID_FREE(synth->ready);
+  if (synth->ready_count != NULL) FLUID_FREE(synth->ready_count);
+}
 
-    voice = synth->voice[i];
+/* the lowest numbered voice below the polyphony that is not playing, or NULL */
+static fluid_voice_t*
+fluid_synth_first_free_voice(fluid_synth_t* synth)
+{
+  int w, i;
+  unsigned int bits;
+
+  for (w = 0; w * FLUID_SYNTH_FREE_BITS < synth->polyphony; w++) {
+    bits = synth->voice_free[w];
+    if (bits != 0) {
+      i = w * FLUID_SYNTH_FREE_BITS + fluid_synth_ctz(bits);
+      return (i < synth->polyphony) ? synth->voice[i] : NULL;
+    }
+  }
+  return NULL;
+}
 
-    /* safeguard against an available voice. */
-    if (_AVAILABLE(voice)) {
-      return voice;
+/* where a voice is, or would go, in the voices in voice table order */
+static int
+fluid_synth_active_pos(fluid_synth_t* synth, fluid_voice_t* voice)
+{
+  int lo = 0, hi = synth->nactive, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (synth->active[mid]->index < voice->index) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
+  }
+  return lo;
+}
 
-    /* Determine, how 'important' a voice is.
-     * Start with an arbitrary number */
-    this_voice_prio = 10000.;
+static void
+fluid_synth_list_insert(fluid_voice_t** head, fluid_voice_t* voice, int list)
+{
+  voice->link[list].prev = NULL;
+  voice->link[list].next = *head;
+  if (*head != NULL) {
+    (*head)->link[list].prev = voice;
+  }
+  *head = voice;
+}
 
-    /* Is this voice on the drum channel?
-     * Then it is very important.
-     * Also, forget about the released-note condition:
-     * Typically, drum notes are triggered only very briefly, they run most
-     * of the time in release phase.
+static void
+fluid_synth_list_remove(fluid_voice_t** head, fluid_voice_t* voice, int list)
+{
+  fluid_voice_t* prev = voice->link[list].prev;
+  fluid_voice_t* next = voice->link[list].next;
+
+  if (prev != NULL) {
+    prev->link[list].next = next;
+  } else {
+    *head = next;
+  }
+  if (next != NULL) {
+    next->link[list].prev = prev;
+  }
+  voice->link[list].prev = NULL;
+  voice->link[list].next = NULL;
+}
+
+/*
+ * fluid_synth_steal_prio
+ *
+ * Determines how 'important' a voice is; the voice with the lowest
+ * priority is the one killed when no voice is free.
+ */
+static double
+fluid_synth_steal_prio(fluid_voice_t* voice)
+{
+  /* Start with an arbitrary number */
+  double prio = 10000.;
+
+  /* Is this voice on the drum channel?
+   * Then it is very important.
+   * Also, forget about the released-note condition:
+   * Typically, drum notes are triggered only very briefly, they run most
+   * of the time in release phase.
+   */
+  if (_RELEASED(voice)){
+    /* The key for this voice has been released. Consider it much less important
+     * than a voice, which is still held.
      */
-    if (_RELEASED(voice)){
-      /* The key for this voice has been released. Consider it much less important
-       * than a voice, which is still held.
-       */
-      this_voice_prio -= 2000.;
-    }
+    prio -= 2000.;
+  }
+
+  if (_SUSTAINED(voice)){
+    /* The sustain pedal is held down on this channel.
+     * Consider it less important than non-sustained channels.
+     * This decision is somehow subjective. But usually the sustain pedal
+     * is used to play 'more-voices-than-fingers', so it shouldn't hurt
+     * if we kill one voice.
+     */
+    prio -= 1000;
+  }
+
+  /* We are not enthusiastic about releasing voices, which have just been started.
+   * Otherwise hitting a chord may result in killing notes belonging to that very same
+   * chord.
+   * So add the id of the voice to the priority - an older voice is just a little
+   * bit less important than a younger voice. Counting up from the id rather
+   * than down from the newest note keeps the priority fixed as notes start. */
+  prio += fluid_voice_get_id(voice);
+
+  /* take a rough estimate of loudness into account. Louder voices are more important. */
+  if (voice->volenv_section != FLUID_VOICE_ENVATTACK){
+    prio += voice->volenv_val * 1000.;
+  }
 
-    if (_SUSTAINED(voice)){
-      /* The sustain pedal is held down on this channel.
-       * Consider it less important than non-sustained channels.
-       * This decision is somehow subjective. But usually the sustain pedal
-       * is used to play 'more-voices-than-fingers', so it shouldn't hurt
-       * if we kill one voice.
-       */
-      this_voice_prio -= 1000;
+  return prio;
+}
+
+/* ties go to the lower numbered voice */
+#define FLUID_SYNTH_STEAL_BEFORE(_a, _b) \
+  (((_a)->steal_prio < (_b)->steal_prio) \
+   || (((_a)->steal_prio == (_b)->steal_prio) && ((_a)->index < (_b)->index)))
+
+static void
+fluid_synth_heap_place(fluid_synth_t* synth, fluid_voice_t* voice, int i)
+{
+  synth->steal_heap[i] = voice;
+  voice->heap_index = i;
+}
+
+static void
+fluid_synth_heap_up(fluid_synth_t* synth, int i)
+{
+  fluid_voice_t* voice = synth->steal_heap[i];
+  int parent;
+
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (!FLUID_SYNTH_STEAL_BEFORE(voice, synth->steal_heap[parent])) {
+      break;
     }
+    fluid_synth_heap_place(synth, synth->steal_heap[parent], i);
+    i = parent;
+  }
+  fluid_synth_heap_place(synth, voice, i);
+}
 
-    /* We are not enthusiastic about releasing voices, which have just been started.
-     * Otherwise hitting a chord may result in killing notes belonging to that very same
-     * chord.
-     * So subtract the age of the voice from the priority - an older voice is just a little
-     * bit less important than a younger voice.
-     * This is a number between roughly 0 and 100.*/
-    this_voice_prio -= (synth->noteid - fluid_voice_get_id(voice));
+static void
+fluid_synth_heap_down(fluid_synth_t* synth, int i)
+{
+  fluid_voice_t* voice = synth->steal_heap[i];
+  int child;
 
-    /* take a rough estimate of loudness into account. Louder voices are more important. */
-    if (voice->volenv_section != FLUID_VOICE_ENVATTACK){
-      this_voice_prio += voice->volenv_val * 1000.;
+  for (;;) {
+    child = 2 * i + 1;
+    if (child >= synth->steal_heap_count) {
+      break;
+    }
+    if ((child + 1 < synth->steal_heap_count)
+	&& FLUID_SYNTH_STEAL_BEFORE(synth->steal_heap[child + 1], synth->steal_heap[child])) {
+      child++;
+    }
+    if (!FLUID_SYNTH_STEAL_BEFORE(synth->steal_heap[child], voice)) {
+      break;
     }
+    fluid_synth_heap_place(synth, synth->steal_heap[child], i);
+    i = child;
+  }
+  fluid_synth_heap_place(synth, voice, i);
+}
+
+static void
+fluid_synth_heap_remove(fluid_synth_t* synth, fluid_voice_t* voice)
+{
+  int i = voice->heap_index;
+  fluid_voice_t* last;
+
+  voice->heap_index = -1;
+  last = synth->steal_heap[--synth->steal_heap_count];
+  if (last == voice) {
+    return;
+  }
+  fluid_synth_heap_place(synth, last, i);
+  fluid_synth_heap_up(synth, i);
+  fluid_synth_heap_down(synth, last->heap_index);
+}
+
+/* Voice priorities change as envelopes advance and keys and pedals are
+   released, so those invalidate the heap, and it is rebuilt when a voice
+   next has to be stolen. */
+static void
+fluid_synth_heap_build(fluid_synth_t* synth)
+{
+  int i;
+  fluid_voice_t* voice;
+
+  synth->steal_heap_count = 0;
+  for (i = 0; i < synth->nactive; i++) {
+    voice = synth->active[i];
+    voice->steal_prio = fluid_synth_steal_prio(voice);
+    fluid_synth_heap_place(synth, voice, synth->steal_heap_count++);
+  }
+  for (i = synth->steal_heap_count / 2 - 1; i >= 0; i--) {
+    fluid_synth_heap_down(synth, i);
+  }
+  synth->steal_heap_valid = 1;
+}
+
+/*
+ * fluid_synth_link_voice
+ *
+ * Adds a voice that has just started to the indices.
+ */
+static void
+fluid_synth_link_voice(fluid_synth_t* synth, fluid_voice_t* voice)
+{
+  int chan = voice->chan;
+  int pos = fluid_synth_active_pos(synth, voice);
+
+  synth->voice_free[voice->index / FLUID_SYNTH_FREE_BITS] &= ~(1u << (voice->index % FLUID_SYNTH_FREE_BITS));
+  FLUID_MEMMOVE(&synth->active[pos + 1], &synth->active[pos], sizeof(fluid_voice_t*) * (synth->nactive - pos));
+  synth->active[pos] = voice;
+  synth->nactive++;
+  fluid_synth_list_insert(&synth->chan_voices[chan], voice, FLUID_VOICE_LIST_CHAN);
+  fluid_synth_list_insert(&synth->key_voices[FLUID_SYNTH_VOICE_SLOT(chan, voice->key)],
+			  voice, FLUID_VOICE_LIST_KEY);
+
+  voice->excl_class = (int) _GEN(voice, GEN_EXCLUSIVECLASS);
+  if (voice->excl_class != 0) {
+    fluid_synth_list_insert(&synth->excl_voices[FLUID_SYNTH_VOICE_SLOT(chan, voice->excl_class)],
+			    voice, FLUID_VOICE_LIST_EXCL);
+  }
+
+  if (synth->steal_heap_valid) {
+    voice->steal_prio = fluid_synth_steal_prio(voice);
+    fluid_synth_heap_place(synth, voice, synth->steal_heap_count++);
+    fluid_synth_heap_up(synth, voice->heap_index);
+  }
+}
+
+/*
+ * fluid_synth_unlink_voice
+ *
+ * Removes a playing voice from the indices, called by fluid_voice_off().
+ */
+void
+fluid_synth_unlink_voice(fluid_synth_t* synth, fluid_voice_t* voice)
+{
+  int chan = voice->chan;
+  int pos = fluid_synth_active_pos(synth, voice);
+
+  synth->nactive--;
+  FLUID_MEMMOVE(&synth->active[pos], &synth->active[pos + 1], sizeof(fluid_voice_t*) * (synth->nactive - pos));
+
+  fluid_synth_list_remove(&synth->chan_voices[chan], voice, FLUID_VOICE_LIST_CHAN);
+  fluid_synth_list_remove(&synth->key_voices[FLUID_SYNTH_VOICE_SLOT(chan, voice->key)],
+			  voice, FLUID_VOICE_LIST_KEY);
+  if (voice->excl_class != 0) {
+    fluid_synth_list_remove(&synth->excl_voices[FLUID_SYNTH_VOICE_SLOT(chan, voice->excl_class)],
+			    voice, FLUID_VOICE_LIST_EXCL);
+    voice->excl_class = 0;
+  }
+
+  if (synth->steal_heap_valid && (voice->heap_index >= 0)) {
+    fluid_synth_heap_remove(synth, voice);
+  }
+  voice->heap_index = -1;
+
+  synth->voice_free[voice->index / FLUID_SYNTH_FREE_BITS] |= 1u << (voice->index % FLUID_SYNTH_FREE_BITS);
+}
+
+/*
+ * fluid_synth_free_voice_by_kill
+ *
+ * selects a voice for killing. the selection algorithm is a refinement
+ * of the algorithm previously in fluid_synth_alloc_voice.
+ */
+fluid_voice_t*
+fluid_synth_free_voice_by_kill(fluid_synth_t* synth)
+{
+  fluid_voice_t* voice;
 
-    /* check if this voice has less priority than the previous candidate. */
-    if (this_voice_prio < best_prio)
-      best_voice_index = i,
-      best_prio = this_voice_prio;
+/*   fluid_mutex_lock(synth->busy); /\* Don't interfere with the audio thread *\/ */
+/*   fluid_mutex_unlock(synth->busy); */
+
+  /* safeguard against an available voice. */
+  voice = fluid_synth_first_free_voice(synth);
+  if (voice != NULL) {
+    return voice;
   }
 
-  if (best_voice_index < 0) {
+  if (!synth->steal_heap_valid) {
+    fluid_synth_heap_build(synth);
+  }
+  if (synth->steal_heap_count == 0) {
     return NULL;
   }
 
-  voice = synth->voice[best_voice_index];
+  voice = synth->steal_heap[0];
   fluid_voice_off(voice);
+  synth->voices_stolen++;
 
   return voice;
 }
 
 /*
- * fluid_synth_alloc_voice
+ * fluid_synth_alloc_voice_template
+ *
+ * Allocates a voice that starts with the generators and modulators of
+ * a template, or with the defaults if templ is NULL.
  */
 fluid_voice_t*
-fluid_synth_alloc_voice(fluid_synth_t* synth, fluid_sample_t* sample, int chan, int key, int vel)
+fluid_synth_alloc_voice_template(fluid_synth_t* synth, fluid_sample_t* sample, int chan, int key, int vel,
+				 const fluid_voice_template_t* templ)
 {
   int i, k;
   fluid_voice_t* voice = NULL;
@@ -2463,12 +3190,7 @@ fluid_synth_alloc_voice(fluid_synth_t* synth, fluid_sample_t* sample, int chan,
 /*   fluid_mutex_unlock(synth->busy); */
 
   /* check if there's an available synthesis process */
-  for (i = 0; i < synth->polyphony; i++) {
-    if (_AVAILABLE(synth->voice[i])) {
-      voice = synth->voice[i];
-      break;
-    }
-  }
+  voice = fluid_synth_first_free_voice(synth);
 
   /* No success yet? Then stop a running voice. */
   if (voice == NULL) {
@@ -2503,10 +3225,27 @@ fluid_synth_alloc_voice(fluid_synth_t* synth, fluid_sample_t* sample, int chan,
   }
 
   if (fluid_voice_init(voice, sample, channel, key, vel,
-		       synth->storeid, synth->ticks, synth->gain) != FLUID_OK) {
+		       synth->storeid, synth->ticks, synth->gain, templ) != FLUID_OK) {
     FLUID_LOG(FLUID_WARN, "Failed to initialize voice");
     return NULL;
   }
+  voice->start_offset = synth->start_offset;
+
+  return voice;
+}
+
+/*
+ * fluid_synth_alloc_voice
+ */
+fluid_voice_t*
+fluid_synth_alloc_voice(fluid_synth_t* synth, fluid_sample_t* sample, int chan, int key, int vel)
+{
+  fluid_voice_t* voice;
+
+  voice = fluid_synth_alloc_voice_template(synth, sample, chan, key, vel, NULL);
+  if (voice == NULL) {
+    return NULL;
+  }
 
   /* add the default modulators to the synthesis process. */
   fluid_voice_add_mod(voice, &default_vel2att_mod, FLUID_VOICE_DEFAULT);    /* SF2.01 $8.4.1  */
@@ -2523,6 +3262,27 @@ fluid_synth_alloc_voice(fluid_synth_t* synth, fluid_sample_t* sample, int chan,
   return voice;
 }
 
+/*
+ * fluid_synth_template_default_mods
+ *
+ * Starts the modulator list of a voice template with the default
+ * modulators, in the order fluid_synth_alloc_voice() adds them.
+ */
+void
+fluid_synth_template_default_mods(fluid_voice_template_t* templ)
+{
+  fluid_voice_template_add_mod(templ, &default_vel2att_mod, FLUID_VOICE_DEFAULT);
+  fluid_voice_template_add_mod(templ, &default_vel2filter_mod, FLUID_VOICE_DEFAULT);
+  fluid_voice_template_add_mod(templ, &default_at2viblfo_mod, FLUID_VOICE_DEFAULT);
+  fluid_voice_template_add_mod(templ, &default_mod2viblfo_mod, FLUID_VOICE_DEFAULT);
+  fluid_voice_template_add_mod(templ, &default_att_mod, FLUID_VOICE_DEFAULT);
+  fluid_voice_template_add_mod(templ, &default_pan_mod, FLUID_VOICE_DEFAULT);
+  fluid_voice_template_add_mod(templ, &default_expr_mod, FLUID_VOICE_DEFAULT);
+  fluid_voice_template_add_mod(templ, &default_reverb_mod, FLUID_VOICE_DEFAULT);
+  fluid_voice_template_add_mod(templ, &default_chorus_mod, FLUID_VOICE_DEFAULT);
+  fluid_voice_template_add_mod(templ, &default_pitch_bend_mod, FLUID_VOICE_DEFAULT);
+}
+
 /*
  * fluid_synth_kill_by_exclusive_class
  */
@@ -2538,7 +3298,9 @@ void fluid_synth_kill_by_exclusive_class(fluid_synth_t* synth, fluid_voice_t* ne
       class excl_class.
   */
 
-  int i;
+  fluid_voice_t* existing_voice;
+  fluid_voice_t* next;
+  fluid_voice_t** head;
   int excl_class = _GEN(new_voice,GEN_EXCLUSIVECLASS);
 
   /* Check if the voice belongs to an exclusive class. In that case,
@@ -2551,24 +3313,16 @@ void fluid_synth_kill_by_exclusive_class(fluid_synth_t* synth, fluid_voice_t* ne
 
   //  FLUID_LOG(FLUID_INFO, "Voice belongs to exclusive class (class=%d, ignore_id=%d)", excl_class, ignore_ID);
 
-    /* Kill all notes on the same channel with the same exclusive class */
+    /* Kill all notes on the same channel with the same exclusive class.
+     * An exclusive class is valid for a whole channel (or preset), and
+     * only playing voices are in the list. */
 
-  for (i = 0; i < synth->polyphony; i++) {
-    fluid_voice_t* existing_voice = synth->voice[i];
+  head = &synth->excl_voices[FLUID_SYNTH_VOICE_SLOT(new_voice->chan, excl_class)];
+  for (existing_voice = *head; existing_voice != NULL; existing_voice = next) {
+    next = existing_voice->link[FLUID_VOICE_LIST_EXCL].next;
 
-    /* Existing voice does not play? Leave it alone. */
-    if (!_PLAYING(existing_voice)) {
-      continue;
-    }
-
-    /* An exclusive class is valid for a whole channel (or preset).
-     * Is the voice on a different channel? Leave it alone. */
-    if (existing_voice->chan != new_voice->chan) {
-      continue;
-    }
-
-    /* Existing voice has a different (or no) exclusive class? Leave it alone. */
-    if ((int)_GEN(existing_voice, GEN_EXCLUSIVECLASS) != excl_class) {
+    /* Existing voice has a different exclusive class? Leave it alone. */
+    if (existing_voice->excl_class != excl_class) {
       continue;
     }
 
@@ -2581,7 +3335,11 @@ void fluid_synth_kill_by_exclusive_class(fluid_synth_t* synth, fluid_voice_t* ne
     //    FLUID_LOG(FLUID_INFO, "Releasing previous voice of exclusive class (class=%d, id=%d)",
     //     (int)_GEN(existing_voice, GEN_EXCLUSIVECLASS), (int)fluid_voice_get_id(existing_voice));
 
+    /* the voice loses its class, and so leaves the list */
+    fluid_synth_list_remove(head, existing_voice, FLUID_VOICE_LIST_EXCL);
+    existing_voice->excl_class = 0;
     fluid_voice_kill_excl(existing_voice);
+    synth->steal_heap_valid = 0;
   };
 }
 
@@ -2601,6 +3359,7 @@ void fluid_synth_start_voice(fluid_synth_t* synth, fluid_voice_t* voice)
   /* Start the new voice */
 
   fluid_voice_start(voice);
+  fluid_synth_link_voice(synth, voice);
 }
 
 /*
@@ -2884,13 +3643,13 @@ fluid_synth_get_voicelist(fluid_synth_t* synth, fluid_voice_t* buf[], int bufsiz
 {
   int i;
   int count = 0;
-  for (i = 0; i < synth->polyphony; i++) {
-    fluid_voice_t* voice = synth->voice[i];
+  for (i = 0; i < synth->nactive; i++) {
+    fluid_voice_t* voice = synth->active[i];
     if (count >= bufsize) {
       return;
     }
 
-    if (_PLAYING(voice) && ((int)voice->id == ID || ID < 0)) {
+    if ((int)voice->id == ID || ID < 0) {
       buf[count++] = voice;
     }
   }
@@ -2974,17 +3733,16 @@ double fluid_synth_get_reverb_width(fluid_synth_t* synth)
  * release those...
  */
 void fluid_synth_release_voice_on_same_note(fluid_synth_t* synth, int chan, int key){
-  int i;
   fluid_voice_t* voice;
+  fluid_voice_t* next;
 
 /*   fluid_mutex_lock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   fluid_mutex_unlock(synth->busy); */
 
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
-    if (_PLAYING(voice)
-	&& (voice->chan == chan)
-	&& (voice->key == key)
+  synth->steal_heap_valid = 0;
+  for (voice = synth->key_voices[FLUID_SYNTH_VOICE_SLOT(chan, key)]; voice != NULL; voice = next) {
+    next = voice->link[FLUID_VOICE_LIST_KEY].next;
+    if ((voice->key == key)
 	&& (fluid_voice_get_id(voice) != synth->noteid)) {
       fluid_voice_noteoff(voice);
     }
@@ -3381,7 +4139,6 @@ int fluid_synth_getint(fluid_synth_t* synth, char* name, int* val)
 int
 fluid_synth_set_gen(fluid_synth_t* synth, int chan, int param, float value)
 {
-  int i;
   fluid_voice_t* voice;
 
   if ((chan < 0) || (chan >= synth->midi_channels)) {
@@ -3396,11 +4153,8 @@ fluid_synth_set_gen(fluid_synth_t* synth, int chan, int param, float value)
 
   fluid_channel_set_gen(synth->channel[chan], param, value, 0);
 
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
-    if (voice->chan == chan) {
-      fluid_voice_set_param(voice, param, value, 0);
-    }
+  for (voice = synth->chan_voices[chan]; voice != NULL; voice = voice->link[FLUID_VOICE_LIST_CHAN].next) {
+    fluid_voice_set_param(voice, param, value, 0);
   }
 
   return FLUID_OK;
@@ -3433,7 +4187,6 @@ int
 fluid_synth_set_gen2(fluid_synth_t* synth, int chan, int param,
 		     float value, int absolute, int normalized)
 {
-  int i;
   fluid_voice_t* voice;
   float v;
 
@@ -3451,11 +4204,8 @@ fluid_synth_set_gen2(fluid_synth_t* synth, int chan, int param,
 
   fluid_channel_set_gen(synth->channel[chan], param, v, absolute);
 
-  for (i = 0; i < synth->polyphony; i++) {
-    voice = synth->voice[i];
-    if (voice->chan == chan) {
-      fluid_voice_set_param(voice, param, v, absolute);
-    }
+  for (voice = synth->chan_voices[chan]; voice != NULL; voice = voice->link[FLUID_VOICE_LIST_CHAN].next) {
+    fluid_voice_set_param(voice, param, v, absolute);
   }
 
   return FLUID_OK;
@@ -3530,9 +4280,10 @@ int fluid_synth_stop(fluid_synth_t* synth, unsigned int id)
   int status = FLUID_FAILED;
   int count = 0;
 
-  for (i = 0; i < synth->polyphony; i++) {
+  synth->steal_heap_valid = 0;
+  for (i = 0; i < synth->nactive; i++) {
 
-    voice = synth->voice[i];
+    voice = synth->active[i];
 
     if (_ON(voice) && (fluid_voice_get_id(voice) == id)) {
 	    count++;
@@ -35,6 +35,7 @@
 #include "fluid_voice.h"
 #include "fluid_chorus.h"
 #include "fluid_sys.h"
+#include "fluid_workers.h"
 
 /***************************************************************
  *
@@ -70,6 +71,26 @@ enum fluid_synth_status
 };
 
 
+#ifdef WITH_PROFILING
+/* The readings fluid_synth_one_block() takes of itself: times in
+   nanoseconds, then the voices behind some of them */
+enum fluid_synth_prof {
+  FLUID_SYNTH_PROF_TOTAL,
+  FLUID_SYNTH_PROF_CLEAR,
+  FLUID_SYNTH_PROF_PREPARE,
+  FLUID_SYNTH_PROF_VOICES,
+  FLUID_SYNTH_PROF_INTERP,          /* four of them: none, linear, 4th, 7th order */
+  FLUID_SYNTH_PROF_FILTER_UPDATE = FLUID_SYNTH_PROF_INTERP + 4,
+  FLUID_SYNTH_PROF_REVERB,
+  FLUID_SYNTH_PROF_CHORUS,
+  FLUID_SYNTH_PROF_INTERP_VOICES,   /* four of them */
+  FLUID_SYNTH_PROF_FILTER_UPDATE_VOICES = FLUID_SYNTH_PROF_INTERP_VOICES + 4,
+  FLUID_SYNTH_PROF_LAST
+};
+
+#define FLUID_SYNTH_PROF_WINDOW 64   /* blocks the readings are averaged over */
+#endif
+
 typedef struct _fluid_bank_offset_t fluid_bank_offset_t;
 
 struct _fluid_bank_offset_t {
@@ -89,9 +110,11 @@ struct _fluid_synth_t
   int polyphony;                     /** maximum polyphony */
   char with_reverb;                  /** Should the synth use the built-in reverb unit? */
   char with_chorus;                  /** Should the synth use the built-in chorus unit? */
+  char filter_bypass;                /** Skip voice filters that are wide open without resonance? */
   char verbose;                      /** Turn verbose mode on? */
   char dump;                         /** Dump events to stdout to hook up a user interface? */
   double sample_rate;                /** The sample rate */
+  int block_size;                    /** the number of frames rendered per block */
   int midi_channels;                 /** the number of MIDI channels (>= 16) */
   int audio_channels;                /** the number of audio channels (1 channel=left+right) */
   int audio_groups;                  /** the number of (stereo) 'sub'groups from the synth.
@@ -114,7 +137,24 @@ struct _fluid_synth_t
   int num_channels;                   /** the number of channels */
   int nvoice;                         /** the length of the synthesis process array */
   fluid_voice_t** voice;              /** the synthesis processes */
+  fluid_voice_pool_t* voice_pool;     /**< the storage of the synthesis processes */
   int active_voice_count;             /**< count of active voices */
+  unsigned int voices_stolen;         /**< voices stopped to make room for new ones */
+
+  /* indices of the playing voices, kept by fluid_synth_link_voice() and
+     fluid_synth_unlink_voice() */
+  unsigned int* voice_free;           /**< one bit per voice that is not playing */
+  fluid_voice_t** active;             /**< the playing voices, in voice table order */
+  int nactive;
+  fluid_voice_t** chan_voices;        /**< voices by channel */
+  fluid_voice_t** key_voices;         /**< voices by channel and key */
+  fluid_voice_t** excl_voices;        /**< voices by channel and exclusive class */
+  fluid_voice_t** steal_heap;         /**< playing voices, least important first */
+  int steal_heap_count;
+  int steal_heap_valid;               /**< cleared whenever a voice's priority may have changed */
+  fluid_voice_t** ready;              /**< the voices that render in this block */
+  int* ready_count;                   /**< the points each of them rendered */
+  fluid_workers_t* workers;           /**< threads rendering on other cores, or NULL */
   unsigned int noteid;                /** the id is incremented for every new note. it's used for noteoff's  */
   unsigned int storeid;
   int nbuf;                           /** How many audio buffers are used? (depends on nr of audio channels / groups)*/
@@ -131,6 +171,7 @@ struct _fluid_synth_t
   double chorus_param[FLUID_CHORUS_PARAM_LAST];
 
   int cur;                           /** the current sample in the audio buffers to be output */
+  int start_offset;                  /** the start_offset of the voices being started */
   int dither_index;		/* current index in random dither value buffer: fluid_synth_(write_s16|dither_s16) */
 
   char outbuf[256];                  /** buffer for message output */
@@ -139,6 +180,14 @@ struct _fluid_synth_t
   fluid_tuning_t* cur_tuning;         /** current tuning in the iteration */
 
   unsigned int min_note_length_ticks; /**< If note-offs are triggered just after a note-on, they will be delayed */
+
+#ifdef WITH_PROFILING
+  /* the readings of the last blocks, and their sums */
+  unsigned int prof[FLUID_SYNTH_PROF_WINDOW][FLUID_SYNTH_PROF_LAST];
+  unsigned long long prof_sum[FLUID_SYNTH_PROF_LAST];
+  int prof_next;                      /**< the reading the next block replaces */
+  int prof_blocks;                    /**< the readings in the window */
+#endif
 };
 
 /** returns 1 if the value has been set, 0 otherwise */
@@ -163,6 +212,9 @@ int fluid_synth_getint(fluid_synth_t* synth, char* name, int* val);
 int fluid_synth_set_reverb_preset(fluid_synth_t* synth, int num);
 
 int fluid_synth_one_block(fluid_synth_t* synth, int do_not_mix_fx_to_out);
+void fluid_synth_write_voices(fluid_synth_t* synth, fluid_voice_t** voices, int* count, int n,
+			      fluid_real_t** left_buf, fluid_real_t** right_buf,
+			      fluid_real_t* reverb_buf, fluid_real_t* chorus_buf);
 
 fluid_preset_t* fluid_synth_get_preset(fluid_synth_t* synth,
 				     unsigned int sfontnum,
@@ -173,14 +225,18 @@ fluid_preset_t* fluid_synth_find_preset(fluid_synth_t* synth,
 				      unsigned int banknum,
 				      unsigned int prognum);
 
-int fluid_synth_all_notes_off(fluid_synth_t* synth, int chan);
 int fluid_synth_all_sounds_off(fluid_synth_t* synth, int chan);
 int fluid_synth_modulate_voices(fluid_synth_t* synth, int chan, int is_cc, int ctrl);
 int fluid_synth_modulate_voices_all(fluid_synth_t* synth, int chan);
 int fluid_synth_damp_voices(fluid_synth_t* synth, int chan);
 int fluid_synth_kill_voice(fluid_synth_t* synth, fluid_voice_t * voice);
 void fluid_synth_kill_by_exclusive_class(fluid_synth_t* synth, fluid_voice_t* voice);
+fluid_voice_t* fluid_synth_alloc_voice_template(fluid_synth_t* synth, fluid_sample_t* sample,
+					       int chan, int key, int vel,
+					       const fluid_voice_template_t* templ);
+void fluid_synth_template_default_mods(fluid_voice_template_t* templ);
 void fluid_synth_release_voice_on_same_note(fluid_synth_t* synth, int chan, int key);
+void fluid_synth_unlink_voice(fluid_synth_t* synth, fluid_voice_t* voice);
 void fluid_synth_sfunload_macos9(fluid_synth_t* synth);
 
 void fluid_synth_print_voice(fluid_synth_t* synth);
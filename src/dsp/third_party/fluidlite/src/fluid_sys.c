@@ -353,10 +353,21 @@ fluid_is_soundfont(char* filename)
 
 /***************************************************************
  *
- *               Profiling (Linux, i586 only)
+ *               Profiling
  *
  */
 
+#ifdef WITH_PROFILING
+#include <time.h>
+
+unsigned int fluid_profile_ref(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned int) ts.tv_sec * 1000000000u + (unsigned int) ts.tv_nsec;
+}
+#endif
+
 
 /***************************************************************
  *
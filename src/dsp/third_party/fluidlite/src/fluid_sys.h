@@ -136,6 +136,12 @@ enum {
 
 /* Profiling */
 
+#ifdef WITH_PROFILING
+/* the monotonic clock in nanoseconds, modulo 2^32: differences of two
+   readings less than four seconds apart time the code between them */
+unsigned int fluid_profile_ref(void);
+#endif
+
 
 /**
 
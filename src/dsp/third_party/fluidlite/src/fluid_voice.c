@@ -45,31 +45,37 @@
 /* min vol envelope release (to stop clicks) in SoundFont timecents */
 #define FLUID_MIN_VOLENVRELEASE -7200.0f /* ~16ms */
 
+static int fluid_voice_interpolate (fluid_voice_t *voice);
+static int fluid_voice_stream_interpolate (fluid_voice_t *voice);
+
 //removed inline
-static void fluid_voice_effects (fluid_voice_t *voice, int count,
+static void fluid_voice_effects (fluid_voice_t *voice, int count, int filtered,
 				        fluid_real_t* dsp_left_buf,
 				        fluid_real_t* dsp_right_buf,
 				        fluid_real_t* dsp_reverb_buf,
 				        fluid_real_t* dsp_chorus_buf);
 /*
- * new_fluid_voice
+ * fluid_voice_setup
+ *
+ * Puts a voice of a pool into the state of a voice that never played.
  */
-fluid_voice_t*
-new_fluid_voice(fluid_real_t output_rate)
+static void
+fluid_voice_setup(fluid_voice_t* voice, fluid_gen_t* gen, fluid_mod_t* mod,
+		  fluid_real_t output_rate, int block_size)
 {
-  fluid_voice_t* voice;
-  voice = FLUID_NEW(fluid_voice_t);
-  if (voice == NULL) {
-    FLUID_LOG(FLUID_ERR, "Out of memory");
-    return NULL;
-  }
+  FLUID_MEMSET(voice, 0, sizeof(fluid_voice_t));
+  voice->gen = gen;
+  voice->mod = mod;
   voice->status = FLUID_VOICE_CLEAN;
   voice->chan = NO_CHANNEL;
   voice->key = 0;
   voice->vel = 0;
   voice->channel = NULL;
   voice->sample = NULL;
+  voice->stream = NULL;
   voice->output_rate = output_rate;
+  voice->block_size = block_size;
+  voice->heap_index = -1;
 
   /* The 'sustain' and 'finished' segments of the volume / modulation
    * envelope are constant. They are never affected by any modulator
@@ -99,32 +105,79 @@ new_fluid_voice(fluid_real_t output_rate)
   voice->modenv_data[FLUID_VOICE_ENVFINISHED].incr = 0.0f;
   voice->modenv_data[FLUID_VOICE_ENVFINISHED].min = -1.0f;
   voice->modenv_data[FLUID_VOICE_ENVFINISHED].max = 1.0f;
+}
+
+/*
+ * new_fluid_voice_pool
+ */
+fluid_voice_pool_t*
+new_fluid_voice_pool(int count, fluid_real_t output_rate, int block_size)
+{
+  fluid_voice_pool_t* pool;
+
+  pool = FLUID_NEW(fluid_voice_pool_t);
+  if (pool == NULL) {
+    FLUID_LOG(FLUID_ERR, "Out of memory");
+    return NULL;
+  }
+  pool->count = count;
+  pool->stride = (sizeof(fluid_voice_t) + FLUID_VOICE_ALIGN - 1) & ~(size_t) (FLUID_VOICE_ALIGN - 1);
+  pool->mem = FLUID_MALLOC(pool->stride * count + FLUID_VOICE_ALIGN - 1);
+  pool->gen = FLUID_ARRAY(fluid_gen_t, (size_t) count * GEN_LAST);
+  pool->mod = FLUID_ARRAY(fluid_mod_t, (size_t) count * FLUID_NUM_MOD);
+  if ((pool->mem == NULL) || (pool->gen == NULL) || (pool->mod == NULL)) {
+    FLUID_LOG(FLUID_ERR, "Out of memory");
+    delete_fluid_voice_pool(pool);
+    return NULL;
+  }
+  pool->voices = (char*) (((size_t) pool->mem + FLUID_VOICE_ALIGN - 1) & ~(size_t) (FLUID_VOICE_ALIGN - 1));
 
-  return voice;
+  fluid_voice_pool_reset(pool, output_rate, block_size);
+  return pool;
 }
 
 /*
- * delete_fluid_voice
+ * delete_fluid_voice_pool
  */
-int
-delete_fluid_voice(fluid_voice_t* voice)
+void
+delete_fluid_voice_pool(fluid_voice_pool_t* pool)
 {
-  if (voice == NULL) {
-    return FLUID_OK;
+  if (pool == NULL) {
+    return;
+  }
+  if (pool->mem != NULL) FLUID_FREE(pool->mem);
+  if (pool->gen != NULL) FLUID_FREE(pool->gen);
+  if (pool->mod != NULL) FLUID_FREE(pool->mod);
+  FLUID_FREE(pool);
+}
+
+/*
+ * fluid_voice_pool_reset
+ */
+void
+fluid_voice_pool_reset(fluid_voice_pool_t* pool, fluid_real_t output_rate, int block_size)
+{
+  int i;
+
+  for (i = 0; i < pool->count; i++) {
+    fluid_voice_setup(fluid_voice_pool_get(pool, i), &pool->gen[(size_t) i * GEN_LAST],
+		      &pool->mod[(size_t) i * FLUID_NUM_MOD], output_rate, block_size);
   }
-  FLUID_FREE(voice);
-  return FLUID_OK;
 }
 
 /* fluid_voice_init
  *
- * Initialize the synthesis process
+ * Initialize the synthesis process. Without a template, the voice
+ * starts with the default generators and no modulators.
  */
 int
 fluid_voice_init(fluid_voice_t* voice, fluid_sample_t* sample,
 		 fluid_channel_t* channel, int key, int vel, unsigned int id,
-		 unsigned int start_time, fluid_real_t gain)
+		 unsigned int start_time, fluid_real_t gain,
+		 const fluid_voice_template_t* templ)
 {
+  int i;
+
   /* Note: The voice parameters will be initialized later, when the
    * generators have been retrieved from the sound font. Here, only
    * the 'working memory' of the voice (position in envelopes, history
@@ -141,6 +194,7 @@ fluid_voice_init(fluid_voice_t* voice, fluid_sample_t* sample,
   voice->start_time = start_time;
   voice->ticks = 0;
   voice->noteoff_ticks = 0;
+  voice->start_offset = 0;
   voice->debug = 0;
   voice->has_looped = 0; /* Will be set during voice_write when the 2nd loop point is reached */
   voice->last_fres = -1; /* The filter coefficients have to be calculated later in the DSP loop. */
@@ -180,6 +234,15 @@ fluid_voice_init(fluid_voice_t* voice, fluid_sample_t* sample,
    * fluid_voice_calculate_runtime_synthesis_parameters.  */
   fluid_gen_init(&voice->gen[0], channel);
 
+  if (templ != NULL) {
+    for (i = 0; i < templ->gen_count; i++) {
+      voice->gen[templ->gen[i]].val = templ->val[i];
+      voice->gen[templ->gen[i]].flags = GEN_SET;
+    }
+    FLUID_MEMCPY(voice->mod, templ->mod, templ->mod_count * sizeof(fluid_mod_t));
+    voice->mod_count = templ->mod_count;
+  }
+
   voice->synth_gain = gain;
   /* avoid division by zero later*/
   if (voice->synth_gain < 0.0000001){
@@ -198,6 +261,11 @@ fluid_voice_init(fluid_voice_t* voice, fluid_sample_t* sample,
      unloading of the soundfont while this voice is playing. */
   fluid_sample_incr_ref(voice->sample);
 
+  /* start reading the body ahead while the head plays from memory */
+  if (sample->stream != NULL) {
+    voice->stream = fluid_stream_open(sample->stream);
+  }
+
   return FLUID_OK;
 }
 
@@ -238,33 +306,137 @@ fluid_real_t fluid_voice_gen_value(fluid_voice_t* voice, int num)
  * synthesizer to generate the sound samples. The synthesizer passes
  * four audio buffers: left, right, reverb out, and chorus out.
  *
- * The biggest part of this function sets the correct values for all
- * the dsp parameters (all the control data boil down to only a few
- * dsp parameters). The dsp routine is #included in several places (fluid_dsp_core.c).
+ * It is fluid_voice_prepare(), fluid_voice_render() and
+ * fluid_voice_finish() in a row. The synth may also call them apart, to
+ * filter several voices at once or to render voices on other threads.
  */
 int
 fluid_voice_write(fluid_voice_t* voice,
 		 fluid_real_t* dsp_left_buf, fluid_real_t* dsp_right_buf,
 		 fluid_real_t* dsp_reverb_buf, fluid_real_t* dsp_chorus_buf)
 {
-  fluid_real_t fres;
-  fluid_real_t target_amp;	/* target amplitude */
+  fluid_real_t dsp_buf[FLUID_MAX_BUFSIZE];
   int count;
 
-  fluid_real_t dsp_buf[FLUID_BUFSIZE];
+  if (!fluid_voice_prepare (voice)) return FLUID_OK;
+
+  count = fluid_voice_render (voice, dsp_buf);
+  fluid_voice_finish (voice, count, 0, dsp_left_buf, dsp_right_buf,
+		      dsp_reverb_buf, dsp_chorus_buf);
+
+  /* turn off voice if short count (sample ended and not looping) */
+  if (count < voice->block_size)
+  {
+      fluid_voice_off(voice);
+  }
+  return FLUID_OK;
+}
+
+/*
+ * fluid_voice_env_advance
+ *
+ * Moves an envelope on by 'frames' output frames. Section lengths are
+ * counted in frames, so a section that ends inside the block hands the
+ * rest of the block to the next one instead of taking all of it: stage
+ * times stay the same whatever the block size. Returns the value at the
+ * end of the frames. 'is_volenv' forces the value at the end of the
+ * decay, as the volume envelope needs. If 'delay' isn't NULL, it is set
+ * to the number of the frames spent in the delay section.
+ */
+static fluid_real_t
+fluid_voice_env_advance(fluid_env_data_t* data, int* section, unsigned int* count,
+                        fluid_real_t val, unsigned int frames, int is_volenv,
+                        unsigned int* delay)
+{
   fluid_env_data_t* env_data;
-  fluid_real_t x;
+  fluid_real_t x, limit;
+  unsigned int n;
+
+  if (delay != NULL)
+    *delay = 0;
+
+  while (*section < FLUID_VOICE_ENVFINISHED)
+  {
+    env_data = &data[*section];
+
+    /* skip to the next section of the envelope if necessary */
+    if (*count >= env_data->count)
+    {
+      // If we're switching envelope stages from decay to sustain, force the value to be the end value of the previous stage
+      if (is_volenv && *section == FLUID_VOICE_ENVDECAY)
+        val = env_data->min * env_data->coeff;
 
+      (*section)++;
+      *count = 0;
+      continue;
+    }
+
+    if (frames == 0)
+      break;
+
+    n = env_data->count - *count;
+    if (n > frames)
+      n = frames;
+
+    if (delay != NULL && *section == FLUID_VOICE_ENVDELAY)
+      *delay += n;
+
+    /* calculate the envelope value and check for valid range */
+    x = env_data->coeff * val + env_data->incr * n;
+    if (x < env_data->min || x > env_data->max)
+    {
+      /* the section ends on the frame the value reaches its limit */
+      limit = (x < env_data->min) ? env_data->min : env_data->max;
+      x = (env_data->incr != 0) ? (limit - env_data->coeff * val) / env_data->incr + (fluid_real_t) 0.5 : 0;
+      if (x < 0)
+        x = 0;
+      if (x < n)
+        n = (unsigned int) x;
+
+      val = limit;
+      frames -= n;
+      (*section)++;
+      *count = 0;
+      continue;
+    }
+
+    val = x;
+    *count += n;
+    frames -= n;
+  }
+
+  return val;
+}
+
+/*
+ * fluid_voice_prepare
+ *
+ * The biggest part of the work: sets the correct values for all the
+ * dsp parameters (all the control data boil down to only a few dsp
+ * parameters) for the next block. Returns 1 if the voice is to be
+ * rendered, 0 if it gives no sound this block or was turned off.
+ *
+ * Only this part may turn off a voice or touch the synth, the rest
+ * keeps to the voice itself.
+ */
+int
+fluid_voice_prepare(fluid_voice_t* voice)
+{
+  fluid_real_t fres;
+  int fres_open;
+  fluid_real_t target_amp;	/* target amplitude */
+  unsigned int frames;		/* frames of the block the voice plays in */
+  unsigned int delay;		/* frames of them still in the delay */
 
   /* make sure we're playing and that we have sample data */
-  if (!_PLAYING(voice)) return FLUID_OK;
+  if (!_PLAYING(voice)) return 0;
 
   /******************* sample **********************/
 
   if (voice->sample == NULL)
   {
     fluid_voice_off(voice);
-    return FLUID_OK;
+    return 0;
   }
 
   if (voice->noteoff_ticks != 0 && voice->ticks >= voice->noteoff_ticks)
@@ -276,38 +448,14 @@ fluid_voice_write(fluid_voice_t* voice,
    * Initial phase is calculated here*/
   fluid_voice_check_sample_sanity (voice);
 
-  /******************* vol env **********************/
-
-  env_data = &voice->volenv_data[voice->volenv_section];
-
-  /* skip to the next section of the envelope if necessary */
-  while (voice->volenv_count >= env_data->count)
-  {
-    // If we're switching envelope stages from decay to sustain, force the value to be the end value of the previous stage
-    if (env_data && voice->volenv_section == FLUID_VOICE_ENVDECAY)
-      voice->volenv_val = env_data->min * env_data->coeff;
+  /* a note started inside the block plays from start_offset on */
+  frames = voice->block_size - voice->start_offset;
 
-    env_data = &voice->volenv_data[++voice->volenv_section];
-    voice->volenv_count = 0;
-  }
-
-  /* calculate the envelope value and check for valid range */
-  x = env_data->coeff * voice->volenv_val + env_data->incr;
-  if (x < env_data->min)
-  {
-    x = env_data->min;
-    voice->volenv_section++;
-    voice->volenv_count = 0;
-  }
-  else if (x > env_data->max)
-  {
-    x = env_data->max;
-    voice->volenv_section++;
-    voice->volenv_count = 0;
-  }
+  /******************* vol env **********************/
 
-  voice->volenv_val = x;
-  voice->volenv_count++;
+  voice->volenv_val = fluid_voice_env_advance(voice->volenv_data, &voice->volenv_section,
+                                              &voice->volenv_count, voice->volenv_val,
+                                              frames, 1, &delay);
 
   if (voice->volenv_section == FLUID_VOICE_ENVFINISHED)
   {
@@ -317,33 +465,9 @@ fluid_voice_write(fluid_voice_t* voice,
 
   /******************* mod env **********************/
 
-  env_data = &voice->modenv_data[voice->modenv_section];
-
-  /* skip to the next section of the envelope if necessary */
-  while (voice->modenv_count >= env_data->count)
-  {
-    env_data = &voice->modenv_data[++voice->modenv_section];
-    voice->modenv_count = 0;
-  }
-
-  /* calculate the envelope value and check for valid range */
-  x = env_data->coeff * voice->modenv_val + env_data->incr;
-
-  if (x < env_data->min)
-  {
-    x = env_data->min;
-    voice->modenv_section++;
-    voice->modenv_count = 0;
-  }
-  else if (x > env_data->max)
-  {
-    x = env_data->max;
-    voice->modenv_section++;
-    voice->modenv_count = 0;
-  }
-
-  voice->modenv_val = x;
-  voice->modenv_count++;
+  voice->modenv_val = fluid_voice_env_advance(voice->modenv_data, &voice->modenv_section,
+                                              &voice->modenv_count, voice->modenv_val,
+                                              frames, 0, NULL);
 
   /******************* mod lfo **********************/
 
@@ -444,8 +568,15 @@ fluid_voice_write(fluid_voice_t* voice,
     }
   }
 
-  /* Volume increment to go from voice->amp to target_amp in FLUID_BUFSIZE steps */
-  voice->amp_incr = (target_amp - voice->amp) / FLUID_BUFSIZE;
+  /* A delay that ends inside the block silences the block up to its
+   * end: fluid_voice_render() starts the sample on the frame after it,
+   * and the ramp to target_amp with it. */
+  voice->start_offset += (int) delay;
+  if (voice->start_offset >= voice->block_size)
+    goto post_process;
+
+  /* Volume increment to go from voice->amp to target_amp in the frames that sound */
+  voice->amp_incr = (target_amp - voice->amp) / (voice->block_size - voice->start_offset);
 
   /* no volume and not changing? - No need to process */
   if ((voice->amp == 0.0f) && (voice->amp_incr == 0.0f))
@@ -483,11 +614,18 @@ fluid_voice_write(fluid_voice_t* voice,
    * clipping the maximum filter frequency at 0.45*srate, the filter
    * is used as an anti-aliasing filter. */
 
-  if (fres > 0.45f * voice->output_rate)
+  fres_open = 0;
+  if (fres > 0.45f * voice->output_rate) {
     fres = 0.45f * voice->output_rate;
+    fres_open = 1;
+  }
   else if (fres < 5)
     fres = 5;
 
+#ifdef WITH_PROFILING
+  voice->prof_filter_update = (fabs(fres - voice->last_fres) > 0.01);
+#endif
+
   /* if filter enabled and there is a significant frequency change.. */
   if ((fabs(fres - voice->last_fres) > 0.01))
   {
@@ -545,14 +683,14 @@ fluid_voice_write(fluid_voice_t* voice,
 
       /* The filter frequency is changed.  Calculate an increment
        * factor, so that the new setting is reached after one buffer
-       * length. x_incr is added to the current value FLUID_BUFSIZE
+       * length. x_incr is added to the current value block_size
        * times. The length is arbitrarily chosen. Longer than one
        * buffer will sacrifice some performance, though.  Note: If
        * the filter is still too 'grainy', then increase this number
        * at will.
        */
 
-#define FILTER_TRANSITION_SAMPLES (FLUID_BUFSIZE)
+#define FILTER_TRANSITION_SAMPLES (voice->block_size)
 
       voice->a1_incr = (a1_temp - voice->a1) / FILTER_TRANSITION_SAMPLES;
       voice->a2_incr = (a2_temp - voice->a2) / FILTER_TRANSITION_SAMPLES;
@@ -564,48 +702,384 @@ fluid_voice_write(fluid_voice_t* voice,
     voice->last_fres = fres;
   }
 
+  /* Clamped this high without resonance the filter only takes off the
+   * top of the spectrum. If the synth allows it, such a filter is
+   * skipped and only its gain applied, once it no longer fades between
+   * settings. */
+  voice->filter_bypass = fres_open && voice->channel->synth->filter_bypass
+    && (_GEN(voice, GEN_FILTERQ) <= 0.0f) && (voice->filter_coeff_incr_count == 0);
+
+
+  voice->ticks += voice->block_size;
+  return 1;
+
+ post_process:
+  voice->start_offset = 0;	/* a block that isn't rendered uses up the offset */
+  voice->ticks += voice->block_size;
+  return 0;
+}
+
+/*
+ * fluid_voice_render
+ *
+ * Interpolates the block fluid_voice_prepare() set up into dsp_buf.
+ * Returns the number of points written; fewer than block_size means
+ * the sample ended and the voice is to be turned off.
+ *
+ * The block a voice starts to sound in begins with start_offset points
+ * of silence, for a note started inside the block or a delay that ends
+ * in it: the sample is interpolated into the rest of the block, as if
+ * the block were that much shorter, so that it starts from its first
+ * point at the offset.
+ */
+int
+fluid_voice_render(fluid_voice_t* voice, fluid_real_t* dsp_buf)
+{
+  int offset = voice->start_offset;
+  int count;
 
   /*********************** run the dsp chain ************************
    * The sample is mixed with the output buffer.
-   * The buffer has to be filled from 0 to FLUID_BUFSIZE-1.
+   * The buffer has to be filled from 0 to block_size-1.
    * Depending on the position in the loop and the loop size, this
    * may require several runs. */
 
-  voice->dsp_buf = dsp_buf;
+  voice->dsp_buf = dsp_buf + offset;
+  voice->dsp_data = voice->sample->data;
+  voice->block_size -= offset;
+
+  if (voice->sample->stream != NULL)
+    count = fluid_voice_stream_interpolate (voice);
+  else
+    count = fluid_voice_interpolate (voice);
+
+  voice->block_size += offset;
+  if (offset > 0) {
+    voice->dsp_buf = dsp_buf;
+    voice->start_offset = 0;
+    FLUID_MEMSET(dsp_buf, 0, offset * sizeof(fluid_real_t));
+  }
+  return offset + count;
+}
 
+/*
+ * fluid_voice_finish
+ *
+ * Filters and mixes the 'count' points fluid_voice_render() left in
+ * voice->dsp_buf, skipping the filter if fluid_dsp_float_filter() ran
+ * it already ('filtered').
+ */
+void
+fluid_voice_finish(fluid_voice_t* voice, int count, int filtered,
+		  fluid_real_t* dsp_left_buf, fluid_real_t* dsp_right_buf,
+		  fluid_real_t* dsp_reverb_buf, fluid_real_t* dsp_chorus_buf)
+{
+  if (count > 0)
+    fluid_voice_effects (voice, count, filtered, dsp_left_buf, dsp_right_buf,
+			 dsp_reverb_buf, dsp_chorus_buf);
+}
+
+/*
+ * fluid_voice_filter_lane
+ *
+ * Whether fluid_dsp_float_filter() can run the filter of a voice over
+ * 'count' points: the filter is not bypassed, and it either holds its
+ * setting or fades towards a new one for all of them.
+ */
+int
+fluid_voice_filter_lane(fluid_voice_t* voice, int count)
+{
+  return !voice->filter_bypass
+    && ((voice->filter_coeff_incr_count <= 0)
+	|| (voice->filter_coeff_incr_count >= count));
+}
+
+/*
+ * fluid_voice_interpolate
+ *
+ * Fills voice->dsp_buf from voice->dsp_data with the configured
+ * interpolation. Returns the number of points written.
+ */
+static int
+fluid_voice_interpolate(fluid_voice_t* voice)
+{
   switch (voice->interp_method)
   {
     case FLUID_INTERP_NONE:
-      count = fluid_dsp_float_interpolate_none (voice);
-      break;
+      return fluid_dsp_float_interpolate_none (voice);
     case FLUID_INTERP_LINEAR:
-      count = fluid_dsp_float_interpolate_linear (voice);
-      break;
+      return fluid_dsp_float_interpolate_linear (voice);
     case FLUID_INTERP_4THORDER:
     default:
-      count = fluid_dsp_float_interpolate_4th_order (voice);
-      break;
+      return fluid_dsp_float_interpolate_4th_order (voice);
     case FLUID_INTERP_7THORDER:
-      count = fluid_dsp_float_interpolate_7th_order (voice);
-      break;
+      return fluid_dsp_float_interpolate_7th_order (voice);
   }
+}
 
-  if (count > 0)
-    fluid_voice_effects (voice, count, dsp_left_buf, dsp_right_buf,
-			 dsp_reverb_buf, dsp_chorus_buf);
+/* position of sample point 'index' in a window of n points from 'lo' */
+static int
+fluid_voice_rebase(int index, unsigned int lo, unsigned int n)
+{
+  if (index < (int) lo) return 0;
+  if ((unsigned int) index - lo > n) return (int) n;
+  return (int) ((unsigned int) index - lo);
+}
 
-  /* turn off voice if short count (sample ended and not looping) */
-  if (count < FLUID_BUFSIZE)
-  {
-      fluid_voice_off(voice);
+/* count a block that played streamed points as silence */
+static void
+fluid_voice_stream_underrun(fluid_sample_stream_t* stream)
+{
+#if defined(__GNUC__)
+  __atomic_fetch_add(&stream->file->underruns, 1, __ATOMIC_RELAXED);
+#else
+  stream->file->underruns++;
+#endif
+}
+
+/*
+ * fluid_voice_stream_skip
+ *
+ * Plays a block of a streamed sample as silence: moves the phase and the
+ * amplitude on and loops or ends the way the interpolation would, without
+ * reading a sample point. Returns the number of points written.
+ */
+static int
+fluid_voice_stream_skip(fluid_voice_t* voice, int looping)
+{
+  fluid_phase_t incr;
+  unsigned int last = looping ? voice->loopend - 1 : voice->end;
+  int count;
+
+  fluid_phase_set_float(incr, voice->phase_incr);
+  for (count = 0; count < voice->block_size; count++) {
+    if (fluid_phase_index(voice->phase) > last) {
+      if (!looping) break;
+      while (fluid_phase_index(voice->phase) > last) {
+	fluid_phase_sub_int(voice->phase, voice->loopend - voice->loopstart);
+      }
+      voice->has_looped = 1;
+    }
+    voice->dsp_buf[count] = 0;
+    fluid_phase_incr(voice->phase, incr);
   }
+  voice->amp += voice->amp_incr * count;
 
- post_process:
-  voice->ticks += FLUID_BUFSIZE;
-  return FLUID_OK;
+  return count;
+}
+
+/*
+ * fluid_voice_stream_interpolate
+ *
+ * Interpolation for a sample whose body is streamed (see
+ * fluid_sample_stream_t). Blocks that stay clear of the body read the
+ * sample in place. Otherwise the points the block can reach are gathered
+ * into a window - head and tail from the sample, the body from the
+ * voice's ring - and the interpolation runs on positions rebased to the
+ * window. Loop and end points the block can't reach are clamped to the
+ * window edge, so they are never read. Body points the disk hasn't
+ * delivered yet play as silence and count as an underrun; the voice keeps
+ * its pace rather than waiting. The body is never read through the
+ * mapping: blocks the window can't serve play as silence too.
+ */
+static int
+fluid_voice_stream_interpolate(fluid_voice_t* voice)
+{
+  short int window[FLUID_STREAM_WINDOW + FLUID_STREAM_GUARD];
+  fluid_sample_t* sample = voice->sample;
+  fluid_sample_stream_t* stream = sample->stream;
+  unsigned int body_start = stream->body_start;
+  unsigned int body_end = stream->body_end;
+  unsigned int index, lo, hi, n, from, to, got, first, last;
+  int start, end, loopstart, loopend;
+  int looping, count, underrun = 0;
+
+  looping = _SAMPLEMODE(voice) == FLUID_LOOP_DURING_RELEASE
+    || (_SAMPLEMODE(voice) == FLUID_LOOP_UNTIL_RELEASE
+	&& voice->volenv_section < FLUID_VOICE_ENVRELEASE);
+
+  /* the points this block may read, whatever the interpolation order */
+  index = fluid_phase_index(voice->phase);
+  lo = (index > 3) ? index - 3 : 0;
+  hi = index + (unsigned int) (voice->block_size * voice->phase_incr) + 5;
+
+  if (looping && ((unsigned int) voice->loopend <= body_start)
+      && (hi >= (unsigned int) voice->loopend)) {
+    /* a loop in the head turns back before the body */
+    hi = voice->loopend - 1;
+  }
+
+  /* Loops moved into the body by generators: the ring only reads ahead,
+     so once the voice gets there it plays silence */
+  if (looping && ((unsigned int) voice->loopstart < body_end)
+      && ((unsigned int) voice->loopend > body_start)
+      && (voice->has_looped || (hi >= body_start))) {
+    fluid_voice_stream_underrun(stream);
+    return fluid_voice_stream_skip(voice, looping);
+  }
+
+  if ((hi < body_start) || (lo >= body_end)) {
+    /* in the head or past the body: keep the start and end points the
+       interpolation fetches up front off the body */
+    start = voice->start;
+    end = voice->end;
+    if (((unsigned int) start >= body_start) && ((unsigned int) start < body_end)) {
+      voice->start = body_end;
+    }
+    if (((unsigned int) end >= body_start) && ((unsigned int) end < body_end) && (hi < body_start)) {
+      voice->end = hi;
+    }
+    count = fluid_voice_interpolate(voice);
+    voice->start = start;
+    voice->end = end;
+
+    /* loops stay clear of the body, so it won't come back: free the ring */
+    if ((lo >= body_end) && (voice->stream != NULL)) {
+      fluid_stream_close(voice->stream);
+      voice->stream = NULL;
+    }
+    return count;
+  }
+
+  n = hi - lo + 1;
+  if (n > FLUID_STREAM_WINDOW) {
+    /* transposed up this far, the ring can't keep up anyway */
+    fluid_voice_stream_underrun(stream);
+    return fluid_voice_stream_skip(voice, looping);
+  }
+
+  for (from = lo; from <= hi; from = to) {
+    if ((from >= body_start) && (from < body_end)) {
+      to = (hi < body_end) ? hi + 1 : body_end;
+      got = 0;
+      if (voice->stream != NULL) {
+	got = fluid_stream_read(voice->stream, window + (from - lo), from, to - from);
+      }
+      if (got < to - from) {
+	FLUID_MEMSET(window + (from - lo) + got, 0, (to - from - got) * sizeof(short));
+	underrun = 1;
+      }
+    } else {
+      to = ((from < body_start) && (hi >= body_start)) ? body_start : hi + 1;
+
+      /* resident, but only within the sample itself */
+      first = (from > sample->start) ? from : sample->start;
+      last = (to <= sample->end) ? to : sample->end + 1;
+      FLUID_MEMSET(window + (from - lo), 0, (to - from) * sizeof(short));
+      if (first < last) {
+	FLUID_MEMCPY(window + (first - lo), sample->data + first, (last - first) * sizeof(short));
+      }
+    }
+  }
+  FLUID_MEMSET(window + n, 0, FLUID_STREAM_GUARD * sizeof(short));
+
+  start = voice->start;
+  end = voice->end;
+  loopstart = voice->loopstart;
+  loopend = voice->loopend;
+
+  voice->start = fluid_voice_rebase(start, lo, n);
+  voice->end = fluid_voice_rebase(end, lo, n);
+  voice->loopstart = fluid_voice_rebase(loopstart, lo, n);
+  voice->loopend = fluid_voice_rebase(loopend, lo, n);
+  voice->dsp_data = window;
+  fluid_phase_sub_int(voice->phase, lo);
+
+  count = fluid_voice_interpolate(voice);
+
+  fluid_phase_incr(voice->phase, fluid_phase_from_index_fract(lo, 0));
+  voice->dsp_data = sample->data;
+  voice->start = start;
+  voice->end = end;
+  voice->loopstart = loopstart;
+  voice->loopend = loopend;
+
+  if (underrun) {
+    fluid_voice_stream_underrun(stream);
+  }
+
+  return count;
 }
 
 
+/* What fluid_voice_mix() does to each point: filter it, and add it to
+   the outputs and sends with a gain. A centered voice adds a single
+   product to both sides. */
+#define FLUID_MIX_FILTER	0x01
+#define FLUID_MIX_CENTER	0x02
+#define FLUID_MIX_LEFT		0x04
+#define FLUID_MIX_RIGHT		0x08
+#define FLUID_MIX_REVERB	0x10
+#define FLUID_MIX_CHORUS	0x20
+
+#if defined(__GNUC__)
+#define FLUID_MIX_INLINE static FLUID_INLINE __attribute__ ((always_inline))
+#else
+#define FLUID_MIX_INLINE static FLUID_INLINE
+#endif
+
+/*
+ * fluid_voice_mix
+ *
+ * Filters and mixes a block in one pass. 'mask' is a constant at every
+ * call, so each combination of the FLUID_MIX_ flags compiles to its own
+ * loop with nothing in it but the work it asks for; the loops without
+ * the filter vectorize.
+ */
+FLUID_MIX_INLINE void
+fluid_voice_mix (fluid_voice_t *voice, int count, int mask,
+		 fluid_real_t amp_left, fluid_real_t amp_right,
+		 fluid_real_t amp_reverb, fluid_real_t amp_chorus,
+		 fluid_real_t* dsp_left_buf, fluid_real_t* dsp_right_buf,
+		 fluid_real_t* dsp_reverb_buf, fluid_real_t* dsp_chorus_buf)
+{
+  fluid_real_t *dsp_buf = voice->dsp_buf;
+  fluid_real_t dsp_hist1 = voice->hist1;
+  fluid_real_t dsp_hist2 = voice->hist2;
+  fluid_real_t dsp_a1 = voice->a1;
+  fluid_real_t dsp_a2 = voice->a2;
+  fluid_real_t dsp_b02 = voice->b02;
+  fluid_real_t dsp_b1 = voice->b1;
+  fluid_real_t dsp_centernode;
+  fluid_real_t x;
+  int dsp_i;
+  float v;
+
+  for (dsp_i = 0; dsp_i < count; dsp_i++)
+  {
+    x = dsp_buf[dsp_i];
+
+    if (mask & FLUID_MIX_FILTER)
+    { /* The filter is implemented in Direct-II form. */
+      dsp_centernode = x - dsp_a1 * dsp_hist1 - dsp_a2 * dsp_hist2;
+      x = dsp_b02 * (dsp_centernode + dsp_hist2) + dsp_b1 * dsp_hist1;
+      dsp_hist2 = dsp_hist1;
+      dsp_hist1 = dsp_centernode;
+    }
+
+    if (mask & FLUID_MIX_CENTER)
+    {
+      v = amp_left * x;
+      dsp_left_buf[dsp_i] += v;
+      dsp_right_buf[dsp_i] += v;
+    }
+    if (mask & FLUID_MIX_LEFT)
+      dsp_left_buf[dsp_i] += amp_left * x;
+    if (mask & FLUID_MIX_RIGHT)
+      dsp_right_buf[dsp_i] += amp_right * x;
+    if (mask & FLUID_MIX_REVERB)
+      dsp_reverb_buf[dsp_i] += amp_reverb * x;
+    if (mask & FLUID_MIX_CHORUS)
+      dsp_chorus_buf[dsp_i] += amp_chorus * x;
+  }
+
+  if (mask & FLUID_MIX_FILTER)
+  {
+    voice->hist1 = dsp_hist1;
+    voice->hist2 = dsp_hist2;
+  }
+}
+
 /* Purpose:
  *
  * - filters (applies a lowpass filter with variable cutoff frequency and quality factor)
@@ -637,7 +1111,7 @@ fluid_voice_write(fluid_voice_t* voice,
  *
  */
 static void
-fluid_voice_effects (fluid_voice_t *voice, int count,
+fluid_voice_effects (fluid_voice_t *voice, int count, int filtered,
 		     fluid_real_t* dsp_left_buf, fluid_real_t* dsp_right_buf,
 		     fluid_real_t* dsp_reverb_buf, fluid_real_t* dsp_chorus_buf)
 {
@@ -659,20 +1133,31 @@ fluid_voice_effects (fluid_voice_t *voice, int count,
   fluid_real_t *dsp_buf = voice->dsp_buf;
 
   fluid_real_t dsp_centernode;
+  fluid_real_t gain = 1.0f;
   int dsp_i;
-  float v;
+  int mask = 0;
 
   /* filter (implement the voice filter according to SoundFont standard) */
 
   /* Check for denormal number (too close to zero). */
   if (fabs (dsp_hist1) < 1e-20) dsp_hist1 = 0.0f;  /* FIXME JMG - Is this even needed? */
+  voice->hist1 = dsp_hist1;
 
-  /* Two versions of the filter loop. One, while the filter is
-  * changing towards its new setting. The other, if the filter
-  * doesn't change.
-  */
+  /* Three versions of the filter. While the filter is changing towards
+   * its new setting it runs here, ahead of the mixing. If it doesn't
+   * change, it runs in the mixing loop. A bypassed filter only leaves
+   * its gain, and a history that lets it take over without a jump.
+   * The synth may have run it along with the filters of other voices.
+   */
 
-  if (dsp_filter_coeff_incr_count > 0)
+  if (filtered)
+    ;
+  else if (voice->filter_bypass)
+  {
+    gain = voice->filter_gain;
+    voice->hist1 = voice->hist2 = (count > 0) ? dsp_buf[count - 1] / (1.0f + dsp_a1 + dsp_a2) : 0.0f;
+  }
+  else if (dsp_filter_coeff_incr_count > 0)
   {
     /* Increment is added to each filter coefficient filter_coeff_incr_count times. */
     for (dsp_i = 0; dsp_i < count; dsp_i++)
@@ -691,69 +1176,65 @@ fluid_voice_effects (fluid_voice_t *voice, int count,
 	dsp_b1 += dsp_b1_incr;
       }
     } /* for dsp_i */
+
+    voice->hist1 = dsp_hist1;
+    voice->hist2 = dsp_hist2;
+    voice->a1 = dsp_a1;
+    voice->a2 = dsp_a2;
+    voice->b02 = dsp_b02;
+    voice->b1 = dsp_b1;
+    voice->filter_coeff_incr_count = dsp_filter_coeff_incr_count;
   }
-  else /* The filter parameters are constant.  This is duplicated to save time. */
+  else /* The filter parameters are constant. */
   {
-    for (dsp_i = 0; dsp_i < count; dsp_i++)
-    { /* The filter is implemented in Direct-II form. */
-      dsp_centernode = dsp_buf[dsp_i] - dsp_a1 * dsp_hist1 - dsp_a2 * dsp_hist2;
-      dsp_buf[dsp_i] = dsp_b02 * (dsp_centernode + dsp_hist2) + dsp_b1 * dsp_hist1;
-      dsp_hist2 = dsp_hist1;
-      dsp_hist1 = dsp_centernode;
-    }
+    mask |= FLUID_MIX_FILTER;
   }
 
   /* pan (Copy the signal to the left and right output buffer) The voice
   * panning generator has a range of -500 .. 500.  If it is centered,
   * it's close to 0.  voice->amp_left and voice->amp_right are then the
   * same, and we can save one multiplication per voice and sample.
+  * Otherwise stereo samples have one side zero.
   */
   if ((-0.5 < voice->pan) && (voice->pan < 0.5))
+    mask |= FLUID_MIX_CENTER;
+  else
   {
-    /* The voice is centered. Use voice->amp_left twice. */
-    for (dsp_i = 0; dsp_i < count; dsp_i++)
-    {
-      v = voice->amp_left * dsp_buf[dsp_i];
-      dsp_left_buf[dsp_i] += v;
-      dsp_right_buf[dsp_i] += v;
-    }
-  }
-  else	/* The voice is not centered. Stereo samples have one side zero. */
-  {
-    if (voice->amp_left != 0.0)
-    {
-      for (dsp_i = 0; dsp_i < count; dsp_i++)
-	dsp_left_buf[dsp_i] += voice->amp_left * dsp_buf[dsp_i];
-    }
-
-    if (voice->amp_right != 0.0)
-    {
-      for (dsp_i = 0; dsp_i < count; dsp_i++)
-	dsp_right_buf[dsp_i] += voice->amp_right * dsp_buf[dsp_i];
-    }
+    if (voice->amp_left != 0.0) mask |= FLUID_MIX_LEFT;
+    if (voice->amp_right != 0.0) mask |= FLUID_MIX_RIGHT;
   }
 
-  /* reverb send. Buffer may be NULL. */
-  if ((dsp_reverb_buf != NULL) && (voice->amp_reverb != 0.0))
-  {
-    for (dsp_i = 0; dsp_i < count; dsp_i++)
-      dsp_reverb_buf[dsp_i] += voice->amp_reverb * dsp_buf[dsp_i];
-  }
+  /* reverb and chorus send. Buffers may be NULL. */
+  if ((dsp_reverb_buf != NULL) && (voice->amp_reverb != 0.0)) mask |= FLUID_MIX_REVERB;
+  if ((dsp_chorus_buf != NULL) && (voice->amp_chorus != 0)) mask |= FLUID_MIX_CHORUS;
 
-  /* chorus send. Buffer may be NULL. */
-  if ((dsp_chorus_buf != NULL) && (voice->amp_chorus != 0))
+#define FLUID_MIX_CASE(_m) \
+  case (_m): \
+    fluid_voice_mix (voice, count, (_m), gain * voice->amp_left, gain * voice->amp_right, \
+		     gain * voice->amp_reverb, gain * voice->amp_chorus, \
+		     dsp_left_buf, dsp_right_buf, dsp_reverb_buf, dsp_chorus_buf); \
+    break;
+#define FLUID_MIX_SENDS(_m) \
+  FLUID_MIX_CASE (_m) \
+  FLUID_MIX_CASE ((_m) | FLUID_MIX_REVERB) \
+  FLUID_MIX_CASE ((_m) | FLUID_MIX_CHORUS) \
+  FLUID_MIX_CASE ((_m) | FLUID_MIX_REVERB | FLUID_MIX_CHORUS)
+#define FLUID_MIX_PANS(_m) \
+  FLUID_MIX_SENDS (_m) \
+  FLUID_MIX_SENDS ((_m) | FLUID_MIX_CENTER) \
+  FLUID_MIX_SENDS ((_m) | FLUID_MIX_LEFT) \
+  FLUID_MIX_SENDS ((_m) | FLUID_MIX_RIGHT) \
+  FLUID_MIX_SENDS ((_m) | FLUID_MIX_LEFT | FLUID_MIX_RIGHT)
+
+  switch (mask)
   {
-    for (dsp_i = 0; dsp_i < count; dsp_i++)
-      dsp_chorus_buf[dsp_i] += voice->amp_chorus * dsp_buf[dsp_i];
+    FLUID_MIX_PANS (0)
+    FLUID_MIX_PANS (FLUID_MIX_FILTER)
   }
 
-  voice->hist1 = dsp_hist1;
-  voice->hist2 = dsp_hist2;
-  voice->a1 = dsp_a1;
-  voice->a2 = dsp_a2;
-  voice->b02 = dsp_b02;
-  voice->b1 = dsp_b1;
-  voice->filter_coeff_incr_count = dsp_filter_coeff_incr_count;
+#undef FLUID_MIX_CASE
+#undef FLUID_MIX_SENDS
+#undef FLUID_MIX_PANS
 }
 
 /*
@@ -931,14 +1412,14 @@ fluid_voice_calculate_runtime_synthesis_parameters(fluid_voice_t* voice)
 }
 
 /*
- * calculate_hold_decay_buffers
+ * calculate_hold_decay_frames
  */
-int calculate_hold_decay_buffers(fluid_voice_t* voice, int gen_base,
+int calculate_hold_decay_frames(fluid_voice_t* voice, int gen_base,
 				 int gen_key2base, int is_decay)
 {
   /* Purpose:
    *
-   * Returns the number of DSP loops, that correspond to the hold
+   * Returns the number of output frames, that correspond to the hold
    * (is_decay=0) or decay (is_decay=1) time.
    * gen_base=GEN_VOLENVHOLD, GEN_VOLENVDECAY, GEN_MODENVHOLD,
    * GEN_MODENVDECAY gen_key2base=GEN_KEYTOVOLENVHOLD,
@@ -947,7 +1428,7 @@ int calculate_hold_decay_buffers(fluid_voice_t* voice, int gen_base,
 
   fluid_real_t timecents;
   fluid_real_t seconds;
-  int buffers;
+  int frames;
 
   /* SF2.01 section 8.4.3 # 31, 32, 39, 40
    * GEN_KEYTOxxxENVxxx uses key 60 as 'origin'.
@@ -982,14 +1463,12 @@ int calculate_hold_decay_buffers(fluid_voice_t* voice, int gen_base,
   }
 
   seconds = fluid_tc2sec(timecents);
-  /* Each DSP loop processes FLUID_BUFSIZE samples. */
 
-  /* round to next full number of buffers */
-  buffers = (int)(((fluid_real_t)voice->output_rate * seconds)
-		  / (fluid_real_t)FLUID_BUFSIZE
-		  +0.5);
+  /* round to the nearest frame, the envelope is stepped frame exact */
+  frames = (int)(((fluid_real_t)voice->output_rate * seconds)
+		 +0.5);
 
-  return buffers;
+  return frames;
 }
 
 /*
@@ -1168,23 +1647,23 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
     break;
 
   case GEN_MODLFOFREQ:
-    /* - the frequency is converted into a delta value, per buffer of FLUID_BUFSIZE samples
+    /* - the frequency is converted into a delta value, per buffer of block_size samples
      * - the delay into a sample delay
      */
     x = _GEN(voice, GEN_MODLFOFREQ);
     fluid_clip(x, -16000.0f, 4500.0f);
-    voice->modlfo_incr = (4.0f * FLUID_BUFSIZE * fluid_act2hz(x) / voice->output_rate);
+    voice->modlfo_incr = (4.0f * voice->block_size * fluid_act2hz(x) / voice->output_rate);
     break;
 
   case GEN_VIBLFOFREQ:
     /* vib lfo
      *
-     * - the frequency is converted into a delta value, per buffer of FLUID_BUFSIZE samples
+     * - the frequency is converted into a delta value, per buffer of block_size samples
      * - the delay into a sample delay
      */
     x = _GEN(voice, GEN_VIBLFOFREQ);
     fluid_clip(x, -16000.0f, 4500.0f);
-    voice->viblfo_incr = (4.0f * FLUID_BUFSIZE * fluid_act2hz(x) / voice->output_rate);
+    voice->viblfo_incr = (4.0f * voice->block_size * fluid_act2hz(x) / voice->output_rate);
     break;
 
   case GEN_VIBLFODELAY:
@@ -1293,9 +1772,9 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
     break;
 
     /* Conversion functions differ in range limit */
-#define NUM_BUFFERS_DELAY(_v)   (unsigned int) (voice->output_rate * fluid_tc2sec_delay(_v) / FLUID_BUFSIZE)
-#define NUM_BUFFERS_ATTACK(_v)  (unsigned int) (voice->output_rate * fluid_tc2sec_attack(_v) / FLUID_BUFSIZE)
-#define NUM_BUFFERS_RELEASE(_v) (unsigned int) (voice->output_rate * fluid_tc2sec_release(_v) / FLUID_BUFSIZE)
+#define NUM_FRAMES_DELAY(_v)   (unsigned int) (voice->output_rate * fluid_tc2sec_delay(_v))
+#define NUM_FRAMES_ATTACK(_v)  (unsigned int) (voice->output_rate * fluid_tc2sec_attack(_v))
+#define NUM_FRAMES_RELEASE(_v) (unsigned int) (voice->output_rate * fluid_tc2sec_release(_v))
 
     /* volume envelope
      *
@@ -1306,7 +1785,7 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
   case GEN_VOLENVDELAY:                /* SF2.01 section 8.1.3 # 33 */
     x = _GEN(voice, GEN_VOLENVDELAY);
     fluid_clip(x, -12000.0f, 5000.0f);
-    count = NUM_BUFFERS_DELAY(x);
+    count = NUM_FRAMES_DELAY(x);
     voice->volenv_data[FLUID_VOICE_ENVDELAY].count = count;
     voice->volenv_data[FLUID_VOICE_ENVDELAY].coeff = 0.0f;
     voice->volenv_data[FLUID_VOICE_ENVDELAY].incr = 0.0f;
@@ -1317,7 +1796,7 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
   case GEN_VOLENVATTACK:               /* SF2.01 section 8.1.3 # 34 */
     x = _GEN(voice, GEN_VOLENVATTACK);
     fluid_clip(x, -12000.0f, 8000.0f);
-    count = 1 + NUM_BUFFERS_ATTACK(x);
+    count = 1 + NUM_FRAMES_ATTACK(x);
     voice->volenv_data[FLUID_VOICE_ENVATTACK].count = count;
     voice->volenv_data[FLUID_VOICE_ENVATTACK].coeff = 1.0f;
     voice->volenv_data[FLUID_VOICE_ENVATTACK].incr = count ? 1.0f / count : 0.0f;
@@ -1327,7 +1806,7 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
 
   case GEN_VOLENVHOLD:                 /* SF2.01 section 8.1.3 # 35 */
   case GEN_KEYTOVOLENVHOLD:            /* SF2.01 section 8.1.3 # 39 */
-    count = calculate_hold_decay_buffers(voice, GEN_VOLENVHOLD, GEN_KEYTOVOLENVHOLD, 0); /* 0 means: hold */
+    count = calculate_hold_decay_frames(voice, GEN_VOLENVHOLD, GEN_KEYTOVOLENVHOLD, 0); /* 0 means: hold */
     voice->volenv_data[FLUID_VOICE_ENVHOLD].count = count;
     voice->volenv_data[FLUID_VOICE_ENVHOLD].coeff = 1.0f;
     voice->volenv_data[FLUID_VOICE_ENVHOLD].incr = 0.0f;
@@ -1340,7 +1819,7 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
   case GEN_KEYTOVOLENVDECAY:          /* SF2.01 section 8.1.3 # 40 */
     y = 1.0f - 0.001f * _GEN(voice, GEN_VOLENVSUSTAIN);
     fluid_clip(y, 0.0f, 1.0f);
-    count = calculate_hold_decay_buffers(voice, GEN_VOLENVDECAY, GEN_KEYTOVOLENVDECAY, 1); /* 1 for decay */
+    count = calculate_hold_decay_frames(voice, GEN_VOLENVDECAY, GEN_KEYTOVOLENVDECAY, 1); /* 1 for decay */
     voice->volenv_data[FLUID_VOICE_ENVDECAY].count = count;
     voice->volenv_data[FLUID_VOICE_ENVDECAY].coeff = 1.0f;
     voice->volenv_data[FLUID_VOICE_ENVDECAY].incr = count ? -1.0f / count : 0.0f;
@@ -1351,7 +1830,7 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
   case GEN_VOLENVRELEASE:             /* SF2.01 section 8.1.3 # 38 */
     x = _GEN(voice, GEN_VOLENVRELEASE);
     fluid_clip(x, FLUID_MIN_VOLENVRELEASE, 8000.0f);
-    count = 1 + NUM_BUFFERS_RELEASE(x);
+    count = 1 + NUM_FRAMES_RELEASE(x);
     voice->volenv_data[FLUID_VOICE_ENVRELEASE].count = count;
     voice->volenv_data[FLUID_VOICE_ENVRELEASE].coeff = 1.0f;
     voice->volenv_data[FLUID_VOICE_ENVRELEASE].incr = count ? -1.0f / count : 0.0f;
@@ -1363,7 +1842,7 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
   case GEN_MODENVDELAY:               /* SF2.01 section 8.1.3 # 25 */
     x = _GEN(voice, GEN_MODENVDELAY);
     fluid_clip(x, -12000.0f, 5000.0f);
-    voice->modenv_data[FLUID_VOICE_ENVDELAY].count = NUM_BUFFERS_DELAY(x);
+    voice->modenv_data[FLUID_VOICE_ENVDELAY].count = NUM_FRAMES_DELAY(x);
     voice->modenv_data[FLUID_VOICE_ENVDELAY].coeff = 0.0f;
     voice->modenv_data[FLUID_VOICE_ENVDELAY].incr = 0.0f;
     voice->modenv_data[FLUID_VOICE_ENVDELAY].min = -1.0f;
@@ -1373,7 +1852,7 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
   case GEN_MODENVATTACK:               /* SF2.01 section 8.1.3 # 26 */
     x = _GEN(voice, GEN_MODENVATTACK);
     fluid_clip(x, -12000.0f, 8000.0f);
-    count = 1 + NUM_BUFFERS_ATTACK(x);
+    count = 1 + NUM_FRAMES_ATTACK(x);
     voice->modenv_data[FLUID_VOICE_ENVATTACK].count = count;
     voice->modenv_data[FLUID_VOICE_ENVATTACK].coeff = 1.0f;
     voice->modenv_data[FLUID_VOICE_ENVATTACK].incr = count ? 1.0f / count : 0.0f;
@@ -1383,7 +1862,7 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
 
   case GEN_MODENVHOLD:               /* SF2.01 section 8.1.3 # 27 */
   case GEN_KEYTOMODENVHOLD:          /* SF2.01 section 8.1.3 # 31 */
-    count = calculate_hold_decay_buffers(voice, GEN_MODENVHOLD, GEN_KEYTOMODENVHOLD, 0); /* 1 means: hold */
+    count = calculate_hold_decay_frames(voice, GEN_MODENVHOLD, GEN_KEYTOMODENVHOLD, 0); /* 1 means: hold */
     voice->modenv_data[FLUID_VOICE_ENVHOLD].count = count;
     voice->modenv_data[FLUID_VOICE_ENVHOLD].coeff = 1.0f;
     voice->modenv_data[FLUID_VOICE_ENVHOLD].incr = 0.0f;
@@ -1394,7 +1873,7 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
   case GEN_MODENVDECAY:                                   /* SF 2.01 section 8.1.3 # 28 */
   case GEN_MODENVSUSTAIN:                                 /* SF 2.01 section 8.1.3 # 29 */
   case GEN_KEYTOMODENVDECAY:                              /* SF 2.01 section 8.1.3 # 32 */
-    count = calculate_hold_decay_buffers(voice, GEN_MODENVDECAY, GEN_KEYTOMODENVDECAY, 1); /* 1 for decay */
+    count = calculate_hold_decay_frames(voice, GEN_MODENVDECAY, GEN_KEYTOMODENVDECAY, 1); /* 1 for decay */
     y = 1.0f - 0.001f * _GEN(voice, GEN_MODENVSUSTAIN);
     fluid_clip(y, 0.0f, 1.0f);
     voice->modenv_data[FLUID_VOICE_ENVDECAY].count = count;
@@ -1407,7 +1886,7 @@ fluid_voice_update_param(fluid_voice_t* voice, int gen)
   case GEN_MODENVRELEASE:                                  /* SF 2.01 section 8.1.3 # 30 */
     x = _GEN(voice, GEN_MODENVRELEASE);
     fluid_clip(x, -12000.0f, 8000.0f);
-    count = 1 + NUM_BUFFERS_RELEASE(x);
+    count = 1 + NUM_FRAMES_RELEASE(x);
     voice->modenv_data[FLUID_VOICE_ENVRELEASE].count = count;
     voice->modenv_data[FLUID_VOICE_ENVRELEASE].coeff = 1.0f;
     voice->modenv_data[FLUID_VOICE_ENVRELEASE].incr = count ? -1.0f / count : 0.0;
@@ -1626,6 +2105,11 @@ fluid_voice_kill_excl(fluid_voice_t* voice){
 int
 fluid_voice_off(fluid_voice_t* voice)
 {
+  /* the synth finds a playing voice through its channel and key */
+  if (_PLAYING(voice)) {
+    fluid_synth_unlink_voice(voice->channel->synth, voice);
+  }
+
   voice->chan = NO_CHANNEL;
   voice->volenv_section = FLUID_VOICE_ENVFINISHED;
   voice->volenv_count = 0;
@@ -1633,6 +2117,11 @@ fluid_voice_off(fluid_voice_t* voice)
   voice->modenv_count = 0;
   voice->status = FLUID_VOICE_OFF;
 
+  if (voice->stream) {
+    fluid_stream_close(voice->stream);
+    voice->stream = NULL;
+  }
+
   /* Decrement the reference count of the sample. */
   if (voice->sample) {
     fluid_sample_decr_ref(voice->sample);
@@ -1644,19 +2133,9 @@ fluid_voice_off(fluid_voice_t* voice)
   return FLUID_OK;
 }
 
-/*
- * fluid_voice_add_mod
- *
- * Adds a modulator to the voice.  "mode" indicates, what to do, if
- * an identical modulator exists already.
- *
- * mode == FLUID_VOICE_ADD: Identical modulators on preset level are added
- * mode == FLUID_VOICE_OVERWRITE: Identical modulators on instrument level are overwritten
- * mode == FLUID_VOICE_DEFAULT: This is a default modulator, there can be no identical modulator.
- *                             Don't check.
- */
-void
-fluid_voice_add_mod(fluid_voice_t* voice, fluid_mod_t* mod, int mode)
+/* adds a modulator to a list of *count, see fluid_voice_add_mod() */
+static void
+fluid_voice_add_mod_to(fluid_mod_t* list, int* count, fluid_mod_t* mod, int mode)
 {
   int i;
 
@@ -1681,10 +2160,10 @@ fluid_voice_add_mod(fluid_voice_t* voice, fluid_mod_t* mod, int mode)
   if (mode == FLUID_VOICE_ADD) {
 
     /* if identical modulator exists, add them */
-    for (i = 0; i < voice->mod_count; i++) {
-      if (fluid_mod_test_identity(&voice->mod[i], mod)) {
+    for (i = 0; i < *count; i++) {
+      if (fluid_mod_test_identity(&list[i], mod)) {
 	//		printf("Adding modulator...\n");
-	voice->mod[i].amount += mod->amount;
+	list[i].amount += mod->amount;
 	return;
       }
     }
@@ -1692,10 +2171,10 @@ fluid_voice_add_mod(fluid_voice_t* voice, fluid_mod_t* mod, int mode)
   } else if (mode == FLUID_VOICE_OVERWRITE) {
 
     /* if identical modulator exists, replace it (only the amount has to be changed) */
-    for (i = 0; i < voice->mod_count; i++) {
-      if (fluid_mod_test_identity(&voice->mod[i], mod)) {
+    for (i = 0; i < *count; i++) {
+      if (fluid_mod_test_identity(&list[i], mod)) {
 	//		printf("Replacing modulator...amount is %f\n",mod->amount);
-	voice->mod[i].amount = mod->amount;
+	list[i].amount = mod->amount;
 	return;
       }
     }
@@ -1704,11 +2183,40 @@ fluid_voice_add_mod(fluid_voice_t* voice, fluid_mod_t* mod, int mode)
   /* Add a new modulator (No existing modulator to add / overwrite).
      Also, default modulators (FLUID_VOICE_DEFAULT) are added without
      checking, if the same modulator already exists. */
-  if (voice->mod_count < FLUID_NUM_MOD) {
-    fluid_mod_clone(&voice->mod[voice->mod_count++], mod);
+  if (*count < FLUID_NUM_MOD) {
+    fluid_mod_clone(&list[(*count)++], mod);
   }
 }
 
+/*
+ * fluid_voice_add_mod
+ *
+ * Adds a modulator to the voice.  "mode" indicates, what to do, if
+ * an identical modulator exists already.
+ *
+ * mode == FLUID_VOICE_ADD: Identical modulators on preset level are added
+ * mode == FLUID_VOICE_OVERWRITE: Identical modulators on instrument level are overwritten
+ * mode == FLUID_VOICE_DEFAULT: This is a default modulator, there can be no identical modulator.
+ *                             Don't check.
+ */
+void
+fluid_voice_add_mod(fluid_voice_t* voice, fluid_mod_t* mod, int mode)
+{
+  fluid_voice_add_mod_to(voice->mod, &voice->mod_count, mod, mode);
+}
+
+/*
+ * fluid_voice_template_add_mod
+ *
+ * Adds a modulator to a template like fluid_voice_add_mod() adds it to
+ * a voice. The template's modulator list holds FLUID_NUM_MOD entries.
+ */
+void
+fluid_voice_template_add_mod(fluid_voice_template_t* templ, fluid_mod_t* mod, int mode)
+{
+  fluid_voice_add_mod_to(templ->mod, &templ->mod_count, mod, mode);
+}
+
 unsigned int fluid_voice_get_id(fluid_voice_t* voice)
 {
   return voice->id;
@@ -1780,6 +2288,15 @@ fluid_real_t fluid_voice_get_lower_boundary_for_attenuation(fluid_voice_t* voice
 }
 
 
+/* The noise floor of a sample is worked out when it is paged in, which
+   may happen on another thread than the one starting a voice on it */
+#if defined(__GNUC__)
+#define fluid_sample_noise_floor_valid(s) \
+  __atomic_load_n(&(s)->amplitude_that_reaches_noise_floor_is_valid, __ATOMIC_ACQUIRE)
+#else
+#define fluid_sample_noise_floor_valid(s) ((s)->amplitude_that_reaches_noise_floor_is_valid)
+#endif
+
 /* Purpose:
  *
  * Make sure, that sample start / end point and loop points are in
@@ -1867,7 +2384,7 @@ void fluid_voice_check_sample_sanity(fluid_voice_t* voice)
       if ((int)voice->loopstart >= (int)voice->sample->loopstart
 	  && (int)voice->loopend <= (int)voice->sample->loopend){
 	/* Is there a valid peak amplitude available for the loop? */
-	if (voice->sample->amplitude_that_reaches_noise_floor_is_valid){
+	if (fluid_sample_noise_floor_valid(voice->sample)){
 	  voice->amplitude_that_reaches_noise_floor_loop=voice->sample->amplitude_that_reaches_noise_floor / voice->synth_gain;
 	} else {
 	  /* Worst case */
@@ -1965,7 +2482,7 @@ int fluid_voice_optimize_sample(fluid_sample_t* s)
   if (!s->valid || (s->sampletype & FLUID_SAMPLETYPE_OGG_VORBIS))
     return (FLUID_OK);
 
-  if (!s->amplitude_that_reaches_noise_floor_is_valid){ /* Only once */
+  if (!fluid_sample_noise_floor_valid(s)){ /* Only once */
     /* Scan the loop */
     for (i = (int)s->loopstart; i < (int) s->loopend; i ++){
       signed short val = s->data[i];
@@ -2000,7 +2517,12 @@ int fluid_voice_optimize_sample(fluid_sample_t* s)
 
     /* Store in sample */
     s->amplitude_that_reaches_noise_floor = (double)result;
+#if defined(__GNUC__)
+    __atomic_store_n(&s->amplitude_that_reaches_noise_floor_is_valid, 1,
+		     __ATOMIC_RELEASE);
+#else
     s->amplitude_that_reaches_noise_floor_is_valid = 1;
+#endif
 #if 0
     printf("Sample peak detection: factor %f\n", (double)result);
 #endif
@@ -25,6 +25,7 @@
 #include "fluid_phase.h"
 #include "fluid_gen.h"
 #include "fluid_mod.h"
+#include "fluid_stream.h"
 
 #define NO_CHANNEL             0xff
 
@@ -41,7 +42,7 @@ enum fluid_voice_status
  * envelope data
  */
 struct _fluid_env_data_t {
-	unsigned int count;
+	unsigned int count;             /* length of the section in output frames */
 	fluid_real_t coeff;
 	fluid_real_t incr;
 	fluid_real_t min;
@@ -60,6 +61,40 @@ enum fluid_voice_envelope_index_t{
 	FLUID_VOICE_ENVLAST
 };
 
+/*
+ * fluid_voice_template_t
+ *
+ * The generators and modulators a voice of a zone starts with, merged
+ * from the preset and instrument zones ahead of the note-on: the values
+ * of the generators the zones set, which replace the defaults, and the
+ * complete modulator list, default modulators included.
+ */
+struct _fluid_voice_template_t
+{
+	int gen_count;
+	unsigned char* gen;             /* generator numbers */
+	double* val;                    /* and their values */
+	int mod_count;
+	fluid_mod_t* mod;
+};
+
+void fluid_voice_template_add_mod(fluid_voice_template_t* templ, fluid_mod_t* mod, int mode);
+
+/* the lists a playing voice is linked into */
+enum fluid_voice_list
+{
+	FLUID_VOICE_LIST_CHAN,          /* all voices of a channel */
+	FLUID_VOICE_LIST_KEY,           /* voices of a channel on one key */
+	FLUID_VOICE_LIST_EXCL,          /* voices of a channel in one exclusive class */
+	FLUID_VOICE_LISTS
+};
+
+typedef struct _fluid_voice_link_t
+{
+	fluid_voice_t* prev;
+	fluid_voice_t* next;
+} fluid_voice_link_t;
+
 /*
  * fluid_voice_t
  */
@@ -72,11 +107,10 @@ struct _fluid_voice_t
 	unsigned char key;              /* the key, quick acces for noteoff */
 	unsigned char vel;              /* the velocity */
 	fluid_channel_t* channel;
-	fluid_gen_t gen[GEN_LAST];
-	fluid_mod_t mod[FLUID_NUM_MOD];
 	int mod_count;
 	int has_looped;                 /* Flag that is set as soon as the first loop is completed. */
 	fluid_sample_t* sample;
+	fluid_stream_slot_t* stream;    /* ring the body of a streamed sample arrives in */
 	int check_sample_sanity_flag;   /* Flag that initiates, that sample-related parameters
 					   have to be checked. */
 #if 0
@@ -104,9 +138,11 @@ struct _fluid_voice_t
 
 	/* basic parameters */
 	fluid_real_t output_rate;        /* the sample rate of the synthesizer */
+	int block_size;                  /* the frames in a block of the synthesizer */
 
 	unsigned int start_time;
 	unsigned int ticks;
+	int start_offset;                /* silent points before the block starts to sound */
     unsigned int noteoff_ticks;      /* Delay note-off until this tick */
 
 	fluid_real_t amp;                /* current linear amplitude */
@@ -117,6 +153,7 @@ struct _fluid_voice_t
 	fluid_real_t phase_incr;	/* the phase increment for the next 64 samples */
 	fluid_real_t amp_incr;		/* amplitude increment value */
 	fluid_real_t *dsp_buf;		/* buffer to store interpolated sample data to */
+	short int *dsp_data;		/* sample data to interpolate, normally sample->data */
 
 	/* End temporary variables */
 
@@ -191,6 +228,12 @@ struct _fluid_voice_t
 	fluid_real_t a1_incr;
 	fluid_real_t a2_incr;
 	int filter_coeff_incr_count;
+	int filter_bypass;              /* Flag: the filter is wide open without resonance and
+					   only its gain is applied */
+#ifdef WITH_PROFILING
+	int prof_filter_update;         /* the coefficients were recalculated for this block */
+	unsigned int prof_ns;           /* time spent rendering this block */
+#endif
 
 	/* pan */
 	fluid_real_t pan;
@@ -210,21 +253,70 @@ struct _fluid_voice_t
 
 	/* for debugging */
 	int debug;
+
+	/* Everything from here on is mostly used on note-on, note-off and
+	   controller changes; rendering reads only the sample mode and the
+	   filter Q from the generators. The generators and modulators are
+	   not in the voice at all but in arrays of the voice pool. */
+	fluid_gen_t* gen;               /* GEN_LAST generators */
+	fluid_mod_t* mod;               /* FLUID_NUM_MOD modulators */
+
+	/* the synth's indices of its playing voices, see fluid_synth_link_voice() */
+	int index;                      /* position in the synth's voice table */
+	fluid_voice_link_t link[FLUID_VOICE_LISTS];
+	int excl_class;                 /* exclusive class the voice was linked under, 0 if none */
+	int heap_index;                 /* position in the steal heap, -1 if not in it */
+	double steal_prio;
 };
 
+/* voices start on boundaries of this many bytes */
+#define FLUID_VOICE_ALIGN 64
+
+/*
+ * fluid_voice_pool_t
+ *
+ * The voices of a synth. The voice structs follow each other in one
+ * block of memory, each on a FLUID_VOICE_ALIGN boundary, instead of
+ * one allocation each. Generators and modulators are kept in separate
+ * arrays, which brings a voice down from several kilobytes to about
+ * one. Rendering times did not change measurably with the split; what
+ * it does to cache misses has not been measured.
+ */
+typedef struct _fluid_voice_pool_t
+{
+	int count;
+	size_t stride;                  /* bytes from one voice to the next */
+	char* mem;                      /* as allocated */
+	char* voices;                   /* the first voice, aligned */
+	fluid_gen_t* gen;
+	fluid_mod_t* mod;
+} fluid_voice_pool_t;
+
+fluid_voice_pool_t* new_fluid_voice_pool(int count, fluid_real_t output_rate, int block_size);
+void delete_fluid_voice_pool(fluid_voice_pool_t* pool);
+/* puts all voices back into the state they were allocated in */
+void fluid_voice_pool_reset(fluid_voice_pool_t* pool, fluid_real_t output_rate, int block_size);
+
+#define fluid_voice_pool_get(_pool, _i) \
+  ((fluid_voice_t*) ((_pool)->voices + (size_t) (_i) * (_pool)->stride))
 
-fluid_voice_t* new_fluid_voice(fluid_real_t output_rate);
-int delete_fluid_voice(fluid_voice_t* voice);
 
 void fluid_voice_start(fluid_voice_t* voice);
 
 int fluid_voice_write(fluid_voice_t* voice,
 		      fluid_real_t* left, fluid_real_t* right,
 		      fluid_real_t* reverb_buf, fluid_real_t* chorus_buf);
+int fluid_voice_prepare(fluid_voice_t* voice);
+int fluid_voice_render(fluid_voice_t* voice, fluid_real_t* dsp_buf);
+void fluid_voice_finish(fluid_voice_t* voice, int count, int filtered,
+			fluid_real_t* left, fluid_real_t* right,
+			fluid_real_t* reverb_buf, fluid_real_t* chorus_buf);
+int fluid_voice_filter_lane(fluid_voice_t* voice, int count);
 
 int fluid_voice_init(fluid_voice_t* voice, fluid_sample_t* sample,
 		     fluid_channel_t* channel, int key, int vel,
-		     unsigned int id, unsigned int time, fluid_real_t gain);
+		     unsigned int id, unsigned int time, fluid_real_t gain,
+		     const fluid_voice_template_t* templ);
 
 int fluid_voice_modulate(fluid_voice_t* voice, int cc, int ctrl);
 int fluid_voice_modulate_all(fluid_voice_t* voice);
@@ -247,7 +339,7 @@ int fluid_voice_noteoff(fluid_voice_t* voice);
 int fluid_voice_off(fluid_voice_t* voice);
 int fluid_voice_calculate_runtime_synthesis_parameters(fluid_voice_t* voice);
 fluid_channel_t* fluid_voice_get_channel(fluid_voice_t* voice);
-int calculate_hold_decay_buffers(fluid_voice_t* voice, int gen_base,
+int calculate_hold_decay_frames(fluid_voice_t* voice, int gen_base,
 				 int gen_key2base, int is_decay);
 int fluid_voice_kill_excl(fluid_voice_t* voice);
 fluid_real_t fluid_voice_get_lower_boundary_for_attenuation(fluid_voice_t* voice);
@@ -289,4 +381,13 @@ int fluid_dsp_float_interpolate_linear (fluid_voice_t *voice);
 int fluid_dsp_float_interpolate_4th_order (fluid_voice_t *voice);
 int fluid_dsp_float_interpolate_7th_order (fluid_voice_t *voice);
 
+/* the most voices fluid_dsp_float_filter() filters at once */
+#define FLUID_FILTER_LANES 4
+int fluid_dsp_float_filter_lanes (void);
+int fluid_dsp_float_filter (fluid_voice_t **voices, int *count, int n);
+
+/* n frames of left and right as interleaved, clamped 16 bit points */
+void fluid_dsp_float_write_s16 (const fluid_real_t *left, const fluid_real_t *right,
+				short int *out, int n);
+
 #endif /* _FLUID_VOICE_H */
@@ -0,0 +1,580 @@
+/* FluidSynth - A Software Synthesizer
+ *
+ * Copyright (C) 2003  Peter Hanappe and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307, USA
+ */
+
+/*
+ * Parallel voice rendering
+ *
+ * A synth with synth.cpu-cores above 1 hands voices to worker threads of
+ * one pool that all synths of the process share, each worker pinned to a
+ * core of its own from the second one on. The pool has as many workers as
+ * the synth asking for the most cores needs, and lives as long as a synth
+ * uses it. The voices ready for a block are cut into one contiguous
+ * share per core, using no more cores than give every share
+ * FLUID_WORKERS_MIN_VOICES; a quiet block is rendered by the audio thread
+ * alone, as without workers. The audio thread renders the first share
+ * into the synth's buffers; the other shares are rendered into buffers of
+ * their own by whichever worker takes them first. A share that no worker
+ * has taken by the time the audio thread is done with its own is rendered
+ * by the audio thread instead, so a worker that sleeps or was preempted
+ * costs time but never the block. The shares are then added to the
+ * synth's buffers in order, which makes the output the same whichever
+ * thread rendered what.
+ *
+ * A share is handed over through its state word alone: the audio thread
+ * publishes it as READY, whoever takes it moves it to TAKEN, and the
+ * renderer marks it DONE. The share slots belong to the pool and are
+ * never freed while it lives, so a worker may look at any of them. A
+ * worker spins for FLUID_WORKERS_SPIN_US after its last share, a small
+ * part of a block, and then parks on the pool's job counter, which the
+ * audio thread bumps and wakes it through with every hand-out.
+ *
+ * The audio thread waits for shares that workers have taken, so the
+ * workers run with the scheduling of the highest priority audio thread
+ * that uses them; a worker the system preempts for anything the audio
+ * thread would not be preempted for is a worker the audio thread waits
+ * on. Until every worker has taken on the scheduling of the audio thread
+ * at hand, its synth renders on that thread alone, which is also what
+ * happens for good when the workers are not allowed to raise their
+ * priority.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* sched_setaffinity */
+#endif
+
+#include "fluid_workers.h"
+#include "fluid_synth.h"
+
+#if FLUID_WORKERS_SUPPORT
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define FLUID_WORKERS_SPIN_US 100
+#define FLUID_WORKERS_IDLE_NS 100000
+
+/* shares handed out at once, over all synths of the process */
+#define FLUID_WORKERS_SLOTS 64
+
+enum {
+  FLUID_SHARE_IDLE = 0,
+  FLUID_SHARE_READY,
+  FLUID_SHARE_TAKEN,
+  FLUID_SHARE_DONE
+};
+
+typedef struct _fluid_share_t {
+  int state;
+  fluid_synth_t* synth;       /* the synth the slot is in use by, NULL if free */
+  int first;                  /* the voices synth->ready[first, first + count) */
+  int count;
+  fluid_real_t** left_buf;    /* one per audio buffer of the synth */
+  fluid_real_t** right_buf;
+  fluid_real_t* reverb_buf;   /* NULL without the send */
+  fluid_real_t* chorus_buf;
+  fluid_real_t* reverb_mem;
+  fluid_real_t* chorus_mem;
+} fluid_share_t;
+
+/* The workers of the process; the members up to slots are changed under
+   fluid_pool_lock, count also read without it by the audio threads */
+typedef struct _fluid_pool_t {
+  int users;                  /* synths with workers */
+  int count;                  /* worker threads started */
+  pthread_t thread[FLUID_WORKERS_MAX];
+  int slots;                  /* slots ever used, the ones workers look at */
+  int quit;
+  int jobs;                   /* bumped on every hand-out, parked workers wait on it */
+  int parked;                 /* workers parked or about to park */
+  int sched;                  /* the scheduling the workers are to take on */
+  int worker_sched[FLUID_WORKERS_MAX];   /* the one each has, -1 before it runs */
+  fluid_share_t share[FLUID_WORKERS_SLOTS];
+} fluid_pool_t;
+
+struct _fluid_workers_t {
+  fluid_synth_t* synth;
+  int cores;
+  fluid_share_t* share[FLUID_WORKERS_MAX];   /* share 0 is the audio thread's */
+};
+
+static pthread_mutex_t fluid_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static fluid_pool_t fluid_pool;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define fluid_workers_pause() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define fluid_workers_pause() __asm__ __volatile__ ("yield")
+#else
+#define fluid_workers_pause()
+#endif
+
+static double fluid_workers_now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+/* sleeps until the job counter moves on from seen */
+static void fluid_pool_park(int seen)
+{
+#if defined(__linux__)
+  syscall(SYS_futex, &fluid_pool.jobs, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#else
+  struct timespec idle = { 0, FLUID_WORKERS_IDLE_NS };
+  (void) seen;
+  nanosleep(&idle, NULL);
+#endif
+}
+
+/* tells the workers there is work; wakes them only when some are parked */
+static void fluid_pool_wake(void)
+{
+  __atomic_fetch_add(&fluid_pool.jobs, 1, __ATOMIC_SEQ_CST);
+#if defined(__linux__)
+  if (__atomic_load_n(&fluid_pool.parked, __ATOMIC_SEQ_CST) > 0) {
+    syscall(SYS_futex, &fluid_pool.jobs, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  }
+#endif
+}
+
+/* a scheduling policy and priority as one number that orders them by
+   priority, SCHED_OTHER and the like at 0 */
+static int fluid_pool_sched_of(pthread_t thread)
+{
+  struct sched_param param;
+  int policy;
+
+  if ((pthread_getschedparam(thread, &policy, &param) != 0)
+      || ((policy != SCHED_FIFO) && (policy != SCHED_RR))) {
+    return 0;
+  }
+  return (param.sched_priority << 8) | policy;
+}
+
+/* makes the calling worker run with the scheduling sched; returns the one it has */
+static int fluid_pool_set_sched(int sched)
+{
+  static int warned;
+  struct sched_param param;
+  int policy = (sched == 0) ? SCHED_OTHER : (sched & 0xff);
+
+  param.sched_priority = sched >> 8;
+  if (pthread_setschedparam(pthread_self(), policy, &param) == 0) {
+    return sched;
+  }
+  if (!__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+    FLUID_LOG(FLUID_WARN, "Render threads may not run at the audio thread's priority; "
+	      "rendering on one core");
+  }
+  return fluid_pool_sched_of(pthread_self());
+}
+
+/* whether every worker runs at the priority of the calling thread or
+   above, asking them to take it on if not */
+static int fluid_pool_sched_ready(void)
+{
+  int sched = fluid_pool_sched_of(pthread_self());
+  int want = __atomic_load_n(&fluid_pool.sched, __ATOMIC_ACQUIRE);
+  int count = __atomic_load_n(&fluid_pool.count, __ATOMIC_ACQUIRE);
+  int k;
+
+  /* a higher priority is never given up for a lower one, so that the
+     workers suit every audio thread of the process */
+  while (sched > want) {
+    if (__atomic_compare_exchange_n(&fluid_pool.sched, &want, sched, 0,
+				    __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+      fluid_pool_wake();
+      return 0;
+    }
+  }
+  for (k = 0; k < count; k++) {
+    if (__atomic_load_n(&fluid_pool.worker_sched[k], __ATOMIC_ACQUIRE) < sched) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void fluid_workers_add(fluid_real_t* out, const fluid_real_t* in, int count)
+{
+  int i;
+
+  for (i = 0; i < count; i++) {
+    out[i] += in[i];
+  }
+}
+
+/* renders a share other than the first into its own buffers */
+static void fluid_workers_render(fluid_share_t* share)
+{
+  fluid_synth_t* synth = share->synth;
+  int byte_size = synth->block_size * sizeof(fluid_real_t);
+  int i;
+
+  for (i = 0; i < synth->nbuf; i++) {
+    FLUID_MEMSET(share->left_buf[i], 0, byte_size);
+    FLUID_MEMSET(share->right_buf[i], 0, byte_size);
+  }
+  if (share->reverb_buf != NULL) FLUID_MEMSET(share->reverb_buf, 0, byte_size);
+  if (share->chorus_buf != NULL) FLUID_MEMSET(share->chorus_buf, 0, byte_size);
+
+  fluid_synth_write_voices(synth, synth->ready + share->first, synth->ready_count + share->first,
+			   share->count, share->left_buf, share->right_buf,
+			   share->reverb_buf, share->chorus_buf);
+}
+
+/* takes and renders a share that is ready, of any synth; 1 if it did */
+static int fluid_pool_take(void)
+{
+  int slots = __atomic_load_n(&fluid_pool.slots, __ATOMIC_ACQUIRE);
+  fluid_share_t* share;
+  int expected;
+  int i;
+
+  for (i = 0; i < slots; i++) {
+    share = &fluid_pool.share[i];
+    expected = FLUID_SHARE_READY;
+    if ((__atomic_load_n(&share->state, __ATOMIC_RELAXED) == FLUID_SHARE_READY)
+	&& __atomic_compare_exchange_n(&share->state, &expected, FLUID_SHARE_TAKEN, 0,
+				       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      fluid_workers_render(share);
+      __atomic_store_n(&share->state, FLUID_SHARE_DONE, __ATOMIC_RELEASE);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void* fluid_pool_run(void* data)
+{
+  int k = (int) (intptr_t) data;
+  double last = fluid_workers_now_us();
+  int tried = -1;
+  int seen;
+  int want;
+
+#if defined(__linux__)
+  {
+    /* best effort; an unpinned worker still works */
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(k + 1, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+  }
+#endif
+
+  while (!__atomic_load_n(&fluid_pool.quit, __ATOMIC_ACQUIRE)) {
+    seen = __atomic_load_n(&fluid_pool.jobs, __ATOMIC_SEQ_CST);
+    want = __atomic_load_n(&fluid_pool.sched, __ATOMIC_ACQUIRE);
+    if (want != tried) {
+      tried = want;
+      __atomic_store_n(&fluid_pool.worker_sched[k], fluid_pool_set_sched(want), __ATOMIC_RELEASE);
+    }
+    if (fluid_pool_take()) {
+      last = fluid_workers_now_us();
+    } else if (fluid_workers_now_us() - last < FLUID_WORKERS_SPIN_US) {
+      fluid_workers_pause();
+    } else {
+      /* the audio thread checks parked after bumping jobs, and we check
+	 jobs after raising parked: one of the two sees the other */
+      __atomic_fetch_add(&fluid_pool.parked, 1, __ATOMIC_SEQ_CST);
+      if ((__atomic_load_n(&fluid_pool.jobs, __ATOMIC_SEQ_CST) == seen)
+	  && !__atomic_load_n(&fluid_pool.quit, __ATOMIC_ACQUIRE)) {
+	fluid_pool_park(seen);
+      }
+      __atomic_fetch_sub(&fluid_pool.parked, 1, __ATOMIC_SEQ_CST);
+      last = fluid_workers_now_us();
+    }
+  }
+  return NULL;
+}
+
+/* stops the workers; caller holds fluid_pool_lock */
+static void fluid_pool_stop(void)
+{
+  int k;
+
+  __atomic_store_n(&fluid_pool.quit, 1, __ATOMIC_RELEASE);
+  fluid_pool_wake();
+  for (k = 0; k < fluid_pool.count; k++) {
+    pthread_join(fluid_pool.thread[k], NULL);
+  }
+  __atomic_store_n(&fluid_pool.count, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&fluid_pool.sched, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&fluid_pool.quit, 0, __ATOMIC_RELAXED);
+}
+
+/* starts workers until there are count of them; caller holds fluid_pool_lock */
+static int fluid_pool_start(int count)
+{
+  while (fluid_pool.count < count) {
+    /* worker k on core k + 1; the audio thread is left wherever the host put it */
+    fluid_pool.worker_sched[fluid_pool.count] = -1;
+    if (pthread_create(&fluid_pool.thread[fluid_pool.count], NULL, fluid_pool_run,
+		       (void*) (intptr_t) fluid_pool.count) != 0) {
+      FLUID_LOG(FLUID_ERR, "Failed to start a render thread");
+      return FLUID_FAILED;
+    }
+    __atomic_store_n(&fluid_pool.count, fluid_pool.count + 1, __ATOMIC_RELEASE);
+  }
+  return FLUID_OK;
+}
+
+/* frees the buffers of a slot and gives it back; caller holds fluid_pool_lock */
+static void fluid_pool_release_share(fluid_share_t* share)
+{
+  fluid_synth_t* synth = share->synth;
+  int i;
+
+  if (synth == NULL) {
+    return;
+  }
+  for (i = 0; i < synth->nbuf; i++) {
+    if ((share->left_buf != NULL) && (share->left_buf[i] != NULL)) FLUID_FREE(share->left_buf[i]);
+    if ((share->right_buf != NULL) && (share->right_buf[i] != NULL)) FLUID_FREE(share->right_buf[i]);
+  }
+  if (share->left_buf != NULL) FLUID_FREE(share->left_buf);
+  if (share->right_buf != NULL) FLUID_FREE(share->right_buf);
+  if (share->reverb_mem != NULL) FLUID_FREE(share->reverb_mem);
+  if (share->chorus_mem != NULL) FLUID_FREE(share->chorus_mem);
+  FLUID_MEMSET(share, 0, sizeof(fluid_share_t));
+}
+
+/* takes a free slot for a synth, with buffers for it; caller holds fluid_pool_lock */
+static fluid_share_t* fluid_pool_new_share(fluid_synth_t* synth)
+{
+  fluid_share_t* share = NULL;
+  int i;
+
+  for (i = 0; i < FLUID_WORKERS_SLOTS; i++) {
+    if (fluid_pool.share[i].synth == NULL) {
+      share = &fluid_pool.share[i];
+      break;
+    }
+  }
+  if (share == NULL) {
+    FLUID_LOG(FLUID_WARN, "Too many synths rendering on several cores");
+    return NULL;
+  }
+
+  share->synth = synth;
+  share->left_buf = FLUID_ARRAY(fluid_real_t*, synth->nbuf);
+  share->right_buf = FLUID_ARRAY(fluid_real_t*, synth->nbuf);
+  if ((share->left_buf == NULL) || (share->right_buf == NULL)) {
+    goto error_recovery;
+  }
+  FLUID_MEMSET(share->left_buf, 0, synth->nbuf * sizeof(fluid_real_t*));
+  FLUID_MEMSET(share->right_buf, 0, synth->nbuf * sizeof(fluid_real_t*));
+  for (i = 0; i < synth->nbuf; i++) {
+    share->left_buf[i] = FLUID_ARRAY(fluid_real_t, synth->block_size);
+    share->right_buf[i] = FLUID_ARRAY(fluid_real_t, synth->block_size);
+    if ((share->left_buf[i] == NULL) || (share->right_buf[i] == NULL)) {
+      goto error_recovery;
+    }
+  }
+  share->reverb_mem = FLUID_ARRAY(fluid_real_t, synth->block_size);
+  share->chorus_mem = FLUID_ARRAY(fluid_real_t, synth->block_size);
+  if ((share->reverb_mem == NULL) || (share->chorus_mem == NULL)) {
+    goto error_recovery;
+  }
+
+  if (share - fluid_pool.share >= fluid_pool.slots) {
+    __atomic_store_n(&fluid_pool.slots, (int) (share - fluid_pool.share) + 1, __ATOMIC_RELEASE);
+  }
+  return share;
+
+ error_recovery:
+  FLUID_LOG(FLUID_ERR, "Out of memory");
+  fluid_pool_release_share(share);
+  return NULL;
+}
+
+/*
+ * new_fluid_workers
+ */
+fluid_workers_t* new_fluid_workers(fluid_synth_t* synth, int cores)
+{
+  fluid_workers_t* workers;
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  int k;
+
+  /* no more threads than cores to run them on */
+  if ((online > 0) && (cores > online)) {
+    cores = (int) online;
+  }
+  if (cores > FLUID_WORKERS_MAX) {
+    cores = FLUID_WORKERS_MAX;
+  }
+  if (cores < 2) {
+    return NULL;
+  }
+
+  workers = FLUID_NEW(fluid_workers_t);
+  if (workers == NULL) {
+    FLUID_LOG(FLUID_ERR, "Out of memory");
+    return NULL;
+  }
+  FLUID_MEMSET(workers, 0, sizeof(fluid_workers_t));
+  workers->synth = synth;
+  workers->cores = cores;
+
+  pthread_mutex_lock(&fluid_pool_lock);
+  fluid_pool.users++;
+  for (k = 1; k < cores; k++) {
+    workers->share[k] = fluid_pool_new_share(synth);
+    if (workers->share[k] == NULL) {
+      goto error_recovery;
+    }
+  }
+  if (fluid_pool_start(cores - 1) != FLUID_OK) {
+    goto error_recovery;
+  }
+  pthread_mutex_unlock(&fluid_pool_lock);
+  return workers;
+
+ error_recovery:
+  pthread_mutex_unlock(&fluid_pool_lock);
+  delete_fluid_workers(workers);
+  return NULL;
+}
+
+/*
+ * delete_fluid_workers
+ */
+void delete_fluid_workers(fluid_workers_t* workers)
+{
+  int k;
+
+  if (workers == NULL) {
+    return;
+  }
+
+  /* the synth is not rendering, so none of its shares is handed out */
+  pthread_mutex_lock(&fluid_pool_lock);
+  for (k = 1; k < workers->cores; k++) {
+    if (workers->share[k] != NULL) {
+      fluid_pool_release_share(workers->share[k]);
+    }
+  }
+  if (--fluid_pool.users == 0) {
+    fluid_pool_stop();
+  }
+  pthread_mutex_unlock(&fluid_pool_lock);
+  FLUID_FREE(workers);
+}
+
+/*
+ * fluid_workers_write
+ */
+int fluid_workers_write(fluid_workers_t* workers, int n,
+			fluid_real_t* reverb_buf, fluid_real_t* chorus_buf)
+{
+  fluid_synth_t* synth = workers->synth;
+  fluid_share_t* share;
+  int cores = n / FLUID_WORKERS_MIN_VOICES;
+  double start;
+  int expected;
+  int i, k;
+
+  if (cores > workers->cores) {
+    cores = workers->cores;
+  }
+  if ((cores < 2) || !fluid_pool_sched_ready()) {
+    return 0;
+  }
+
+  /* hand out shares 1 and up */
+  for (k = 1; k < cores; k++) {
+    share = workers->share[k];
+    share->first = k * n / cores;
+    share->count = (k + 1) * n / cores - share->first;
+    share->reverb_buf = (reverb_buf != NULL) ? share->reverb_mem : NULL;
+    share->chorus_buf = (chorus_buf != NULL) ? share->chorus_mem : NULL;
+    __atomic_store_n(&share->state, FLUID_SHARE_READY, __ATOMIC_RELEASE);
+  }
+  fluid_pool_wake();
+
+  fluid_synth_write_voices(synth, synth->ready, synth->ready_count, n / cores,
+			   synth->left_buf, synth->right_buf, reverb_buf, chorus_buf);
+
+  /* take over the shares no worker took */
+  for (k = 1; k < cores; k++) {
+    share = workers->share[k];
+    expected = FLUID_SHARE_READY;
+    if (__atomic_compare_exchange_n(&share->state, &expected, FLUID_SHARE_TAKEN, 0,
+				    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      fluid_workers_render(share);
+      __atomic_store_n(&share->state, FLUID_SHARE_DONE, __ATOMIC_RELAXED);
+    }
+  }
+
+  /* add up the shares in order; a worker that takes longer than a spin
+     was interrupted by something of our priority, which we yield to */
+  for (k = 1; k < cores; k++) {
+    share = workers->share[k];
+    start = fluid_workers_now_us();
+    while (__atomic_load_n(&share->state, __ATOMIC_ACQUIRE) != FLUID_SHARE_DONE) {
+      if (fluid_workers_now_us() - start < FLUID_WORKERS_SPIN_US) {
+	fluid_workers_pause();
+      } else {
+	sched_yield();
+      }
+    }
+    __atomic_store_n(&share->state, FLUID_SHARE_IDLE, __ATOMIC_RELAXED);
+
+    for (i = 0; i < synth->nbuf; i++) {
+      fluid_workers_add(synth->left_buf[i], share->left_buf[i], synth->block_size);
+      fluid_workers_add(synth->right_buf[i], share->right_buf[i], synth->block_size);
+    }
+    if (reverb_buf != NULL) fluid_workers_add(reverb_buf, share->reverb_buf, synth->block_size);
+    if (chorus_buf != NULL) fluid_workers_add(chorus_buf, share->chorus_buf, synth->block_size);
+  }
+  return 1;
+}
+
+#else /* FLUID_WORKERS_SUPPORT */
+
+fluid_workers_t* new_fluid_workers(fluid_synth_t* synth, int cores)
+{
+  if (cores > 1) {
+    FLUID_LOG(FLUID_WARN, "Rendering on more than one core is not supported on this platform");
+  }
+  return NULL;
+}
+
+void delete_fluid_workers(fluid_workers_t* workers)
+{
+}
+
+int fluid_workers_write(fluid_workers_t* workers, int n,
+			fluid_real_t* reverb_buf, fluid_real_t* chorus_buf)
+{
+  return 0;
+}
+
+#endif /* FLUID_WORKERS_SUPPORT */
@@ -0,0 +1,49 @@
+/* FluidSynth - A Software Synthesizer
+ *
+ * Copyright (C) 2003  Peter Hanappe and others.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307, USA
+ */
+
+#ifndef _FLUID_WORKERS_H
+#define _FLUID_WORKERS_H
+
+#include "fluidsynth_priv.h"
+
+/* rendering voices on other cores needs threads */
+#define FLUID_WORKERS_SUPPORT (HAVE_PTHREAD_H && HAVE_UNISTD_H)
+
+/* most cores a synth renders on */
+#define FLUID_WORKERS_MAX 16
+
+/* fewest voices per core that are worth handing over to a worker */
+#define FLUID_WORKERS_MIN_VOICES 16
+
+typedef struct _fluid_workers_t fluid_workers_t;
+
+/* Lets a synth render on cores cores, starting workers of the process
+   wide pool as needed, or returns NULL if cores is 1 or the workers could
+   not be started. */
+fluid_workers_t* new_fluid_workers(fluid_synth_t* synth, int cores);
+void delete_fluid_workers(fluid_workers_t* workers);
+
+/* Renders the n voices in synth->ready on the workers and the calling
+   thread. Returns 0, having rendered nothing, when n is too small for
+   more than one core. */
+int fluid_workers_write(fluid_workers_t* workers, int n,
+			fluid_real_t* reverb_buf, fluid_real_t* chorus_buf);
+
+#endif /* _FLUID_WORKERS_H */
@@ -52,6 +52,14 @@
 #include <limits.h>
 #endif
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
 
 #include "fluidlite.h"
 
@@ -158,13 +166,17 @@ typedef struct _fluid_channel_t fluid_channel_t;
 typedef struct _fluid_tuning_t fluid_tuning_t;
 typedef struct _fluid_hashtable_t  fluid_hashtable_t;
 typedef struct _fluid_client_t fluid_client_t;
+typedef struct _fluid_voice_template_t fluid_voice_template_t;
 
 /***************************************************************
  *
  *                      CONSTANTS
  */
 
+/* the default number of frames the synth renders per block, and the
+   most synth.block-size may ask for */
 #define FLUID_BUFSIZE                64
+#define FLUID_MAX_BUFSIZE            256
 
 #ifndef PI
 #define PI                          3.141592654
@@ -187,6 +199,7 @@ typedef FILE*  fluid_file;
 #define FLUID_FSEEK(_f,_n,_set)      fseek(_f,_n,_set)
 #define FLUID_FTELL(_f)              ftell(_f)
 #define FLUID_MEMCPY(_dst,_src,_n)   memcpy(_dst,_src,_n)
+#define FLUID_MEMMOVE(_dst,_src,_n)  memmove(_dst,_src,_n)
 #define FLUID_MEMSET(_s,_c,_n)       memset(_s,_c,_n)
 #define FLUID_STRLEN(_s)             strlen(_s)
 #define FLUID_STRCMP(_s,_t)          strcmp(_s,_t)
@@ -0,0 +1,492 @@
+/*
+ * Headless host for the SF2 plugin
+ *
+ * Stands in for the Move host off the device: implements host_api_v1_t
+ * (logging, a dummy mapped_memory, MIDI send stubs), loads dsp.so with
+ * dlopen and drives one instance through create_instance, on_midi and
+ * render_block, from a Standard MIDI File or from a synthetic stress
+ * pattern: dense chords on several channels, the sustain pedal, CC
+ * sweeps and pitch bends. Reports the real-time factor, percentiles of
+ * the time per block and peak RSS, and the plugin's own perf_stats.
+ *
+ * Built natively or for ARM by scripts/build_host.sh:
+ *
+ *   ./scripts/build_host.sh
+ *   ./build/host/host_bench build/host/dsp.so <module dir> --stress 30
+ *   ./build/host/host_bench build/host/dsp.so <module dir> --midi song.mid
+ *
+ * The module dir needs a soundfonts/ folder with at least one .sf2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define MOVE_PLUGIN_API_VERSION_2 2
+#define SAMPLE_RATE 44100
+#define FRAMES 128
+#define MAPPED_MEMORY_SIZE 4096
+
+typedef struct host_api_v1 {
+    uint32_t api_version;
+    int sample_rate;
+    int frames_per_block;
+    uint8_t *mapped_memory;
+    int audio_out_offset;
+    int audio_in_offset;
+    void (*log)(const char *msg);
+    int (*midi_send_internal)(const uint8_t *msg, int len);
+    int (*midi_send_external)(const uint8_t *msg, int len);
+} host_api_v1_t;
+
+typedef struct plugin_api_v2 {
+    uint32_t api_version;
+    void* (*create_instance)(const char *module_dir, const char *json_defaults);
+    void (*destroy_instance)(void *instance);
+    void (*on_midi)(void *instance, const uint8_t *msg, int len, int source);
+    void (*set_param)(void *instance, const char *key, const char *val);
+    int (*get_param)(void *instance, const char *key, char *buf, int buf_len);
+    int (*get_error)(void *instance, char *buf, int buf_len);
+    void (*render_block)(void *instance, int16_t *out_interleaved_lr, int frames);
+} plugin_api_v2_t;
+
+/* A MIDI message and the frame it is due at */
+typedef struct {
+    long frame;
+    uint8_t msg[3];
+    uint8_t len;
+} event_t;
+
+typedef struct {
+    event_t *events;
+    int count;
+    int size;
+} event_list_t;
+
+static int verbose;
+static long midi_sent;
+
+/* ------------------------------------------------------------------ */
+/* Host side                                                          */
+/* ------------------------------------------------------------------ */
+
+static void host_log(const char *msg) {
+    if (verbose) fprintf(stderr, "%s\n", msg);
+}
+
+static int host_midi_send(const uint8_t *msg, int len) {
+    (void)msg;
+    midi_sent++;
+    return len;
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void sleep_until_us(double t) {
+    double left = t - now_us();
+    if (left > 0) {
+        struct timespec ts = { (time_t)(left / 1e6), (long)((left - (time_t)(left / 1e6) * 1e6) * 1e3) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Events                                                             */
+/* ------------------------------------------------------------------ */
+
+static int add_event(event_list_t *list, long frame, uint8_t status, uint8_t d1, uint8_t d2, int len) {
+    if (list->count == list->size) {
+        int size = list->size ? list->size * 2 : 4096;
+        event_t *events = realloc(list->events, size * sizeof(event_t));
+        if (!events) return -1;
+        list->events = events;
+        list->size = size;
+    }
+    event_t *e = &list->events[list->count++];
+    e->frame = frame;
+    e->msg[0] = status;
+    e->msg[1] = d1;
+    e->msg[2] = d2;
+    e->len = (uint8_t)len;
+    return 0;
+}
+
+static int compare_events(const void *a, const void *b) {
+    const event_t *x = a, *y = b;
+    if (x->frame != y->frame) return x->frame < y->frame ? -1 : 1;
+    return 0;
+}
+
+/* The stress pattern: a chord of eight notes on each of four channels
+ * every 250 ms, the sustain pedal held for two seconds out of every
+ * four, a filter and a modulation sweep and a pitch bend wobble on the
+ * chord channels every block, and a drum hit on channel 10 every
+ * eighth note. */
+static int stress_events(event_list_t *list, double seconds) {
+    long end = (long)(seconds * SAMPLE_RATE);
+    long chord_frames = SAMPLE_RATE / 4;
+    int chord = 0;
+
+    for (long f = 0; f < end; f += chord_frames, chord++) {
+        for (int ch = 0; ch < 4; ch++) {
+            for (int k = 0; k < 8; k++) {
+                uint8_t key = (uint8_t)(36 + ((chord * 5 + ch * 7 + k * 4) % 60));
+                if (add_event(list, f, 0x90 | ch, key, (uint8_t)(70 + (k * 7) % 50), 3) ||
+                    add_event(list, f + chord_frames - FRAMES, 0x80 | ch, key, 0, 3)) {
+                    return -1;
+                }
+            }
+        }
+        if (chord % 16 == 0 && add_event(list, f, 0xB0, 64, 127, 3)) return -1;
+        if (chord % 16 == 8 && add_event(list, f, 0xB0, 64, 0, 3)) return -1;
+        for (int hit = 0; hit < 2; hit++) {
+            if (add_event(list, f + hit * chord_frames / 2, 0x99, (uint8_t)(36 + (chord + hit) % 12), 110, 3)) {
+                return -1;
+            }
+        }
+    }
+
+    for (long f = 0, b = 0; f < end; f += FRAMES, b++) {
+        for (int ch = 0; ch < 4; ch++) {
+            int sweep = (int)((b + ch * 32) % 256);
+            int bend = 8192 + (int)(((b * 3 + ch * 50) % 400) - 200) * 20;
+            if (sweep > 127) sweep = 255 - sweep;
+            if (add_event(list, f, 0xB0 | ch, 74, (uint8_t)sweep, 3) ||
+                add_event(list, f, 0xB0 | ch, 1, (uint8_t)(127 - sweep), 3) ||
+                add_event(list, f, 0xE0 | ch, bend & 0x7F, (bend >> 7) & 0x7F, 3)) {
+                return -1;
+            }
+        }
+    }
+
+    qsort(list->events, list->count, sizeof(event_t), compare_events);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Standard MIDI File                                                 */
+/* ------------------------------------------------------------------ */
+
+/* An event of a track, in ticks, before the tempo map is applied */
+typedef struct {
+    long tick;
+    long order;             /* keeps events of the same tick in file order */
+    uint8_t msg[3];
+    uint8_t len;
+    long tempo;             /* microseconds per quarter note, or 0 */
+} smf_event_t;
+
+static int compare_smf_events(const void *a, const void *b) {
+    const smf_event_t *x = a, *y = b;
+    if (x->tick != y->tick) return x->tick < y->tick ? -1 : 1;
+    return x->order < y->order ? -1 : (x->order > y->order);
+}
+
+static long read_vlq(const uint8_t *p, long len, long *pos) {
+    long value = 0;
+    for (int i = 0; i < 4 && *pos < len; i++) {
+        uint8_t c = p[(*pos)++];
+        value = (value << 7) | (c & 0x7F);
+        if (!(c & 0x80)) break;
+    }
+    return value;
+}
+
+static uint32_t read_be(const uint8_t *p, int n) {
+    uint32_t v = 0;
+    for (int i = 0; i < n; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+static int smf_events(event_list_t *list, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (!data || fread(data, 1, size, f) != (size_t)size) {
+        fclose(f);
+        free(data);
+        fprintf(stderr, "%s: read failed\n", path);
+        return -1;
+    }
+    fclose(f);
+
+    if (size < 14 || memcmp(data, "MThd", 4) != 0) {
+        fprintf(stderr, "%s: not a Standard MIDI File\n", path);
+        free(data);
+        return -1;
+    }
+    int tracks = (int)read_be(data + 10, 2);
+    int division = (int)read_be(data + 12, 2);
+    long pos = 8 + read_be(data + 4, 4);
+
+    smf_event_t *events = NULL;
+    long count = 0, cap = 0;
+
+    for (int t = 0; t < tracks && pos + 8 <= size; t++) {
+        long track_len = read_be(data + pos + 4, 4);
+        int is_track = memcmp(data + pos, "MTrk", 4) == 0;
+        long p = pos + 8, end = pos + 8 + track_len;
+        pos = end;
+        if (!is_track) continue;
+        if (end > size) end = size;
+
+        long tick = 0;
+        uint8_t running = 0;
+        while (p < end) {
+            tick += read_vlq(data, end, &p);
+            if (p >= end) break;
+            uint8_t status = data[p];
+            if (status & 0x80) {
+                p++;
+            } else {
+                status = running;
+            }
+            if (count == cap) {
+                cap = cap ? cap * 2 : 4096;
+                smf_event_t *grown = realloc(events, cap * sizeof(smf_event_t));
+                if (!grown) {
+                    free(events);
+                    free(data);
+                    return -1;
+                }
+                events = grown;
+            }
+            smf_event_t *e = &events[count];
+            memset(e, 0, sizeof(*e));
+            e->tick = tick;
+            e->order = count;
+
+            if (status == 0xFF) {
+                if (p >= end) break;
+                uint8_t type = data[p++];
+                long len = read_vlq(data, end, &p);
+                if (type == 0x51 && len == 3 && p + 3 <= end) {
+                    e->tempo = read_be(data + p, 3);
+                    count++;
+                }
+                if (type == 0x2F) break;
+                p += len;
+            } else if (status == 0xF0 || status == 0xF7) {
+                p += read_vlq(data, end, &p);
+            } else if (status >= 0x80) {
+                int len = ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0) ? 2 : 3;
+                if (p + len - 1 > end) break;
+                running = status;
+                e->msg[0] = status;
+                e->msg[1] = data[p];
+                e->msg[2] = len == 3 ? data[p + 1] : 0;
+                e->len = (uint8_t)len;
+                p += len - 1;
+                count++;
+            } else {
+                break;      /* data byte without a status: give up on the track */
+            }
+        }
+    }
+    free(data);
+
+    qsort(events, count, sizeof(smf_event_t), compare_smf_events);
+
+    /* Ticks to frames through the tempo map */
+    double tempo = 500000.0, seconds = 0.0;
+    double ticks_per_second = 0.0;
+    long last_tick = 0;
+    if (division & 0x8000) {
+        ticks_per_second = (double)(-(int8_t)(division >> 8)) * (division & 0xFF);
+    }
+    for (long i = 0; i < count; i++) {
+        smf_event_t *e = &events[i];
+        double tps = ticks_per_second > 0.0 ? ticks_per_second : division * 1e6 / tempo;
+        seconds += (e->tick - last_tick) / tps;
+        last_tick = e->tick;
+        if (e->tempo) {
+            tempo = (double)e->tempo;
+        } else if (add_event(list, (long)(seconds * SAMPLE_RATE), e->msg[0], e->msg[1], e->msg[2], e->len)) {
+            free(events);
+            return -1;
+        }
+    }
+    free(events);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Driver                                                             */
+/* ------------------------------------------------------------------ */
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : (x > y);
+}
+
+static double percentile(const double *sorted, long n, double p) {
+    long i = (long)(p / 100.0 * (n - 1) + 0.5);
+    return n ? sorted[i < n ? i : n - 1] : 0.0;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s <dsp.so> <module dir> [options]\n"
+           "  --midi <file.mid>   play a Standard MIDI File\n"
+           "  --stress <seconds>  play the stress pattern (default, 30 s)\n"
+           "  --defaults <json>   json_defaults for create_instance\n"
+           "  --tail <seconds>    render on after the last event (default 2)\n"
+           "  --realtime          pace blocks to the wall clock, like the host\n"
+           "  --out <file.raw>    write the output as raw 16-bit stereo\n"
+           "  --verbose           show the plugin's log\n", prog);
+}
+
+int main(int argc, char **argv) {
+    const char *midi_path = NULL, *defaults = "{}", *out_path = NULL;
+    double stress_seconds = 30.0, tail = 2.0;
+    int realtime = 0;
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--midi") == 0 && i + 1 < argc) midi_path = argv[++i];
+        else if (strcmp(argv[i], "--stress") == 0 && i + 1 < argc) stress_seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--defaults") == 0 && i + 1 < argc) defaults = argv[++i];
+        else if (strcmp(argv[i], "--tail") == 0 && i + 1 < argc) tail = atof(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) out_path = argv[++i];
+        else if (strcmp(argv[i], "--realtime") == 0) realtime = 1;
+        else if (strcmp(argv[i], "--verbose") == 0) verbose = 1;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    event_list_t events = { NULL, 0, 0 };
+    if (midi_path ? smf_events(&events, midi_path) : stress_events(&events, stress_seconds)) {
+        return 1;
+    }
+
+    void *lib = dlopen(argv[1], RTLD_NOW);
+    if (!lib) {
+        fprintf(stderr, "%s\n", dlerror());
+        return 1;
+    }
+    plugin_api_v2_t *(*init)(const host_api_v1_t *) =
+        (plugin_api_v2_t *(*)(const host_api_v1_t *))dlsym(lib, "move_plugin_init_v2");
+    if (!init) {
+        fprintf(stderr, "%s: no move_plugin_init_v2\n", argv[1]);
+        return 1;
+    }
+
+    static uint8_t mapped_memory[MAPPED_MEMORY_SIZE];
+    host_api_v1_t host = {
+        .api_version = 1,
+        .sample_rate = SAMPLE_RATE,
+        .frames_per_block = FRAMES,
+        .mapped_memory = mapped_memory,
+        .audio_out_offset = 0,
+        .audio_in_offset = FRAMES * 2 * sizeof(int16_t),
+        .log = host_log,
+        .midi_send_internal = host_midi_send,
+        .midi_send_external = host_midi_send,
+    };
+    plugin_api_v2_t *api = init(&host);
+    if (!api || api->api_version != MOVE_PLUGIN_API_VERSION_2) {
+        fprintf(stderr, "%s: not a v2 plugin\n", argv[1]);
+        return 1;
+    }
+
+    double t0 = now_us();
+    void *inst = api->create_instance(argv[2], defaults);
+    if (!inst) {
+        fprintf(stderr, "create_instance failed\n");
+        return 1;
+    }
+
+    /* Render silence until the soundfont is in, as the host would */
+    int16_t out[FRAMES * 2];
+    char buf[2048];
+    do {
+        api->render_block(inst, out, FRAMES);
+        api->get_param(inst, "loading", buf, sizeof(buf));
+    } while (buf[0] == '1' && now_us() - t0 < 60e6);
+    double load_ms = (now_us() - t0) / 1e3;
+    if (api->get_param(inst, "load_error", buf, sizeof(buf)) > 0) {
+        fprintf(stderr, "load error: %s\n", buf);
+        return 1;
+    }
+    api->set_param(inst, "perf_stats_reset", "1");
+
+    long last = events.count ? events.events[events.count - 1].frame : 0;
+    long blocks = (last + (long)(tail * SAMPLE_RATE)) / FRAMES + 1;
+    double *times = malloc(blocks * sizeof(double));
+    FILE *out_file = out_path ? fopen(out_path, "wb") : NULL;
+    if (!times || (out_path && !out_file)) {
+        fprintf(stderr, "cannot allocate or open output\n");
+        return 1;
+    }
+
+    /* Messages due in a block go in ahead of it, as the host passes on
+     * what arrived during the previous one */
+    int next = 0;
+    double start = now_us(), total = 0.0;
+    for (long b = 0; b < blocks; b++) {
+        long end = (b + 1) * FRAMES;
+        while (next < events.count && events.events[next].frame < end) {
+            api->on_midi(inst, events.events[next].msg, events.events[next].len, 0);
+            next++;
+        }
+        double t = now_us();
+        api->render_block(inst, out, FRAMES);
+        times[b] = now_us() - t;
+        total += times[b];
+        if (out_file) fwrite(out, sizeof(int16_t), FRAMES * 2, out_file);
+        if (realtime) sleep_until_us(start + (b + 1) * 1e6 * FRAMES / SAMPLE_RATE);
+    }
+    if (out_file) fclose(out_file);
+
+    double audio_us = blocks * 1e6 * FRAMES / SAMPLE_RATE;
+    double budget_us = 1e6 * FRAMES / SAMPLE_RATE;
+    long misses = 0;
+    for (long b = 0; b < blocks; b++) {
+        if (times[b] > budget_us) misses++;
+    }
+    qsort(times, blocks, sizeof(double), compare_doubles);
+
+    struct rusage usage_self;
+    getrusage(RUSAGE_SELF, &usage_self);
+
+    printf("source        %s\n", midi_path ? midi_path : "stress pattern");
+    printf("events        %d MIDI messages, %ld sent back by the plugin\n", events.count, midi_sent);
+    printf("load          %.1f ms\n", load_ms);
+    printf("audio         %.2f s in %ld blocks of %d frames (budget %.1f us)\n",
+           audio_us / 1e6, blocks, FRAMES, budget_us);
+    printf("rendering     %.3f s, real-time factor %.4f (%.1fx faster than real time)\n",
+           total / 1e6, total / audio_us, total > 0.0 ? audio_us / total : 0.0);
+    printf("per block us  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           percentile(times, blocks, 50), percentile(times, blocks, 90),
+           percentile(times, blocks, 99), percentile(times, blocks, 99.9),
+           times[blocks - 1]);
+    printf("over budget   %ld blocks\n", misses);
+    printf("peak RSS      %ld KiB\n", usage_self.ru_maxrss);
+    if (api->get_param(inst, "perf_stats", buf, sizeof(buf)) > 0) {
+        printf("perf_stats    %s\n", buf);
+    }
+
+    api->destroy_instance(inst);
+    free(times);
+    free(events.events);
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * set_param stress test for the SF2 plugin
+ *
+ * Loads dsp.so the way the host does and drives one instance from three
+ * threads at once: an audio thread rendering blocks as fast as it can, a
+ * control thread setting parameters in a tight loop (gain, effects,
+ * presets, transpose, panic, state restores, timing stats and now and
+ * then a soundfont switch) and a MIDI thread playing notes, bends and
+ * controllers and program changes.
+ * Checks that the parameters read back as last set once the threads
+ * stop. Meant to run under ThreadSanitizer or AddressSanitizer, with the
+ * FluidLite sources scripts/build.sh compiles (listed in scripts/sources.sh):
+ *
+ *   . scripts/sources.sh
+ *   gcc -g -O1 -fsanitize=thread -shared -fPIC -DNDEBUG src/dsp/sf2_plugin.c \
+ *       $FLUIDLITE_SRCS -o /tmp/dsp_tsan.so -Isrc/dsp -I$FLUIDLITE_DIR/include \
+ *       -I$FLUIDLITE_DIR/src -lm -lpthread
+ *   gcc -g -O1 -fsanitize=thread tests/param_stress.c -o /tmp/param_stress -ldl -lpthread
+ *   /tmp/param_stress /tmp/dsp_tsan.so <module dir> [seconds]
+ *
+ * The test fails if a parameter reads back wrong (exit code 1) or if the
+ * sanitizer reports anything: it sets halt_on_error for ThreadSanitizer,
+ * which then stops at the first race with exit code 66 instead of going
+ * on to print OK. AddressSanitizer halts on its first error by default.
+ *
+ * The module dir needs a soundfonts/ folder with at least one .sf2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FRAMES 128
+
+typedef struct host_api_v1 {
+    uint32_t api_version;
+    int sample_rate;
+    int frames_per_block;
+    uint8_t *mapped_memory;
+    int audio_out_offset;
+    int audio_in_offset;
+    void (*log)(const char *msg);
+    int (*midi_send_internal)(const uint8_t *msg, int len);
+    int (*midi_send_external)(const uint8_t *msg, int len);
+} host_api_v1_t;
+
+typedef struct plugin_api_v2 {
+    uint32_t api_version;
+    void* (*create_instance)(const char *module_dir, const char *json_defaults);
+    void (*destroy_instance)(void *instance);
+    void (*on_midi)(void *instance, const uint8_t *msg, int len, int source);
+    void (*set_param)(void *instance, const char *key, const char *val);
+    int (*get_param)(void *instance, const char *key, char *buf, int buf_len);
+    int (*get_error)(void *instance, char *buf, int buf_len);
+    void (*render_block)(void *instance, int16_t *out_interleaved_lr, int frames);
+} plugin_api_v2_t;
+
+/* Picked up by ThreadSanitizer at startup, before TSAN_OPTIONS */
+const char *__tsan_default_options(void) {
+    return "halt_on_error=1";
+}
+
+static plugin_api_v2_t *api;
+static void *inst;
+static int stop;
+static long blocks, params, messages;
+
+static void host_log(const char *msg) {
+    (void)msg;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *audio_main(void *arg) {
+    int16_t out[FRAMES * 2];
+    (void)arg;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        api->render_block(inst, out, FRAMES);
+        __atomic_add_fetch(&blocks, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void *control_main(void *arg) {
+    char val[256], stats[1024];
+    long i;
+    (void)arg;
+    for (i = 0; !__atomic_load_n(&stop, __ATOMIC_RELAXED); i++) {
+        switch (i % 10) {
+            case 0: snprintf(val, sizeof(val), "%.3f", (i % 200) / 100.0); api->set_param(inst, "gain", val); break;
+            case 1: api->set_param(inst, "reverb_on", (i / 10) % 2 ? "1" : "0"); break;
+            case 2: api->set_param(inst, "chorus_on", (i / 10) % 3 ? "1" : "0"); break;
+            case 3: snprintf(val, sizeof(val), "%.3f", (i % 100) / 100.0); api->set_param(inst, "reverb_level", val); break;
+            case 4: snprintf(val, sizeof(val), "%.3f", (i % 100) / 10.0); api->set_param(inst, "chorus_level", val); break;
+            case 5: snprintf(val, sizeof(val), "%ld", (i / 10) % 8); api->set_param(inst, "preset", val); break;
+            case 6: snprintf(val, sizeof(val), "%ld", (i / 10) % 9 - 4); api->set_param(inst, "octave_transpose", val); break;
+            case 7: if (i % 1000 == 7) api->set_param(inst, "all_notes_off", "1"); break;
+            case 8:
+                snprintf(val, sizeof(val), "{\"preset\":%ld,\"gain\":0.8,\"reverb_level\":0.4,\"chorus_level\":2}", (i / 10) % 4);
+                api->set_param(inst, "state", val);
+                break;
+            case 9:
+                if (i % 20000 == 9) api->set_param(inst, "next_soundfont", "1");
+                else if (i % 5000 == 19) api->set_param(inst, "perf_stats_reset", "1");
+                else api->get_param(inst, "perf_stats", stats, sizeof(stats));
+                break;
+        }
+        params++;
+    }
+    return NULL;
+}
+
+/* a few messages a block, as a host passes them on, and now and then a
+   burst more than the MIDI queue holds, which drops the rest */
+static void *midi_main(void *arg) {
+    long i, block = -1;
+    (void)arg;
+    for (i = 0; !__atomic_load_n(&stop, __ATOMIC_RELAXED); i++) {
+        while (__atomic_load_n(&blocks, __ATOMIC_RELAXED) == block &&
+               !__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+            usleep(50);
+        }
+        block = __atomic_load_n(&blocks, __ATOMIC_RELAXED);
+        uint8_t on[3] = { 0x90 | (i % 4), 36 + i % 48, 100 };
+        uint8_t off[3] = { 0x80 | ((i - 8) % 4), 36 + (i - 8) % 48, 0 };
+        uint8_t bend[3] = { 0xE0, 0, 64 + i % 60 };
+        uint8_t cc[3] = { 0xB0, 74, i % 128 };
+        uint8_t program[2] = { 0xC0, (i / 50) % 8 };
+        api->on_midi(inst, on, 3, 0);
+        api->on_midi(inst, off, 3, 0);
+        api->on_midi(inst, bend, 3, 0);
+        api->on_midi(inst, cc, 3, 0);
+        messages += 4;
+        if (i % 50 == 0) {
+            api->on_midi(inst, program, 2, 0);
+            messages++;
+        }
+        if (i % 500 == 0) {
+            for (int k = 0; k < 300; k++) {
+                api->on_midi(inst, cc, 3, 0);
+            }
+            messages += 300;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    pthread_t audio, control, midi;
+    double seconds = 5.0, start;
+    char buf[64];
+    int16_t out[FRAMES * 2];
+    int failed = 0;
+
+    if (argc < 3) {
+        printf("Usage: %s <dsp.so> <module dir> [seconds]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 3) seconds = atof(argv[3]);
+
+    void *lib = dlopen(argv[1], RTLD_NOW);
+    if (!lib) {
+        fprintf(stderr, "%s\n", dlerror());
+        return 1;
+    }
+    plugin_api_v2_t *(*init)(const host_api_v1_t *) =
+        (plugin_api_v2_t *(*)(const host_api_v1_t *))dlsym(lib, "move_plugin_init_v2");
+    static const host_api_v1_t host = { 1, 44100, FRAMES, NULL, 0, 0, host_log, NULL, NULL };
+    api = init(&host);
+    inst = api->create_instance(argv[2], "{}");
+    if (!inst) {
+        fprintf(stderr, "create_instance failed\n");
+        return 1;
+    }
+
+    /* let the first soundfont land */
+    start = now_s();
+    do {
+        api->render_block(inst, out, FRAMES);
+        api->get_param(inst, "loading", buf, sizeof(buf));
+    } while (buf[0] != '0' && now_s() - start < 30.0);
+
+    pthread_create(&audio, NULL, audio_main, NULL);
+    pthread_create(&control, NULL, control_main, NULL);
+    pthread_create(&midi, NULL, midi_main, NULL);
+    usleep((useconds_t)(seconds * 1e6));
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    pthread_join(control, NULL);
+    pthread_join(midi, NULL);
+    pthread_join(audio, NULL);
+
+    /* the last values set, as the control thread would leave them */
+    api->set_param(inst, "gain", "0.5");
+    api->set_param(inst, "reverb_level", "0.25");
+    api->set_param(inst, "octave_transpose", "2");
+    api->render_block(inst, out, FRAMES);
+    api->get_param(inst, "gain", buf, sizeof(buf));
+    if (atof(buf) != 0.5) failed = 1;
+    api->get_param(inst, "reverb_level", buf, sizeof(buf));
+    if (atof(buf) != 0.25) failed = 1;
+    api->get_param(inst, "octave_transpose", buf, sizeof(buf));
+    if (atoi(buf) != 2) failed = 1;
+
+    printf("%ld blocks, %ld parameters, %ld MIDI messages in %.1f s\n",
+           blocks, params, messages, seconds);
+    api->destroy_instance(inst);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed;
+}